@@ -0,0 +1,528 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * mccr-bench - Benchmarks for the libmccr hot paths
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include <hidapi.h>
+
+#include <common.h>
+
+#include <mccr.h>
+#include "mccr-log.h"
+#include "mccr-hid.h"
+#include "mccr-feature-report.h"
+
+#include "alloc-hooks.h"
+#include "fake-hidapi.h"
+
+#define PROGRAM_NAME    "mccr-bench"
+#define PROGRAM_VERSION PACKAGE_VERSION
+
+#define DEFAULT_ITERATIONS 100000
+
+/******************************************************************************/
+/* Shared benchmark state */
+
+static mccr_report_descriptor_context_t *desc;
+static mccr_feature_report_t            *feature_report;
+static mccr_device_t                    *device;
+static mccr_device_t                    *cold_device;
+static mccr_swipe_report_t              *swipe_report;
+static mccr_swipe_ring_t                *ring;
+static mccr_swipe_ring_t                *ring_consumer;
+static uint8_t                          *swipe_data;
+static size_t                            swipe_data_size;
+
+/* A typical track 2 payload, the kind of buffer dumped in hex everywhere */
+static const uint8_t track_data[] = {
+    0x3b, 0x34, 0x37, 0x36, 0x31, 0x37, 0x33, 0x39, 0x30, 0x30, 0x31, 0x30, 0x31, 0x30, 0x30, 0x31,
+    0x30, 0x3d, 0x31, 0x35, 0x31, 0x32, 0x31, 0x30, 0x31, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+    0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x3f, 0x00, 0x8a, 0x71, 0xe2, 0x05, 0xc4, 0x19, 0xbd, 0x63,
+    0x27, 0x9e, 0x40, 0xf1, 0x5c, 0xa8, 0x36, 0xd2, 0x0b, 0x7f, 0x94, 0x13, 0xee, 0x58, 0xc1, 0x2a,
+};
+static char *track_data_hex;
+
+static void
+log_handler_discard (pthread_t   thread_id,
+                     const char *message)
+{
+}
+
+static void
+fill_swipe_usage (uint8_t        usage_id,
+                  const uint8_t *value,
+                  size_t         value_size)
+{
+    uint32_t offset_bits, size_bits;
+
+    if (!mccr_report_descriptor_get_input_report_usage (desc, usage_id, &offset_bits, &size_bits))
+        return;
+    assert (value_size <= size_bits / 8);
+    memcpy (&swipe_data[offset_bits / 8], value, value_size);
+}
+
+static void
+fill_swipe_track (uint8_t decode_status_usage_id,
+                  uint8_t encrypted_data_length_usage_id,
+                  uint8_t absolute_data_length_usage_id,
+                  uint8_t encrypted_data_usage_id,
+                  uint8_t masked_data_length_usage_id,
+                  uint8_t masked_data_usage_id)
+{
+    uint8_t decode_status = 0x00;
+    uint8_t length        = sizeof (track_data);
+    uint8_t absolute      = 38;
+    uint8_t masked_length = 38;
+
+    fill_swipe_usage (decode_status_usage_id,         &decode_status, 1);
+    fill_swipe_usage (encrypted_data_length_usage_id, &length,        1);
+    fill_swipe_usage (absolute_data_length_usage_id,  &absolute,      1);
+    fill_swipe_usage (encrypted_data_usage_id,        track_data,     sizeof (track_data));
+    fill_swipe_usage (masked_data_length_usage_id,    &masked_length, 1);
+    fill_swipe_usage (masked_data_usage_id,           track_data,     masked_length);
+}
+
+static bool
+setup (void)
+{
+    uint8_t       encode_type = MCCR_CARD_ENCODE_TYPE_ISO_ABA;
+    mccr_status_t st;
+
+    if ((st = mccr_parse_report_descriptor (fake_hidapi_report_descriptor,
+                                            fake_hidapi_report_descriptor_size,
+                                            &desc)) != MCCR_STATUS_OK) {
+        fprintf (stderr, "error: couldn't parse report descriptor: %s\n", mccr_status_to_string (st));
+        return false;
+    }
+
+    if (!(feature_report = mccr_feature_report_new (desc))) {
+        fprintf (stderr, "error: couldn't allocate feature report\n");
+        return false;
+    }
+
+    /* Build a full swipe report as the reader would send it */
+    swipe_data_size = mccr_report_descriptor_get_input_report_size (desc);
+    swipe_data = calloc (swipe_data_size, 1);
+    if (!swipe_data) {
+        fprintf (stderr, "error: couldn't allocate swipe report data\n");
+        return false;
+    }
+    fill_swipe_usage (MCCR_INPUT_USAGE_ID_CARD_ENCODE_TYPE, &encode_type, 1);
+    fill_swipe_track (MCCR_INPUT_USAGE_ID_TRACK_1_DECODE_STATUS,
+                      MCCR_INPUT_USAGE_ID_TRACK_1_ENCRYPTED_DATA_LENGTH,
+                      MCCR_INPUT_USAGE_ID_TRACK_1_ABSOLUTE_DATA_LENGTH,
+                      MCCR_INPUT_USAGE_ID_TRACK_1_ENCRYPTED_DATA,
+                      MCCR_INPUT_USAGE_ID_TRACK_1_MASKED_DATA_LENGTH,
+                      MCCR_INPUT_USAGE_ID_TRACK_1_MASKED_DATA);
+    fill_swipe_track (MCCR_INPUT_USAGE_ID_TRACK_2_DECODE_STATUS,
+                      MCCR_INPUT_USAGE_ID_TRACK_2_ENCRYPTED_DATA_LENGTH,
+                      MCCR_INPUT_USAGE_ID_TRACK_2_ABSOLUTE_DATA_LENGTH,
+                      MCCR_INPUT_USAGE_ID_TRACK_2_ENCRYPTED_DATA,
+                      MCCR_INPUT_USAGE_ID_TRACK_2_MASKED_DATA_LENGTH,
+                      MCCR_INPUT_USAGE_ID_TRACK_2_MASKED_DATA);
+    fill_swipe_track (MCCR_INPUT_USAGE_ID_TRACK_3_DECODE_STATUS,
+                      MCCR_INPUT_USAGE_ID_TRACK_3_ENCRYPTED_DATA_LENGTH,
+                      MCCR_INPUT_USAGE_ID_TRACK_3_ABSOLUTE_DATA_LENGTH,
+                      MCCR_INPUT_USAGE_ID_TRACK_3_ENCRYPTED_DATA,
+                      MCCR_INPUT_USAGE_ID_TRACK_3_MASKED_DATA_LENGTH,
+                      MCCR_INPUT_USAGE_ID_TRACK_3_MASKED_DATA);
+    fake_hidapi_set_input_report (swipe_data, swipe_data_size);
+
+    /* Open the fake reader and get one swipe report to decode */
+    if ((st = mccr_init ()) != MCCR_STATUS_OK) {
+        fprintf (stderr, "error: couldn't initialize MCCR library: %s\n", mccr_status_to_string (st));
+        return false;
+    }
+    if (!(device = mccr_device_new (FAKE_HIDAPI_DEVICE_PATH))) {
+        fprintf (stderr, "error: couldn't create fake device\n");
+        return false;
+    }
+    /* Never left open, so that every open is a cold one */
+    if (!(cold_device = mccr_device_new (FAKE_HIDAPI_DEVICE_PATH))) {
+        fprintf (stderr, "error: couldn't create fake device\n");
+        return false;
+    }
+    if ((st = mccr_device_open (device)) != MCCR_STATUS_OK) {
+        fprintf (stderr, "error: couldn't open fake device: %s\n", mccr_status_to_string (st));
+        return false;
+    }
+    if ((st = mccr_device_wait_swipe_report (device, 0, &swipe_report)) != MCCR_STATUS_OK) {
+        fprintf (stderr, "error: couldn't read swipe report from fake device: %s\n", mccr_status_to_string (st));
+        return false;
+    }
+
+    /* Both ends of the swipe ring in the same process */
+    if ((st = mccr_swipe_ring_new (device, 64, &ring)) != MCCR_STATUS_OK ||
+        (st = mccr_swipe_ring_new_from_fd (mccr_swipe_ring_get_fd (ring), &ring_consumer)) != MCCR_STATUS_OK) {
+        fprintf (stderr, "error: couldn't create swipe ring: %s\n", mccr_status_to_string (st));
+        return false;
+    }
+
+    if (!(track_data_hex = strhex (track_data, sizeof (track_data), NULL))) {
+        fprintf (stderr, "error: couldn't allocate track data hex string\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void
+teardown (void)
+{
+    mccr_log_set_handler (NULL);
+    free (track_data_hex);
+    mccr_swipe_ring_free (ring_consumer);
+    mccr_swipe_ring_free (ring);
+    if (swipe_report)
+        mccr_swipe_report_free (swipe_report);
+    if (device) {
+        mccr_device_close (device);
+        mccr_device_unref (device);
+    }
+    if (cold_device)
+        mccr_device_unref (cold_device);
+    mccr_exit ();
+    free (swipe_data);
+    if (feature_report)
+        mccr_feature_report_free (feature_report);
+    if (desc)
+        mccr_report_descriptor_context_unref (desc);
+}
+
+/******************************************************************************/
+/* Benchmarks */
+
+static void
+bench_parse_report_descriptor (void)
+{
+    mccr_report_descriptor_context_t *ctx;
+
+    if (mccr_parse_report_descriptor (fake_hidapi_report_descriptor,
+                                      fake_hidapi_report_descriptor_size,
+                                      &ctx) == MCCR_STATUS_OK)
+        mccr_report_descriptor_context_unref (ctx);
+}
+
+static void
+bench_swipe_usage_lookup (void)
+{
+    /* Last usage in the report, worst case for a lookup */
+    mccr_report_descriptor_get_input_report_usage (desc, MCCR_INPUT_USAGE_ID_HASHED_TRACK_2_DATA, NULL, NULL);
+}
+
+#define DECODE_TRACK(N) do {                                                      \
+        uint8_t        status, encrypted_length, absolute_length, masked_length;  \
+        const uint8_t *encrypted, *masked;                                        \
+                                                                                  \
+        mccr_swipe_report_get_track_##N##_decode_status          (swipe_report, &status);           \
+        mccr_swipe_report_get_track_##N##_encrypted_data_length  (swipe_report, &encrypted_length); \
+        mccr_swipe_report_get_track_##N##_absolute_data_length   (swipe_report, &absolute_length);  \
+        mccr_swipe_report_get_track_##N##_encrypted_data         (swipe_report, &encrypted);        \
+        mccr_swipe_report_get_track_##N##_masked_data_length     (swipe_report, &masked_length);    \
+        mccr_swipe_report_get_track_##N##_masked_data            (swipe_report, &masked);           \
+    } while (0)
+
+static void
+bench_swipe_report_decode (void)
+{
+    mccr_card_encode_type_t encode_type;
+
+    mccr_swipe_report_get_card_encode_type (swipe_report, &encode_type);
+    DECODE_TRACK (1);
+    DECODE_TRACK (2);
+    DECODE_TRACK (3);
+}
+
+static void
+bench_wait_swipe_report (void)
+{
+    mccr_swipe_report_t *report;
+
+    if (mccr_device_wait_swipe_report (device, 0, &report) == MCCR_STATUS_OK)
+        mccr_swipe_report_free (report);
+}
+
+static void
+bench_swipe_ring_publish (void)
+{
+    mccr_swipe_ring_publish (ring, swipe_report);
+}
+
+static void
+bench_swipe_ring_read (void)
+{
+    mccr_swipe_report_t *report;
+
+    mccr_swipe_ring_publish (ring, swipe_report);
+    if (mccr_swipe_ring_wait_swipe_report (ring_consumer, 0, &report, NULL) == MCCR_STATUS_OK)
+        mccr_swipe_report_free (report);
+}
+
+static void
+bench_track_parse (void)
+{
+    static const char *track_1 = "%B4111111111111111^DOE/JOHN^2512101123456789?";
+    static const char *track_2 = ";4111111111111111=25121011234567890?";
+    mccr_track_t       track;
+
+    mccr_track_parse (MCCR_CARD_ENCODE_TYPE_ISO_ABA, 1, MCCR_TRACK_PARSE_FLAGS_MASKED,
+                      (const uint8_t *) track_1, strlen (track_1), &track);
+    mccr_track_parse (MCCR_CARD_ENCODE_TYPE_ISO_ABA, 2, MCCR_TRACK_PARSE_FLAGS_MASKED,
+                      (const uint8_t *) track_2, strlen (track_2), &track);
+}
+
+static void
+bench_device_open (void)
+{
+    if (mccr_device_open (cold_device) == MCCR_STATUS_OK)
+        mccr_device_close (cold_device);
+}
+
+static void
+bench_strhex (void)
+{
+    free (strhex (track_data, sizeof (track_data), ":"));
+}
+
+static void
+bench_strhex_multiline (void)
+{
+    free (strhex_multiline (track_data, sizeof (track_data), 16, "\t", " "));
+}
+
+static void
+bench_strbin (void)
+{
+    uint8_t buffer[sizeof (track_data)];
+
+    strbin (track_data_hex, buffer, sizeof (buffer));
+}
+
+static void
+bench_strascii (void)
+{
+    free (strascii (track_data, sizeof (track_data)));
+}
+
+static void
+bench_feature_report_build (void)
+{
+    static const uint8_t session_id[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+
+    mccr_feature_report_reset (feature_report);
+    mccr_feature_report_set_request (feature_report,
+                                     MCCR_FEATURE_REPORT_COMMAND_SET_SESSION_ID,
+                                     session_id, sizeof (session_id));
+}
+
+static void
+bench_log_no_handler (void)
+{
+    mccr_log ("read %u bytes... (total %u)", 64, 887);
+}
+
+static void
+bench_log_handler (void)
+{
+    mccr_log ("read %u bytes... (total %u)", 64, 887);
+}
+
+static void
+bench_log_raw_handler (void)
+{
+    mccr_log_raw ("<<<<", track_data, sizeof (track_data));
+}
+
+typedef struct {
+    const char          *name;
+    void               (*run) (void);
+    mccr_log_handler_t   log_handler;
+} bench_t;
+
+static const bench_t benchmarks[] = {
+    { "parse-report-descriptor", bench_parse_report_descriptor, NULL                },
+    { "swipe-usage-lookup",      bench_swipe_usage_lookup,      NULL                },
+    { "swipe-report-decode",     bench_swipe_report_decode,     NULL                },
+    { "wait-swipe-report",       bench_wait_swipe_report,       NULL                },
+    { "swipe-ring-publish",      bench_swipe_ring_publish,      NULL                },
+    { "swipe-ring-read",         bench_swipe_ring_read,         NULL                },
+    { "track-parse",             bench_track_parse,             NULL                },
+    { "device-open",             bench_device_open,             NULL                },
+    { "strhex",                  bench_strhex,                  NULL                },
+    { "strhex-multiline",        bench_strhex_multiline,        NULL                },
+    { "strbin",                  bench_strbin,                  NULL                },
+    { "strascii",                bench_strascii,                NULL                },
+    { "feature-report-build",    bench_feature_report_build,    NULL                },
+    { "log-no-handler",          bench_log_no_handler,          NULL                },
+    { "log-handler",             bench_log_handler,             log_handler_discard },
+    { "log-raw-handler",         bench_log_raw_handler,         log_handler_discard },
+};
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static void
+run_benchmark (const bench_t *bench,
+               unsigned long  iterations)
+{
+    unsigned long i;
+    unsigned long allocs_start, allocs_end;
+    uint64_t      time_start, time_end;
+
+    mccr_log_set_handler (bench->log_handler);
+
+    /* Warm up caches and allocator */
+    for (i = 0; i < (iterations / 10) + 1; i++)
+        bench->run ();
+
+    allocs_start = alloc_hooks_get_n_allocs ();
+    time_start   = now_ns ();
+    for (i = 0; i < iterations; i++)
+        bench->run ();
+    time_end     = now_ns ();
+    allocs_end   = alloc_hooks_get_n_allocs ();
+
+    mccr_log_set_handler (NULL);
+
+    /* One line per benchmark: name, iterations, ns/op, allocs/op */
+    printf ("%s\t%lu\t%.1f ns/op\t%.2f allocs/op\n",
+            bench->name,
+            iterations,
+            (double) (time_end - time_start) / iterations,
+            (double) (allocs_end - allocs_start) / iterations);
+    fflush (stdout);
+}
+
+/******************************************************************************/
+/* Main */
+
+static void
+print_help (void)
+{
+    printf ("\n"
+            "Usage: " PROGRAM_NAME " <option>\n"
+            "\n"
+            "Options:\n"
+            "  -n, --iterations=[N]        Number of iterations per benchmark.\n"
+            "  -f, --filter=[STR]          Only run benchmarks whose name contains STR.\n"
+            "  -l, --list                  List available benchmarks.\n"
+            "  -v, --version               Display version.\n"
+            "  -h, --help                  Display help.\n"
+            "\n"
+            "Output:\n"
+            "  One line per benchmark, with tab separated fields:\n"
+            "    <name> <iterations> <nanoseconds> ns/op <allocations> allocs/op\n"
+            "\n");
+}
+
+static void
+print_version (void)
+{
+    printf ("\n"
+            PROGRAM_NAME " " PROGRAM_VERSION "\n"
+            "Copyright (2017) Zodiac Inflight Innovations\n"
+            "\n");
+}
+
+static const struct option longopts[] = {
+    { "iterations", required_argument, 0, 'n' },
+    { "filter",     required_argument, 0, 'f' },
+    { "list",       no_argument,       0, 'l' },
+    { "version",    no_argument,       0, 'v' },
+    { "help",       no_argument,       0, 'h' },
+    { 0,            0,                 0, 0   },
+};
+
+int main (int argc, char **argv)
+{
+    int            idx, iarg = 0;
+    unsigned long  iterations = DEFAULT_ITERATIONS;
+    const char    *filter = NULL;
+    bool           list = false;
+    unsigned int   i;
+    int            ret = EXIT_FAILURE;
+
+    /* turn off getopt error message */
+    opterr = 1;
+    while (iarg != -1) {
+        iarg = getopt_long (argc, argv, "n:f:lvh", longopts, &idx);
+        switch (iarg) {
+        case 'n':
+            iterations = strtoul (optarg, NULL, 10);
+            if (!iterations) {
+                fprintf (stderr, "error: invalid number of iterations given: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'l':
+            list = true;
+            break;
+        case 'h':
+            print_help ();
+            return EXIT_SUCCESS;
+        case 'v':
+            print_version ();
+            return EXIT_SUCCESS;
+        }
+    }
+
+    if (list) {
+        for (i = 0; i < sizeof (benchmarks) / sizeof (benchmarks[0]); i++)
+            printf ("%s\n", benchmarks[i].name);
+        return EXIT_SUCCESS;
+    }
+
+    if (!setup ())
+        goto out;
+
+    printf ("# libmccr %u.%u.%u\n", mccr_get_major_version (), mccr_get_minor_version (), mccr_get_micro_version ());
+    for (i = 0; i < sizeof (benchmarks) / sizeof (benchmarks[0]); i++) {
+        if (filter && !strstr (benchmarks[i].name, filter))
+            continue;
+        run_benchmark (&benchmarks[i], iterations);
+    }
+
+    ret = EXIT_SUCCESS;
+
+out:
+    teardown ();
+    return ret;
+}
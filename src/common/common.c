@@ -8,145 +8,445 @@
 
 #include <malloc.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
 
 #include "common.h"
 
-char *
-strhex (const void *mem,
-        size_t      size,
-        const char *delimiter)
+/******************************************************************************/
+/* Hex encode/decode kernels
+ *
+ * The x86 kernels are only used to convert runs of bytes without any
+ * delimiter in between: SSE2 is always available on x86-64 builds, while the
+ * AVX2 kernels are selected at runtime if the CPU supports them. Everything
+ * else goes through the table-driven scalar code.
+ */
+
+#if defined __GNUC__ && defined __SSE2__ && (defined __x86_64__ || defined __i386__)
+# define HEX_KERNELS_X86 1
+# include <immintrin.h>
+#endif
+
+static const char hexdigits[] = "0123456789ABCDEF";
+
+static const int8_t hextable[256] = {
+   [0 ... 255] = -1,
+   ['0'] = 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+   ['A'] = 10, 11, 12, 13, 14, 15,
+   ['a'] = 10, 11, 12, 13, 14, 15
+};
+
+static inline void
+hex_encode_byte (uint8_t  byte,
+                 char    *out)
 {
-    const uint8_t *data = mem;
-    size_t         i, j, new_str_length, delimiter_length;
-    char          *new_str;
+    out[0] = hexdigits[byte >> 4];
+    out[1] = hexdigits[byte & 0x0f];
+}
 
-    assert (size > 0);
+#if defined HEX_KERNELS_X86
 
-    /* Allow delimiters of arbitrary sizes, including 0 */
-    delimiter_length = (delimiter ? strlen (delimiter) : 0);
+/* Nibbles (0-15) to upper case hex digits */
+static inline __m128i
+nibbles_to_hex_sse2 (__m128i nibbles)
+{
+    __m128i letters;
+
+    letters = _mm_and_si128 (_mm_cmpgt_epi8 (nibbles, _mm_set1_epi8 (9)), _mm_set1_epi8 ('A' - '0' - 10));
+    return _mm_add_epi8 (_mm_add_epi8 (nibbles, _mm_set1_epi8 ('0')), letters);
+}
+
+/* Encodes 16 bytes into 32 hex digits */
+static size_t
+hex_encode_sse2 (const uint8_t *data,
+                 size_t         size,
+                 char          *out)
+{
+    const __m128i mask = _mm_set1_epi8 (0x0f);
+    size_t        i;
+
+    for (i = 0; i + 16 <= size; i += 16) {
+        __m128i in, hi, lo;
+
+        in = _mm_loadu_si128 ((const __m128i *) &data[i]);
+        hi = nibbles_to_hex_sse2 (_mm_and_si128 (_mm_srli_epi16 (in, 4), mask));
+        lo = nibbles_to_hex_sse2 (_mm_and_si128 (in, mask));
+        _mm_storeu_si128 ((__m128i *) &out[2 * i],      _mm_unpacklo_epi8 (hi, lo));
+        _mm_storeu_si128 ((__m128i *) &out[2 * i + 16], _mm_unpackhi_epi8 (hi, lo));
+    }
+    return i;
+}
+
+/* Hex digits to nibbles, with all bits set in @valid for each hex digit */
+static inline __m128i
+hex_to_nibbles_sse2 (__m128i  in,
+                     __m128i *valid)
+{
+    __m128i digit, letter, is_digit, is_letter;
+
+    digit     = _mm_sub_epi8 (in, _mm_set1_epi8 ('0'));
+    is_digit  = _mm_and_si128 (_mm_cmpgt_epi8 (digit, _mm_set1_epi8 (-1)), _mm_cmplt_epi8 (digit, _mm_set1_epi8 (10)));
+    letter    = _mm_sub_epi8 (_mm_or_si128 (in, _mm_set1_epi8 (0x20)), _mm_set1_epi8 ('a'));
+    is_letter = _mm_and_si128 (_mm_cmpgt_epi8 (letter, _mm_set1_epi8 (-1)), _mm_cmplt_epi8 (letter, _mm_set1_epi8 (6)));
+    *valid = _mm_or_si128 (is_digit, is_letter);
+    return _mm_or_si128 (_mm_and_si128 (digit, is_digit),
+                         _mm_and_si128 (_mm_add_epi8 (letter, _mm_set1_epi8 (10)), is_letter));
+}
+
+/* Two nibbles per 16-bit lane (high one first) to one byte per lane */
+static inline __m128i
+nibble_pairs_to_bytes_sse2 (__m128i nibbles)
+{
+    return _mm_or_si128 (_mm_slli_epi16 (_mm_and_si128 (nibbles, _mm_set1_epi16 (0x00ff)), 4),
+                         _mm_srli_epi16 (nibbles, 8));
+}
+
+/* Hex digits in the smallest block decoded by the kernels */
+#define HEX_DECODE_BLOCK_SIZE 32
+
+/* Decodes 32 hex digits into 16 bytes, stopping at the first block with
+ * anything else but hex digits */
+static size_t
+hex_decode_sse2 (const char *str,
+                 size_t      str_len,
+                 uint8_t    *buffer,
+                 size_t      buffer_size)
+{
+    size_t i;
+
+    for (i = 0; i + 32 <= str_len && (i / 2) + 16 <= buffer_size; i += 32) {
+        __m128i a, b, valid_a, valid_b;
 
-    /* Get new string length. If input string has N bytes, we need:
+        a = hex_to_nibbles_sse2 (_mm_loadu_si128 ((const __m128i *) &str[i]),      &valid_a);
+        b = hex_to_nibbles_sse2 (_mm_loadu_si128 ((const __m128i *) &str[i + 16]), &valid_b);
+        if (_mm_movemask_epi8 (_mm_and_si128 (valid_a, valid_b)) != 0xffff)
+            break;
+        _mm_storeu_si128 ((__m128i *) &buffer[i / 2],
+                          _mm_packus_epi16 (nibble_pairs_to_bytes_sse2 (a), nibble_pairs_to_bytes_sse2 (b)));
+    }
+    return i;
+}
+
+__attribute__ ((target ("avx2")))
+static inline __m256i
+nibbles_to_hex_avx2 (__m256i nibbles)
+{
+    __m256i letters;
+
+    letters = _mm256_and_si256 (_mm256_cmpgt_epi8 (nibbles, _mm256_set1_epi8 (9)), _mm256_set1_epi8 ('A' - '0' - 10));
+    return _mm256_add_epi8 (_mm256_add_epi8 (nibbles, _mm256_set1_epi8 ('0')), letters);
+}
+
+/* Encodes 32 bytes into 64 hex digits */
+__attribute__ ((target ("avx2")))
+static size_t
+hex_encode_avx2 (const uint8_t *data,
+                 size_t         size,
+                 char          *out)
+{
+    const __m256i mask = _mm256_set1_epi8 (0x0f);
+    size_t        i;
+
+    for (i = 0; i + 32 <= size; i += 32) {
+        __m256i in, hi, lo, first, second;
+
+        in = _mm256_loadu_si256 ((const __m256i *) &data[i]);
+        hi = nibbles_to_hex_avx2 (_mm256_and_si256 (_mm256_srli_epi16 (in, 4), mask));
+        lo = nibbles_to_hex_avx2 (_mm256_and_si256 (in, mask));
+        /* Unpacking works within each 128-bit lane, so lanes need to be
+         * reordered afterwards */
+        first  = _mm256_unpacklo_epi8 (hi, lo);
+        second = _mm256_unpackhi_epi8 (hi, lo);
+        _mm256_storeu_si256 ((__m256i *) &out[2 * i],      _mm256_permute2x128_si256 (first, second, 0x20));
+        _mm256_storeu_si256 ((__m256i *) &out[2 * i + 32], _mm256_permute2x128_si256 (first, second, 0x31));
+    }
+    return i;
+}
+
+__attribute__ ((target ("avx2")))
+static inline __m256i
+hex_to_nibbles_avx2 (__m256i  in,
+                     __m256i *valid)
+{
+    __m256i digit, letter, is_digit, is_letter;
+
+    digit     = _mm256_sub_epi8 (in, _mm256_set1_epi8 ('0'));
+    is_digit  = _mm256_andnot_si256 (_mm256_cmpgt_epi8 (digit, _mm256_set1_epi8 (9)),
+                                     _mm256_cmpgt_epi8 (digit, _mm256_set1_epi8 (-1)));
+    letter    = _mm256_sub_epi8 (_mm256_or_si256 (in, _mm256_set1_epi8 (0x20)), _mm256_set1_epi8 ('a'));
+    is_letter = _mm256_andnot_si256 (_mm256_cmpgt_epi8 (letter, _mm256_set1_epi8 (5)),
+                                     _mm256_cmpgt_epi8 (letter, _mm256_set1_epi8 (-1)));
+    *valid = _mm256_or_si256 (is_digit, is_letter);
+    return _mm256_or_si256 (_mm256_and_si256 (digit, is_digit),
+                            _mm256_and_si256 (_mm256_add_epi8 (letter, _mm256_set1_epi8 (10)), is_letter));
+}
+
+__attribute__ ((target ("avx2")))
+static inline __m256i
+nibble_pairs_to_bytes_avx2 (__m256i nibbles)
+{
+    return _mm256_or_si256 (_mm256_slli_epi16 (_mm256_and_si256 (nibbles, _mm256_set1_epi16 (0x00ff)), 4),
+                            _mm256_srli_epi16 (nibbles, 8));
+}
+
+/* Decodes 64 hex digits into 32 bytes, stopping at the first block with
+ * anything else but hex digits */
+__attribute__ ((target ("avx2")))
+static size_t
+hex_decode_avx2 (const char *str,
+                 size_t      str_len,
+                 uint8_t    *buffer,
+                 size_t      buffer_size)
+{
+    size_t i;
+
+    for (i = 0; i + 64 <= str_len && (i / 2) + 32 <= buffer_size; i += 64) {
+        __m256i a, b, valid_a, valid_b, packed;
+
+        a = hex_to_nibbles_avx2 (_mm256_loadu_si256 ((const __m256i *) &str[i]),      &valid_a);
+        b = hex_to_nibbles_avx2 (_mm256_loadu_si256 ((const __m256i *) &str[i + 32]), &valid_b);
+        if (_mm256_movemask_epi8 (_mm256_and_si256 (valid_a, valid_b)) != -1)
+            break;
+        /* Packing works within each 128-bit lane, so 64-bit blocks need to
+         * be reordered afterwards */
+        packed = _mm256_packus_epi16 (nibble_pairs_to_bytes_avx2 (a), nibble_pairs_to_bytes_avx2 (b));
+        _mm256_storeu_si256 ((__m256i *) &buffer[i / 2], _mm256_permute4x64_epi64 (packed, 0xd8));
+    }
+    return i;
+}
+
+static bool
+cpu_has_avx2 (void)
+{
+    static int has_avx2 = -1;
+
+    if (has_avx2 < 0) {
+        __builtin_cpu_init ();
+        has_avx2 = !!__builtin_cpu_supports ("avx2");
+    }
+    return has_avx2;
+}
+
+#endif /* HEX_KERNELS_X86 */
+
+/* Encodes all bytes, without delimiter, returns number of chars written */
+static size_t
+hex_encode_contiguous (const uint8_t *data,
+                       size_t         size,
+                       char          *out)
+{
+    size_t i = 0;
+
+#if defined HEX_KERNELS_X86
+    if (cpu_has_avx2 ())
+        i = hex_encode_avx2 (data, size, out);
+    i += hex_encode_sse2 (&data[i], size - i, &out[2 * i]);
+#endif
+
+    for (; i < size; i++)
+        hex_encode_byte (data[i], &out[2 * i]);
+    return 2 * size;
+}
+
+size_t
+hex_encode_size (size_t      size,
+                 const char *delimiter)
+{
+    size_t delimiter_length;
+
+    /* If input string has N bytes, we need:
      * - 1 byte for last NUL char
      * - 2N bytes for hexadecimal char representation of each byte...
      * - N-1 times the delimiter length
-     * So... e.g. if delimiter is 1 byte,  a total of:
-     *   (1+2N+N-1) = 3N bytes are needed...
      */
-    new_str_length =  1 + (2 * size) + ((size - 1) * delimiter_length);
-
-    /* Allocate memory for new array and initialize contents to NUL */
-    new_str = calloc (new_str_length, 1);
-
-    /* Print hexadecimal representation of each byte... */
-    for (i = 0, j = 0; i < size; i++, j += (2 + delimiter_length)) {
-        /* Print character in output string... */
-        snprintf (&new_str[j], 3, "%02X", data[i]);
-        /* And if needed, add separator */
-        if (delimiter_length && i != (size - 1) )
-            strncpy (&new_str[j + 2], delimiter, delimiter_length);
-    }
-
-    /* Set output string */
-    return new_str;
+    delimiter_length = (delimiter ? strlen (delimiter) : 0);
+    return 1 + (2 * size) + (size ? ((size - 1) * delimiter_length) : 0);
 }
 
-char *
-strhex_multiline (const void *mem,
-                  size_t      size,
-                  size_t      max_bytes_per_line,
-                  const char *line_prefix,
-                  const char *delimiter)
+size_t
+hex_encode (const void *mem,
+            size_t      size,
+            const char *delimiter,
+            char       *out,
+            size_t      out_size)
 {
     const uint8_t *data = mem;
-    size_t         i, j, new_str_length, line_prefix_length, n_line_prefixes, delimiter_length;
-    char          *new_str;
+    size_t         i, j, delimiter_length;
 
-    assert (size > 0);
+    assert (out_size > 0);
 
-    line_prefix_length = (line_prefix ? strlen (line_prefix) : 0);
-    n_line_prefixes = size / max_bytes_per_line;
+    if (out_size < hex_encode_size (size, delimiter)) {
+        out[0] = '\0';
+        return 0;
+    }
 
     /* Allow delimiters of arbitrary sizes, including 0 */
     delimiter_length = (delimiter ? strlen (delimiter) : 0);
 
-    new_str_length = 1 + (2 * size) + (n_line_prefixes * line_prefix_length) + ((size - 1) * delimiter_length);
-    new_str = calloc (new_str_length + 1, 1);
-
-    /* Print hexadecimal representation of each byte... */
-    for (i = 0, j = 0; i < size; i++) {
-        /* Print character in output string... */
-        snprintf (&new_str[j], 3, "%02X", data[i]);
-        /* And if needed, add separator or EOL + prefix*/
-        if (i != (size - 1)) {
-            if ((i + 1) % max_bytes_per_line == 0) {
-                new_str[j + 2] = '\n';
-                j += 3;
-                if (line_prefix_length) {
-                    strncpy (&new_str[j], line_prefix, line_prefix_length);
-                    j += line_prefix_length;
-                }
-            } else {
-                j += 2;
-                if (delimiter_length) {
-                    strncpy (&new_str[j], delimiter, delimiter_length);
-                    j += delimiter_length;
-                }
+    if (!delimiter_length)
+        j = hex_encode_contiguous (data, size, out);
+    else if (delimiter_length == 1) {
+        for (i = 0, j = 0; i < size; i++, j += 3) {
+            hex_encode_byte (data[i], &out[j]);
+            out[j + 2] = delimiter[0];
+        }
+        /* No delimiter after the last byte */
+        if (j)
+            j--;
+    } else {
+        for (i = 0, j = 0; i < size; i++) {
+            if (i) {
+                memcpy (&out[j], delimiter, delimiter_length);
+                j += delimiter_length;
             }
+            hex_encode_byte (data[i], &out[j]);
+            j += 2;
         }
     }
 
-    return new_str;
+    out[j] = '\0';
+    return j;
 }
 
-static const long hextable[] = {
-   [0 ... 255] = -1,
-   ['0'] = 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
-   ['A'] = 10, 11, 12, 13, 14, 15,
-   ['a'] = 10, 11, 12, 13, 14, 15
-};
-
 ssize_t
-strbin (const char *str,
-        uint8_t    *buffer,
-        size_t      buffer_size)
+hex_decode (const char *str,
+            size_t      str_len,
+            uint8_t    *buffer,
+            size_t      buffer_size)
 {
-    size_t str_len;
     size_t i = 0, j = 0;
-
-    str_len = strlen (str);
+#if defined HEX_KERNELS_X86
+    /* Hex digits decoded one by one in a row since the kernels stopped; they
+     * are only tried again after a whole block of them, so that delimited
+     * input (e.g. "AA:BB:CC") doesn't go into the kernels before every byte */
+    size_t run = HEX_DECODE_BLOCK_SIZE;
+#endif
 
     while (i < str_len) {
-        long xdigith;
-        long xdigitl;
+        int8_t xdigith;
+        int8_t xdigitl;
+
+#if defined HEX_KERNELS_X86
+        /* Bulk decode runs of hex digits, if any */
+        if (run >= HEX_DECODE_BLOCK_SIZE && str_len - i >= HEX_DECODE_BLOCK_SIZE) {
+            size_t n = 0;
+
+            if (cpu_has_avx2 ())
+                n = hex_decode_avx2 (&str[i], str_len - i, &buffer[j], buffer_size - j);
+            n += hex_decode_sse2 (&str[i + n], str_len - i - n, &buffer[j + n / 2], buffer_size - j - n / 2);
+            i += n;
+            j += n / 2;
+            run = 0;
+            if (i >= str_len)
+                break;
+        }
+#endif
 
         if (str[i] == ' ' || str[i] == '\n' || str[i] == ':') {
             i++;
+#if defined HEX_KERNELS_X86
+            run = 0;
+#endif
             continue;
         }
 
         if (j >= buffer_size)
             return (ssize_t) -1;
 
-        xdigith = hextable [(int) str[i++]];
+        xdigith = hextable [(uint8_t) str[i++]];
         if (xdigith < 0)
             return (ssize_t) -2;
 
         if (i >= str_len)
             return (ssize_t) -3;
 
-        xdigitl = hextable [(int) str[i++]];
+        xdigitl = hextable [(uint8_t) str[i++]];
         if (xdigitl < 0)
             return (ssize_t) -4;
 
-        buffer[j++] = xdigith << 4 | xdigitl;
+        buffer[j++] = (uint8_t) (xdigith << 4 | xdigitl);
+#if defined HEX_KERNELS_X86
+        run += 2;
+#endif
     }
 
     return (ssize_t) j;
 }
 
+/******************************************************************************/
+/* Allocating helpers */
+
+char *
+strhex (const void *mem,
+        size_t      size,
+        const char *delimiter)
+{
+    size_t  new_str_length;
+    char   *new_str;
+
+    assert (size > 0);
+
+    new_str_length = hex_encode_size (size, delimiter);
+    new_str = malloc (new_str_length);
+    if (new_str)
+        hex_encode (mem, size, delimiter, new_str, new_str_length);
+    return new_str;
+}
+
+char *
+strhex_multiline (const void *mem,
+                  size_t      size,
+                  size_t      max_bytes_per_line,
+                  const char *line_prefix,
+                  const char *delimiter)
+{
+    const uint8_t *data = mem;
+    size_t         i, j, new_str_length, line_prefix_length, n_line_breaks, delimiter_length;
+    char          *new_str;
+
+    assert (size > 0);
+
+    line_prefix_length = (line_prefix ? strlen (line_prefix) : 0);
+    n_line_breaks = (size - 1) / max_bytes_per_line;
+
+    /* Allow delimiters of arbitrary sizes, including 0 */
+    delimiter_length = (delimiter ? strlen (delimiter) : 0);
+
+    /* Each line break (EOL + prefix) takes the place of a delimiter */
+    new_str_length = 1 + (2 * size) + (n_line_breaks * (1 + line_prefix_length)) + ((size - 1 - n_line_breaks) * delimiter_length);
+    new_str = malloc (new_str_length);
+    if (!new_str)
+        return NULL;
+
+    /* Print each line, and if needed, add EOL + prefix */
+    for (i = 0, j = 0; i < size; i += max_bytes_per_line) {
+        size_t n_bytes;
+
+        if (i) {
+            new_str[j++] = '\n';
+            if (line_prefix_length) {
+                memcpy (&new_str[j], line_prefix, line_prefix_length);
+                j += line_prefix_length;
+            }
+        }
+
+        n_bytes = (size - i < max_bytes_per_line) ? (size - i) : max_bytes_per_line;
+        j += hex_encode (&data[i], n_bytes, delimiter, &new_str[j], new_str_length - j);
+    }
+
+    return new_str;
+}
+
+ssize_t
+strbin (const char *str,
+        uint8_t    *buffer,
+        size_t      buffer_size)
+{
+    return hex_decode (str, strlen (str), buffer, buffer_size);
+}
+
 char *
 strascii (const void *mem,
           size_t      size)
@@ -169,3 +469,15 @@ strascii (const void *mem,
     /* Set output string */
     return new_str;
 }
+
+/******************************************************************************/
+
+/* The call through a volatile pointer can't be dropped by the compiler */
+static void *(* volatile memwipe_memset) (void *, int, size_t) = memset;
+
+void
+memwipe (void   *mem,
+         size_t  size)
+{
+    memwipe_memset (mem, 0, size);
+}
@@ -12,6 +12,27 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+/* Hex encode into a caller provided buffer, which must be at least
+ * hex_encode_size() bytes long. Returns the string length. */
+size_t hex_encode_size (size_t      size,
+                        const char *delimiter);
+
+size_t hex_encode (const void *mem,
+                   size_t      size,
+                   const char *delimiter,
+                   char       *out,
+                   size_t      out_size);
+
+/* Hex decode into a caller provided buffer, skipping ' ', '\n' and ':'
+ * between bytes. Returns the number of bytes written, or a negative value on
+ * error: -1 if the buffer is too small, -2/-4 on an invalid high/low hex
+ * digit, -3 on a truncated byte. */
+ssize_t hex_decode (const char *str,
+                    size_t      str_len,
+                    uint8_t    *buffer,
+                    size_t      buffer_size);
+
+/* Allocating wrappers of the above */
 char *strhex (const void *mem,
               size_t      size,
               const char *delimiter);
@@ -29,4 +50,9 @@ ssize_t strbin (const char *str,
 char *strascii (const void *mem,
                 size_t      size);
 
+/* Zeroes memory holding secrets; unlike memset(), it can't be optimized out
+ * by the compiler even if the memory is freed right after */
+void memwipe (void   *mem,
+              size_t  size);
+
 #endif /* COMMON_H */
@@ -0,0 +1,161 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2017 Zodiac Inflight Innovations, Inc.
+ * All rights reserved.
+ *
+ * Author: Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "json.h"
+
+void
+json_buffer_reset (json_buffer_t *buffer)
+{
+    buffer->len    = 0;
+    buffer->failed = false;
+}
+
+void
+json_buffer_clear (json_buffer_t *buffer)
+{
+    free (buffer->str);
+    buffer->str       = NULL;
+    buffer->len       = 0;
+    buffer->allocated = 0;
+    buffer->failed    = false;
+}
+
+bool
+json_buffer_reserve (json_buffer_t *buffer,
+                     size_t         n)
+{
+    char   *aux;
+    size_t  allocated;
+
+    if (buffer->failed)
+        return false;
+    if (buffer->len + n <= buffer->allocated)
+        return true;
+
+    for (allocated = buffer->allocated ? buffer->allocated : 1024; allocated < buffer->len + n; allocated *= 2);
+    aux = realloc (buffer->str, allocated);
+    if (!aux) {
+        buffer->failed = true;
+        return false;
+    }
+    buffer->str       = aux;
+    buffer->allocated = allocated;
+    return true;
+}
+
+void
+json_buffer_append (json_buffer_t *buffer,
+                    const char    *str)
+{
+    size_t n;
+
+    n = strlen (str);
+    if (json_buffer_reserve (buffer, n)) {
+        memcpy (&buffer->str[buffer->len], str, n);
+        buffer->len += n;
+    }
+}
+
+static void
+append_key (json_buffer_t *buffer,
+            const char    *key)
+{
+    json_buffer_append (buffer, "\"");
+    json_buffer_append (buffer, key);
+    json_buffer_append (buffer, "\":");
+}
+
+void
+json_buffer_append_uint (json_buffer_t *buffer,
+                         const char    *key,
+                         unsigned int   value)
+{
+    char aux[16];
+
+    append_key (buffer, key);
+    snprintf (aux, sizeof (aux), "%u,", value);
+    json_buffer_append (buffer, aux);
+}
+
+void
+json_buffer_append_hex (json_buffer_t *buffer,
+                        const char    *key,
+                        const uint8_t *data,
+                        size_t         size)
+{
+    size_t n;
+
+    append_key (buffer, key);
+    json_buffer_append (buffer, "\"");
+    n = hex_encode_size (size, NULL);
+    if (json_buffer_reserve (buffer, n))
+        buffer->len += hex_encode (data, size, NULL, &buffer->str[buffer->len], n);
+    json_buffer_append (buffer, "\",");
+}
+
+/* Data is not trusted to be printable */
+void
+json_buffer_append_string (json_buffer_t *buffer,
+                           const char    *key,
+                           const uint8_t *data,
+                           size_t         size)
+{
+    size_t i;
+
+    append_key (buffer, key);
+    json_buffer_append (buffer, "\"");
+    /* Worst case, every byte escaped as \u00XX, plus the NUL of the last
+     * one printed */
+    if (json_buffer_reserve (buffer, (6 * size) + 1)) {
+        for (i = 0; i < size; i++) {
+            if (data[i] == '"' || data[i] == '\\') {
+                buffer->str[buffer->len++] = '\\';
+                buffer->str[buffer->len++] = (char) data[i];
+            } else if (data[i] < 0x20 || data[i] >= 0x7f)
+                buffer->len += (size_t) sprintf (&buffer->str[buffer->len], "\\u%04x", data[i]);
+            else
+                buffer->str[buffer->len++] = (char) data[i];
+        }
+    }
+    json_buffer_append (buffer, "\",");
+}
+
+/* Current UTC time, with milliseconds */
+void
+json_buffer_append_time (json_buffer_t *buffer,
+                         const char    *key)
+{
+    struct timespec now;
+    struct tm       tm;
+    char            aux[64];
+    size_t          n;
+
+    clock_gettime (CLOCK_REALTIME, &now);
+    gmtime_r (&now.tv_sec, &tm);
+    n = strftime (aux, sizeof (aux), "\"%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf (&aux[n], sizeof (aux) - n, ".%03uZ\",", (unsigned int) (now.tv_nsec / 1000000));
+
+    append_key (buffer, key);
+    json_buffer_append (buffer, aux);
+}
+
+/* Drop the trailing comma of the last member, if any, and close */
+void
+json_buffer_close (json_buffer_t *buffer,
+                   const char    *str)
+{
+    if (buffer->len && buffer->str[buffer->len - 1] == ',')
+        buffer->len--;
+    json_buffer_append (buffer, str);
+}
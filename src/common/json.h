@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2017 Zodiac Inflight Innovations, Inc.
+ * All rights reserved.
+ *
+ * Author: Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Growable buffer to build compact JSON records. Members are appended with a
+ * trailing comma, dropped when the enclosing object or array is closed. The
+ * buffer may be reused for multiple records with json_buffer_reset(). If the
+ * buffer cannot grow, it is flagged as failed and nothing else is appended
+ * until reset, so incomplete records must not be used. */
+typedef struct {
+    char   *str;
+    size_t  len;
+    size_t  allocated;
+    bool    failed;
+} json_buffer_t;
+
+void json_buffer_reset  (json_buffer_t *buffer);
+void json_buffer_clear  (json_buffer_t *buffer);
+bool json_buffer_reserve (json_buffer_t *buffer,
+                          size_t         n);
+
+void json_buffer_append        (json_buffer_t *buffer,
+                                const char    *str);
+void json_buffer_append_uint   (json_buffer_t *buffer,
+                                const char    *key,
+                                unsigned int   value);
+void json_buffer_append_hex    (json_buffer_t *buffer,
+                                const char    *key,
+                                const uint8_t *data,
+                                size_t         size);
+void json_buffer_append_string (json_buffer_t *buffer,
+                                const char    *key,
+                                const uint8_t *data,
+                                size_t         size);
+void json_buffer_append_time   (json_buffer_t *buffer,
+                                const char    *key);
+void json_buffer_close         (json_buffer_t *buffer,
+                                const char    *str);
+
+#endif /* JSON_H */
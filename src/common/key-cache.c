@@ -0,0 +1,376 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2017 Zodiac Inflight Innovations, Inc.
+ * All rights reserved.
+ *
+ * Author: Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "key-cache.h"
+
+/* The transaction counter is the lower 21 bits of the KSN */
+#define KSN_COUNTER_BYTE_OFFSET 7
+#define KSN_COUNTER_HIGH_MASK   0x1f
+
+/* Entry identifier: BDK digest and KSN with the counter cleared. The BDK
+ * itself is never kept in the cache. */
+#define BDK_DIGEST_SIZE 32
+#define ENTRY_ID_SIZE   (BDK_DIGEST_SIZE + sizeof (dukpt_ksn_t))
+
+#define NONE -1
+
+/******************************************************************************/
+/* SHA-256, only used to identify BDKs */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+sha256_block (uint32_t      *state,
+              const uint8_t *block)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    unsigned int i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = ((uint32_t) block[4 * i] << 24) | ((uint32_t) block[4 * i + 1] << 16) |
+               ((uint32_t) block[4 * i + 2] << 8) | (uint32_t) block[4 * i + 3];
+    for (i = 16; i < 64; i++)
+        w[i] = w[i - 16] + (ROTR (w[i - 15], 7) ^ ROTR (w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+               w[i - 7]  + (ROTR (w[i - 2], 17) ^ ROTR (w[i - 2], 19)  ^ (w[i - 2] >> 10));
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+    for (i = 0; i < 64; i++) {
+        uint32_t t1, t2;
+
+        t1 = h + (ROTR (e, 6) ^ ROTR (e, 11) ^ ROTR (e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (ROTR (a, 2) ^ ROTR (a, 13) ^ ROTR (a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+
+    memwipe (w, sizeof (w));
+}
+
+#undef ROTR
+
+static void
+sha256 (const uint8_t *data,
+        size_t         size,
+        uint8_t       *out_digest)
+{
+    uint32_t state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    uint8_t  block[64];
+    size_t   offset, left;
+    uint64_t bits = (uint64_t) size * 8;
+    unsigned int i;
+
+    for (offset = 0; size - offset >= sizeof (block); offset += sizeof (block))
+        sha256_block (state, &data[offset]);
+
+    /* Padding: 0x80, zeros, and the length in bits, big endian */
+    left = size - offset;
+    memset (block, 0, sizeof (block));
+    memcpy (block, &data[offset], left);
+    block[left] = 0x80;
+    if (left >= sizeof (block) - 8) {
+        sha256_block (state, block);
+        memset (block, 0, sizeof (block));
+    }
+    for (i = 0; i < 8; i++)
+        block[sizeof (block) - 1 - i] = (uint8_t) (bits >> (8 * i));
+    sha256_block (state, block);
+
+    for (i = 0; i < 8; i++) {
+        out_digest[4 * i]     = (uint8_t) (state[i] >> 24);
+        out_digest[4 * i + 1] = (uint8_t) (state[i] >> 16);
+        out_digest[4 * i + 2] = (uint8_t) (state[i] >> 8);
+        out_digest[4 * i + 3] = (uint8_t) state[i];
+    }
+
+    memwipe (block, sizeof (block));
+    memwipe (state, sizeof (state));
+}
+
+/******************************************************************************/
+/* Bounded LRU map from entry identifiers to keys */
+
+typedef struct {
+    uint8_t     id[ENTRY_ID_SIZE];
+    dukpt_key_t key;
+    /* Least recently used list, most recent at the head */
+    int         prev;
+    int         next;
+    /* Hash bucket chain */
+    int         bucket_next;
+} entry_t;
+
+typedef struct {
+    entry_t       *entries;
+    size_t         n_entries;
+    size_t         max_entries;
+    int           *buckets;
+    size_t         n_buckets;
+    int            head;
+    int            tail;
+    unsigned long  hits;
+    unsigned long  misses;
+} lru_t;
+
+static uint32_t
+id_hash (const uint8_t *id)
+{
+    uint32_t hash = 2166136261u;
+    size_t   i;
+
+    /* FNV-1a */
+    for (i = 0; i < ENTRY_ID_SIZE; i++) {
+        hash ^= id[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool
+lru_init (lru_t  *lru,
+          size_t  max_entries)
+{
+    size_t i;
+
+    memset (lru, 0, sizeof (lru_t));
+    lru->max_entries = max_entries ? max_entries : 1;
+    /* At most two entries per bucket on average when full */
+    lru->n_buckets   = (lru->max_entries + 1) / 2;
+    lru->entries     = calloc (lru->max_entries, sizeof (entry_t));
+    lru->buckets     = malloc (lru->n_buckets * sizeof (int));
+    if (!lru->entries || !lru->buckets)
+        return false;
+    for (i = 0; i < lru->n_buckets; i++)
+        lru->buckets[i] = NONE;
+    lru->head = NONE;
+    lru->tail = NONE;
+    return true;
+}
+
+static void
+lru_clear (lru_t *lru)
+{
+    if (lru->entries)
+        memwipe (lru->entries, lru->max_entries * sizeof (entry_t));
+    free (lru->entries);
+    free (lru->buckets);
+}
+
+static void
+lru_unlink (lru_t *lru,
+            int    i)
+{
+    entry_t *entry = &lru->entries[i];
+
+    if (entry->prev != NONE)
+        lru->entries[entry->prev].next = entry->next;
+    else
+        lru->head = entry->next;
+    if (entry->next != NONE)
+        lru->entries[entry->next].prev = entry->prev;
+    else
+        lru->tail = entry->prev;
+}
+
+static void
+lru_link_head (lru_t *lru,
+               int    i)
+{
+    entry_t *entry = &lru->entries[i];
+
+    entry->prev = NONE;
+    entry->next = lru->head;
+    if (lru->head != NONE)
+        lru->entries[lru->head].prev = i;
+    lru->head = i;
+    if (lru->tail == NONE)
+        lru->tail = i;
+}
+
+static void
+lru_bucket_remove (lru_t *lru,
+                   int    i)
+{
+    int *link;
+
+    link = &lru->buckets[id_hash (lru->entries[i].id) % lru->n_buckets];
+    while (*link != i)
+        link = &lru->entries[*link].bucket_next;
+    *link = lru->entries[i].bucket_next;
+}
+
+static int
+lru_find (lru_t         *lru,
+          const uint8_t *id)
+{
+    int i;
+
+    for (i = lru->buckets[id_hash (id) % lru->n_buckets]; i != NONE; i = lru->entries[i].bucket_next) {
+        if (memcmp (lru->entries[i].id, id, ENTRY_ID_SIZE) == 0)
+            return i;
+    }
+    return NONE;
+}
+
+static bool
+lru_lookup (lru_t         *lru,
+            const uint8_t *id,
+            dukpt_key_t   *out_key)
+{
+    int i;
+
+    if ((i = lru_find (lru, id)) == NONE) {
+        lru->misses++;
+        return false;
+    }
+
+    if (lru->head != i) {
+        lru_unlink    (lru, i);
+        lru_link_head (lru, i);
+    }
+    memcpy (out_key, &lru->entries[i].key, sizeof (dukpt_key_t));
+    lru->hits++;
+    return true;
+}
+
+static void
+lru_insert (lru_t             *lru,
+            const uint8_t     *id,
+            const dukpt_key_t *key)
+{
+    int      i;
+    uint32_t bucket;
+
+    /* Another thread may have computed the same one meanwhile */
+    if (lru_find (lru, id) != NONE)
+        return;
+
+    /* Reuse the least recently used entry when full */
+    if (lru->n_entries < lru->max_entries)
+        i = (int) lru->n_entries++;
+    else {
+        i = lru->tail;
+        lru_unlink        (lru, i);
+        lru_bucket_remove (lru, i);
+        memwipe (&lru->entries[i], sizeof (entry_t));
+    }
+
+    memcpy (lru->entries[i].id,   id,  ENTRY_ID_SIZE);
+    memcpy (&lru->entries[i].key, key, sizeof (dukpt_key_t));
+
+    bucket = id_hash (id) % lru->n_buckets;
+    lru->entries[i].bucket_next = lru->buckets[bucket];
+    lru->buckets[bucket] = i;
+    lru_link_head (lru, i);
+}
+
+/******************************************************************************/
+
+struct key_cache_s {
+    pthread_mutex_t mutex;
+    lru_t           ipeks;
+};
+
+key_cache_t *
+key_cache_new (size_t max_ipeks)
+{
+    key_cache_t *cache;
+
+    if (!(cache = calloc (1, sizeof (key_cache_t))))
+        return NULL;
+
+    if (!lru_init (&cache->ipeks, max_ipeks)) {
+        lru_clear (&cache->ipeks);
+        free (cache);
+        return NULL;
+    }
+
+    pthread_mutex_init (&cache->mutex, NULL);
+    return cache;
+}
+
+void
+key_cache_free (key_cache_t *cache)
+{
+    if (!cache)
+        return;
+
+    pthread_mutex_destroy (&cache->mutex);
+    lru_clear (&cache->ipeks);
+    free (cache);
+}
+
+void
+key_cache_get_key (key_cache_t       *cache,
+                   const dukpt_key_t *bdk,
+                   const dukpt_ksn_t *ksn,
+                   dukpt_key_type_t   key_type,
+                   dukpt_key_t       *out_key)
+{
+    uint8_t     ipek_id[ENTRY_ID_SIZE];
+    uint8_t    *ksn_id;
+    dukpt_key_t ipek;
+    bool        found;
+    size_t      i;
+
+    sha256 ((const uint8_t *) bdk, sizeof (dukpt_key_t), ipek_id);
+    ksn_id = &ipek_id[BDK_DIGEST_SIZE];
+    memcpy (ksn_id, ksn, sizeof (dukpt_ksn_t));
+    ksn_id[KSN_COUNTER_BYTE_OFFSET] &= ~KSN_COUNTER_HIGH_MASK;
+    for (i = KSN_COUNTER_BYTE_OFFSET + 1; i < sizeof (dukpt_ksn_t); i++)
+        ksn_id[i] = 0;
+
+    /* Key derivations are never done with the lock held */
+    pthread_mutex_lock (&cache->mutex);
+    found = lru_lookup (&cache->ipeks, ipek_id, &ipek);
+    pthread_mutex_unlock (&cache->mutex);
+
+    if (!found) {
+        dukpt_compute_ipek (bdk, ksn, &ipek);
+        pthread_mutex_lock (&cache->mutex);
+        lru_insert (&cache->ipeks, ipek_id, &ipek);
+        pthread_mutex_unlock (&cache->mutex);
+    }
+
+    dukpt_compute_key (&ipek, ksn, key_type, out_key);
+    memwipe (&ipek, sizeof (ipek));
+}
+
+void
+key_cache_get_stats (key_cache_t   *cache,
+                     unsigned long *out_hits,
+                     unsigned long *out_misses)
+{
+    pthread_mutex_lock (&cache->mutex);
+    if (out_hits)
+        *out_hits = cache->ipeks.hits;
+    if (out_misses)
+        *out_misses = cache->ipeks.misses;
+    pthread_mutex_unlock (&cache->mutex);
+}
@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2017 Zodiac Inflight Innovations, Inc.
+ * All rights reserved.
+ *
+ * Author: Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#ifndef KEY_CACHE_H
+#define KEY_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <dukpt.h>
+
+/* DUKPT key derivation cache, safe to use from multiple threads.
+ *
+ * The IPEK only depends on the BDK and on the KSN without the transaction
+ * counter, so it is computed once for all the transactions of a given reader
+ * and key, and only the derivation of the transaction key from it is done for
+ * every request. Transaction keys themselves are not cached, as each
+ * transaction counter is used once. The cache is bounded and drops the
+ * least recently used IPEK when full.
+ *
+ * Entries are identified by a digest of the BDK, never by the BDK itself, and
+ * the IPEKs cached are cleared from memory as soon as they are dropped. */
+typedef struct key_cache_s key_cache_t;
+
+key_cache_t *key_cache_new     (size_t              max_ipeks);
+void         key_cache_free    (key_cache_t        *cache);
+void         key_cache_get_key (key_cache_t        *cache,
+                                const dukpt_key_t  *bdk,
+                                const dukpt_ksn_t  *ksn,
+                                dukpt_key_type_t    key_type,
+                                dukpt_key_t        *out_key);
+
+/* Number of IPEK cache hits and misses */
+void         key_cache_get_stats (key_cache_t   *cache,
+                                  unsigned long *out_hits,
+                                  unsigned long *out_misses);
+
+#endif /* KEY_CACHE_H */
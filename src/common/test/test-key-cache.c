@@ -0,0 +1,268 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2017 Zodiac Inflight Innovations, Inc.
+ * All rights reserved.
+ *
+ * Author: Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+/*
+ * Key cache tests: IPEKs must be shared by all the transaction counters of a
+ * reader and key, and only by those; they must be dropped least recently used
+ * first, and no key material may be left in memory given back to the system.
+ *
+ * The cache is built in the test itself, so that its internals can be checked
+ * and the memory it frees scanned before it's actually freed.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <malloc.h>
+
+static void test_free (void *mem);
+
+#define free test_free
+#include "key-cache.c"
+#undef free
+
+#define MAX_SECRETS 8
+
+/* Key material that must never be found in freed memory */
+static dukpt_key_t secrets[MAX_SECRETS];
+static unsigned int n_secrets;
+static bool         secret_freed;
+
+/******************************************************************************/
+
+static bool
+contains_secret (const uint8_t *mem,
+                 size_t         size)
+{
+    unsigned int i;
+    size_t       j;
+
+    for (i = 0; i < n_secrets; i++) {
+        for (j = 0; j + sizeof (dukpt_key_t) <= size; j++) {
+            if (memcmp (&mem[j], &secrets[i], sizeof (dukpt_key_t)) == 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+static void
+test_free (void *mem)
+{
+    if (mem && contains_secret (mem, malloc_usable_size (mem)))
+        secret_freed = true;
+    free (mem);
+}
+
+/* Readers are identified in the KSN right before the transaction counter,
+ * so that the bit next to the counter is part of the reader id */
+static void
+build_ksn (uint8_t      reader,
+           uint32_t     counter,
+           dukpt_ksn_t *out_ksn)
+{
+    uint8_t *ksn = (uint8_t *) out_ksn;
+
+    memset (ksn, 0x22, sizeof (dukpt_ksn_t));
+    ksn[KSN_COUNTER_BYTE_OFFSET - 1] = reader >> 3;
+    ksn[KSN_COUNTER_BYTE_OFFSET]     = (uint8_t) (reader << 5) | ((counter >> 16) & KSN_COUNTER_HIGH_MASK);
+    ksn[KSN_COUNTER_BYTE_OFFSET + 1] = (uint8_t) (counter >> 8);
+    ksn[KSN_COUNTER_BYTE_OFFSET + 2] = (uint8_t) counter;
+}
+
+static void
+build_bdk (uint8_t      bdk_id,
+           dukpt_key_t *out_bdk)
+{
+    memset (out_bdk, 0x11, sizeof (dukpt_key_t));
+    ((uint8_t *) out_bdk)[0] = bdk_id;
+}
+
+/* Gets the key from the cache, and checks it along with whether the IPEK was
+ * already cached */
+static bool
+expect_key (key_cache_t      *cache,
+            const char       *description,
+            uint8_t           bdk_id,
+            uint8_t           reader,
+            uint32_t          counter,
+            dukpt_key_type_t  key_type,
+            bool              expected_hit)
+{
+    dukpt_key_t   bdk, ipek, key, expected;
+    dukpt_ksn_t   ksn;
+    unsigned long hits_before, hits_after;
+
+    build_bdk (bdk_id, &bdk);
+    build_ksn (reader, counter, &ksn);
+    dukpt_compute_ipek ((const dukpt_key_t *) &bdk, (const dukpt_ksn_t *) &ksn, &ipek);
+    dukpt_compute_key ((const dukpt_key_t *) &ipek, (const dukpt_ksn_t *) &ksn, key_type, &expected);
+
+    key_cache_get_stats (cache, &hits_before, NULL);
+    key_cache_get_key (cache, (const dukpt_key_t *) &bdk, (const dukpt_ksn_t *) &ksn, key_type, &key);
+    key_cache_get_stats (cache, &hits_after, NULL);
+
+    if (memcmp (&key, &expected, sizeof (dukpt_key_t)) != 0) {
+        printf ("FAIL: %s: wrong key\n", description);
+        return false;
+    }
+    if ((hits_after != hits_before) != expected_hit) {
+        printf ("FAIL: %s: IPEK cache %s expected\n", description, expected_hit ? "hit" : "miss");
+        return false;
+    }
+    return true;
+}
+
+/* Checks whether the IPEK of the given reader is anywhere in the cache */
+static bool
+ipek_cached (key_cache_t *cache,
+             uint8_t      bdk_id,
+             uint8_t      reader)
+{
+    dukpt_key_t bdk, ipek;
+    dukpt_ksn_t ksn;
+    bool        found;
+
+    build_bdk (bdk_id, &bdk);
+    build_ksn (reader, 0, &ksn);
+    dukpt_compute_ipek ((const dukpt_key_t *) &bdk, (const dukpt_ksn_t *) &ksn, &ipek);
+
+    n_secrets = 1;
+    memcpy (&secrets[0], &ipek, sizeof (dukpt_key_t));
+    found = contains_secret ((const uint8_t *) cache->ipeks.entries, cache->ipeks.max_entries * sizeof (entry_t));
+    n_secrets = 0;
+    return found;
+}
+
+/******************************************************************************/
+/* Tests */
+
+/* Only the 21 counter bits are ignored when looking up IPEKs */
+static bool
+test_counter_mask (void)
+{
+    key_cache_t *cache;
+    bool         ok = true;
+
+    if (!(cache = key_cache_new (4)))
+        return false;
+
+    ok &= expect_key (cache, "first counter", 1, 1, 0x000001, DUKPT_KEY_TYPE_DATA_REQUEST, false);
+    ok &= expect_key (cache, "last counter", 1, 1, 0x1fffff, DUKPT_KEY_TYPE_DATA_REQUEST, true);
+    ok &= expect_key (cache, "counter high bits", 1, 1, 0x100000, DUKPT_KEY_TYPE_DATA_REQUEST, true);
+    ok &= expect_key (cache, "other key type", 1, 1, 0x000002, DUKPT_KEY_TYPE_PIN_ENCRYPTION, true);
+    /* Differs from reader 1 in the bit right above the counter */
+    ok &= expect_key (cache, "bit above counter", 1, 0, 0x000001, DUKPT_KEY_TYPE_DATA_REQUEST, false);
+    ok &= expect_key (cache, "other reader", 1, 9, 0x000001, DUKPT_KEY_TYPE_DATA_REQUEST, false);
+    ok &= expect_key (cache, "other BDK", 2, 1, 0x000001, DUKPT_KEY_TYPE_DATA_REQUEST, false);
+    ok &= expect_key (cache, "first reader again", 1, 1, 0x000003, DUKPT_KEY_TYPE_DATA_REQUEST, true);
+
+    key_cache_free (cache);
+    if (ok)
+        printf ("PASS: counter mask\n");
+    return ok;
+}
+
+/* The least recently used IPEK is dropped when full, and wiped */
+static bool
+test_eviction (void)
+{
+    key_cache_t *cache;
+    bool         ok = true;
+
+    if (!(cache = key_cache_new (2)))
+        return false;
+
+    ok &= expect_key (cache, "fill", 1, 1, 1, DUKPT_KEY_TYPE_DATA_REQUEST, false);
+    ok &= expect_key (cache, "fill", 1, 2, 1, DUKPT_KEY_TYPE_DATA_REQUEST, false);
+    /* Reader 1 becomes the most recently used, so reader 2 is dropped */
+    ok &= expect_key (cache, "use oldest", 1, 1, 2, DUKPT_KEY_TYPE_DATA_REQUEST, true);
+    ok &= expect_key (cache, "insert when full", 1, 3, 1, DUKPT_KEY_TYPE_DATA_REQUEST, false);
+    if (ipek_cached (cache, 1, 2)) {
+        printf ("FAIL: eviction: dropped IPEK still in memory\n");
+        ok = false;
+    }
+    ok &= expect_key (cache, "used kept", 1, 1, 3, DUKPT_KEY_TYPE_DATA_REQUEST, true);
+    ok &= expect_key (cache, "inserted kept", 1, 3, 2, DUKPT_KEY_TYPE_DATA_REQUEST, true);
+    ok &= expect_key (cache, "least recently used dropped", 1, 2, 2, DUKPT_KEY_TYPE_DATA_REQUEST, false);
+
+    key_cache_free (cache);
+    if (ok)
+        printf ("PASS: eviction\n");
+    return ok;
+}
+
+/* The BDKs are never kept, and the IPEKs are not left in the memory freed */
+static bool
+test_wipe (void)
+{
+    key_cache_t *cache;
+    dukpt_key_t  bdk;
+    dukpt_ksn_t  ksn;
+    uint8_t      bdk_id;
+    uint8_t      reader;
+    bool         ok = true;
+
+    if (!(cache = key_cache_new (4)))
+        return false;
+
+    for (bdk_id = 1; bdk_id <= 2; bdk_id++) {
+        for (reader = 1; reader <= 2; reader++)
+            ok &= expect_key (cache, "fill", bdk_id, reader, 1, DUKPT_KEY_TYPE_DATA_REQUEST, false);
+    }
+
+    n_secrets = 0;
+    build_bdk (1, &secrets[n_secrets++]);
+    build_bdk (2, &secrets[n_secrets++]);
+    if (contains_secret ((const uint8_t *) cache->ipeks.entries, cache->ipeks.max_entries * sizeof (entry_t))) {
+        printf ("FAIL: wipe: BDK kept in the cache\n");
+        ok = false;
+    }
+
+    n_secrets = 0;
+    for (bdk_id = 1; bdk_id <= 2; bdk_id++) {
+        for (reader = 1; reader <= 2; reader++) {
+            build_bdk (bdk_id, &bdk);
+            build_ksn (reader, 0, &ksn);
+            dukpt_compute_ipek ((const dukpt_key_t *) &bdk, (const dukpt_ksn_t *) &ksn, &secrets[n_secrets++]);
+        }
+    }
+    /* Otherwise the check below would be meaningless */
+    if (!contains_secret ((const uint8_t *) cache->ipeks.entries, cache->ipeks.max_entries * sizeof (entry_t))) {
+        printf ("FAIL: wipe: IPEKs not found in the cache\n");
+        ok = false;
+    }
+
+    secret_freed = false;
+    key_cache_free (cache);
+    n_secrets = 0;
+    if (secret_freed) {
+        printf ("FAIL: wipe: IPEK left in freed memory\n");
+        ok = false;
+    }
+
+    if (ok)
+        printf ("PASS: wipe\n");
+    return ok;
+}
+
+/******************************************************************************/
+
+int main (int argc, char **argv)
+{
+    bool ok = true;
+
+    ok &= test_counter_mask ();
+    ok &= test_eviction ();
+    ok &= test_wipe ();
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,142 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr - Support library for MagTek Credit Card Readers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "mccr.h"
+#include "mccr-log.h"
+#include "mccr-hid.h"
+#include "mccr-builtin-layouts.h"
+
+/******************************************************************************/
+/* Known report descriptors
+ *
+ * Devices with a known VID/PID and report descriptor size may be opened
+ * without reading and parsing their HID report descriptor, using the layout
+ * built from the descriptor listed here instead. New entries should only be
+ * added from descriptors dumped from real hardware (e.g. 'report desc' in
+ * mccr-cli --debug); none has been added yet.
+ */
+
+typedef struct {
+    uint16_t       vid;
+    uint16_t       pid;
+    const uint8_t *desc;
+    size_t         desc_size;
+} builtin_layout_t;
+
+/* Terminated by an entry with no descriptor */
+static const builtin_layout_t builtin_layouts[] = {
+    { 0, 0, NULL, 0 },
+};
+
+#define N_BUILTIN_LAYOUTS (sizeof (builtin_layouts) / sizeof (builtin_layouts[0]))
+
+/* Layouts are built once on first use, and shared by all devices. A layout
+ * is rejected (and never used again) as soon as a device with its VID/PID
+ * and descriptor size is found exposing a different report descriptor. */
+static pthread_mutex_t                   builtin_layouts_lock = PTHREAD_MUTEX_INITIALIZER;
+static mccr_report_descriptor_context_t *builtin_layout_contexts[N_BUILTIN_LAYOUTS];
+static bool                              builtin_layout_rejected[N_BUILTIN_LAYOUTS];
+
+static size_t
+builtin_layout_lookup (uint16_t vid,
+                       uint16_t pid,
+                       size_t   desc_size)
+{
+    size_t i;
+
+    for (i = 0; builtin_layouts[i].desc; i++) {
+        if (builtin_layouts[i].vid == vid &&
+            builtin_layouts[i].pid == pid &&
+            builtin_layouts[i].desc_size == desc_size)
+            return i;
+    }
+    return N_BUILTIN_LAYOUTS;
+}
+
+mccr_report_descriptor_context_t *
+mccr_builtin_layout_get (uint16_t        vid,
+                         uint16_t        pid,
+                         size_t          desc_size,
+                         const uint8_t **out_desc)
+{
+    mccr_report_descriptor_context_t *ctx = NULL;
+    size_t                            i;
+
+    if ((i = builtin_layout_lookup (vid, pid, desc_size)) == N_BUILTIN_LAYOUTS)
+        return NULL;
+
+    pthread_mutex_lock (&builtin_layouts_lock);
+    if (!builtin_layout_rejected[i] &&
+        !builtin_layout_contexts[i] &&
+        mccr_parse_report_descriptor (builtin_layouts[i].desc,
+                                      builtin_layouts[i].desc_size,
+                                      &builtin_layout_contexts[i]) != MCCR_STATUS_OK) {
+        mccr_log ("error: couldn't parse built-in report descriptor for %04x:%04x", vid, pid);
+        builtin_layout_contexts[i] = NULL;
+    }
+    if (!builtin_layout_rejected[i] && builtin_layout_contexts[i])
+        ctx = mccr_report_descriptor_context_ref (builtin_layout_contexts[i]);
+    pthread_mutex_unlock (&builtin_layouts_lock);
+
+    if (ctx && out_desc)
+        *out_desc = builtin_layouts[i].desc;
+
+    return ctx;
+}
+
+void
+mccr_builtin_layout_reject (uint16_t vid,
+                            uint16_t pid,
+                            size_t   desc_size)
+{
+    size_t i;
+
+    if ((i = builtin_layout_lookup (vid, pid, desc_size)) == N_BUILTIN_LAYOUTS)
+        return;
+
+    pthread_mutex_lock (&builtin_layouts_lock);
+    if (!builtin_layout_rejected[i])
+        mccr_log ("built-in layout for %04x:%04x rejected", vid, pid);
+    builtin_layout_rejected[i] = true;
+    pthread_mutex_unlock (&builtin_layouts_lock);
+}
+
+void
+mccr_builtin_layouts_clear (void)
+{
+    size_t i;
+
+    pthread_mutex_lock (&builtin_layouts_lock);
+    for (i = 0; i < N_BUILTIN_LAYOUTS; i++) {
+        if (builtin_layout_contexts[i]) {
+            mccr_report_descriptor_context_unref (builtin_layout_contexts[i]);
+            builtin_layout_contexts[i] = NULL;
+        }
+        builtin_layout_rejected[i] = false;
+    }
+    pthread_mutex_unlock (&builtin_layouts_lock);
+}
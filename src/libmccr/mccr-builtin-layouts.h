@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr - Support library for MagTek Credit Card Readers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#if !defined MCCR_BUILTIN_LAYOUTS_H
+# define MCCR_BUILTIN_LAYOUTS_H
+
+#include "mccr.h"
+#include "mccr-hid.h"
+
+/******************************************************************************/
+/* Built-in report layouts */
+
+/* Layouts are looked up by VID/PID and by the size of the report descriptor
+ * exposed by the device, which is cheaper to get than the descriptor itself */
+mccr_report_descriptor_context_t *mccr_builtin_layout_get    (uint16_t        vid,
+                                                             uint16_t        pid,
+                                                             size_t          desc_size,
+                                                             const uint8_t **out_desc);
+void                              mccr_builtin_layout_reject (uint16_t        vid,
+                                                             uint16_t        pid,
+                                                             size_t          desc_size);
+void                              mccr_builtin_layouts_clear (void);
+
+#endif /* MCCR_BUILTIN_LAYOUTS_H */
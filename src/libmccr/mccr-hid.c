@@ -32,32 +32,6 @@
 #include "mccr-log.h"
 #include "mccr-hid.h"
 
-static const char *type_str[] = {
-    [0b00] = "main",
-    [0b01] = "global",
-    [0b10] = "local",
-    [0b11] = "reserved"
-};
-
-static const char *main_tag_str[] = {
-    [0b0000] = "Reserved",
-    [0b0001] = "Reserved",
-    [0b0010] = "Reserved",
-    [0b0011] = "Reserved",
-    [0b0100] = "Reserved",
-    [0b0101] = "Reserved",
-    [0b0110] = "Reserved",
-    [0b0111] = "Reserved",
-    [0b1000] = "Input",
-    [0b1001] = "Output",
-    [0b1010] = "Collection",
-    [0b1011] = "Feature",
-    [0b1100] = "End Collection",
-    [0b1101] = "Reserved",
-    [0b1110] = "Reserved",
-    [0b1111] = "Reserved",
-};
-
 static const char *main_collection_str[] = {
     [0x00] = "Physical",
     [0x01] = "Application",
@@ -68,44 +42,6 @@ static const char *main_collection_str[] = {
     [0x06] = "Usage modifier"
 };
 
-static const char *global_tag_str[] = {
-    [0b0000] = "Usage page",
-    [0b0001] = "Logical minimum",
-    [0b0010] = "Logical maximum",
-    [0b0011] = "Physical minimum",
-    [0b0100] = "Physical maximum",
-    [0b0101] = "Unit exponent",
-    [0b0110] = "Unit",
-    [0b0111] = "Report size",
-    [0b1000] = "Report ID",
-    [0b1001] = "Report count",
-    [0b1010] = "Push",
-    [0b1011] = "Pop",
-    [0b1100] = "Reserved",
-    [0b1101] = "Reserved",
-    [0b1110] = "Reserved",
-    [0b1111] = "Reserved"
-};
-
-static const char *local_tag_str[] = {
-    [0b0000] = "Usage",
-    [0b0001] = "Usage minimum",
-    [0b0010] = "Usage maximum",
-    [0b0011] = "Designator index",
-    [0b0100] = "Designator minimum",
-    [0b0101] = "Designator maximum",
-    [0b0110] = "Reserved",
-    [0b0111] = "String index",
-    [0b1000] = "String minimum",
-    [0b1001] = "String maximum",
-    [0b1010] = "Delimiter",
-    [0b1011] = "Reserved",
-    [0b1100] = "Reserved",
-    [0b1101] = "Reserved",
-    [0b1110] = "Reserved",
-    [0b1111] = "Reserved"
-};
-
 static const char *input_usage_id_str[] = {
     [MCCR_INPUT_USAGE_ID_TRACK_1_DECODE_STATUS]           = "Track 1 decode status",
     [MCCR_INPUT_USAGE_ID_TRACK_2_DECODE_STATUS]           = "Track 2 decode status",
@@ -167,6 +103,23 @@ feature_usage_id_to_string (uint8_t usage_id)
 }
 
 /******************************************************************************/
+/* Report layout
+ *
+ * The parsed report descriptor is stored in a single contiguous block,
+ * which is never modified once built and which doesn't contain pointers.
+ * It may therefore be shared read-only by any number of devices and
+ * threads, and also stored as is (e.g. in a descriptor cache) to be loaded
+ * back later on.
+ */
+
+#define LAYOUT_MAGIC   0x4c52434d /* "MCRL" */
+#define LAYOUT_VERSION 1
+
+/* Usage lookups are done through a per-report index, with one entry per
+ * possible usage id, storing the 1-based position of the usage in the
+ * report, or 0 if not available. */
+#define MAX_USAGE_ID      0xFF
+#define MAX_REPORT_USAGES 0xFF
 
 typedef struct {
     uint32_t id;
@@ -174,70 +127,51 @@ typedef struct {
     uint32_t offset_bits;
 } usage_t;
 
-static void
-append_to_usage_array (usage_t **array,
-                       size_t   *array_size,
-                       size_t   *array_allocated,
-                       usage_t  *items,
-                       size_t    n_items)
-{
-    if ((*array_size + n_items) > *array_allocated) {
-        do
-            *array_allocated = (*array_allocated > 0 ? (*array_allocated * 2) : 2);
-        while ((*array_size + n_items) > *array_allocated);
-        *array = realloc (*array, sizeof (usage_t) * (*array_allocated));
-        if (!(*array)) {
-            *array_size = *array_allocated = 0;
-            return;
-        }
-    }
+typedef struct {
+    uint32_t n_usages;
+    uint32_t size;
+    uint8_t  index[MAX_USAGE_ID + 1];
+} report_layout_t;
 
-    assert ((*array_size + n_items) <= *array_allocated);
-    assert (*array);
-    memcpy (&((*array)[*array_size]), items, sizeof (usage_t) * n_items);
-    (*array_size) += n_items;
-}
+typedef struct {
+    uint32_t        magic;
+    uint32_t        version;
+    uint32_t        size;
+    report_layout_t input;
+    report_layout_t feature;
+    /* input report usages, followed by feature report usages */
+    usage_t         usages[];
+} layout_t;
 
-static void
-cleanup_usage_array (usage_t **array,
-                     size_t   *array_size,
-                     size_t   *array_allocated)
+struct mccr_report_descriptor_context_s {
+    volatile int    refcount;
+    const layout_t *layout;
+};
+
+static size_t
+layout_compute_size (size_t n_input_usages,
+                     size_t n_feature_usages)
 {
-    free (*array);
-    *array = NULL;
-    *array_size = *array_allocated = 0;
+    return sizeof (layout_t) + (sizeof (usage_t) * (n_input_usages + n_feature_usages));
 }
 
-static usage_t *
-lookup_usage_array (usage_t *array,
-                    size_t   array_size,
-                    uint8_t  usage_id)
+static mccr_report_descriptor_context_t *
+report_descriptor_context_new (size_t     layout_size,
+                               layout_t **out_layout)
 {
-    size_t i;
+    mccr_report_descriptor_context_t *ctx;
 
-    for (i = 0; i < array_size; i++) {
-        usage_t *usage;
+    /* The context and the layout are allocated in the same block */
+    ctx = calloc (sizeof (mccr_report_descriptor_context_t) + layout_size, 1);
+    if (!ctx)
+        return NULL;
 
-        usage = &array[i];
-        if (usage->id == usage_id)
-            return usage;
-    }
-    return NULL;
+    ctx->refcount = 1;
+    *out_layout = (layout_t *) (ctx + 1);
+    ctx->layout = *out_layout;
+    return ctx;
 }
 
-typedef struct {
-    usage_t *usages;
-    size_t   usages_size;
-    size_t   usages_allocated;
-    size_t   size;
-} report_t;
-
-struct mccr_report_descriptor_context_s {
-    volatile int refcount;
-    report_t     input;
-    report_t     feature;
-};
-
 void
 mccr_report_descriptor_context_unref (mccr_report_descriptor_context_t *ctx)
 {
@@ -245,8 +179,6 @@ mccr_report_descriptor_context_unref (mccr_report_descriptor_context_t *ctx)
     if (__sync_fetch_and_sub (&ctx->refcount, 1) != 1)
         return;
 
-    free (ctx->input.usages);
-    free (ctx->feature.usages);
     free (ctx);
 }
 
@@ -258,18 +190,19 @@ mccr_report_descriptor_context_ref (mccr_report_descriptor_context_t *ctx)
     return ctx;
 }
 
-bool
-mccr_report_descriptor_get_input_report_usage (mccr_report_descriptor_context_t *ctx,
-                                               uint8_t                           usage_id,
-                                               uint32_t                         *usage_offset,
-                                               uint32_t                         *usage_size)
+static bool
+report_layout_get_usage (const report_layout_t *report,
+                         const usage_t         *usages,
+                         uint8_t                usage_id,
+                         uint32_t              *usage_offset,
+                         uint32_t              *usage_size)
 {
-    usage_t *usage;
+    const usage_t *usage;
 
-    usage = lookup_usage_array (ctx->input.usages, ctx->input.usages_size, usage_id);
-    if (!usage)
+    if (!report->index[usage_id])
         return false;
 
+    usage = &usages[report->index[usage_id] - 1];
     if (usage_offset)
         *usage_offset = usage->offset_bits;
     if (usage_size)
@@ -277,10 +210,21 @@ mccr_report_descriptor_get_input_report_usage (mccr_report_descriptor_context_t
     return true;
 }
 
+bool
+mccr_report_descriptor_get_input_report_usage (mccr_report_descriptor_context_t *ctx,
+                                               uint8_t                           usage_id,
+                                               uint32_t                         *usage_offset,
+                                               uint32_t                         *usage_size)
+{
+    return report_layout_get_usage (&ctx->layout->input,
+                                    ctx->layout->usages,
+                                    usage_id, usage_offset, usage_size);
+}
+
 size_t
 mccr_report_descriptor_get_input_report_size (mccr_report_descriptor_context_t *ctx)
 {
-    return ctx->input.size;
+    return ctx->layout->input.size;
 }
 
 bool
@@ -289,29 +233,135 @@ mccr_report_descriptor_get_feature_report_usage (mccr_report_descriptor_context_
                                                  uint32_t                         *usage_offset,
                                                  uint32_t                         *usage_size)
 {
-    usage_t *usage;
+    return report_layout_get_usage (&ctx->layout->feature,
+                                    &ctx->layout->usages[ctx->layout->input.n_usages],
+                                    usage_id, usage_offset, usage_size);
+}
+
+size_t
+mccr_report_descriptor_get_feature_report_size (mccr_report_descriptor_context_t *ctx)
+{
+    return ctx->layout->feature.size;
+}
+
+/******************************************************************************/
+/* Layout serialization */
+
+void
+mccr_report_descriptor_context_get_layout (mccr_report_descriptor_context_t  *ctx,
+                                           const uint8_t                    **out_layout,
+                                           size_t                            *out_layout_size)
+{
+    *out_layout      = (const uint8_t *) ctx->layout;
+    *out_layout_size = ctx->layout->size;
+}
+
+static bool
+report_layout_validate (const report_layout_t *report,
+                        const usage_t         *usages)
+{
+    unsigned int i;
 
-    usage = lookup_usage_array (ctx->feature.usages, ctx->feature.usages_size, usage_id);
-    if (!usage)
+    if (!report->n_usages || report->n_usages > MAX_REPORT_USAGES)
         return false;
 
-    if (usage_offset)
-        *usage_offset = usage->offset_bits;
-    if (usage_size)
-        *usage_size = usage->size_bits;
+    for (i = 0; i < report->n_usages; i++) {
+        if (usages[i].size_bits > (report->size * 8) ||
+            usages[i].offset_bits > ((report->size * 8) - usages[i].size_bits))
+            return false;
+    }
+
+    for (i = 0; i <= MAX_USAGE_ID; i++) {
+        if (report->index[i] > report->n_usages ||
+            (report->index[i] && usages[report->index[i] - 1].id != i))
+            return false;
+    }
+
     return true;
 }
 
-size_t
-mccr_report_descriptor_get_feature_report_size (mccr_report_descriptor_context_t *ctx)
+static bool
+layout_validate (const layout_t *layout,
+                 size_t          layout_size)
 {
-    return ctx->feature.size;
+    if (layout->magic != LAYOUT_MAGIC) {
+        mccr_log ("error: invalid report layout: unexpected magic");
+        return false;
+    }
+
+    if (layout->version != LAYOUT_VERSION) {
+        mccr_log ("error: invalid report layout: unsupported version %u", layout->version);
+        return false;
+    }
+
+    if (layout->size != layout_size ||
+        layout->input.n_usages > MAX_REPORT_USAGES ||
+        layout->feature.n_usages > MAX_REPORT_USAGES ||
+        layout_compute_size (layout->input.n_usages, layout->feature.n_usages) != layout_size) {
+        mccr_log ("error: invalid report layout: unexpected size");
+        return false;
+    }
+
+    if (!report_layout_validate (&layout->input, layout->usages) ||
+        !report_layout_validate (&layout->feature, &layout->usages[layout->input.n_usages])) {
+        mccr_log ("error: invalid report layout: inconsistent usages");
+        return false;
+    }
+
+    return true;
+}
+
+mccr_status_t
+mccr_report_descriptor_context_new_from_layout (const uint8_t                     *layout,
+                                                size_t                             layout_size,
+                                                mccr_report_descriptor_context_t **out_ctx)
+{
+    mccr_report_descriptor_context_t *ctx;
+    layout_t                         *ctx_layout;
+
+    if (layout_size < sizeof (layout_t)) {
+        mccr_log ("error: invalid report layout: too short");
+        return MCCR_STATUS_INVALID_INPUT;
+    }
+
+    /* Copy before validating, so that the validation runs on properly
+     * aligned data */
+    ctx = report_descriptor_context_new (layout_size, &ctx_layout);
+    if (!ctx)
+        return MCCR_STATUS_FAILED;
+    memcpy (ctx_layout, layout, layout_size);
+
+    if (!layout_validate (ctx_layout, layout_size)) {
+        mccr_report_descriptor_context_unref (ctx);
+        return MCCR_STATUS_INVALID_INPUT;
+    }
+
+    *out_ctx = ctx;
+    return MCCR_STATUS_OK;
 }
 
 /******************************************************************************/
+/* Report descriptor parsing
+ *
+ * The descriptor is parsed twice: a first pass validates it and counts the
+ * usages in each report, so that the layout can be allocated at once, and
+ * a second pass fills in the layout.
+ */
+
+/* Maximum number of usages given before a main item */
+#define MAX_WIP_USAGES 64
 
 typedef struct {
-    mccr_report_descriptor_context_t *desc_ctx;
+    /* layout being filled, NULL in the first pass */
+    usage_t  *input_usages;
+    usage_t  *feature_usages;
+    layout_t *layout;
+
+    /* reports */
+    size_t   n_input_usages;
+    uint32_t input_offset_bits;
+    size_t   n_feature_usages;
+    uint32_t feature_offset_bits;
 
     /* global */
     uint32_t usage_page;
@@ -320,98 +370,189 @@ typedef struct {
     /* main */
     uint32_t collection;
     /* local */
+    uint32_t wip_usages[MAX_WIP_USAGES];
+    size_t   n_wip_usages;
 
-    /* helpers */
+    /* helpers; logging is never enabled in the second pass, so that
+     * warnings are not logged twice (errors end the first one) */
+    bool         log_enabled;
     unsigned int log_indent;
     bool         fatal_error;
-    usage_t     *wip_usages;
-    size_t       wip_usages_size;
-    size_t       wip_usages_allocated;
 } parse_context_t;
 
+enum {
+    ITEM_TYPE_MAIN     = 0b00,
+    ITEM_TYPE_GLOBAL   = 0b01,
+    ITEM_TYPE_LOCAL    = 0b10,
+    ITEM_TYPE_RESERVED = 0b11,
+};
+
+/* Short items are identified by the item prefix without the size bits */
+#define ITEM(type, tag) (((tag) << 2) | (type))
+
+enum {
+    ITEM_INPUT          = ITEM (ITEM_TYPE_MAIN,   0b1000),
+    ITEM_OUTPUT         = ITEM (ITEM_TYPE_MAIN,   0b1001),
+    ITEM_COLLECTION     = ITEM (ITEM_TYPE_MAIN,   0b1010),
+    ITEM_FEATURE        = ITEM (ITEM_TYPE_MAIN,   0b1011),
+    ITEM_END_COLLECTION = ITEM (ITEM_TYPE_MAIN,   0b1100),
+    ITEM_USAGE_PAGE     = ITEM (ITEM_TYPE_GLOBAL, 0b0000),
+    ITEM_REPORT_SIZE    = ITEM (ITEM_TYPE_GLOBAL, 0b0111),
+    ITEM_REPORT_COUNT   = ITEM (ITEM_TYPE_GLOBAL, 0b1001),
+    ITEM_USAGE          = ITEM (ITEM_TYPE_LOCAL,  0b0000),
+};
+
 static void
-parse_context_clear (parse_context_t *ctx)
+log_data_item (parse_context_t *ctx,
+               const char      *name,
+               uint32_t         value,
+               bool             volatile_flag)
 {
-    mccr_report_descriptor_context_unref (ctx->desc_ctx);
-    free (ctx->wip_usages);
+    char value_str[255] = { '\0' };
+
+    strcat (value_str, (value & (1 << 0)) ? "constant," : "data,");
+    strcat (value_str, (value & (1 << 1)) ? "variable," : "array,");
+    strcat (value_str, (value & (1 << 2)) ? "relative," : "absolute,");
+    strcat (value_str, (value & (1 << 3)) ? "wrap," : "no wrap,");
+    strcat (value_str, (value & (1 << 4)) ? "non linear," : "linear,");
+    strcat (value_str, (value & (1 << 5)) ? "no preferred," : "preferred state,");
+    strcat (value_str, (value & (1 << 6)) ? "null state," : "no null position,");
+    if (volatile_flag)
+        strcat (value_str, (value & (1 << 7)) ? "volatile," : "non volatile,");
+    strcat (value_str, (value & (1 << 8)) ? "buffered bytes" : "bitfield");
+    mccr_log ("%*s%s (0x%x: %s)", ctx->log_indent, "", name, value, value_str);
 }
 
 static void
-process_input_output_feature (parse_context_t *ctx,
-                              uint8_t          tag,
-                              uint32_t         value)
+append_report_usages (parse_context_t *ctx,
+                      const char      *report_name,
+                      usage_t         *usages,
+                      report_layout_t *report,
+                      size_t          *n_usages,
+                      uint32_t        *offset_bits)
 {
-    report_t *target = NULL;
+    uint32_t size_bits, size_bits_single;
+    size_t   i;
 
-    if (mccr_log_is_enabled ()) {
-        char value_str[255] = { '\0' };
-
-        strcat (value_str, (value & (1 << 0)) ? "constant," : "data,");
-        strcat (value_str, (value & (1 << 1)) ? "variable," : "array,");
-        strcat (value_str, (value & (1 << 2)) ? "relative," : "absolute,");
-        strcat (value_str, (value & (1 << 3)) ? "wrap," : "no wrap,");
-        strcat (value_str, (value & (1 << 4)) ? "non linear," : "linear,");
-        strcat (value_str, (value & (1 << 5)) ? "no preferred," : "preferred state,");
-        strcat (value_str, (value & (1 << 6)) ? "null state," : "no null position,");
-        if (tag != 0b1000)
-            strcat (value_str, (value & (1 << 7)) ? "volatile," : "non volatile,");
-        strcat (value_str, (value & (1 << 8)) ? "buffered bytes" : "bitfield");
-        mccr_log ("%*s%s (0x%x: %s)", ctx->log_indent, "", main_tag_str[tag], value, value_str);
+    size_bits = ctx->report_count * ctx->report_size;
+
+    /* Fields without usages are just padding */
+    if (!ctx->n_wip_usages) {
+        *offset_bits += size_bits;
+        return;
     }
 
-    switch (tag) {
-    case 0b1000:
-        target = &(ctx->desc_ctx->input);
-        break;
-    case 0b1011:
-        target = &(ctx->desc_ctx->feature);
-        break;
-    default:
-        break;
+    if (!size_bits) {
+        mccr_log ("error: couldn't compute usage field size in bits");
+        ctx->fatal_error = true;
+        return;
     }
 
-    /* Copy to report */
-    if (target)
-        append_to_usage_array (&(target->usages), &(target->usages_size), &(target->usages_allocated),
-                               ctx->wip_usages, ctx->wip_usages_size);
+    /* If we have a single usage defined, the report count defines the
+     * length of the field. If we have more than one usage defined, the
+     * report count defines the length of all the fields together, we
+     * assume evenly distributed. */
+    if (size_bits % ctx->n_wip_usages != 0) {
+        mccr_log ("error: size given by report count doesn't match previously defined usage count");
+        ctx->fatal_error = true;
+        return;
+    }
+    size_bits_single = size_bits / ctx->n_wip_usages;
 
-    /* And cleanup previous usages */
-    cleanup_usage_array (&ctx->wip_usages, &ctx->wip_usages_size, &ctx->wip_usages_allocated);
+    if ((*n_usages + ctx->n_wip_usages) > MAX_REPORT_USAGES) {
+        mccr_log ("error: too many usages defined in %s report", report_name);
+        ctx->fatal_error = true;
+        return;
+    }
+
+    for (i = 0; i < ctx->n_wip_usages; i++) {
+        if (usages) {
+            usage_t *usage;
+
+            usage = &usages[*n_usages];
+            usage->id          = ctx->wip_usages[i];
+            usage->size_bits   = size_bits_single;
+            usage->offset_bits = *offset_bits;
+
+            /* Only the first instance of a given usage is looked up */
+            if (usage->id <= MAX_USAGE_ID && !report->index[usage->id])
+                report->index[usage->id] = *n_usages + 1;
+        }
+        (*n_usages)++;
+        *offset_bits += size_bits_single;
+    }
+}
+
+static void
+process_input (parse_context_t *ctx,
+               uint32_t         value)
+{
+    if (ctx->log_enabled)
+        log_data_item (ctx, "Input", value, false);
+
+    append_report_usages (ctx, "input",
+                          ctx->input_usages, ctx->layout ? &ctx->layout->input : NULL,
+                          &ctx->n_input_usages, &ctx->input_offset_bits);
+    ctx->n_wip_usages = 0;
+}
+
+static void
+process_output (parse_context_t *ctx,
+                uint32_t         value)
+{
+    if (ctx->log_enabled)
+        log_data_item (ctx, "Output", value, true);
+
+    /* Output reports are not used */
+    ctx->n_wip_usages = 0;
+}
+
+static void
+process_feature (parse_context_t *ctx,
+                 uint32_t         value)
+{
+    if (ctx->log_enabled)
+        log_data_item (ctx, "Feature", value, true);
+
+    append_report_usages (ctx, "feature",
+                          ctx->feature_usages, ctx->layout ? &ctx->layout->feature : NULL,
+                          &ctx->n_feature_usages, &ctx->feature_offset_bits);
+    ctx->n_wip_usages = 0;
 }
 
 static void
 process_collection (parse_context_t *ctx,
                     uint32_t         value)
 {
-    if (mccr_log_is_enabled ()) {
-        char value_str[64] = { '\0' };
+    if (ctx->log_enabled) {
+        const char *value_str;
 
         if (value < (sizeof (main_collection_str) / sizeof (main_collection_str[0])))
-            strcat (value_str, main_collection_str[value]);
+            value_str = main_collection_str[value];
         else if (value <= 0x7F)
-            strcat (value_str, "reserved");
+            value_str = "reserved";
         else if (value <= 0xFF)
-            strcat (value_str, "vendor-defined");
+            value_str = "vendor-defined";
         else
-            strcat (value_str, "invalid");
-        mccr_log ("%*s%s (0x%x: %s)", ctx->log_indent, "", main_tag_str[0b1010], value, value_str);
+            value_str = "invalid";
+        mccr_log ("%*sCollection (0x%x: %s)", ctx->log_indent, "", value, value_str);
         /* increase indent */
         ctx->log_indent += 2;
     }
 
-    if (!ctx->wip_usages_size) {
+    if (!ctx->n_wip_usages) {
         mccr_log ("error: collection defined with no associated usage");
         ctx->fatal_error = true;
         return;
     }
-    if (ctx->wip_usages_size != 1) {
+    if (ctx->n_wip_usages != 1) {
         mccr_log ("error: collection defined associated to multiple usages");
         ctx->fatal_error = true;
         return;
     }
 
     /* We expect a single collection, part of the default usage */
-    if (ctx->wip_usages->id != MCCR_USAGE) {
+    if (ctx->wip_usages[0] != MCCR_USAGE) {
         mccr_log ("error: collection not defined on the default mccr usage");
         ctx->fatal_error = true;
         return;
@@ -428,18 +569,19 @@ process_collection (parse_context_t *ctx,
     ctx->collection = value;
 
     /* And cleanup previous usages */
-    cleanup_usage_array (&ctx->wip_usages, &ctx->wip_usages_size, &ctx->wip_usages_allocated);
+    ctx->n_wip_usages = 0;
 }
 
 static void
-process_collection_end (parse_context_t *ctx)
+process_collection_end (parse_context_t *ctx,
+                        uint32_t         value)
 {
-    if (mccr_log_is_enabled ()) {
+    if (ctx->log_enabled) {
         ctx->log_indent = (ctx->log_indent >= 2 ? (ctx->log_indent - 2) : 0);
-        mccr_log ("%*s%s", ctx->log_indent, "", main_tag_str[0b1100]);
+        mccr_log ("%*sEnd Collection", ctx->log_indent, "");
     }
 
-    if (ctx->wip_usages_size) {
+    if (ctx->n_wip_usages) {
         mccr_log ("error: usages defined out of input/output/report inside the collection");
         ctx->fatal_error = true;
     }
@@ -448,77 +590,11 @@ process_collection_end (parse_context_t *ctx)
     ctx->collection = 0;
 }
 
-static void
-parse_item_main (parse_context_t *ctx,
-                 uint8_t          tag,
-                 uint32_t         value)
-{
-    switch (tag) {
-    case 0b1000:
-    case 0b1001:
-    case 0b1011:
-        process_input_output_feature (ctx, tag, value);
-        break;
-    case 0b1010:
-        process_collection (ctx, value);
-        break;
-    case 0b1100:
-        process_collection_end (ctx);
-        break;
-    default:
-        mccr_log ("%*s%s (0x%x)",
-                  ctx->log_indent, "",
-                  (tag < (sizeof (main_tag_str) / sizeof (main_tag_str[0]))) ? main_tag_str[tag] : "Unknown main item",
-                  value);
-        /* Cleanup previous usages, if any (ignored) */
-        cleanup_usage_array (&ctx->wip_usages, &ctx->wip_usages_size, &ctx->wip_usages_allocated);
-        break;
-    }
-}
-
 static void
 process_report_count (parse_context_t *ctx,
                       uint32_t         value)
 {
-    uint32_t size_bits, size_bits_single, i;
-
-    size_bits = value * ctx->report_size;
-
-    /* Warn if no usages were defined */
-    if (!ctx->wip_usages_size) {
-        mccr_log ("warning: report count given but not previous usage defined");
-        return;
-    }
-
-    /* If we have a single usage defined previously, the report count
-     * defines the length of the field. */
-    if (ctx->wip_usages_size == 1) {
-        assert (ctx->wip_usages);
-        ctx->wip_usages->size_bits = size_bits;
-        if (!ctx->wip_usages->size_bits) {
-            mccr_log ("error: couldn't compute usage field size in bits");
-            ctx->fatal_error = true;
-        }
-        return;
-    }
-
-    /* If we have more than one usage defined previously, the report
-     * count defines the length of all the previous fields together, we
-     * assume evenly distributed. */
-    if (size_bits % ctx->wip_usages_size != 0) {
-        mccr_log ("error: size given by report count doesn't match previously defined usage count");
-        ctx->fatal_error = true;
-        return;
-    }
-
-    /* Apply the size to all previous usages */
-    size_bits_single = size_bits / ctx->wip_usages_size;
-    for (i = 0; i < ctx->wip_usages_size; i++) {
-        usage_t *usage;
-
-        usage = &ctx->wip_usages[i];
-        usage->size_bits = size_bits_single;
-    }
+    ctx->report_count = value;
 }
 
 static void
@@ -526,7 +602,7 @@ process_report_size (parse_context_t *ctx,
                      uint32_t         value)
 {
     ctx->report_size = value;
-    if (ctx->report_size != 8)
+    if (ctx->report_size != 8 && ctx->log_enabled)
         mccr_log ("warning: unexpected report size: %u", ctx->report_size);
 }
 
@@ -535,73 +611,68 @@ process_usage_page (parse_context_t *ctx,
                     uint32_t         value)
 {
     ctx->usage_page = value;
-    if (ctx->usage_page != 0xFF00) {
+    if (ctx->usage_page != MCCR_USAGE_PAGE) {
         /* our logic here doesn't expect any usage page other than the
          * mccr usage page, report an error if we get any as we'd
          * require to update the library to support it.
          */
-        mccr_log ("error: unsupported usage page reported: 0x%x");
+        mccr_log ("error: unsupported usage page reported: 0x%x", ctx->usage_page);
         ctx->fatal_error = true;
     }
 }
 
-static void
-parse_item_global (parse_context_t *ctx,
-                   uint8_t          tag,
-                   uint32_t         value)
-{
-    mccr_log ("%*s%s (0x%x: %u)",
-              ctx->log_indent, "",
-              (tag < (sizeof (global_tag_str) / sizeof (global_tag_str[0]))) ? global_tag_str[tag] : "reserved",
-              value, value);
-
-    /* Store the values we require.
-     * Note: we ignore report id because the mccr devices don't use it */
-    switch (tag) {
-    case 0b0000:
-        process_usage_page (ctx, value);
-        break;
-    case 0b0111:
-        process_report_size (ctx, value);
-        break;
-    case 0b1001:
-        process_report_count (ctx, value);
-        break;
-    }
-}
-
 static void
 process_usage (parse_context_t *ctx,
                uint32_t         value)
 {
-    usage_t item;
-
-    memset (&item, 0, sizeof (usage_t));
-    item.id = value;
-
-    append_to_usage_array (&ctx->wip_usages, &ctx->wip_usages_size, &ctx->wip_usages_allocated,
-                           &item, 1);
-    if (!ctx->wip_usages) {
-        mccr_log ("error: couldn't append usage to array");
-        ctx->fatal_error = 1;
+    if (ctx->n_wip_usages == MAX_WIP_USAGES) {
+        mccr_log ("error: too many usages defined");
+        ctx->fatal_error = true;
+        return;
     }
-}
 
-static void
-parse_item_local (parse_context_t *ctx,
-                  uint8_t          tag,
-                  uint32_t         value)
-{
-    mccr_log ("%*s%s (0x%x: %u)",
-              ctx->log_indent, "",
-              (tag < (sizeof (local_tag_str) / sizeof (local_tag_str[0]))) ? local_tag_str[tag] : "reserved",
-              value, value);
-
-    /* Usage */
-    if (tag == 0b0000)
-        process_usage (ctx, value);
+    ctx->wip_usages[ctx->n_wip_usages++] = value;
 }
 
+typedef struct {
+    const char *name;
+    void      (*process) (parse_context_t *ctx,
+                          uint32_t         value);
+} item_t;
+
+/* Note: we ignore report id because the mccr devices don't use it */
+static const item_t short_items[] = {
+    [ITEM_INPUT]                                  = { "Input",              process_input          },
+    [ITEM_OUTPUT]                                 = { "Output",             process_output         },
+    [ITEM_COLLECTION]                             = { "Collection",         process_collection     },
+    [ITEM_FEATURE]                                = { "Feature",            process_feature        },
+    [ITEM_END_COLLECTION]                         = { "End Collection",     process_collection_end },
+    [ITEM_USAGE_PAGE]                             = { "Usage page",         process_usage_page     },
+    [ITEM (ITEM_TYPE_GLOBAL, 0b0001)]             = { "Logical minimum",    NULL                   },
+    [ITEM (ITEM_TYPE_GLOBAL, 0b0010)]             = { "Logical maximum",    NULL                   },
+    [ITEM (ITEM_TYPE_GLOBAL, 0b0011)]             = { "Physical minimum",   NULL                   },
+    [ITEM (ITEM_TYPE_GLOBAL, 0b0100)]             = { "Physical maximum",   NULL                   },
+    [ITEM (ITEM_TYPE_GLOBAL, 0b0101)]             = { "Unit exponent",      NULL                   },
+    [ITEM (ITEM_TYPE_GLOBAL, 0b0110)]             = { "Unit",               NULL                   },
+    [ITEM_REPORT_SIZE]                            = { "Report size",        process_report_size    },
+    [ITEM (ITEM_TYPE_GLOBAL, 0b1000)]             = { "Report ID",          NULL                   },
+    [ITEM_REPORT_COUNT]                           = { "Report count",       process_report_count   },
+    [ITEM (ITEM_TYPE_GLOBAL, 0b1010)]             = { "Push",               NULL                   },
+    [ITEM (ITEM_TYPE_GLOBAL, 0b1011)]             = { "Pop",                NULL                   },
+    [ITEM_USAGE]                                  = { "Usage",              process_usage          },
+    [ITEM (ITEM_TYPE_LOCAL, 0b0001)]              = { "Usage minimum",      NULL                   },
+    [ITEM (ITEM_TYPE_LOCAL, 0b0010)]              = { "Usage maximum",      NULL                   },
+    [ITEM (ITEM_TYPE_LOCAL, 0b0011)]              = { "Designator index",   NULL                   },
+    [ITEM (ITEM_TYPE_LOCAL, 0b0100)]              = { "Designator minimum", NULL                   },
+    [ITEM (ITEM_TYPE_LOCAL, 0b0101)]              = { "Designator maximum", NULL                   },
+    [ITEM (ITEM_TYPE_LOCAL, 0b0111)]              = { "String index",       NULL                   },
+    [ITEM (ITEM_TYPE_LOCAL, 0b1000)]              = { "String minimum",     NULL                   },
+    [ITEM (ITEM_TYPE_LOCAL, 0b1001)]              = { "String maximum",     NULL                   },
+    [ITEM (ITEM_TYPE_LOCAL, 0b1010)]              = { "Delimiter",          NULL                   },
+    /* Make sure every possible prefix has an entry */
+    [ITEM (ITEM_TYPE_RESERVED, 0b1111)]           = { NULL,                 NULL                   },
+};
+
 static void
 parse_report_descriptor (parse_context_t *ctx,
                          const uint8_t   *desc,
@@ -609,107 +680,95 @@ parse_report_descriptor (parse_context_t *ctx,
 {
     size_t i = 0;
 
-    mccr_log ("---------------------------------");
-
     while (i < desc_size && !ctx->fatal_error) {
-        uint8_t  prefix, data_size, type, tag;
-        uint32_t value = 0;
+        uint8_t       prefix, data_size, type;
+        uint32_t      value = 0;
+        const item_t *item;
 
         prefix = desc[i];
 
-        /* Long item */
+        /* Long item: prefix, data size, long item tag and data; ignored */
         if (prefix == 0b11111110) {
             if (i + 1 >= desc_size) {
-                mccr_log ("warning: invalid long item in report descriptor");
+                if (ctx->log_enabled)
+                    mccr_log ("warning: invalid long item in report descriptor");
                 break;
             }
             data_size = desc[i + 1];
-            mccr_log ("long item size '%u'", data_size);
-            goto next_item;
+            if (ctx->log_enabled)
+                mccr_log ("long item size '%u'", data_size);
+            i += (data_size + 3);
+            continue;
         }
 
         /* Short item */
-        type = (prefix & 0b00001100) >> 2;
-        tag  = (prefix & 0b11110000) >> 4;
         data_size = prefix & 0b11;
         if (data_size == 0b11)
             data_size = 4;
 
         if (i + data_size >= desc_size) {
-            mccr_log ("short item type '%s', tag '0x%02x', size '%u': <invalid data>",
-                      type_str[type],
-                      tag,
-                      data_size);
-            goto next_item;
+            if (ctx->log_enabled)
+                mccr_log ("warning: invalid short item data in report descriptor");
+            break;
         }
 
         memcpy (&value, &desc[i + 1], data_size);
         value = le32toh (value);
 
-        switch (type) {
-        case 0b00:
-            parse_item_main (ctx, tag, value);
-            break;
-        case 0b01:
-            parse_item_global (ctx, tag, value);
-            break;
-        case 0b10:
-            parse_item_local (ctx, tag, value);
-            break;
-        case 0b11:
-            mccr_log ("short item type '%s', tag '0x%02x', size '%u': 0x%x",
-                      type_str[type], tag, data_size, value);
-            break;
-        }
+        item = &short_items[prefix >> 2];
+        type = (prefix & 0b00001100) >> 2;
+
+        /* Main items log themselves */
+        if (ctx->log_enabled && (type != ITEM_TYPE_MAIN || !item->process))
+            mccr_log ("%*s%s (0x%x: %u)",
+                      ctx->log_indent, "",
+                      item->name ? item->name : "Reserved",
+                      value, value);
+
+        if (item->process)
+            item->process (ctx, value);
+        else if (type == ITEM_TYPE_MAIN)
+            /* Cleanup previous usages, if any (ignored) */
+            ctx->n_wip_usages = 0;
 
-    next_item:
         i += (data_size + 1);
     };
-
-    mccr_log ("---------------------------------");
 }
 
-static void
-process_report (parse_context_t *ctx,
-                const char      *report_name,
-                const char      *(id_to_string) (uint8_t usage_id),
-                report_t        *report)
+static bool
+check_report (const char *report_name,
+              size_t      n_usages,
+              uint32_t    offset_bits)
 {
-    uint32_t offset_bits = 0;
-    size_t i;
-
-    if (ctx->fatal_error)
-        return;
-
-    mccr_log ("processing %s report:", report_name);
-
-    if (report->usages_size == 0) {
+    if (!n_usages) {
         mccr_log ("error: no usages defined in %s report", report_name);
-        ctx->fatal_error = true;
-        return;
+        return false;
     }
 
-    for (i = 0; i < report->usages_size; i++) {
-        usage_t *usage;
+    if (offset_bits % 8) {
+        mccr_log ("error: %s report size not multiple of bytes", report_name);
+        return false;
+    }
 
-        usage = (usage_t *)&(report->usages[i]);
-        usage->offset_bits = offset_bits;
+    return true;
+}
 
-        mccr_log ("  usage 0x%02x (%s) available in %s report: offset %u bytes (+%u bits), size %u bytes (+%u bits)",
-                  usage->id, id_to_string (usage->id), report_name,
-                  usage->offset_bits / 8, usage->offset_bits % 8,
-                  usage->size_bits / 8, usage->size_bits % 8);
+static void
+log_report (const char             *report_name,
+            const char            *(id_to_string) (uint8_t usage_id),
+            const report_layout_t  *report,
+            const usage_t          *usages)
+{
+    size_t i;
 
-        offset_bits += usage->size_bits;
-    }
+    mccr_log ("processing %s report:", report_name);
 
-    if (offset_bits % 8) {
-        mccr_log ("error: %s report size not multiple of bytes", report_name);
-        ctx->fatal_error = true;
-        return;
-    }
+    for (i = 0; i < report->n_usages; i++)
+        mccr_log ("  usage 0x%02x (%s) available in %s report: offset %u bytes (+%u bits), size %u bytes (+%u bits)",
+                  usages[i].id, id_to_string (usages[i].id), report_name,
+                  usages[i].offset_bits / 8, usages[i].offset_bits % 8,
+                  usages[i].size_bits / 8, usages[i].size_bits % 8);
 
-    report->size = offset_bits / 8;
     mccr_log ("  total %s report size: %u bytes", report_name, report->size);
 }
 
@@ -718,27 +777,52 @@ mccr_parse_report_descriptor (const uint8_t                     *desc,
                               size_t                             desc_size,
                               mccr_report_descriptor_context_t **out_ctx)
 {
-    parse_context_t ctx;
+    parse_context_t                   ctx;
+    mccr_report_descriptor_context_t *desc_ctx;
+    layout_t                         *layout;
+    size_t                            layout_size;
 
-    /* Prepare context */
+    /* First pass: validate and count usages */
     memset (&ctx, 0, sizeof (ctx));
-    ctx.desc_ctx = calloc (sizeof (mccr_report_descriptor_context_t), 1);
-    ctx.desc_ctx->refcount = 1;
+    ctx.log_enabled = mccr_log_is_enabled ();
 
-    /* Parse descriptor */
+    mccr_log ("---------------------------------");
     parse_report_descriptor (&ctx, desc, desc_size);
+    mccr_log ("---------------------------------");
 
-    /* Process reports */
-    process_report (&ctx, "input",   input_usage_id_to_string,   &(ctx.desc_ctx->input));
-    process_report (&ctx, "feature", feature_usage_id_to_string, &(ctx.desc_ctx->feature));
+    if (ctx.fatal_error ||
+        !check_report ("input",   ctx.n_input_usages,   ctx.input_offset_bits) ||
+        !check_report ("feature", ctx.n_feature_usages, ctx.feature_offset_bits))
+        return MCCR_STATUS_FAILED;
 
-    if (ctx.fatal_error) {
-        parse_context_clear (&ctx);
+    layout_size = layout_compute_size (ctx.n_input_usages, ctx.n_feature_usages);
+    desc_ctx = report_descriptor_context_new (layout_size, &layout);
+    if (!desc_ctx)
         return MCCR_STATUS_FAILED;
+
+    layout->magic            = LAYOUT_MAGIC;
+    layout->version          = LAYOUT_VERSION;
+    layout->size             = layout_size;
+    layout->input.n_usages   = ctx.n_input_usages;
+    layout->input.size       = ctx.input_offset_bits / 8;
+    layout->feature.n_usages = ctx.n_feature_usages;
+    layout->feature.size     = ctx.feature_offset_bits / 8;
+
+    /* Second pass: fill in usages, no logging */
+    memset (&ctx, 0, sizeof (ctx));
+    ctx.layout         = layout;
+    ctx.input_usages   = layout->usages;
+    ctx.feature_usages = &layout->usages[layout->input.n_usages];
+    parse_report_descriptor (&ctx, desc, desc_size);
+    assert (!ctx.fatal_error);
+    assert (ctx.n_input_usages == layout->input.n_usages);
+    assert (ctx.n_feature_usages == layout->feature.n_usages);
+
+    if (mccr_log_is_enabled ()) {
+        log_report ("input",   input_usage_id_to_string,   &layout->input,   ctx.input_usages);
+        log_report ("feature", feature_usage_id_to_string, &layout->feature, ctx.feature_usages);
     }
 
-    /* On success, return the descriptor context */
-    *out_ctx = mccr_report_descriptor_context_ref (ctx.desc_ctx);
-    parse_context_clear (&ctx);
+    *out_ctx = desc_ctx;
     return MCCR_STATUS_OK;
 }
@@ -90,4 +90,14 @@ mccr_status_t mccr_parse_report_descriptor (const uint8_t                     *d
                                             size_t                             desc_size,
                                             mccr_report_descriptor_context_t **out_ctx);
 
+/* The layout is a self-contained blob with the parsed input and feature
+ * reports, which may be stored (e.g. in a descriptor cache) and loaded back
+ * later on in a process running the same library version and architecture. */
+void          mccr_report_descriptor_context_get_layout      (mccr_report_descriptor_context_t  *ctx,
+                                                              const uint8_t                    **out_layout,
+                                                              size_t                            *out_layout_size);
+mccr_status_t mccr_report_descriptor_context_new_from_layout (const uint8_t                     *layout,
+                                                              size_t                             layout_size,
+                                                              mccr_report_descriptor_context_t **out_ctx);
+
 #endif /* MCCR_HID_H */
@@ -26,12 +26,14 @@
 #include <malloc.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #include <hidapi.h>
 
 #include "mccr.h"
 #include "mccr-hid.h"
 #include "mccr-log.h"
+#include "mccr-shm-ring.h"
 #include "mccr-input-report.h"
 
 #define DEFAULT_IN_PROGRESS_TIMEOUT_MS 500
@@ -39,8 +41,22 @@
 struct mccr_input_report_s {
     uint8_t *report_data;
     size_t   report_size;
+    /* Timing of the fragments received */
+    unsigned int n_fragments;
+    uint64_t     first_fragment_us;
+    uint64_t     last_fragment_us;
+    uint64_t     max_gap_us;
 };
 
+static uint64_t
+monotonic_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
 mccr_input_report_t *
 mccr_input_report_new (mccr_report_descriptor_context_t *desc)
 {
@@ -74,12 +90,16 @@ mccr_input_report_receive (mccr_input_report_t *report,
                            hid_device          *hid,
                            int                  timeout_ms)
 {
-    int    n_read;
-    size_t total_read = 0;
+    int      n_read;
+    size_t   total_read = 0;
+    uint64_t now;
 
     if (!hid)
         return MCCR_STATUS_NOT_OPEN;
 
+    report->n_fragments = 0;
+    report->max_gap_us  = 0;
+
     mccr_log ("waiting for input report (%u bytes): timeout %d ms", report->report_size, timeout_ms);
 
     do {
@@ -95,6 +115,13 @@ mccr_input_report_receive (mccr_input_report_t *report,
         if (!n_read)
             break;
 
+        now = monotonic_us ();
+        if (!report->n_fragments++)
+            report->first_fragment_us = now;
+        else if (now - report->last_fragment_us > report->max_gap_us)
+            report->max_gap_us = now - report->last_fragment_us;
+        report->last_fragment_us = now;
+
         total_read += n_read;
         mccr_log ("read %u bytes... (total %u)", n_read, total_read);
     } while (total_read != report->report_size);
@@ -112,6 +139,58 @@ mccr_input_report_receive (mccr_input_report_t *report,
     return MCCR_STATUS_OK;
 }
 
+/* Reports read from a ring were not received through HID reads here, so
+ * they only keep the time at which they were received by the producer */
+mccr_status_t
+mccr_input_report_receive_from_ring (mccr_input_report_t *report,
+                                     mccr_shm_ring_t     *ring,
+                                     int                  timeout_ms,
+                                     unsigned int        *n_dropped)
+{
+    mccr_status_t st;
+    uint64_t      timestamp_us = 0;
+
+    if (mccr_shm_ring_get_record_size (ring) != report->report_size)
+        return MCCR_STATUS_INVALID_INPUT;
+
+    st = mccr_shm_ring_read (ring, timeout_ms, report->report_data, &timestamp_us, n_dropped);
+    if (st != MCCR_STATUS_OK)
+        return st;
+
+    report->n_fragments       = 0;
+    report->max_gap_us        = 0;
+    report->first_fragment_us = timestamp_us;
+    report->last_fragment_us  = timestamp_us;
+    return MCCR_STATUS_OK;
+}
+
+mccr_status_t
+mccr_input_report_publish (mccr_input_report_t *report,
+                           mccr_shm_ring_t     *ring)
+{
+    if (mccr_shm_ring_get_record_size (ring) != report->report_size)
+        return MCCR_STATUS_INVALID_INPUT;
+
+    return mccr_shm_ring_publish (ring, report->report_data, report->report_size, report->last_fragment_us);
+}
+
+/* Reports recorded elsewhere (e.g. in a file) carry no timing information */
+mccr_status_t
+mccr_input_report_set_data (mccr_input_report_t *report,
+                            const uint8_t       *data,
+                            size_t               data_size)
+{
+    if (data_size != report->report_size)
+        return MCCR_STATUS_INVALID_INPUT;
+
+    memcpy (report->report_data, data, data_size);
+    report->n_fragments       = 0;
+    report->max_gap_us        = 0;
+    report->first_fragment_us = 0;
+    report->last_fragment_us  = 0;
+    return MCCR_STATUS_OK;
+}
+
 void
 mccr_input_report_get_data (mccr_input_report_t  *report,
                             const uint8_t       **data,
@@ -120,3 +199,20 @@ mccr_input_report_get_data (mccr_input_report_t  *report,
     *data      = report->report_data;
     *data_size = report->report_size;
 }
+
+void
+mccr_input_report_get_timing (mccr_input_report_t *report,
+                              unsigned int        *n_fragments,
+                              uint64_t            *total_us,
+                              uint64_t            *max_gap_us)
+{
+    *n_fragments = report->n_fragments;
+    *total_us    = report->n_fragments ? (report->last_fragment_us - report->first_fragment_us) : 0;
+    *max_gap_us  = report->max_gap_us;
+}
+
+uint64_t
+mccr_input_report_get_timestamp (mccr_input_report_t *report)
+{
+    return report->last_fragment_us;
+}
@@ -28,16 +28,31 @@
 
 #include "mccr.h"
 #include "mccr-hid.h"
+#include "mccr-shm-ring.h"
 
 typedef struct mccr_input_report_s mccr_input_report_t;
 
-mccr_input_report_t *mccr_input_report_new      (mccr_report_descriptor_context_t  *desc);
-void                 mccr_input_report_free     (mccr_input_report_t               *report);
-mccr_status_t        mccr_input_report_receive  (mccr_input_report_t               *report,
-                                                 hid_device                        *hid,
-                                                 int                                timeout_ms);
-void                 mccr_input_report_get_data (mccr_input_report_t               *report,
-                                                 const uint8_t                    **data,
-                                                 size_t                            *data_size);
+mccr_input_report_t *mccr_input_report_new               (mccr_report_descriptor_context_t *desc);
+void                 mccr_input_report_free              (mccr_input_report_t              *report);
+mccr_status_t        mccr_input_report_receive           (mccr_input_report_t              *report,
+                                                          hid_device                       *hid,
+                                                          int                               timeout_ms);
+mccr_status_t        mccr_input_report_receive_from_ring (mccr_input_report_t              *report,
+                                                          mccr_shm_ring_t                  *ring,
+                                                          int                               timeout_ms,
+                                                          unsigned int                     *n_dropped);
+mccr_status_t        mccr_input_report_publish           (mccr_input_report_t              *report,
+                                                          mccr_shm_ring_t                  *ring);
+mccr_status_t        mccr_input_report_set_data          (mccr_input_report_t              *report,
+                                                          const uint8_t                    *data,
+                                                          size_t                            data_size);
+void                 mccr_input_report_get_data          (mccr_input_report_t              *report,
+                                                          const uint8_t                   **data,
+                                                          size_t                           *data_size);
+void                 mccr_input_report_get_timing        (mccr_input_report_t              *report,
+                                                          unsigned int                     *n_fragments,
+                                                          uint64_t                         *total_us,
+                                                          uint64_t                         *max_gap_us);
+uint64_t             mccr_input_report_get_timestamp     (mccr_input_report_t              *report);
 
 #endif /* MCCR_INPUT_REPORT_H */
@@ -88,3 +88,51 @@ out:
 
     return st;
 }
+
+mccr_status_t
+mccr_read_report_descriptor_size (const char *path,
+                                  size_t     *out_desc_size)
+{
+    int           fd, desc_size;
+    mccr_status_t st;
+
+    fd = open (path, O_RDWR|O_NONBLOCK);
+    if (fd < 0) {
+        mccr_log ("error: couldn't open raw device: %s", strerror (errno));
+        return MCCR_STATUS_FAILED;
+    }
+
+    if (ioctl (fd, HIDIOCGRDESCSIZE, &desc_size) < 0) {
+        mccr_log ("error: couldn't read report descriptor size: %s", strerror (errno));
+        st = MCCR_STATUS_FAILED;
+    } else {
+        *out_desc_size = (size_t) desc_size;
+        st = MCCR_STATUS_OK;
+    }
+
+    close (fd);
+    return st;
+}
+
+/******************************************************************************/
+
+int
+mccr_input_monitor_open (const char *path)
+{
+    int fd;
+
+    fd = open (path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        mccr_log ("error: couldn't open raw device input monitor: %s", strerror (errno));
+    return fd;
+}
+
+void
+mccr_input_monitor_drain (int fd)
+{
+    uint8_t buffer[64];
+
+    /* Each read() consumes a whole report, even if truncated to the buffer
+     * size; the contents are not needed */
+    while (read (fd, buffer, sizeof (buffer)) > 0);
+}
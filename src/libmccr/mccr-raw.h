@@ -27,8 +27,21 @@
 /******************************************************************************/
 /* Report descriptor (raw) */
 
-mccr_status_t mccr_read_report_descriptor (const char  *path,
-                                           uint8_t    **out_desc,
-                                           size_t      *out_desc_size);
+mccr_status_t mccr_read_report_descriptor      (const char  *path,
+                                                uint8_t    **out_desc,
+                                                size_t      *out_desc_size);
+mccr_status_t mccr_read_report_descriptor_size (const char  *path,
+                                                size_t      *out_desc_size);
+
+/******************************************************************************/
+/* Input monitor (raw)
+ *
+ * A descriptor of its own on the hidraw node, which gets a copy of every input
+ * report the device sends, so that it can be polled for readability without
+ * touching the one used to read them.
+ */
+
+int  mccr_input_monitor_open  (const char *path);
+void mccr_input_monitor_drain (int         fd);
 
 #endif /* MCCR_RAW_H */
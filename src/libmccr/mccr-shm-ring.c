@@ -0,0 +1,455 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr - Support library for MagTek Credit Card Readers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <config.h>
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "mccr.h"
+#include "mccr-log.h"
+#include "mccr-shm-ring.h"
+
+#define RING_MAGIC      0x5252434d /* 'MCRR' */
+#define RING_VERSION    1
+#define CACHE_LINE_SIZE 64
+
+#define MAX_SLOTS       (1 << 16)
+#define MAX_RECORD_SIZE (1 << 16)
+#define MAX_BLOB_SIZE   (1 << 20)
+
+#define ALIGN(x, a) (((x) + ((a) - 1)) & ~((size_t) (a) - 1))
+
+/******************************************************************************/
+/* Shared memory layout
+ *
+ *   [header] [blob] [slot 0] [slot 1] ... [slot n-1]
+ *
+ * Everything but the head counter and the slots is written once by the
+ * producer, before the memfd is sealed and given to consumers.
+ */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_slots;
+    uint32_t slot_size;
+    uint32_t record_size;
+    uint32_t blob_offset;
+    uint32_t blob_size;
+    uint32_t slots_offset;
+    uint8_t  reserved[CACHE_LINE_SIZE - (8 * sizeof (uint32_t))];
+    /* Number of records published (wrapping), also used as futex word to
+     * wake up consumers; in its own cache line */
+    uint32_t head;
+    uint8_t  reserved2[CACHE_LINE_SIZE - sizeof (uint32_t)];
+} ring_header_t;
+
+/* Each slot is a seqlock: the sequence number (plus one) of the record is
+ * written in seq_begin before updating the contents, and in seq_end after,
+ * so a reader copying the contents in between the two sees them differ */
+typedef struct {
+    uint32_t seq_begin;
+    uint32_t seq_end;
+    uint64_t timestamp_us;
+    uint8_t  record[];
+} ring_slot_t;
+
+struct mccr_shm_ring_s {
+    int             fd;
+    uint8_t        *map;
+    size_t          map_size;
+    ring_header_t  *header;
+    /* Validated copy of the header, which is what is used afterwards */
+    ring_header_t   info;
+    /* Producer */
+    bool            producer;
+    pthread_mutex_t lock;
+    /* Consumer */
+    uint32_t        cursor;
+};
+
+static inline ring_slot_t *
+ring_slot (mccr_shm_ring_t *ring,
+           uint32_t         seq)
+{
+    return (ring_slot_t *) (ring->map +
+                            ring->info.slots_offset +
+                            ((size_t) (seq & (ring->info.n_slots - 1)) * ring->info.slot_size));
+}
+
+static inline uint32_t
+ring_load (const uint32_t *value)
+{
+    uint32_t ret;
+
+    ret = *(const volatile uint32_t *) value;
+    __sync_synchronize ();
+    return ret;
+}
+
+static inline void
+ring_store (uint32_t *value,
+            uint32_t  new_value)
+{
+    __sync_synchronize ();
+    *(volatile uint32_t *) value = new_value;
+}
+
+/******************************************************************************/
+/* Producer */
+
+mccr_status_t
+mccr_shm_ring_new (unsigned int      n_slots,
+                   size_t            record_size,
+                   const uint8_t    *blob,
+                   size_t            blob_size,
+                   mccr_shm_ring_t **out_ring)
+{
+    mccr_shm_ring_t *ring;
+    size_t           slot_size;
+    size_t           slots_offset;
+    unsigned int     n;
+
+    if (!n_slots || n_slots > MAX_SLOTS || !record_size || record_size > MAX_RECORD_SIZE || blob_size > MAX_BLOB_SIZE)
+        return MCCR_STATUS_INVALID_INPUT;
+
+    /* Power of two number of slots, so that the slot index is just a mask
+     * of the sequence number, even when it wraps */
+    for (n = 1; n < n_slots; n <<= 1);
+
+    slot_size    = ALIGN (sizeof (ring_slot_t) + record_size, CACHE_LINE_SIZE);
+    slots_offset = ALIGN (sizeof (ring_header_t) + blob_size, CACHE_LINE_SIZE);
+
+    ring = calloc (sizeof (mccr_shm_ring_t), 1);
+    if (!ring)
+        return MCCR_STATUS_FAILED;
+    ring->producer = true;
+    ring->map_size = slots_offset + (n * slot_size);
+    pthread_mutex_init (&ring->lock, NULL);
+
+    ring->fd = memfd_create ("mccr-swipe-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring->fd < 0) {
+        mccr_log ("error: couldn't create shared memory ring: %s", strerror (errno));
+        mccr_shm_ring_free (ring);
+        return MCCR_STATUS_FAILED;
+    }
+
+    if (ftruncate (ring->fd, ring->map_size) < 0 ||
+        (ring->map = mmap (NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0)) == MAP_FAILED) {
+        mccr_log ("error: couldn't map shared memory ring: %s", strerror (errno));
+        ring->map = NULL;
+        mccr_shm_ring_free (ring);
+        return MCCR_STATUS_FAILED;
+    }
+
+    ring->info.magic        = RING_MAGIC;
+    ring->info.version      = RING_VERSION;
+    ring->info.n_slots      = n;
+    ring->info.slot_size    = slot_size;
+    ring->info.record_size  = record_size;
+    ring->info.blob_offset  = sizeof (ring_header_t);
+    ring->info.blob_size    = blob_size;
+    ring->info.slots_offset = slots_offset;
+
+    ring->header = (ring_header_t *) ring->map;
+    memcpy (ring->header, &ring->info, sizeof (ring_header_t));
+    if (blob_size)
+        memcpy (ring->map + ring->info.blob_offset, blob, blob_size);
+
+    /* Consumers map the ring as is, it must never be resized */
+    if (fcntl (ring->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+        mccr_log ("error: couldn't seal shared memory ring: %s", strerror (errno));
+        mccr_shm_ring_free (ring);
+        return MCCR_STATUS_FAILED;
+    }
+#if defined F_SEAL_FUTURE_WRITE
+    /* Only the producer mapping may write, if the kernel supports it */
+    if (fcntl (ring->fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE) < 0)
+        mccr_log ("couldn't seal shared memory ring against writes: %s", strerror (errno));
+#endif
+    fcntl (ring->fd, F_ADD_SEALS, F_SEAL_SEAL);
+
+    mccr_log ("shared memory ring created: %u slots of %u bytes", n, (unsigned int) slot_size);
+
+    *out_ring = ring;
+    return MCCR_STATUS_OK;
+}
+
+mccr_status_t
+mccr_shm_ring_publish (mccr_shm_ring_t *ring,
+                       const uint8_t   *record,
+                       size_t           record_size,
+                       uint64_t         timestamp_us)
+{
+    ring_slot_t *slot;
+    uint32_t     seq;
+
+    if (!ring->producer)
+        return MCCR_STATUS_INVALID_OPERATION;
+    if (record_size > ring->info.record_size)
+        return MCCR_STATUS_INVALID_INPUT;
+
+    pthread_mutex_lock (&ring->lock);
+
+    seq  = ring->header->head;
+    slot = ring_slot (ring, seq);
+
+    ring_store (&slot->seq_begin, seq + 1);
+    __sync_synchronize ();
+    memcpy (slot->record, record, record_size);
+    memset (&slot->record[record_size], 0, ring->info.record_size - record_size);
+    slot->timestamp_us = timestamp_us;
+    ring_store (&slot->seq_end, seq + 1);
+    ring_store (&ring->header->head, seq + 1);
+
+    pthread_mutex_unlock (&ring->lock);
+
+    /* Consumers may sleep on the head, and there is no way to know as they
+     * can't write to the ring */
+    syscall (SYS_futex, &ring->header->head, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    return MCCR_STATUS_OK;
+}
+
+/******************************************************************************/
+/* Consumer */
+
+static bool
+ring_header_validate (const ring_header_t *header,
+                      size_t               map_size)
+{
+    if (header->magic != RING_MAGIC) {
+        mccr_log ("error: invalid shared memory ring: unexpected magic");
+        return false;
+    }
+
+    if (header->version != RING_VERSION) {
+        mccr_log ("error: invalid shared memory ring: unsupported version %u", header->version);
+        return false;
+    }
+
+    if (!header->n_slots || header->n_slots > MAX_SLOTS || (header->n_slots & (header->n_slots - 1)) ||
+        !header->record_size || header->record_size > MAX_RECORD_SIZE ||
+        header->slot_size < sizeof (ring_slot_t) + header->record_size ||
+        header->blob_offset < sizeof (ring_header_t) || header->blob_size > MAX_BLOB_SIZE ||
+        (size_t) header->blob_offset + header->blob_size > header->slots_offset ||
+        header->slots_offset % CACHE_LINE_SIZE || header->slot_size % CACHE_LINE_SIZE ||
+        (size_t) header->slots_offset + ((size_t) header->n_slots * header->slot_size) > map_size) {
+        mccr_log ("error: invalid shared memory ring: inconsistent layout");
+        return false;
+    }
+
+    return true;
+}
+
+mccr_status_t
+mccr_shm_ring_new_from_fd (int               fd,
+                           mccr_shm_ring_t **out_ring)
+{
+    mccr_shm_ring_t *ring;
+    struct stat      st;
+    int              seals;
+
+    if (fd < 0)
+        return MCCR_STATUS_INVALID_INPUT;
+
+    /* The producer is unable to shrink it under our feet only if sealed */
+    if ((seals = fcntl (fd, F_GET_SEALS)) < 0 || !(seals & F_SEAL_SHRINK)) {
+        mccr_log ("error: invalid shared memory ring: not sealed");
+        return MCCR_STATUS_INVALID_INPUT;
+    }
+
+    if (fstat (fd, &st) < 0 || (size_t) st.st_size < sizeof (ring_header_t)) {
+        mccr_log ("error: invalid shared memory ring: too short");
+        return MCCR_STATUS_INVALID_INPUT;
+    }
+
+    ring = calloc (sizeof (mccr_shm_ring_t), 1);
+    if (!ring)
+        return MCCR_STATUS_FAILED;
+    ring->map_size = st.st_size;
+    pthread_mutex_init (&ring->lock, NULL);
+
+    /* Keep our own reference, the caller owns the given one */
+    if ((ring->fd = fcntl (fd, F_DUPFD_CLOEXEC, 0)) < 0 ||
+        (ring->map = mmap (NULL, ring->map_size, PROT_READ, MAP_SHARED, ring->fd, 0)) == MAP_FAILED) {
+        mccr_log ("error: couldn't map shared memory ring: %s", strerror (errno));
+        ring->map = NULL;
+        mccr_shm_ring_free (ring);
+        return MCCR_STATUS_FAILED;
+    }
+
+    ring->header = (ring_header_t *) ring->map;
+    memcpy (&ring->info, ring->header, sizeof (ring_header_t));
+    if (!ring_header_validate (&ring->info, ring->map_size)) {
+        mccr_shm_ring_free (ring);
+        return MCCR_STATUS_UNEXPECTED_FORMAT;
+    }
+
+    /* Only records published from now on */
+    ring->cursor = ring_load (&ring->header->head);
+
+    *out_ring = ring;
+    return MCCR_STATUS_OK;
+}
+
+static uint64_t
+monotonic_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+mccr_status_t
+mccr_shm_ring_read (mccr_shm_ring_t *ring,
+                    int              timeout_ms,
+                    uint8_t         *record,
+                    uint64_t        *out_timestamp_us,
+                    unsigned int    *out_n_dropped)
+{
+    unsigned int n_dropped = 0;
+    uint64_t     deadline_ms = 0;
+    uint32_t     head;
+
+    if (ring->producer)
+        return MCCR_STATUS_INVALID_OPERATION;
+
+    if (timeout_ms > 0)
+        deadline_ms = monotonic_ms () + timeout_ms;
+
+    for (;;) {
+        struct timespec  ts;
+        uint64_t         now_ms;
+
+        head = ring_load (&ring->header->head);
+
+        /* Records already overwritten are skipped */
+        if (head - ring->cursor > ring->info.n_slots) {
+            n_dropped   += head - ring->cursor - ring->info.n_slots;
+            ring->cursor = head - ring->info.n_slots;
+        }
+
+        while (ring->cursor != head) {
+            ring_slot_t *slot;
+            uint32_t     seq;
+            uint64_t     timestamp_us;
+
+            seq  = ring->cursor++;
+            slot = ring_slot (ring, seq);
+
+            if (ring_load (&slot->seq_end) == seq + 1) {
+                memcpy (record, slot->record, ring->info.record_size);
+                timestamp_us = slot->timestamp_us;
+                /* The copy must be complete before checking that the writer
+                 * didn't start overwriting the slot meanwhile */
+                __sync_synchronize ();
+                if (ring_load (&slot->seq_begin) == seq + 1) {
+                    if (out_timestamp_us)
+                        *out_timestamp_us = timestamp_us;
+                    if (out_n_dropped)
+                        *out_n_dropped = n_dropped;
+                    return MCCR_STATUS_OK;
+                }
+            }
+
+            /* Overwritten while we were reading it */
+            n_dropped++;
+        }
+
+        if (!timeout_ms)
+            break;
+
+        if (timeout_ms > 0) {
+            if ((now_ms = monotonic_ms ()) >= deadline_ms)
+                break;
+            ts.tv_sec  = (deadline_ms - now_ms) / 1000;
+            ts.tv_nsec = ((deadline_ms - now_ms) % 1000) * 1000000;
+        }
+
+        /* Sleep until the head changes; returns right away if it already
+         * did, so no records are missed */
+        if (syscall (SYS_futex, &ring->header->head, FUTEX_WAIT, head, timeout_ms > 0 ? &ts : NULL, NULL, 0) < 0 &&
+            errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+            mccr_log ("error: couldn't wait in shared memory ring: %s", strerror (errno));
+            if (out_n_dropped)
+                *out_n_dropped = n_dropped;
+            return MCCR_STATUS_FAILED;
+        }
+    }
+
+    if (out_n_dropped)
+        *out_n_dropped = n_dropped;
+    return MCCR_STATUS_TIMED_OUT;
+}
+
+/******************************************************************************/
+
+void
+mccr_shm_ring_free (mccr_shm_ring_t *ring)
+{
+    if (!ring)
+        return;
+
+    if (ring->map)
+        munmap (ring->map, ring->map_size);
+    if (ring->fd >= 0)
+        close (ring->fd);
+    pthread_mutex_destroy (&ring->lock);
+    free (ring);
+}
+
+int
+mccr_shm_ring_get_fd (mccr_shm_ring_t *ring)
+{
+    return ring->fd;
+}
+
+void
+mccr_shm_ring_get_blob (mccr_shm_ring_t  *ring,
+                        const uint8_t   **out_blob,
+                        size_t           *out_blob_size)
+{
+    *out_blob      = ring->map + ring->info.blob_offset;
+    *out_blob_size = ring->info.blob_size;
+}
+
+size_t
+mccr_shm_ring_get_record_size (mccr_shm_ring_t *ring)
+{
+    return ring->info.record_size;
+}
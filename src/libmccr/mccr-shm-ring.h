@@ -0,0 +1,68 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr - Support library for MagTek Credit Card Readers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#if !defined MCCR_SHM_RING_H
+# define MCCR_SHM_RING_H
+
+#include "mccr.h"
+
+/******************************************************************************/
+/* Shared memory ring
+ *
+ * Single producer, multiple consumer ring of fixed size records in a sealed
+ * memfd, along with an opaque blob given by the producer (e.g. the report
+ * layout needed to decode the records). Consumers map it read-only and keep
+ * their own cursor, so reading never needs a syscall unless there is nothing
+ * to read yet.
+ */
+
+typedef struct mccr_shm_ring_s mccr_shm_ring_t;
+
+mccr_status_t mccr_shm_ring_new             (unsigned int      n_slots,
+                                             size_t            record_size,
+                                             const uint8_t    *blob,
+                                             size_t            blob_size,
+                                             mccr_shm_ring_t **out_ring);
+mccr_status_t mccr_shm_ring_new_from_fd     (int               fd,
+                                             mccr_shm_ring_t **out_ring);
+void          mccr_shm_ring_free            (mccr_shm_ring_t  *ring);
+int           mccr_shm_ring_get_fd          (mccr_shm_ring_t  *ring);
+void          mccr_shm_ring_get_blob        (mccr_shm_ring_t  *ring,
+                                             const uint8_t   **out_blob,
+                                             size_t           *out_blob_size);
+size_t        mccr_shm_ring_get_record_size (mccr_shm_ring_t  *ring);
+
+/* Producer only */
+mccr_status_t mccr_shm_ring_publish         (mccr_shm_ring_t  *ring,
+                                             const uint8_t    *record,
+                                             size_t            record_size,
+                                             uint64_t          timestamp_us);
+
+/* Consumer only; the record buffer must be as big as the ring record size */
+mccr_status_t mccr_shm_ring_read            (mccr_shm_ring_t  *ring,
+                                             int               timeout_ms,
+                                             uint8_t          *record,
+                                             uint64_t         *out_timestamp_us,
+                                             unsigned int     *out_n_dropped);
+
+#endif /* MCCR_SHM_RING_H */
@@ -0,0 +1,279 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr - Support library for MagTek Credit Card Readers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mccr.h"
+#include "mccr-log.h"
+
+/******************************************************************************/
+/* Duplicate swipe detection
+ *
+ * Swipes are identified by the hashed track 2 data and the serial number of
+ * the reader, both reported in the swipe report itself. Accepted swipes are
+ * kept in a circular array in arrival order, which is also their expiration
+ * order as all share the same window, and indexed by an open addressing hash
+ * table (linear probing, at most half full) storing positions in the array.
+ * Expired swipes are removed from the front of the array, using backward
+ * shift deletion in the table so that no tombstones are ever needed.
+ */
+
+#define KEY_SIZE (MCCR_HASHED_TRACK_2_DATA_SIZE + MCCR_DEVICE_SERIAL_NUMBER_SIZE)
+
+typedef struct {
+    uint64_t hash;
+    uint64_t timestamp_us;
+    uint8_t  key[KEY_SIZE];
+} entry_t;
+
+struct mccr_swipe_dedup_s {
+    volatile int     refcount;
+    pthread_mutex_t  lock;
+    uint64_t         window_us;
+    /* Accepted swipes, oldest first */
+    entry_t         *entries;
+    unsigned int     n_entries_max;
+    unsigned int     first;
+    unsigned int     n_entries;
+    /* Position in entries plus one, or 0 if empty */
+    uint32_t        *table;
+    uint32_t         table_mask;
+};
+
+static uint64_t
+monotonic_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/* FNV-1a */
+static uint64_t
+key_hash (const uint8_t *key)
+{
+    uint64_t     hash = 0xcbf29ce484222325ULL;
+    unsigned int i;
+
+    for (i = 0; i < KEY_SIZE; i++) {
+        hash ^= key[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint32_t
+table_lookup (mccr_swipe_dedup_t *dedup,
+              uint64_t            hash,
+              const uint8_t      *key)
+{
+    uint32_t i;
+
+    for (i = hash & dedup->table_mask; dedup->table[i]; i = (i + 1) & dedup->table_mask) {
+        const entry_t *entry = &dedup->entries[dedup->table[i] - 1];
+
+        if (entry->hash == hash && memcmp (entry->key, key, KEY_SIZE) == 0)
+            return i;
+    }
+    return UINT32_MAX;
+}
+
+static void
+table_remove (mccr_swipe_dedup_t *dedup,
+              uint32_t            i)
+{
+    uint32_t j;
+
+    /* Move back every following entry in the same cluster that may be
+     * stored in the slot being emptied */
+    for (j = (i + 1) & dedup->table_mask; dedup->table[j]; j = (j + 1) & dedup->table_mask) {
+        uint32_t home;
+
+        home = dedup->entries[dedup->table[j] - 1].hash & dedup->table_mask;
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+        dedup->table[i] = dedup->table[j];
+        i = j;
+    }
+    dedup->table[i] = 0;
+}
+
+static void
+remove_oldest (mccr_swipe_dedup_t *dedup)
+{
+    entry_t  *entry;
+    uint32_t  i;
+
+    assert (dedup->n_entries > 0);
+
+    entry = &dedup->entries[dedup->first];
+    for (i = entry->hash & dedup->table_mask; dedup->table[i] != dedup->first + 1; i = (i + 1) & dedup->table_mask)
+        assert (dedup->table[i]);
+    table_remove (dedup, i);
+
+    dedup->first = (dedup->first + 1) % dedup->n_entries_max;
+    dedup->n_entries--;
+}
+
+static void
+insert (mccr_swipe_dedup_t *dedup,
+        uint64_t            hash,
+        const uint8_t      *key,
+        uint64_t            timestamp_us)
+{
+    unsigned int  position;
+    entry_t      *entry;
+    uint32_t      i;
+
+    /* Too many swipes in the window, forget the oldest one early */
+    if (dedup->n_entries == dedup->n_entries_max)
+        remove_oldest (dedup);
+
+    position = (dedup->first + dedup->n_entries++) % dedup->n_entries_max;
+    entry = &dedup->entries[position];
+    entry->hash         = hash;
+    entry->timestamp_us = timestamp_us;
+    memcpy (entry->key, key, KEY_SIZE);
+
+    for (i = hash & dedup->table_mask; dedup->table[i]; i = (i + 1) & dedup->table_mask);
+    dedup->table[i] = position + 1;
+}
+
+mccr_status_t
+mccr_swipe_dedup_check (mccr_swipe_dedup_t  *dedup,
+                        mccr_swipe_report_t *report,
+                        bool                *out_duplicate)
+{
+    static const uint8_t  no_hash[MCCR_HASHED_TRACK_2_DATA_SIZE] = { 0 };
+    const uint8_t        *hashed_track_2;
+    const uint8_t        *serial_number;
+    uint8_t               key[KEY_SIZE];
+    uint64_t              hash;
+    uint64_t              timestamp_us;
+    bool                  duplicate;
+    mccr_status_t         st;
+
+    if ((st = mccr_swipe_report_get_hashed_track_2_data (report, &hashed_track_2)) != MCCR_STATUS_OK ||
+        (st = mccr_swipe_report_get_device_serial_number (report, &serial_number)) != MCCR_STATUS_OK)
+        return st;
+
+    /* Nothing to compare if there was no track 2 read */
+    if (memcmp (hashed_track_2, no_hash, sizeof (no_hash)) == 0) {
+        if (out_duplicate)
+            *out_duplicate = false;
+        return MCCR_STATUS_OK;
+    }
+
+    memcpy (key, hashed_track_2, MCCR_HASHED_TRACK_2_DATA_SIZE);
+    memcpy (&key[MCCR_HASHED_TRACK_2_DATA_SIZE], serial_number, MCCR_DEVICE_SERIAL_NUMBER_SIZE);
+    hash = key_hash (key);
+
+    /* The window is measured between the times at which the swipes were
+     * received, not checked; unless not known (e.g. reports created from
+     * recorded data), or they would never expire */
+    mccr_swipe_report_get_timestamp (report, &timestamp_us);
+    if (!timestamp_us)
+        timestamp_us = monotonic_us ();
+
+    pthread_mutex_lock (&dedup->lock);
+
+    while (dedup->n_entries && dedup->entries[dedup->first].timestamp_us + dedup->window_us < timestamp_us)
+        remove_oldest (dedup);
+
+    /* Duplicates are not added, so the window always starts at the first
+     * swipe accepted */
+    duplicate = (table_lookup (dedup, hash, key) != UINT32_MAX);
+    if (!duplicate)
+        insert (dedup, hash, key, timestamp_us);
+
+    pthread_mutex_unlock (&dedup->lock);
+
+    if (duplicate)
+        mccr_log ("probable duplicate swipe detected");
+
+    if (out_duplicate)
+        *out_duplicate = duplicate;
+    return MCCR_STATUS_OK;
+}
+
+/******************************************************************************/
+
+mccr_swipe_dedup_t *
+mccr_swipe_dedup_new (unsigned int window_ms,
+                      unsigned int max_swipes)
+{
+    mccr_swipe_dedup_t *dedup;
+    uint32_t            table_size;
+
+    if (!max_swipes || max_swipes > (1 << 20))
+        return NULL;
+
+    dedup = calloc (sizeof (mccr_swipe_dedup_t), 1);
+    if (!dedup)
+        return NULL;
+
+    for (table_size = 1; table_size < 2 * max_swipes; table_size <<= 1);
+
+    dedup->refcount      = 1;
+    dedup->window_us     = (uint64_t) window_ms * 1000;
+    dedup->n_entries_max = max_swipes;
+    dedup->table_mask    = table_size - 1;
+    dedup->entries       = calloc (sizeof (entry_t), max_swipes);
+    dedup->table         = calloc (sizeof (uint32_t), table_size);
+    if (!dedup->entries || !dedup->table) {
+        free (dedup->entries);
+        free (dedup->table);
+        free (dedup);
+        return NULL;
+    }
+    pthread_mutex_init (&dedup->lock, NULL);
+
+    return dedup;
+}
+
+mccr_swipe_dedup_t *
+mccr_swipe_dedup_ref (mccr_swipe_dedup_t *dedup)
+{
+    __sync_fetch_and_add (&dedup->refcount, 1);
+    return dedup;
+}
+
+void
+mccr_swipe_dedup_unref (mccr_swipe_dedup_t *dedup)
+{
+    if (__sync_fetch_and_sub (&dedup->refcount, 1) != 1)
+        return;
+
+    pthread_mutex_destroy (&dedup->lock);
+    free (dedup->entries);
+    free (dedup->table);
+    free (dedup);
+}
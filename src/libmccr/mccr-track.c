@@ -0,0 +1,474 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr - Support library for MagTek Credit Card Readers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "mccr.h"
+#include "mccr-log.h"
+
+/******************************************************************************/
+/* Track formats
+ *
+ * Tracks are given already decoded to ASCII (masked or decrypted data), so
+ * the parity of each character can't be checked as such; instead, every
+ * character must be one that the track encoding (7-bit alphanumeric or 5-bit
+ * numeric) is able to represent. The LRC character, if given after the end
+ * sentinel, is the XOR of all the characters (without parity) from the start
+ * sentinel to the end sentinel.
+ */
+
+#define END_SENTINEL   '?'
+#define MASK_CHARACTER '*'
+#define MAX_SEPARATORS 8
+
+typedef struct {
+    uint8_t start_sentinel;
+    uint8_t separator;
+    /* Character set, also the offset of the encoded values */
+    uint8_t charset_min;
+    uint8_t charset_max;
+} track_format_t;
+
+static const track_format_t alphanumeric_format = { '%', '^', 0x20, 0x5f };
+static const track_format_t numeric_format      = { ';', '=', 0x30, 0x3f };
+
+static const char *track_field_str[] = {
+    [MCCR_TRACK_FIELD_FORMAT_CODE]        = "format code",
+    [MCCR_TRACK_FIELD_PAN]                = "primary account number",
+    [MCCR_TRACK_FIELD_NAME]               = "name",
+    [MCCR_TRACK_FIELD_EXPIRATION_DATE]    = "expiration date",
+    [MCCR_TRACK_FIELD_SERVICE_CODE]       = "service code",
+    [MCCR_TRACK_FIELD_DISCRETIONARY_DATA] = "discretionary data",
+    [MCCR_TRACK_FIELD_STATE]              = "state",
+    [MCCR_TRACK_FIELD_CITY]               = "city",
+    [MCCR_TRACK_FIELD_ADDRESS]            = "address",
+    [MCCR_TRACK_FIELD_IIN]                = "issuer identification number",
+    [MCCR_TRACK_FIELD_ID_NUMBER]          = "id number",
+    [MCCR_TRACK_FIELD_BIRTH_DATE]         = "birth date",
+    [MCCR_TRACK_FIELD_ID_NUMBER_OVERFLOW] = "id number overflow",
+};
+
+const char *
+mccr_track_field_to_string (mccr_track_field_t field)
+{
+    return (field < (sizeof (track_field_str) / sizeof (track_field_str[0])) ? track_field_str[field] : "unknown");
+}
+
+/******************************************************************************/
+/* Character class scan
+ *
+ * A single pass finds the end sentinel, the field separators before it and
+ * the first character not in the track character set. The x86 kernel
+ * classifies 16 characters at a time, and the scalar code handles the
+ * remainder.
+ */
+
+#if defined __GNUC__ && defined __SSE2__ && (defined __x86_64__ || defined __i386__)
+# define TRACK_SCAN_X86 1
+# include <emmintrin.h>
+#endif
+
+typedef struct {
+    /* End sentinel position, or the data size if not found */
+    size_t       end;
+    /* First position with a character not in the character set, or the
+     * data size if none */
+    size_t       invalid;
+    size_t       separators[MAX_SEPARATORS];
+    unsigned int n_separators;
+} track_scan_t;
+
+static inline void
+scan_add_separator (track_scan_t *scan,
+                    size_t        position)
+{
+    if (scan->n_separators < MAX_SEPARATORS)
+        scan->separators[scan->n_separators++] = position;
+}
+
+static inline bool
+char_is_valid (const track_format_t     *format,
+               mccr_track_parse_flags_t  flags,
+               uint8_t                   c)
+{
+    return ((c >= format->charset_min && c <= format->charset_max) ||
+            ((flags & MCCR_TRACK_PARSE_FLAGS_MASKED) && c == MASK_CHARACTER));
+}
+
+#if defined TRACK_SCAN_X86
+
+/* Returns the number of bytes scanned; stops at the block with the end
+ * sentinel, if any */
+static size_t
+track_scan_sse2 (const track_format_t     *format,
+                 mccr_track_parse_flags_t  flags,
+                 const uint8_t            *data,
+                 size_t                    size,
+                 track_scan_t             *scan)
+{
+    const __m128i end_sentinel = _mm_set1_epi8 (END_SENTINEL);
+    const __m128i separator    = _mm_set1_epi8 ((char) format->separator);
+    const __m128i charset_min  = _mm_set1_epi8 ((char) format->charset_min);
+    const __m128i charset_span = _mm_set1_epi8 ((char) (format->charset_max - format->charset_min));
+    const __m128i mask_char    = _mm_set1_epi8 ((flags & MCCR_TRACK_PARSE_FLAGS_MASKED) ? MASK_CHARACTER : END_SENTINEL);
+    size_t        i;
+
+    for (i = 0; i + 16 <= size; i += 16) {
+        __m128i      in;
+        __m128i      offset;
+        unsigned int end_mask, separator_mask, valid_mask, invalid_mask;
+
+        in = _mm_loadu_si128 ((const __m128i *) &data[i]);
+
+        /* (c - min) <= (max - min), unsigned */
+        offset = _mm_sub_epi8 (in, charset_min);
+        valid_mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (_mm_max_epu8 (offset, charset_span), charset_span),
+                                                      _mm_cmpeq_epi8 (in, mask_char)));
+        end_mask       = _mm_movemask_epi8 (_mm_cmpeq_epi8 (in, end_sentinel));
+        separator_mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (in, separator));
+        invalid_mask   = ~valid_mask & 0xffff;
+
+        /* Ignore everything after the end sentinel */
+        if (end_mask) {
+            unsigned int limit;
+
+            limit = (1u << __builtin_ctz (end_mask)) - 1;
+            separator_mask &= limit;
+            invalid_mask   &= limit;
+        }
+
+        if (invalid_mask && scan->invalid == size)
+            scan->invalid = i + __builtin_ctz (invalid_mask);
+
+        while (separator_mask) {
+            scan_add_separator (scan, i + __builtin_ctz (separator_mask));
+            separator_mask &= separator_mask - 1;
+        }
+
+        if (end_mask) {
+            scan->end = i + __builtin_ctz (end_mask);
+            return i + 16;
+        }
+    }
+
+    return i;
+}
+
+#endif /* TRACK_SCAN_X86 */
+
+static void
+track_scan (const track_format_t     *format,
+            mccr_track_parse_flags_t  flags,
+            const uint8_t            *data,
+            size_t                    size,
+            track_scan_t             *scan)
+{
+    size_t i = 0;
+
+    scan->end          = size;
+    scan->invalid      = size;
+    scan->n_separators = 0;
+
+#if defined TRACK_SCAN_X86
+    i = track_scan_sse2 (format, flags, data, size, scan);
+    if (scan->end != size)
+        return;
+#endif
+
+    for (; i < size; i++) {
+        if (data[i] == END_SENTINEL) {
+            scan->end = i;
+            return;
+        }
+        if (data[i] == format->separator)
+            scan_add_separator (scan, i);
+        else if (scan->invalid == size && !char_is_valid (format, flags, data[i]))
+            scan->invalid = i;
+    }
+}
+
+/******************************************************************************/
+/* Field parsing */
+
+static inline void
+set_field (mccr_track_t       *track,
+           mccr_track_field_t  field,
+           size_t              start,
+           size_t              end)
+{
+    track->fields[field].offset = start;
+    track->fields[field].length = end - start;
+}
+
+/* First separator at or after the given position, or the end sentinel */
+static size_t
+next_separator (const track_scan_t *scan,
+                size_t              position)
+{
+    unsigned int i;
+
+    for (i = 0; i < scan->n_separators; i++) {
+        if (scan->separators[i] >= position)
+            return scan->separators[i];
+    }
+    return scan->end;
+}
+
+/* Fixed size field, which may be replaced by a separator if not given */
+static size_t
+parse_optional_field (const uint8_t      *data,
+                      const track_scan_t *scan,
+                      uint8_t             separator,
+                      mccr_track_t       *track,
+                      mccr_track_field_t  field,
+                      size_t              position,
+                      size_t              size)
+{
+    if (position < scan->end && data[position] == separator)
+        return position + 1;
+    if (position + size > scan->end)
+        return position;
+    set_field (track, field, position, position + size);
+    return position + size;
+}
+
+/* The expiration date, service code and discretionary data after the PAN
+ * (and name) in financial cards */
+static void
+parse_iso_trailer (const uint8_t      *data,
+                   const track_scan_t *scan,
+                   uint8_t             separator,
+                   mccr_track_t       *track,
+                   size_t              position)
+{
+    position = parse_optional_field (data, scan, separator, track, MCCR_TRACK_FIELD_EXPIRATION_DATE, position, 4);
+    position = parse_optional_field (data, scan, separator, track, MCCR_TRACK_FIELD_SERVICE_CODE,    position, 3);
+    if (position < scan->end)
+        set_field (track, MCCR_TRACK_FIELD_DISCRETIONARY_DATA, position, scan->end);
+}
+
+static bool
+parse_iso_track_1 (const uint8_t      *data,
+                   const track_scan_t *scan,
+                   mccr_track_t       *track)
+{
+    /* %B<pan>^<name>^<expiration><service code><discretionary>? */
+    if (scan->end < 2 || data[1] < 'A' || data[1] > 'Z' || scan->n_separators < 2 ||
+        scan->separators[0] < 3 || scan->separators[0] > 2 + 19)
+        return false;
+
+    set_field (track, MCCR_TRACK_FIELD_FORMAT_CODE, 1, 2);
+    set_field (track, MCCR_TRACK_FIELD_PAN, 2, scan->separators[0]);
+    set_field (track, MCCR_TRACK_FIELD_NAME, scan->separators[0] + 1, scan->separators[1]);
+    parse_iso_trailer (data, scan, '^', track, scan->separators[1] + 1);
+    return true;
+}
+
+static bool
+parse_iso_track_2 (const uint8_t      *data,
+                   const track_scan_t *scan,
+                   mccr_track_t       *track)
+{
+    /* ;<pan>=<expiration><service code><discretionary>? */
+    if (!scan->n_separators || scan->separators[0] < 2 || scan->separators[0] > 1 + 19)
+        return false;
+
+    set_field (track, MCCR_TRACK_FIELD_PAN, 1, scan->separators[0]);
+    parse_iso_trailer (data, scan, '=', track, scan->separators[0] + 1);
+    return true;
+}
+
+static bool
+parse_iso_track_3 (const uint8_t      *data,
+                   const track_scan_t *scan,
+                   mccr_track_t       *track)
+{
+    /* ;<format code><pan>=<discretionary>? */
+    if (!scan->n_separators || scan->separators[0] < 4 || scan->separators[0] > 3 + 19)
+        return false;
+
+    set_field (track, MCCR_TRACK_FIELD_FORMAT_CODE, 1, 3);
+    set_field (track, MCCR_TRACK_FIELD_PAN, 3, scan->separators[0]);
+    if (scan->separators[0] + 1 < scan->end)
+        set_field (track, MCCR_TRACK_FIELD_DISCRETIONARY_DATA, scan->separators[0] + 1, scan->end);
+    return true;
+}
+
+static bool
+parse_aamva_track_1 (const uint8_t      *data,
+                     const track_scan_t *scan,
+                     mccr_track_t       *track)
+{
+    size_t position;
+    size_t end;
+
+    /* %<state><city>^<name>^<address>^? ; the city is only terminated by a
+     * separator if shorter than its maximum size */
+    if (scan->end < 3)
+        return false;
+    set_field (track, MCCR_TRACK_FIELD_STATE, 1, 3);
+
+    end = next_separator (scan, 3);
+    if (end - 3 > 13)
+        end = 3 + 13;
+    set_field (track, MCCR_TRACK_FIELD_CITY, 3, end);
+    position = (end < scan->end && data[end] == '^') ? end + 1 : end;
+    if (position >= scan->end)
+        return true;
+
+    end = next_separator (scan, position);
+    set_field (track, MCCR_TRACK_FIELD_NAME, position, end);
+    if (end + 1 >= scan->end)
+        return true;
+
+    position = end + 1;
+    set_field (track, MCCR_TRACK_FIELD_ADDRESS, position, next_separator (scan, position));
+    return true;
+}
+
+static bool
+parse_aamva_track_2 (const uint8_t      *data,
+                     const track_scan_t *scan,
+                     mccr_track_t       *track)
+{
+    size_t position;
+
+    /* ;<iin><id number>=<expiration><birth date><id number overflow>? */
+    if (!scan->n_separators || scan->separators[0] < 1 + 6 || scan->separators[0] > 1 + 6 + 13)
+        return false;
+
+    set_field (track, MCCR_TRACK_FIELD_IIN, 1, 7);
+    set_field (track, MCCR_TRACK_FIELD_ID_NUMBER, 7, scan->separators[0]);
+
+    position = scan->separators[0] + 1;
+    if (position + 4 > scan->end)
+        return true;
+    set_field (track, MCCR_TRACK_FIELD_EXPIRATION_DATE, position, position + 4);
+    position += 4;
+    if (position + 8 > scan->end)
+        return true;
+    set_field (track, MCCR_TRACK_FIELD_BIRTH_DATE, position, position + 8);
+    position += 8;
+    if (position < scan->end)
+        set_field (track, MCCR_TRACK_FIELD_ID_NUMBER_OVERFLOW, position, scan->end);
+    return true;
+}
+
+static bool
+parse_aamva_track_3 (const uint8_t      *data,
+                     const track_scan_t *scan,
+                     mccr_track_t       *track)
+{
+    /* Jurisdiction specific contents, not split */
+    if (scan->end > 1)
+        set_field (track, MCCR_TRACK_FIELD_DISCRETIONARY_DATA, 1, scan->end);
+    return true;
+}
+
+typedef bool (* parse_func) (const uint8_t      *data,
+                             const track_scan_t *scan,
+                             mccr_track_t       *track);
+
+static const struct {
+    const track_format_t *format;
+    parse_func            parse;
+} parsers[2][3] = {
+    [MCCR_CARD_ENCODE_TYPE_ISO_ABA] = {
+        { &alphanumeric_format, parse_iso_track_1   },
+        { &numeric_format,      parse_iso_track_2   },
+        { &numeric_format,      parse_iso_track_3   },
+    },
+    [MCCR_CARD_ENCODE_TYPE_AAMVA] = {
+        { &alphanumeric_format, parse_aamva_track_1 },
+        { &numeric_format,      parse_aamva_track_2 },
+        { &alphanumeric_format, parse_aamva_track_3 },
+    },
+};
+
+/******************************************************************************/
+
+mccr_status_t
+mccr_track_parse (mccr_card_encode_type_t   encode_type,
+                  unsigned int              track_number,
+                  mccr_track_parse_flags_t  flags,
+                  const uint8_t            *data,
+                  size_t                    data_size,
+                  mccr_track_t             *out_track)
+{
+    const track_format_t *format;
+    track_scan_t          scan;
+    mccr_track_t          track;
+
+    if ((encode_type != MCCR_CARD_ENCODE_TYPE_ISO_ABA && encode_type != MCCR_CARD_ENCODE_TYPE_AAMVA) ||
+        track_number < 1 || track_number > 3 || !data || !out_track)
+        return MCCR_STATUS_INVALID_INPUT;
+
+    format = parsers[encode_type][track_number - 1].format;
+    if (!data_size || data[0] != format->start_sentinel) {
+        mccr_log ("error: track %u: start sentinel not found", track_number);
+        return MCCR_STATUS_UNEXPECTED_FORMAT;
+    }
+
+    track_scan (format, flags, data, data_size, &scan);
+
+    if (scan.end == data_size) {
+        mccr_log ("error: track %u: end sentinel not found", track_number);
+        return MCCR_STATUS_UNEXPECTED_FORMAT;
+    }
+
+    if (scan.invalid < scan.end) {
+        mccr_log ("error: track %u: invalid character 0x%02x at offset %u", track_number, data[scan.invalid], (unsigned int) scan.invalid);
+        return MCCR_STATUS_UNEXPECTED_FORMAT;
+    }
+
+    memset (&track, 0, sizeof (track));
+    track.length = scan.end + 1;
+
+    /* Decrypted data is padded with zeros, so a zero is no LRC */
+    if (scan.end + 1 < data_size && data[scan.end + 1] != 0) {
+        track.has_lrc = true;
+        if (!(flags & MCCR_TRACK_PARSE_FLAGS_MASKED)) {
+            uint8_t lrc = 0;
+            size_t  i;
+
+            for (i = 0; i <= scan.end; i++)
+                lrc ^= data[i] - format->charset_min;
+            if (!char_is_valid (format, MCCR_TRACK_PARSE_FLAGS_NONE, data[scan.end + 1]) ||
+                (uint8_t) (data[scan.end + 1] - format->charset_min) != lrc) {
+                mccr_log ("error: track %u: LRC mismatch", track_number);
+                return MCCR_STATUS_UNEXPECTED_FORMAT;
+            }
+        }
+    }
+
+    if (!parsers[encode_type][track_number - 1].parse (data, &scan, &track)) {
+        mccr_log ("error: track %u: unexpected field layout", track_number);
+        return MCCR_STATUS_UNEXPECTED_FORMAT;
+    }
+
+    *out_track = track;
+    return MCCR_STATUS_OK;
+}
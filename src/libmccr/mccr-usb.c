@@ -197,3 +197,31 @@ out:
 
     return st;
 }
+
+/* The size alone can't be read without claiming the interface, so there is
+ * nothing to save over reading the whole descriptor */
+mccr_status_t
+mccr_read_report_descriptor_size (const char *path,
+                                  size_t     *out_desc_size)
+{
+    uint8_t       *desc = NULL;
+    mccr_status_t  st;
+
+    if ((st = mccr_read_report_descriptor (path, &desc, out_desc_size)) == MCCR_STATUS_OK)
+        free (desc);
+    return st;
+}
+
+/******************************************************************************/
+
+/* libusb doesn't give a descriptor to poll, reports are read in its own thread */
+int
+mccr_input_monitor_open (const char *path)
+{
+    return -1;
+}
+
+void
+mccr_input_monitor_drain (int fd)
+{
+}
@@ -27,8 +27,16 @@
 /******************************************************************************/
 /* Report descriptor (libusb) */
 
-mccr_status_t mccr_read_report_descriptor (const char  *path,
-                                           uint8_t    **out_desc,
-                                           size_t      *out_desc_size);
+mccr_status_t mccr_read_report_descriptor      (const char  *path,
+                                                uint8_t    **out_desc,
+                                                size_t      *out_desc_size);
+mccr_status_t mccr_read_report_descriptor_size (const char  *path,
+                                                size_t      *out_desc_size);
+
+/******************************************************************************/
+/* Input monitor (libusb), unsupported */
+
+int  mccr_input_monitor_open  (const char *path);
+void mccr_input_monitor_drain (int         fd);
 
 #endif /* MCCR_USB_H */
@@ -29,6 +29,8 @@
 #include <malloc.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <pthread.h>
 
 #include <hidapi.h>
@@ -38,8 +40,10 @@
 #include "mccr.h"
 #include "mccr-log.h"
 #include "mccr-hid.h"
+#include "mccr-shm-ring.h"
 #include "mccr-input-report.h"
 #include "mccr-feature-report.h"
+#include "mccr-builtin-layouts.h"
 
 #if defined HIDAPI_BACKEND_USB
 # include "mccr-usb.h"
@@ -68,6 +72,8 @@ static const char *status_str[] = {
     [MCCR_STATUS_INVALID_OPERATION] = "invalid operation",
     [MCCR_STATUS_INVALID_INPUT]     = "invalid input",
     [MCCR_STATUS_UNEXPECTED_FORMAT] = "unexpected format",
+    [MCCR_STATUS_TIMED_OUT]         = "timed out",
+    [MCCR_STATUS_DISCONNECTED]      = "device disconnected",
 };
 
 const char *
@@ -91,8 +97,26 @@ struct mccr_device_s {
     wchar_t          *manufacturer;
     wchar_t          *product;
     hid_device       *hid;
+    /* Path the device was found at when rebinding, if different from the
+     * one it was created with, which never changes */
+    char             *hid_path;
+    /* Held for reading while the HID handle is in use, and for writing when
+     * replacing it or the path it was open from */
+    pthread_rwlock_t  hid_lock;
+    /* Descriptor polled by users for input reports, open on request along
+     * with the HID handle, and closed with it */
+    int               input_fd;
+    bool              reconnect;
     mccr_report_descriptor_context_t *desc;
     mccr_feature_report_t            *feature_report;
+    /* Built-in layout verification */
+    const uint8_t    *builtin_desc;
+    size_t            builtin_desc_size;
+    pthread_t         verify_thread;
+    bool              verify_thread_running;
+    volatile int      layout_mismatch;
+    /* Duplicate swipe detection */
+    mccr_swipe_dedup_t *dedup;
 };
 
 static mccr_device_t *
@@ -119,8 +143,10 @@ device_new (struct hid_device_info *hid_info)
 #if !defined __GCC_HAVE_SYNC_COMPARE_AND_SWAP_4
     pthread_mutex_init (&device->reflock, NULL);
 #endif
+    pthread_rwlock_init (&device->hid_lock, NULL);
 
     device->refcount      = 1;
+    device->input_fd      = -1;
     device->vid           = hid_info->vendor_id;
     device->pid           = hid_info->product_id;
     device->path          = hid_info->path                ? strdup (hid_info->path)                : NULL;
@@ -158,6 +184,10 @@ mccr_device_unref (mccr_device_t *device)
     assert (!device->feature_report);
     assert (!device->desc);
 
+    if (device->dedup)
+        mccr_swipe_dedup_unref (device->dedup);
+    pthread_rwlock_destroy (&device->hid_lock);
+    free (device->hid_path);
     free (device->path);
     free (device->serial_number);
     free (device->manufacturer);
@@ -299,9 +329,31 @@ mccr_device_get_product (mccr_device_t *device)
 /******************************************************************************/
 /* Device open/close */
 
+/* Path to use when reading the descriptor or opening the HID device; only
+ * while opening or with the HID lock held, as it changes when rebinding */
+static const char *
+device_get_hid_path (mccr_device_t *device)
+{
+    return device->hid_path ? device->hid_path : device->path;
+}
+
+static void
+device_join_verify_thread (mccr_device_t *device)
+{
+    if (device->verify_thread_running) {
+        pthread_join (device->verify_thread, NULL);
+        device->verify_thread_running = false;
+    }
+}
+
 static void
 device_clear_open_info (mccr_device_t *device)
 {
+    device_join_verify_thread (device);
+    device->builtin_desc      = NULL;
+    device->builtin_desc_size = 0;
+    device->layout_mismatch   = 0;
+
     if (device->feature_report) {
         mccr_feature_report_free (device->feature_report);
         device->feature_report = NULL;
@@ -316,27 +368,116 @@ device_clear_open_info (mccr_device_t *device)
         hid_close (device->hid);
         device->hid = NULL;
     }
+
+    if (device->input_fd >= 0) {
+        close (device->input_fd);
+        device->input_fd = -1;
+    }
+
+    device->reconnect = false;
 }
 
-mccr_status_t
-mccr_device_open (mccr_device_t *device)
+static mccr_status_t
+device_verify_builtin_layout (mccr_device_t *device)
 {
-    uint8_t            *hid_descriptor = NULL;
-    size_t              hid_descriptor_size = 0;
+    uint8_t       *hid_descriptor = NULL;
+    size_t         hid_descriptor_size = 0;
     mccr_status_t  st;
 
-    if (device->desc) {
-        /* Every successful operation increases refcount */
-        mccr_device_ref (device);
+    if (mccr_read_report_descriptor (device_get_hid_path (device),
+                                     &hid_descriptor,
+                                     &hid_descriptor_size) != MCCR_STATUS_OK) {
+        mccr_log ("error: couldn't read hid descriptor to verify built-in layout");
+        return MCCR_STATUS_FAILED;
+    }
+
+    if (hid_descriptor_size != device->builtin_desc_size ||
+        memcmp (hid_descriptor, device->builtin_desc, hid_descriptor_size) != 0) {
+        mccr_log ("error: device at path '%s' doesn't match built-in layout", device_get_hid_path (device));
+        mccr_log_raw ("  report desc:", hid_descriptor, hid_descriptor_size);
+        mccr_builtin_layout_reject (device->vid, device->pid, device->builtin_desc_size);
+        device->layout_mismatch = 1;
+        st = MCCR_STATUS_UNEXPECTED_FORMAT;
+    } else {
+        mccr_log ("device at path '%s' matches built-in layout", device_get_hid_path (device));
+        st = MCCR_STATUS_OK;
+    }
+
+    free (hid_descriptor);
+    return st;
+}
+
+#if defined HIDAPI_BACKEND_RAW
+static void *
+verify_builtin_layout_thread (void *user_data)
+{
+    device_verify_builtin_layout ((mccr_device_t *) user_data);
+    return NULL;
+}
+#endif
+
+static mccr_status_t
+device_load_builtin_layout (mccr_device_t            *device,
+                            mccr_device_open_flags_t  flags)
+{
+    /* Firmware with a different report layout under the same VID/PID would
+     * be misparsed, so the descriptor size must match as well */
+    if (mccr_read_report_descriptor_size (device_get_hid_path (device),
+                                          &device->builtin_desc_size) != MCCR_STATUS_OK)
+        return MCCR_STATUS_NOT_FOUND;
+
+    device->desc = mccr_builtin_layout_get (device->vid,
+                                            device->pid,
+                                            device->builtin_desc_size,
+                                            &device->builtin_desc);
+    if (!device->desc) {
+        device->builtin_desc_size = 0;
+        return MCCR_STATUS_NOT_FOUND;
+    }
+
+    mccr_log ("using built-in layout for %04x:%04x", device->vid, device->pid);
+
+    if (!(flags & MCCR_DEVICE_OPEN_FLAGS_VERIFY_LAYOUT))
         return MCCR_STATUS_OK;
+
+#if defined HIDAPI_BACKEND_USB
+    /* Reading the descriptor claims the interface, so the verification
+     * cannot run while the device is open; on mismatch, just fallback to
+     * the layout parsed from the device descriptor */
+    {
+        mccr_status_t st;
+
+        st = device_verify_builtin_layout (device);
+        if (st == MCCR_STATUS_UNEXPECTED_FORMAT) {
+            mccr_report_descriptor_context_unref (device->desc);
+            device->desc = NULL;
+            device->layout_mismatch = 0;
+            st = MCCR_STATUS_NOT_FOUND;
+        }
+        return st;
+    }
+#else
+    if (pthread_create (&device->verify_thread, NULL, verify_builtin_layout_thread, device) != 0) {
+        mccr_log ("error: couldn't launch built-in layout verification");
+        return MCCR_STATUS_FAILED;
     }
+    device->verify_thread_running = true;
+    return MCCR_STATUS_OK;
+#endif
+}
+
+static mccr_status_t
+device_load_layout (mccr_device_t *device)
+{
+    uint8_t       *hid_descriptor = NULL;
+    size_t         hid_descriptor_size = 0;
+    mccr_status_t  st;
 
-    if (mccr_read_report_descriptor (device->path,
+    if (mccr_read_report_descriptor (device_get_hid_path (device),
                                      &hid_descriptor,
                                      &hid_descriptor_size) != MCCR_STATUS_OK) {
         mccr_log ("error: couldn't read hid descriptor");
-        st = MCCR_STATUS_FAILED;
-        goto out;
+        return MCCR_STATUS_FAILED;
     }
 
     mccr_log_raw ("  report desc:", hid_descriptor, hid_descriptor_size);
@@ -346,12 +487,36 @@ mccr_device_open (mccr_device_t *device)
                                       &device->desc) != MCCR_STATUS_OK) {
         mccr_log ("error: couldn't parse hid descriptor");
         st = MCCR_STATUS_FAILED;
-        goto out;
+    } else
+        st = MCCR_STATUS_OK;
+
+    free (hid_descriptor);
+    return st;
+}
+
+mccr_status_t
+mccr_device_open_full (mccr_device_t            *device,
+                       mccr_device_open_flags_t  flags)
+{
+    mccr_status_t st;
+
+    if (device->desc) {
+        /* Every successful operation increases refcount */
+        mccr_device_ref (device);
+        return MCCR_STATUS_OK;
     }
 
-    device->hid = hid_open_path (device->path);
+    st = MCCR_STATUS_NOT_FOUND;
+    if (flags & MCCR_DEVICE_OPEN_FLAGS_BUILTIN_LAYOUT)
+        st = device_load_builtin_layout (device, flags);
+    if (st == MCCR_STATUS_NOT_FOUND)
+        st = device_load_layout (device);
+    if (st != MCCR_STATUS_OK)
+        goto out;
+
+    device->hid = hid_open_path (device_get_hid_path (device));
     if (!device->hid) {
-        mccr_log ("couldn't open device at path '%s'", device->path);
+        mccr_log ("couldn't open device at path '%s'", device_get_hid_path (device));
         st = MCCR_STATUS_FAILED;
         goto out;
     }
@@ -363,7 +528,9 @@ mccr_device_open (mccr_device_t *device)
         goto out;
     }
 
-    mccr_log ("device at path '%s' now open", device->path);
+    device->reconnect = !!(flags & MCCR_DEVICE_OPEN_FLAGS_RECONNECT);
+
+    mccr_log ("device at path '%s' now open", device_get_hid_path (device));
 
     /* Every successful operation increases refcount */
     mccr_device_ref (device);
@@ -372,10 +539,15 @@ mccr_device_open (mccr_device_t *device)
 out:
     if (st != MCCR_STATUS_OK)
         device_clear_open_info (device);
-    free (hid_descriptor);
     return st;
 }
 
+mccr_status_t
+mccr_device_open (mccr_device_t *device)
+{
+    return mccr_device_open_full (device, MCCR_DEVICE_OPEN_FLAGS_NONE);
+}
+
 bool
 mccr_device_is_open (mccr_device_t *device)
 {
@@ -396,6 +568,171 @@ mccr_device_close (mccr_device_t *device)
     mccr_device_unref (device);
 }
 
+/******************************************************************************/
+/* Device reconnection
+ *
+ * When the device is open with MCCR_DEVICE_OPEN_FLAGS_RECONNECT, a HID I/O
+ * failure closes the HID handle, and the next operations look for the same
+ * reader (same VID/PID and serial number, or the same path if there is no
+ * serial number) to open it again. The report layout and the feature report
+ * context loaded when the device was first open are kept, so rebinding is
+ * just an enumeration and a HID open.
+ *
+ * The HID handle is only closed or replaced once no other thread is using it;
+ * a thread blocked reading from a reader that went away gets an error and
+ * releases it right away.
+ */
+
+#define RECONNECT_INTERVAL_MS 50
+
+static uint64_t
+monotonic_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static bool
+device_rebind (mccr_device_t *device)
+{
+    struct hid_device_info *devs, *cur_dev;
+    bool                    connected;
+
+    pthread_rwlock_wrlock (&device->hid_lock);
+
+    /* Device closed, or already retried by another thread */
+    if (!device->desc || device->hid)
+        goto out;
+
+    devs = hid_enumerate (device->vid, device->pid);
+    for (cur_dev = devs; cur_dev; cur_dev = cur_dev->next) {
+        if (device->serial_number ?
+            (cur_dev->serial_number && wcscmp (cur_dev->serial_number, device->serial_number) == 0) :
+            (strcmp (cur_dev->path, device_get_hid_path (device)) == 0))
+            break;
+    }
+
+    if (cur_dev) {
+        /* The layout verification reads the descriptor from the path */
+        device_join_verify_thread (device);
+
+        /* The device path is never replaced, as it is given to users without
+         * any lock; only the path used to open the HID device is */
+        if (strcmp (cur_dev->path, device_get_hid_path (device)) != 0) {
+            char *path = NULL;
+
+            if (strcmp (cur_dev->path, device->path) == 0 ||
+                (path = strdup (cur_dev->path)) != NULL) {
+                free (device->hid_path);
+                device->hid_path = path;
+            }
+        }
+
+        if (strcmp (cur_dev->path, device_get_hid_path (device)) == 0 &&
+            (device->hid = hid_open_path (device_get_hid_path (device))) != NULL)
+            mccr_log ("device reconnected at path '%s'", device_get_hid_path (device));
+    }
+
+    hid_free_enumeration (devs);
+
+out:
+    connected = !!device->hid;
+    pthread_rwlock_unlock (&device->hid_lock);
+    return connected;
+}
+
+/* Gets the HID handle to use in an I/O operation, rebinding to the reader if
+ * needed; must be released with device_release_hid() */
+static mccr_status_t
+device_acquire_hid (mccr_device_t  *device,
+                    hid_device    **out_hid)
+{
+    for (;;) {
+        pthread_rwlock_rdlock (&device->hid_lock);
+        if (device->hid) {
+            *out_hid = device->hid;
+            return MCCR_STATUS_OK;
+        }
+        pthread_rwlock_unlock (&device->hid_lock);
+
+        if (!device->reconnect)
+            return MCCR_STATUS_NOT_OPEN;
+        if (!device_rebind (device))
+            return MCCR_STATUS_DISCONNECTED;
+    }
+}
+
+static void
+device_release_hid (mccr_device_t *device)
+{
+    pthread_rwlock_unlock (&device->hid_lock);
+}
+
+/* Called after a HID I/O failure with the given handle */
+static void
+device_hid_failed (mccr_device_t *device,
+                   hid_device    *hid)
+{
+    if (!device->reconnect)
+        return;
+
+    pthread_rwlock_wrlock (&device->hid_lock);
+    if (device->hid == hid) {
+        mccr_log ("device at path '%s' disconnected", device_get_hid_path (device));
+        hid_close (device->hid);
+        device->hid = NULL;
+        if (device->input_fd >= 0) {
+            close (device->input_fd);
+            device->input_fd = -1;
+        }
+    }
+    pthread_rwlock_unlock (&device->hid_lock);
+}
+
+/* Commands are never retried after a reconnection, as the reader may have
+ * run them already */
+static mccr_status_t
+device_send_receive (mccr_device_t *device)
+{
+    hid_device    *hid;
+    mccr_status_t  st;
+
+    if ((st = device_acquire_hid (device, &hid)) != MCCR_STATUS_OK)
+        return st;
+    st = mccr_feature_report_send_receive (device->feature_report, hid);
+    device_release_hid (device);
+
+    if (st == MCCR_STATUS_WRITE_FAILED || st == MCCR_STATUS_READ_FAILED)
+        device_hid_failed (device, hid);
+    return st;
+}
+
+bool
+mccr_device_is_connected (mccr_device_t *device)
+{
+    bool connected;
+
+    pthread_rwlock_rdlock (&device->hid_lock);
+    connected = !!device->hid;
+    pthread_rwlock_unlock (&device->hid_lock);
+    return connected;
+}
+
+int
+mccr_device_get_input_fd (mccr_device_t *device)
+{
+    int fd;
+
+    pthread_rwlock_wrlock (&device->hid_lock);
+    if (device->hid && device->input_fd < 0)
+        device->input_fd = mccr_input_monitor_open (device_get_hid_path (device));
+    fd = device->hid ? device->input_fd : -1;
+    pthread_rwlock_unlock (&device->hid_lock);
+    return fd;
+}
+
 /******************************************************************************/
 /* Device commands: reset */
 
@@ -407,7 +744,7 @@ mccr_device_reset (mccr_device_t *device)
 
     mccr_feature_report_reset (device->feature_report);
     mccr_feature_report_set_request (device->feature_report, MCCR_FEATURE_REPORT_COMMAND_RESET_DEVICE, NULL, 0);
-    return mccr_feature_report_send_receive (device->feature_report, device->hid);
+    return device_send_receive (device);
 }
 
 /******************************************************************************/
@@ -437,7 +774,7 @@ common_device_read_property_string (mccr_device_t  *device,
 
     mccr_feature_report_reset (device->feature_report);
     mccr_feature_report_set_request (device->feature_report, MCCR_FEATURE_REPORT_COMMAND_GET_PROPERTY, &property_id, 1);
-    if ((st = mccr_feature_report_send_receive (device->feature_report, device->hid)) != MCCR_STATUS_OK)
+    if ((st = device_send_receive (device)) != MCCR_STATUS_OK)
         return st;
 
     if (out_str) {
@@ -467,7 +804,7 @@ common_device_read_property_byte (mccr_device_t  *device,
 
     mccr_feature_report_reset (device->feature_report);
     mccr_feature_report_set_request (device->feature_report, MCCR_FEATURE_REPORT_COMMAND_GET_PROPERTY, &property_id, 1);
-    if ((st = mccr_feature_report_send_receive (device->feature_report, device->hid)) != MCCR_STATUS_OK)
+    if ((st = device_send_receive (device)) != MCCR_STATUS_OK)
         return st;
 
     if (out_val) {
@@ -594,7 +931,7 @@ mccr_device_get_dukpt_ksn_and_counter (mccr_device_t  *device,
 
     mccr_feature_report_reset (device->feature_report);
     mccr_feature_report_set_request (device->feature_report, MCCR_FEATURE_REPORT_COMMAND_GET_DUKPT_KSN_AND_COUNTER, NULL, 0);
-    if ((st = mccr_feature_report_send_receive (device->feature_report, device->hid)) != MCCR_STATUS_OK)
+    if ((st = device_send_receive (device)) != MCCR_STATUS_OK)
         return st;
 
     mccr_feature_report_get_response (device->feature_report, &response, &response_size);
@@ -636,7 +973,7 @@ mccr_device_set_session_id (mccr_device_t *device,
 
     mccr_feature_report_reset (device->feature_report);
     mccr_feature_report_set_request (device->feature_report, MCCR_FEATURE_REPORT_COMMAND_SET_SESSION_ID, (uint8_t *)&value_be, sizeof (value_be));
-    return mccr_feature_report_send_receive (device->feature_report, device->hid);
+    return device_send_receive (device);
 }
 
 static const char *reader_state_str[] = {
@@ -687,7 +1024,7 @@ mccr_device_get_reader_state (mccr_device_t                  *device,
 
     mccr_feature_report_reset (device->feature_report);
     mccr_feature_report_set_request (device->feature_report, MCCR_FEATURE_REPORT_COMMAND_GET_READER_STATE, NULL, 0);
-    if ((st = mccr_feature_report_send_receive (device->feature_report, device->hid)) != MCCR_STATUS_OK)
+    if ((st = device_send_receive (device)) != MCCR_STATUS_OK)
         return st;
 
     mccr_feature_report_get_response (device->feature_report, &response, &response_size);
@@ -720,7 +1057,7 @@ mccr_device_get_security_level (mccr_device_t         *device,
 
     mccr_feature_report_reset (device->feature_report);
     mccr_feature_report_set_request (device->feature_report, MCCR_FEATURE_REPORT_COMMAND_SET_SECURITY_LEVEL, NULL, 0);
-    if ((st = mccr_feature_report_send_receive (device->feature_report, device->hid)) != MCCR_STATUS_OK)
+    if ((st = device_send_receive (device)) != MCCR_STATUS_OK)
         return st;
 
     mccr_feature_report_get_response (device->feature_report, &response, &response_size);
@@ -752,7 +1089,7 @@ mccr_device_get_encryption_counter (mccr_device_t  *device,
 
     mccr_feature_report_reset (device->feature_report);
     mccr_feature_report_set_request (device->feature_report, MCCR_FEATURE_REPORT_COMMAND_GET_ENCRYPTION_COUNTER, NULL, 0);
-    if ((st = mccr_feature_report_send_receive (device->feature_report, device->hid)) != MCCR_STATUS_OK)
+    if ((st = device_send_receive (device)) != MCCR_STATUS_OK)
         return st;
 
     mccr_feature_report_get_response (device->feature_report, &response, &response_size);
@@ -795,7 +1132,7 @@ mccr_device_get_magtek_update_token (mccr_device_t  *device,
 
     mccr_feature_report_reset (device->feature_report);
     mccr_feature_report_set_request (device->feature_report, MCCR_FEATURE_REPORT_COMMAND_GET_MAGTEK_UPDATE_TOKEN, NULL, 0);
-    if ((st = mccr_feature_report_send_receive (device->feature_report, device->hid)) != MCCR_STATUS_OK)
+    if ((st = device_send_receive (device)) != MCCR_STATUS_OK)
         return st;
 
     mccr_feature_report_get_response (device->feature_report, &response, &response_size);
@@ -835,7 +1172,7 @@ mccr_device_run_generic (mccr_device_t  *device,
 
     mccr_feature_report_reset (device->feature_report);
     mccr_feature_report_set_request (device->feature_report, command_id, blob, blob_size);
-    if ((st = mccr_feature_report_send_receive (device->feature_report, device->hid)) != MCCR_STATUS_OK)
+    if ((st = device_send_receive (device)) != MCCR_STATUS_OK)
         return st;
 
     if (out_blob || out_blob_size) {
@@ -864,6 +1201,7 @@ mccr_device_run_generic (mccr_device_t  *device,
 struct mccr_swipe_report_s {
     mccr_input_report_t              *input_report;
     mccr_report_descriptor_context_t *desc;
+    bool                              duplicate;
 };
 
 void
@@ -874,6 +1212,112 @@ mccr_swipe_report_free (mccr_swipe_report_t *report)
     free (report);
 }
 
+static mccr_status_t
+swipe_report_new (mccr_report_descriptor_context_t  *desc,
+                  const uint8_t                     *data,
+                  size_t                             data_size,
+                  mccr_swipe_report_t              **out_swipe_report)
+{
+    mccr_input_report_t *input_report;
+    mccr_status_t        st;
+
+    input_report = mccr_input_report_new (desc);
+    if (!input_report)
+        return MCCR_STATUS_FAILED;
+
+    if ((st = mccr_input_report_set_data (input_report, data, data_size)) != MCCR_STATUS_OK)
+        goto out;
+
+    *out_swipe_report = (mccr_swipe_report_t *) calloc (sizeof (struct mccr_swipe_report_s), 1);
+    if (!(*out_swipe_report)) {
+        st = MCCR_STATUS_FAILED;
+        goto out;
+    }
+    (*out_swipe_report)->desc = mccr_report_descriptor_context_ref (desc);
+    (*out_swipe_report)->input_report = input_report;
+    input_report = NULL;
+
+out:
+    mccr_input_report_free (input_report);
+    return st;
+}
+
+mccr_status_t
+mccr_swipe_report_new_from_data (const uint8_t        *report_descriptor,
+                                 size_t                report_descriptor_size,
+                                 const uint8_t        *data,
+                                 size_t                data_size,
+                                 mccr_swipe_report_t **out_swipe_report)
+{
+    mccr_report_descriptor_context_t *desc;
+    mccr_status_t                     st;
+
+    assert (out_swipe_report);
+
+    if (!report_descriptor || !report_descriptor_size)
+        return MCCR_STATUS_INVALID_INPUT;
+    if ((st = mccr_parse_report_descriptor (report_descriptor, report_descriptor_size, &desc)) != MCCR_STATUS_OK)
+        return st;
+
+    st = swipe_report_new (desc, data, data_size, out_swipe_report);
+    mccr_report_descriptor_context_unref (desc);
+    return st;
+}
+
+/******************************************************************************/
+/* Report layout */
+
+struct mccr_report_layout_s {
+    mccr_report_descriptor_context_t *desc;
+};
+
+mccr_status_t
+mccr_report_layout_new (const uint8_t         *report_descriptor,
+                        size_t                 report_descriptor_size,
+                        mccr_report_layout_t **out_layout)
+{
+    mccr_report_layout_t *layout;
+    mccr_status_t         st;
+
+    assert (out_layout);
+
+    if (!report_descriptor || !report_descriptor_size)
+        return MCCR_STATUS_INVALID_INPUT;
+
+    if (!(layout = calloc (sizeof (struct mccr_report_layout_s), 1)))
+        return MCCR_STATUS_FAILED;
+
+    if ((st = mccr_parse_report_descriptor (report_descriptor, report_descriptor_size, &layout->desc)) != MCCR_STATUS_OK) {
+        free (layout);
+        return st;
+    }
+
+    *out_layout = layout;
+    return MCCR_STATUS_OK;
+}
+
+void
+mccr_report_layout_free (mccr_report_layout_t *layout)
+{
+    mccr_report_descriptor_context_unref (layout->desc);
+    free (layout);
+}
+
+mccr_status_t
+mccr_swipe_report_new_from_layout (mccr_report_layout_t  *layout,
+                                   const uint8_t         *data,
+                                   size_t                 data_size,
+                                   mccr_swipe_report_t  **out_swipe_report)
+{
+    assert (layout);
+    assert (out_swipe_report);
+
+    return swipe_report_new (layout->desc, data, data_size, out_swipe_report);
+}
+
+/******************************************************************************/
+/* Swipe report contents */
+
 static mccr_status_t
 swipe_report_get_usage (mccr_swipe_report_t  *report,
                         uint8_t               usage_id,
@@ -1072,6 +1516,121 @@ mccr_swipe_report_get_card_encode_type (mccr_swipe_report_t     *report,
     return MCCR_STATUS_OK;
 }
 
+mccr_status_t
+mccr_swipe_report_get_hashed_track_2_data (mccr_swipe_report_t  *report,
+                                           const uint8_t       **out_data)
+{
+    mccr_status_t  st;
+    const uint8_t *usage;
+
+    if ((st = swipe_report_get_usage (report,
+                                      MCCR_INPUT_USAGE_ID_HASHED_TRACK_2_DATA,
+                                      MCCR_HASHED_TRACK_2_DATA_SIZE,
+                                      &usage)) != MCCR_STATUS_OK)
+        return st;
+
+    if (out_data)
+        *out_data = usage;
+
+    return MCCR_STATUS_OK;
+}
+
+mccr_status_t
+mccr_swipe_report_get_device_serial_number (mccr_swipe_report_t  *report,
+                                            const uint8_t       **out_data)
+{
+    mccr_status_t  st;
+    const uint8_t *usage;
+
+    if ((st = swipe_report_get_usage (report,
+                                      MCCR_INPUT_USAGE_ID_DEVICE_SERIAL_NUMBER,
+                                      MCCR_DEVICE_SERIAL_NUMBER_SIZE,
+                                      &usage)) != MCCR_STATUS_OK)
+        return st;
+
+    if (out_data)
+        *out_data = usage;
+
+    return MCCR_STATUS_OK;
+}
+
+mccr_status_t
+mccr_swipe_report_get_dukpt_ksn_and_counter (mccr_swipe_report_t  *report,
+                                             const uint8_t       **out_data)
+{
+    mccr_status_t  st;
+    const uint8_t *usage;
+
+    if ((st = swipe_report_get_usage (report,
+                                      MCCR_INPUT_USAGE_ID_DUKPT_SERIAL_NUMBER_COUNTER,
+                                      MCCR_DUKPT_KSN_AND_COUNTER_SIZE,
+                                      &usage)) != MCCR_STATUS_OK)
+        return st;
+
+    if (out_data)
+        *out_data = usage;
+
+    return MCCR_STATUS_OK;
+}
+
+mccr_status_t
+mccr_swipe_report_get_duplicate (mccr_swipe_report_t *report,
+                                 bool                *out_duplicate)
+{
+    if (out_duplicate)
+        *out_duplicate = report->duplicate;
+    return MCCR_STATUS_OK;
+}
+
+mccr_status_t
+mccr_swipe_report_get_data (mccr_swipe_report_t  *report,
+                            const uint8_t       **out_data,
+                            size_t               *out_data_size)
+{
+    const uint8_t *data;
+    size_t         data_size;
+
+    mccr_input_report_get_data (report->input_report, &data, &data_size);
+
+    if (out_data)
+        *out_data = data;
+    if (out_data_size)
+        *out_data_size = data_size;
+
+    return MCCR_STATUS_OK;
+}
+
+mccr_status_t
+mccr_swipe_report_get_fragment_timing (mccr_swipe_report_t *report,
+                                       unsigned int        *out_n_fragments,
+                                       unsigned int        *out_total_us,
+                                       unsigned int        *out_max_gap_us)
+{
+    unsigned int n_fragments;
+    uint64_t     total_us;
+    uint64_t     max_gap_us;
+
+    mccr_input_report_get_timing (report->input_report, &n_fragments, &total_us, &max_gap_us);
+
+    if (out_n_fragments)
+        *out_n_fragments = n_fragments;
+    if (out_total_us)
+        *out_total_us = (unsigned int) total_us;
+    if (out_max_gap_us)
+        *out_max_gap_us = (unsigned int) max_gap_us;
+
+    return MCCR_STATUS_OK;
+}
+
+mccr_status_t
+mccr_swipe_report_get_timestamp (mccr_swipe_report_t *report,
+                                 uint64_t            *out_timestamp_us)
+{
+    if (out_timestamp_us)
+        *out_timestamp_us = mccr_input_report_get_timestamp (report->input_report);
+    return MCCR_STATUS_OK;
+}
+
 mccr_status_t
 mccr_device_wait_swipe_report (mccr_device_t        *device,
                                int                   timeout_ms,
@@ -1079,15 +1638,71 @@ mccr_device_wait_swipe_report (mccr_device_t        *device,
 {
     mccr_input_report_t *input_report;
     mccr_status_t        st;
+    uint64_t             deadline_ms = 0;
+    bool                 attempted = false;
+    bool                 retried = false;
 
     if (!device->desc)
         return MCCR_STATUS_NOT_OPEN;
 
+    /* Never decode swipes with a built-in layout the device doesn't match */
+    if (device->layout_mismatch)
+        return MCCR_STATUS_UNEXPECTED_FORMAT;
+
     input_report = mccr_input_report_new (device->desc);
     if (!input_report)
         return MCCR_STATUS_FAILED;
 
-    if ((st = mccr_input_report_receive (input_report, device->hid, timeout_ms)) != MCCR_STATUS_OK)
+    if (timeout_ms >= 0)
+        deadline_ms = monotonic_ms () + timeout_ms;
+
+    /* While the reader is away, keep looking for it until the timeout */
+    for (;;) {
+        hid_device *hid;
+        uint64_t    now_ms;
+        int         remaining_ms = timeout_ms;
+        int         delay_ms;
+
+        if ((st = device_acquire_hid (device, &hid)) == MCCR_STATUS_OK) {
+            /* Every receive after the first one waits only for the time left
+             * until the deadline, if any; once there is none left, the reader
+             * is just checked for an already available report, and the
+             * receive times out otherwise */
+            if (timeout_ms >= 0 && attempted) {
+                now_ms = monotonic_ms ();
+                remaining_ms = (now_ms < deadline_ms) ? (int) (deadline_ms - now_ms) : 0;
+            }
+            attempted = true;
+            /* Reports arriving from now on leave the input descriptor
+             * readable, even if read right away below */
+            if (device->input_fd >= 0)
+                mccr_input_monitor_drain (device->input_fd);
+            st = mccr_input_report_receive (input_report, hid, remaining_ms);
+            device_release_hid (device);
+            if (st != MCCR_STATUS_REPORT_FAILED || !device->reconnect)
+                break;
+            device_hid_failed (device, hid);
+            st = MCCR_STATUS_DISCONNECTED;
+            /* The reader may already be back, e.g. if it went away while not
+             * waiting for swipes */
+            if (!retried) {
+                retried = true;
+                continue;
+            }
+        } else if (st != MCCR_STATUS_DISCONNECTED)
+            break;
+
+        delay_ms = RECONNECT_INTERVAL_MS;
+        if (timeout_ms >= 0) {
+            if ((now_ms = monotonic_ms ()) >= deadline_ms)
+                break;
+            if (delay_ms > deadline_ms - now_ms)
+                delay_ms = (int) (deadline_ms - now_ms);
+        }
+        usleep (delay_ms * 1000);
+    }
+
+    if (st != MCCR_STATUS_OK)
         goto out;
 
     if (out_swipe_report) {
@@ -1099,6 +1714,155 @@ mccr_device_wait_swipe_report (mccr_device_t        *device,
         (*out_swipe_report)->desc = mccr_report_descriptor_context_ref (device->desc);
         (*out_swipe_report)->input_report = input_report;
         input_report = NULL;
+
+        /* Readers not reporting the hashed track 2 are never flagged */
+        if (device->dedup)
+            mccr_swipe_dedup_check (device->dedup, *out_swipe_report, &(*out_swipe_report)->duplicate);
+    }
+
+    st = MCCR_STATUS_OK;
+
+out:
+    mccr_input_report_free (input_report);
+    return st;
+}
+
+void
+mccr_device_set_swipe_dedup (mccr_device_t      *device,
+                             mccr_swipe_dedup_t *dedup)
+{
+    if (dedup)
+        mccr_swipe_dedup_ref (dedup);
+    if (device->dedup)
+        mccr_swipe_dedup_unref (device->dedup);
+    device->dedup = dedup;
+}
+
+/******************************************************************************/
+/* Swipe ring */
+
+struct mccr_swipe_ring_s {
+    mccr_shm_ring_t                  *shm;
+    mccr_report_descriptor_context_t *desc;
+};
+
+void
+mccr_swipe_ring_free (mccr_swipe_ring_t *ring)
+{
+    if (!ring)
+        return;
+
+    if (ring->desc)
+        mccr_report_descriptor_context_unref (ring->desc);
+    mccr_shm_ring_free (ring->shm);
+    free (ring);
+}
+
+mccr_status_t
+mccr_swipe_ring_new (mccr_device_t      *device,
+                     unsigned int        n_slots,
+                     mccr_swipe_ring_t **out_ring)
+{
+    mccr_swipe_ring_t *ring;
+    const uint8_t     *layout;
+    size_t             layout_size;
+    mccr_status_t      st;
+
+    if (!device->desc)
+        return MCCR_STATUS_NOT_OPEN;
+
+    ring = calloc (sizeof (struct mccr_swipe_ring_s), 1);
+    if (!ring)
+        return MCCR_STATUS_FAILED;
+    ring->desc = mccr_report_descriptor_context_ref (device->desc);
+
+    /* Consumers load the report layout from the ring itself */
+    mccr_report_descriptor_context_get_layout (ring->desc, &layout, &layout_size);
+    if ((st = mccr_shm_ring_new (n_slots,
+                                 mccr_report_descriptor_get_input_report_size (ring->desc),
+                                 layout, layout_size,
+                                 &ring->shm)) != MCCR_STATUS_OK) {
+        mccr_swipe_ring_free (ring);
+        return st;
+    }
+
+    *out_ring = ring;
+    return MCCR_STATUS_OK;
+}
+
+mccr_status_t
+mccr_swipe_ring_new_from_fd (int                 fd,
+                             mccr_swipe_ring_t **out_ring)
+{
+    mccr_swipe_ring_t *ring;
+    const uint8_t     *layout;
+    size_t             layout_size;
+    mccr_status_t      st;
+
+    ring = calloc (sizeof (struct mccr_swipe_ring_s), 1);
+    if (!ring)
+        return MCCR_STATUS_FAILED;
+
+    if ((st = mccr_shm_ring_new_from_fd (fd, &ring->shm)) != MCCR_STATUS_OK)
+        goto failed;
+
+    /* The layout is loaded once, and shared by all the swipe reports read */
+    mccr_shm_ring_get_blob (ring->shm, &layout, &layout_size);
+    if ((st = mccr_report_descriptor_context_new_from_layout (layout, layout_size, &ring->desc)) != MCCR_STATUS_OK)
+        goto failed;
+
+    if (mccr_report_descriptor_get_input_report_size (ring->desc) != mccr_shm_ring_get_record_size (ring->shm)) {
+        mccr_log ("error: invalid swipe ring: record size doesn't match the report layout");
+        st = MCCR_STATUS_UNEXPECTED_FORMAT;
+        goto failed;
+    }
+
+    *out_ring = ring;
+    return MCCR_STATUS_OK;
+
+failed:
+    mccr_swipe_ring_free (ring);
+    return st;
+}
+
+int
+mccr_swipe_ring_get_fd (mccr_swipe_ring_t *ring)
+{
+    return mccr_shm_ring_get_fd (ring->shm);
+}
+
+mccr_status_t
+mccr_swipe_ring_publish (mccr_swipe_ring_t   *ring,
+                         mccr_swipe_report_t *report)
+{
+    return mccr_input_report_publish (report->input_report, ring->shm);
+}
+
+mccr_status_t
+mccr_swipe_ring_wait_swipe_report (mccr_swipe_ring_t    *ring,
+                                   int                   timeout_ms,
+                                   mccr_swipe_report_t **out_swipe_report,
+                                   unsigned int         *out_n_dropped)
+{
+    mccr_input_report_t *input_report;
+    mccr_status_t        st;
+
+    input_report = mccr_input_report_new (ring->desc);
+    if (!input_report)
+        return MCCR_STATUS_FAILED;
+
+    if ((st = mccr_input_report_receive_from_ring (input_report, ring->shm, timeout_ms, out_n_dropped)) != MCCR_STATUS_OK)
+        goto out;
+
+    if (out_swipe_report) {
+        *out_swipe_report = (mccr_swipe_report_t *) calloc (sizeof (struct mccr_swipe_report_s), 1);
+        if (!(*out_swipe_report)) {
+            st = MCCR_STATUS_FAILED;
+            goto out;
+        }
+        (*out_swipe_report)->desc = mccr_report_descriptor_context_ref (ring->desc);
+        (*out_swipe_report)->input_report = input_report;
+        input_report = NULL;
     }
 
     st = MCCR_STATUS_OK;
@@ -1126,6 +1890,7 @@ mccr_init (void)
 void
 mccr_exit (void)
 {
+    mccr_builtin_layouts_clear ();
     if (hid_exit () < 0)
         mccr_log ("hidapi support finalization failed");
     mccr_log ("mccr support finished");
@@ -0,0 +1,87 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr test helpers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <config.h>
+
+#include <stddef.h>
+
+#include "alloc-hooks.h"
+
+/* Real allocator, exported by glibc */
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void  __libc_free    (void *ptr);
+
+void *malloc  (size_t size);
+void *calloc  (size_t nmemb, size_t size);
+void *realloc (void *ptr, size_t size);
+void  free    (void *ptr);
+
+static volatile unsigned long n_allocs;
+static volatile unsigned long n_frees;
+
+void *
+malloc (size_t size)
+{
+    __sync_fetch_and_add (&n_allocs, 1);
+    return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb,
+        size_t size)
+{
+    __sync_fetch_and_add (&n_allocs, 1);
+    return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void   *ptr,
+         size_t  size)
+{
+    /* Growing or shrinking an existing block is accounted as a new
+     * allocation as well, it may very well be one */
+    __sync_fetch_and_add (&n_allocs, 1);
+    return __libc_realloc (ptr, size);
+}
+
+void
+free (void *ptr)
+{
+    if (ptr)
+        __sync_fetch_and_add (&n_frees, 1);
+    __libc_free (ptr);
+}
+
+unsigned long
+alloc_hooks_get_n_allocs (void)
+{
+    return n_allocs;
+}
+
+unsigned long
+alloc_hooks_get_n_frees (void)
+{
+    return n_frees;
+}
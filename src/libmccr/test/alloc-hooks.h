@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr test helpers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#if !defined ALLOC_HOOKS_H
+# define ALLOC_HOOKS_H
+
+/******************************************************************************/
+/* Allocation counting
+ *
+ * The program linking alloc-hooks.c overrides malloc(), calloc(), realloc()
+ * and free() for itself and for every shared library it loads (libmccr
+ * included), so that the number of heap allocations performed by a given
+ * operation can be measured. glibc is required, as the real allocator is
+ * reached through its __libc_* entry points.
+ */
+
+unsigned long alloc_hooks_get_n_allocs (void);
+unsigned long alloc_hooks_get_n_frees  (void);
+
+#endif /* ALLOC_HOOKS_H */
@@ -0,0 +1,384 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr test helpers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <hidapi.h>
+
+#include <mccr.h>
+
+#include "fake-hidapi.h"
+
+/******************************************************************************/
+/* Report descriptor */
+
+const uint8_t fake_hidapi_report_descriptor[] = {
+    0x06, 0x00, 0xff,       /* Usage Page (Vendor Defined 0xFF00) */
+    0x09, 0x01,             /* Usage (0x01) */
+    0xa1, 0x01,             /* Collection (Application) */
+    0x15, 0x00,             /*   Logical Minimum (0) */
+    0x26, 0xff, 0x00,       /*   Logical Maximum (255) */
+    0x75, 0x08,             /*   Report Size (8) */
+    0x09, 0x20,             /*   Usage (track 1 decode status) */
+    0x09, 0x21,             /*   Usage (track 2 decode status) */
+    0x09, 0x22,             /*   Usage (track 3 decode status) */
+    0x09, 0x28,             /*   Usage (track 1 encrypted data length) */
+    0x09, 0x29,             /*   Usage (track 2 encrypted data length) */
+    0x09, 0x2a,             /*   Usage (track 3 encrypted data length) */
+    0x09, 0x38,             /*   Usage (card encode type) */
+    0x95, 0x07,             /*   Report Count (7) */
+    0x81, 0x02,             /*   Input (Data,Var,Abs) */
+    0x09, 0x30,             /*   Usage (track 1 encrypted data) */
+    0x09, 0x31,             /*   Usage (track 2 encrypted data) */
+    0x09, 0x32,             /*   Usage (track 3 encrypted data) */
+    0x96, 0x50, 0x01,       /*   Report Count (336) */
+    0x82, 0x02, 0x01,       /*   Input (Data,Var,Abs,Buf) */
+    0x09, 0x39,             /*   Usage (card status) */
+    0x95, 0x01,             /*   Report Count (1) */
+    0x81, 0x02,             /*   Input (Data,Var,Abs) */
+    0x09, 0x23,             /*   Usage (magneprint status) */
+    0x95, 0x04,             /*   Report Count (4) */
+    0x81, 0x02,             /*   Input (Data,Var,Abs) */
+    0x09, 0x2b,             /*   Usage (magneprint data length) */
+    0x95, 0x01,             /*   Report Count (1) */
+    0x81, 0x02,             /*   Input (Data,Var,Abs) */
+    0x09, 0x33,             /*   Usage (magneprint data) */
+    0x95, 0x80,             /*   Report Count (128) */
+    0x82, 0x02, 0x01,       /*   Input (Data,Var,Abs,Buf) */
+    0x09, 0x40,             /*   Usage (device serial number) */
+    0x95, 0x10,             /*   Report Count (16) */
+    0x82, 0x02, 0x01,       /*   Input (Data,Var,Abs,Buf) */
+    0x09, 0x42,             /*   Usage (reader encryption status) */
+    0x95, 0x02,             /*   Report Count (2) */
+    0x81, 0x02,             /*   Input (Data,Var,Abs) */
+    0x09, 0x46,             /*   Usage (DUKPT serial number/counter) */
+    0x95, 0x0a,             /*   Report Count (10) */
+    0x82, 0x02, 0x01,       /*   Input (Data,Var,Abs,Buf) */
+    0x09, 0x47,             /*   Usage (track 1 masked data length) */
+    0x09, 0x48,             /*   Usage (track 2 masked data length) */
+    0x09, 0x49,             /*   Usage (track 3 masked data length) */
+    0x95, 0x03,             /*   Report Count (3) */
+    0x81, 0x02,             /*   Input (Data,Var,Abs) */
+    0x09, 0x4a,             /*   Usage (track 1 masked data) */
+    0x09, 0x4b,             /*   Usage (track 2 masked data) */
+    0x09, 0x4c,             /*   Usage (track 3 masked data) */
+    0x96, 0x50, 0x01,       /*   Report Count (336) */
+    0x82, 0x02, 0x01,       /*   Input (Data,Var,Abs,Buf) */
+    0x09, 0x50,             /*   Usage (encrypted session id) */
+    0x95, 0x08,             /*   Report Count (8) */
+    0x82, 0x02, 0x01,       /*   Input (Data,Var,Abs,Buf) */
+    0x09, 0x51,             /*   Usage (track 1 absolute data length) */
+    0x09, 0x52,             /*   Usage (track 2 absolute data length) */
+    0x09, 0x53,             /*   Usage (track 3 absolute data length) */
+    0x09, 0x54,             /*   Usage (magneprint absolute data length) */
+    0x95, 0x04,             /*   Report Count (4) */
+    0x81, 0x02,             /*   Input (Data,Var,Abs) */
+    0x09, 0x55,             /*   Usage (encryption counter) */
+    0x95, 0x03,             /*   Report Count (3) */
+    0x81, 0x02,             /*   Input (Data,Var,Abs) */
+    0x09, 0x56,             /*   Usage (magnesafe version number) */
+    0x95, 0x08,             /*   Report Count (8) */
+    0x82, 0x02, 0x01,       /*   Input (Data,Var,Abs,Buf) */
+    0x09, 0x57,             /*   Usage (hashed track 2 data) */
+    0x95, 0x14,             /*   Report Count (20) */
+    0x82, 0x02, 0x01,       /*   Input (Data,Var,Abs,Buf) */
+    0x09, 0x20,             /*   Usage (command message) */
+    0x95, 0x3c,             /*   Report Count (60) */
+    0xb1, 0x02,             /*   Feature (Data,Var,Abs) */
+    0xc0,                   /* End Collection */
+};
+
+const size_t fake_hidapi_report_descriptor_size = sizeof (fake_hidapi_report_descriptor);
+
+/* The device may be unplugged and plugged back from another thread */
+static pthread_mutex_t fake_device_path_lock = PTHREAD_MUTEX_INITIALIZER;
+static char            fake_device_path_buffer[64] = FAKE_HIDAPI_DEVICE_PATH;
+static char           *fake_device_path = fake_device_path_buffer;
+
+static bool
+fake_device_path_matches (const char *path)
+{
+    bool match;
+
+    pthread_mutex_lock (&fake_device_path_lock);
+    match = (fake_device_path && strcmp (path, fake_device_path) == 0);
+    pthread_mutex_unlock (&fake_device_path_lock);
+    return match;
+}
+
+/* Provided by the hidapi backend in libmccr, overridden here */
+mccr_status_t mccr_read_report_descriptor      (const char  *path,
+                                                uint8_t    **out_desc,
+                                                size_t      *out_desc_size);
+mccr_status_t mccr_read_report_descriptor_size (const char  *path,
+                                                size_t      *out_desc_size);
+
+mccr_status_t
+mccr_read_report_descriptor (const char  *path,
+                             uint8_t    **out_desc,
+                             size_t      *out_desc_size)
+{
+    if (!fake_device_path_matches (path))
+        return MCCR_STATUS_NOT_FOUND;
+
+    *out_desc = malloc (sizeof (fake_hidapi_report_descriptor));
+    if (!(*out_desc))
+        return MCCR_STATUS_FAILED;
+    memcpy (*out_desc, fake_hidapi_report_descriptor, sizeof (fake_hidapi_report_descriptor));
+    *out_desc_size = sizeof (fake_hidapi_report_descriptor);
+    return MCCR_STATUS_OK;
+}
+
+mccr_status_t
+mccr_read_report_descriptor_size (const char *path,
+                                  size_t     *out_desc_size)
+{
+    if (!fake_device_path_matches (path))
+        return MCCR_STATUS_NOT_FOUND;
+
+    *out_desc_size = sizeof (fake_hidapi_report_descriptor);
+    return MCCR_STATUS_OK;
+}
+
+/******************************************************************************/
+/* Device */
+
+struct hid_device_ {
+    /* input report */
+    const uint8_t *input_report;
+    size_t         input_report_size;
+    size_t         input_report_offset;
+    /* last feature report request */
+    uint8_t        command;
+    uint8_t        command_data[2];
+    /* unplugged since open */
+    volatile int   stale;
+};
+
+static struct hid_device_ fake_device;
+static bool               fake_device_open;
+
+void
+fake_hidapi_set_input_report (const uint8_t *data,
+                              size_t         size)
+{
+    fake_device.input_report        = data;
+    fake_device.input_report_size   = size;
+    fake_device.input_report_offset = 0;
+}
+
+void
+fake_hidapi_set_path (const char *path)
+{
+    pthread_mutex_lock (&fake_device_path_lock);
+    __atomic_store_n (&fake_device.stale, 1, __ATOMIC_RELAXED);
+    if (path) {
+        snprintf (fake_device_path_buffer, sizeof (fake_device_path_buffer), "%s", path);
+        fake_device_path = fake_device_path_buffer;
+    } else
+        fake_device_path = NULL;
+    pthread_mutex_unlock (&fake_device_path_lock);
+}
+
+int
+hid_init (void)
+{
+    return 0;
+}
+
+int
+hid_exit (void)
+{
+    return 0;
+}
+
+struct hid_device_info *
+hid_enumerate (unsigned short vendor_id,
+               unsigned short product_id)
+{
+    struct hid_device_info *info;
+    char                   *path = NULL;
+
+    if ((vendor_id && vendor_id != FAKE_HIDAPI_DEVICE_VID) ||
+        (product_id && product_id != FAKE_HIDAPI_DEVICE_PID))
+        return NULL;
+
+    pthread_mutex_lock (&fake_device_path_lock);
+    if (fake_device_path)
+        path = strdup (fake_device_path);
+    pthread_mutex_unlock (&fake_device_path_lock);
+    if (!path)
+        return NULL;
+
+    info = calloc (sizeof (struct hid_device_info), 1);
+    if (!info) {
+        free (path);
+        return NULL;
+    }
+
+    info->path                = path;
+    info->vendor_id           = FAKE_HIDAPI_DEVICE_VID;
+    info->product_id          = FAKE_HIDAPI_DEVICE_PID;
+    info->serial_number       = wcsdup (L"B4F2A1C");
+    info->manufacturer_string = wcsdup (L"Mag-Tek");
+    info->product_string      = wcsdup (L"USB Swipe Reader");
+    return info;
+}
+
+void
+hid_free_enumeration (struct hid_device_info *devs)
+{
+    while (devs) {
+        struct hid_device_info *next;
+
+        next = devs->next;
+        free (devs->path);
+        free (devs->serial_number);
+        free (devs->manufacturer_string);
+        free (devs->product_string);
+        free (devs);
+        devs = next;
+    }
+}
+
+hid_device *
+hid_open_path (const char *path)
+{
+    if (fake_device_open || !fake_device_path_matches (path))
+        return NULL;
+
+    fake_device_open = true;
+    __atomic_store_n (&fake_device.stale, 0, __ATOMIC_RELAXED);
+    return &fake_device;
+}
+
+void
+hid_close (hid_device *device)
+{
+    if (device == &fake_device)
+        fake_device_open = false;
+}
+
+const wchar_t *
+hid_error (hid_device *device)
+{
+    return L"fake device error";
+}
+
+int
+hid_read_timeout (hid_device    *device,
+                  unsigned char *data,
+                  size_t         length,
+                  int            milliseconds)
+{
+    size_t n_read;
+
+    if (__atomic_load_n (&device->stale, __ATOMIC_RELAXED))
+        return -1;
+
+    /* No swipe available, as if the timeout had elapsed */
+    if (!device->input_report)
+        return 0;
+
+    n_read = device->input_report_size - device->input_report_offset;
+    if (n_read > length)
+        n_read = length;
+
+    memcpy (data, &device->input_report[device->input_report_offset], n_read);
+    device->input_report_offset += n_read;
+    if (device->input_report_offset == device->input_report_size)
+        device->input_report_offset = 0;
+    return (int) n_read;
+}
+
+int
+hid_send_feature_report (hid_device          *device,
+                         const unsigned char *data,
+                         size_t               length)
+{
+    /* report id, command, data length, data */
+    if (__atomic_load_n (&device->stale, __ATOMIC_RELAXED) || length < 5)
+        return -1;
+
+    device->command         = data[1];
+    device->command_data[0] = data[3];
+    device->command_data[1] = data[4];
+    return (int) length;
+}
+
+static size_t
+fake_response_size (hid_device *device)
+{
+    switch (device->command) {
+    case 0x00: /* get property */
+        switch (device->command_data[0]) {
+        case 0x02: /* polling interval */
+        case 0x05: /* track id enable */
+        case 0x0a: /* max packet size */
+            return 1;
+        default:
+            return 7;
+        }
+    case 0x09: /* get dukpt ksn and counter */
+        return 10;
+    case 0x14: /* get reader state */
+        return 2;
+    case 0x15: /* get security level */
+        return 1;
+    case 0x1c: /* get encryption counter */
+        return 19;
+    case 0x19: /* get magtek update token */
+        return 36;
+    default:
+        return 0;
+    }
+}
+
+int
+hid_get_feature_report (hid_device    *device,
+                        unsigned char *data,
+                        size_t         length)
+{
+    size_t response_size;
+    size_t i;
+
+    if (__atomic_load_n (&device->stale, __ATOMIC_RELAXED))
+        return -1;
+
+    response_size = fake_response_size (device);
+    if (length < 3 + response_size)
+        return -1;
+
+    /* report id, result code, data length, data */
+    data[0] = 0x00;
+    data[1] = 0x00;
+    data[2] = (uint8_t) response_size;
+    for (i = 0; i < response_size; i++)
+        data[3 + i] = '0' + (i % 10);
+    return (int) length;
+}
@@ -0,0 +1,59 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr test helpers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#if !defined FAKE_HIDAPI_H
+# define FAKE_HIDAPI_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/******************************************************************************/
+/* Fake transport
+ *
+ * The program linking fake-hidapi.c provides its own implementation of the
+ * hidapi methods used by libmccr, as well as of the report descriptor
+ * loading method of the hidapi backend. When the program is linked with
+ * -export-dynamic, these take precedence over the real ones, so libmccr
+ * ends up talking to a single in-memory MagTek reader instead of to real
+ * hardware.
+ */
+
+#define FAKE_HIDAPI_DEVICE_PATH "/dev/hidraw-fake0"
+#define FAKE_HIDAPI_DEVICE_VID  0x0801
+#define FAKE_HIDAPI_DEVICE_PID  0x0011
+
+/* MagneSafe V5 swipe reader report descriptor */
+extern const uint8_t fake_hidapi_report_descriptor[];
+extern const size_t  fake_hidapi_report_descriptor_size;
+
+/* Contents returned by the next input report reads. The given buffer is not
+ * copied, so it must be valid as long as the fake device is in use. */
+void fake_hidapi_set_input_report (const uint8_t *data,
+                                   size_t         size);
+
+/* Unplugs the fake device (NULL path), or plugs it back at the given path.
+ * While unplugged, the device isn't enumerated and all I/O through the HID
+ * handles open before fails, even after plugging it back. */
+void fake_hidapi_set_path (const char *path);
+
+#endif /* FAKE_HIDAPI_H */
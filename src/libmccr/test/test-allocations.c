@@ -0,0 +1,309 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr allocation audit
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+/*
+ * Steady-state allocation audit: every audited API is run a number of times
+ * against the fake reader once warmed up, and the test fails if the average
+ * number of heap allocations per operation goes above the budget declared
+ * for that API.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+#include <mccr.h>
+#include "mccr-log.h"
+#include "mccr-hid.h"
+
+#include "alloc-hooks.h"
+#include "fake-hidapi.h"
+
+#define N_WARMUP_OPERATIONS 10
+#define N_AUDIT_OPERATIONS  1000
+
+/* Exit code telling the automake test driver the test was skipped */
+#define EXIT_SKIP 77
+
+/* Log messages are printed by the C library, which allocates, grows and
+ * shrinks the string as it sees fit (glibc currently takes 2 allocations
+ * for a short message and 6 for a long hex dump). Budgets with logs are
+ * upper bounds: the allocations done by libmccr itself, plus this many per
+ * message printed, so that they don't depend on the C library version. */
+#define LOG_MESSAGE_ALLOCS_MAX 8
+#define LOG_BUDGET(own, n_messages) ((own) + (n_messages) * LOG_MESSAGE_ALLOCS_MAX)
+
+static mccr_device_t       *device;
+static mccr_swipe_report_t *swipe_report;
+static mccr_swipe_ring_t   *ring;
+static mccr_swipe_ring_t   *ring_consumer;
+static uint8_t             *swipe_data;
+
+/******************************************************************************/
+/* Audited operations */
+
+static void
+log_handler_discard (pthread_t   thread_id,
+                     const char *message)
+{
+}
+
+static void
+run_wait_swipe_report (void)
+{
+    mccr_swipe_report_t *report;
+
+    if (mccr_device_wait_swipe_report (device, 0, &report) == MCCR_STATUS_OK)
+        mccr_swipe_report_free (report);
+}
+
+static void
+run_swipe_report_decode (void)
+{
+    mccr_card_encode_type_t  encode_type;
+    uint8_t                  status, length;
+    const uint8_t           *data;
+
+    mccr_swipe_report_get_card_encode_type (swipe_report, &encode_type);
+    mccr_swipe_report_get_track_2_decode_status (swipe_report, &status);
+    mccr_swipe_report_get_track_2_encrypted_data_length (swipe_report, &length);
+    mccr_swipe_report_get_track_2_encrypted_data (swipe_report, &data);
+    mccr_swipe_report_get_track_2_masked_data_length (swipe_report, &length);
+    mccr_swipe_report_get_track_2_masked_data (swipe_report, &data);
+}
+
+static void
+run_swipe_ring_publish (void)
+{
+    mccr_swipe_ring_publish (ring, swipe_report);
+}
+
+static void
+run_swipe_ring_wait (void)
+{
+    mccr_swipe_report_t *report;
+
+    mccr_swipe_ring_publish (ring, swipe_report);
+    if (mccr_swipe_ring_wait_swipe_report (ring_consumer, 0, &report, NULL) == MCCR_STATUS_OK)
+        mccr_swipe_report_free (report);
+}
+
+static void
+run_get_dukpt_ksn_and_counter (void)
+{
+    uint8_t *ksn = NULL;
+    size_t   ksn_size;
+
+    mccr_device_get_dukpt_ksn_and_counter (device, &ksn, &ksn_size);
+    free (ksn);
+}
+
+static void
+run_run_generic (void)
+{
+    static const uint8_t property_id = 0x00;
+    uint8_t *response = NULL;
+    size_t   response_size;
+
+    mccr_device_run_generic (device, 0x00, &property_id, 1, &response, &response_size);
+    free (response);
+}
+
+static void
+run_run_generic_no_response (void)
+{
+    mccr_device_run_generic (device, 0x02, NULL, 0, NULL, NULL);
+}
+
+static void
+run_set_session_id (void)
+{
+    mccr_device_set_session_id (device, 0x0102030405060708);
+}
+
+static void
+run_log (void)
+{
+    mccr_log ("read %u bytes... (total %u)", 64, 887);
+}
+
+static void
+run_log_raw (void)
+{
+    static const uint8_t mem[64] = { 0 };
+
+    mccr_log_raw ("<<<<", mem, sizeof (mem));
+}
+
+typedef struct {
+    const char          *name;
+    void               (*run) (void);
+    mccr_log_handler_t   log_handler;
+    /* Maximum number of heap allocations per operation */
+    unsigned int         budget;
+} audit_t;
+
+static const audit_t audits[] = {
+    /* The input report buffer, its context and the swipe report returned
+     * to the caller */
+    { "mccr_device_wait_swipe_report",         run_wait_swipe_report,         NULL,                3  },
+    { "mccr_swipe_report_get_*",               run_swipe_report_decode,       NULL,                0  },
+    { "mccr_swipe_ring_publish",               run_swipe_ring_publish,        NULL,                0  },
+    /* Same as when waiting for the device */
+    { "mccr_swipe_ring_wait_swipe_report",     run_swipe_ring_wait,           NULL,                3  },
+    /* The KSN and counter buffer returned to the caller */
+    { "mccr_device_get_dukpt_ksn_and_counter", run_get_dukpt_ksn_and_counter, NULL,                1  },
+    /* The response buffer returned to the caller */
+    { "mccr_device_run_generic",               run_run_generic,               NULL,                1  },
+    { "mccr_device_run_generic (no response)", run_run_generic_no_response,   NULL,                0  },
+    { "mccr_device_set_session_id",            run_set_session_id,            NULL,                0  },
+    /* Log messages are only built when a handler is set; hex dumps take one
+     * more string of their own before being printed */
+    { "mccr_log (no handler)",                 run_log,                       NULL,                0  },
+    { "mccr_log",                              run_log,                       log_handler_discard, LOG_BUDGET (0, 1) },
+    { "mccr_log_raw",                          run_log_raw,                   log_handler_discard, LOG_BUDGET (1, 1) },
+    /* The swipe report allocations, plus two messages and a hex dump */
+    { "mccr_device_wait_swipe_report (logs)",  run_wait_swipe_report,         log_handler_discard, LOG_BUDGET (4, 3) },
+};
+
+/******************************************************************************/
+
+static bool
+setup (void)
+{
+    mccr_report_descriptor_context_t *desc;
+    size_t                            swipe_data_size;
+    uint32_t                          offset_bits;
+
+    /* Build a swipe report with a valid card encode type, which is the only
+     * contents the decode audit needs */
+    if (mccr_parse_report_descriptor (fake_hidapi_report_descriptor,
+                                      fake_hidapi_report_descriptor_size,
+                                      &desc) != MCCR_STATUS_OK)
+        return false;
+
+    swipe_data_size = mccr_report_descriptor_get_input_report_size (desc);
+    swipe_data = calloc (swipe_data_size, 1);
+    if (swipe_data && mccr_report_descriptor_get_input_report_usage (desc, MCCR_INPUT_USAGE_ID_CARD_ENCODE_TYPE, &offset_bits, NULL))
+        swipe_data[offset_bits / 8] = MCCR_CARD_ENCODE_TYPE_ISO_ABA;
+    mccr_report_descriptor_context_unref (desc);
+    if (!swipe_data)
+        return false;
+
+    fake_hidapi_set_input_report (swipe_data, swipe_data_size);
+
+    if (mccr_init () != MCCR_STATUS_OK)
+        return false;
+    if (!(device = mccr_device_new (FAKE_HIDAPI_DEVICE_PATH)))
+        return false;
+    if (mccr_device_open (device) != MCCR_STATUS_OK)
+        return false;
+    if (mccr_device_wait_swipe_report (device, 0, &swipe_report) != MCCR_STATUS_OK)
+        return false;
+    if (mccr_swipe_ring_new (device, 16, &ring) != MCCR_STATUS_OK ||
+        mccr_swipe_ring_new_from_fd (mccr_swipe_ring_get_fd (ring), &ring_consumer) != MCCR_STATUS_OK)
+        return false;
+
+    return true;
+}
+
+static void
+teardown (void)
+{
+    mccr_swipe_ring_free (ring_consumer);
+    mccr_swipe_ring_free (ring);
+    if (swipe_report)
+        mccr_swipe_report_free (swipe_report);
+    if (device) {
+        mccr_device_close (device);
+        mccr_device_unref (device);
+    }
+    mccr_exit ();
+    free (swipe_data);
+}
+
+static bool
+run_audit (const audit_t *audit)
+{
+    unsigned int  i;
+    unsigned long n_allocs;
+
+    mccr_log_set_handler (audit->log_handler);
+
+    for (i = 0; i < N_WARMUP_OPERATIONS; i++)
+        audit->run ();
+
+    n_allocs = alloc_hooks_get_n_allocs ();
+    for (i = 0; i < N_AUDIT_OPERATIONS; i++)
+        audit->run ();
+    n_allocs = alloc_hooks_get_n_allocs () - n_allocs;
+
+    mccr_log_set_handler (NULL);
+
+    if (n_allocs > (unsigned long) audit->budget * N_AUDIT_OPERATIONS) {
+        printf ("FAIL: %s: %.2f allocs/op (budget %u)\n",
+                audit->name, (double) n_allocs / N_AUDIT_OPERATIONS, audit->budget);
+        return false;
+    }
+
+    printf ("PASS: %s: %.2f allocs/op (budget %u)\n",
+            audit->name, (double) n_allocs / N_AUDIT_OPERATIONS, audit->budget);
+    return true;
+}
+
+int main (int argc, char **argv)
+{
+    unsigned long   n_allocs;
+    unsigned int    i;
+    void *volatile  mem;
+    int             ret = EXIT_SUCCESS;
+
+    /* Make sure the allocator hooks are in place, or there is nothing to
+     * audit */
+    n_allocs = alloc_hooks_get_n_allocs ();
+    mem = malloc (1);
+    free (mem);
+    if (alloc_hooks_get_n_allocs () == n_allocs) {
+        printf ("SKIP: allocator hooks unavailable\n");
+        return EXIT_SKIP;
+    }
+
+    if (!setup ()) {
+        printf ("FAIL: couldn't setup fake device\n");
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+
+    for (i = 0; i < sizeof (audits) / sizeof (audits[0]); i++) {
+        if (!run_audit (&audits[i]))
+            ret = EXIT_FAILURE;
+    }
+
+out:
+    teardown ();
+    return ret;
+}
@@ -0,0 +1,219 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr device reconnection tests
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+/*
+ * Device reconnection tests: the fake reader is unplugged and plugged back,
+ * possibly at a different path, and the device operations are checked to
+ * fail while it's away and to work again with the same device once it's
+ * back.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+#include <mccr.h>
+#include "mccr-hid.h"
+
+#include "fake-hidapi.h"
+
+#define OTHER_DEVICE_PATH "/dev/hidraw-fake1"
+#define REPLUG_DELAY_MS   200
+
+static uint8_t *swipe_data;
+
+/******************************************************************************/
+
+static bool
+check_status (const char    *name,
+              mccr_status_t  st,
+              mccr_status_t  expected)
+{
+    if (st != expected) {
+        printf ("FAIL: %s: %s, expected %s\n", name, mccr_status_to_string (st), mccr_status_to_string (expected));
+        return false;
+    }
+    printf ("PASS: %s\n", name);
+    return true;
+}
+
+static mccr_status_t
+read_property (mccr_device_t *device)
+{
+    uint8_t polling_interval;
+
+    return mccr_device_read_polling_interval (device, &polling_interval);
+}
+
+static mccr_status_t
+wait_swipe (mccr_device_t *device,
+            int            timeout_ms)
+{
+    mccr_swipe_report_t *report;
+    mccr_status_t        st;
+
+    st = mccr_device_wait_swipe_report (device, timeout_ms, &report);
+    if (st == MCCR_STATUS_OK)
+        mccr_swipe_report_free (report);
+    return st;
+}
+
+static void *
+replug_thread (void *user_data)
+{
+    usleep (REPLUG_DELAY_MS * 1000);
+    fake_hidapi_set_path ((const char *) user_data);
+    return NULL;
+}
+
+static bool
+test_reconnect (mccr_device_t *device)
+{
+    pthread_t thread;
+    bool      ok = true;
+
+    ok &= check_status ("connected", read_property (device), MCCR_STATUS_OK);
+
+    /* Unplugged: the failed operation detects it, the next ones report it */
+    fake_hidapi_set_path (NULL);
+    ok &= check_status ("command while unplugged", read_property (device), MCCR_STATUS_WRITE_FAILED);
+    ok &= check_status ("command while disconnected", read_property (device), MCCR_STATUS_DISCONNECTED);
+    ok &= check_status ("swipe while disconnected", wait_swipe (device, 0), MCCR_STATUS_DISCONNECTED);
+    if (mccr_device_is_connected (device)) {
+        printf ("FAIL: device reported connected\n");
+        ok = false;
+    }
+
+    /* Plugged back at another path, found by serial number */
+    fake_hidapi_set_path (OTHER_DEVICE_PATH);
+    ok &= check_status ("command once plugged back", read_property (device), MCCR_STATUS_OK);
+    if (!mccr_device_is_connected (device)) {
+        printf ("FAIL: device not rebound to new path\n");
+        ok = false;
+    }
+    /* The path given to users is kept, as they may be still using it */
+    if (strcmp (mccr_device_get_path (device), FAKE_HIDAPI_DEVICE_PATH) != 0) {
+        printf ("FAIL: device path changed\n");
+        ok = false;
+    }
+
+    /* Unplugged and plugged back while not in use: the swipe wait recovers
+     * right away */
+    fake_hidapi_set_path (OTHER_DEVICE_PATH);
+    ok &= check_status ("swipe after replug", wait_swipe (device, 0), MCCR_STATUS_OK);
+
+    /* Plugged back while waiting for a swipe */
+    fake_hidapi_set_path (NULL);
+    if (pthread_create (&thread, NULL, replug_thread, FAKE_HIDAPI_DEVICE_PATH) != 0)
+        return false;
+    ok &= check_status ("swipe while replugging", wait_swipe (device, 5 * REPLUG_DELAY_MS), MCCR_STATUS_OK);
+    pthread_join (thread, NULL);
+
+    /* Not plugged back before the timeout */
+    fake_hidapi_set_path (NULL);
+    ok &= check_status ("swipe timeout while unplugged", wait_swipe (device, REPLUG_DELAY_MS / 2), MCCR_STATUS_DISCONNECTED);
+    fake_hidapi_set_path (FAKE_HIDAPI_DEVICE_PATH);
+
+    return ok;
+}
+
+static bool
+test_no_reconnect (mccr_device_t *device)
+{
+    bool ok = true;
+
+    fake_hidapi_set_path (NULL);
+    ok &= check_status ("no reconnect: command while unplugged", read_property (device), MCCR_STATUS_WRITE_FAILED);
+    fake_hidapi_set_path (FAKE_HIDAPI_DEVICE_PATH);
+    ok &= check_status ("no reconnect: command once plugged back", read_property (device), MCCR_STATUS_WRITE_FAILED);
+    ok &= check_status ("no reconnect: swipe once plugged back", wait_swipe (device, 0), MCCR_STATUS_REPORT_FAILED);
+    return ok;
+}
+
+/******************************************************************************/
+
+static bool
+run_test (mccr_device_open_flags_t   flags,
+          bool                     (*test) (mccr_device_t *device))
+{
+    mccr_device_t *device;
+    bool           ok = false;
+
+    if (!(device = mccr_device_new (FAKE_HIDAPI_DEVICE_PATH))) {
+        printf ("FAIL: couldn't create fake device\n");
+        return false;
+    }
+    if (mccr_device_open_full (device, flags) != MCCR_STATUS_OK)
+        printf ("FAIL: couldn't open fake device\n");
+    else {
+        ok = test (device);
+        mccr_device_close (device);
+    }
+    mccr_device_unref (device);
+    return ok;
+}
+
+static bool
+setup (void)
+{
+    mccr_report_descriptor_context_t *desc;
+    size_t                            swipe_data_size;
+
+    if (mccr_parse_report_descriptor (fake_hidapi_report_descriptor,
+                                      fake_hidapi_report_descriptor_size,
+                                      &desc) != MCCR_STATUS_OK)
+        return false;
+
+    swipe_data_size = mccr_report_descriptor_get_input_report_size (desc);
+    mccr_report_descriptor_context_unref (desc);
+    if (!(swipe_data = calloc (swipe_data_size, 1)))
+        return false;
+    fake_hidapi_set_input_report (swipe_data, swipe_data_size);
+
+    return (mccr_init () == MCCR_STATUS_OK);
+}
+
+int main (int argc, char **argv)
+{
+    int ret = EXIT_SUCCESS;
+
+    if (!setup ()) {
+        printf ("FAIL: couldn't setup fake device\n");
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (!run_test (MCCR_DEVICE_OPEN_FLAGS_RECONNECT, test_reconnect) ||
+        !run_test (MCCR_DEVICE_OPEN_FLAGS_NONE, test_no_reconnect))
+        ret = EXIT_FAILURE;
+
+out:
+    mccr_exit ();
+    free (swipe_data);
+    return ret;
+}
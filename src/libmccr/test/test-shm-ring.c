@@ -0,0 +1,419 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr shared memory ring tests
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+/*
+ * Shared memory ring tests: records are published by a producer ring and read
+ * back from consumer rings mapping the same memfd, checking their contents and
+ * the number of records reported as dropped. Each record is filled with its
+ * own sequence number, so a torn record is one with different values in it.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <mccr.h>
+#include "mccr-shm-ring.h"
+
+#define N_SLOTS           4
+#define RECORD_SIZE       64
+#define N_RACE_RECORDS    200000
+#define RACE_RECORD_SIZE  4096
+#define WAKEUP_TIMEOUT_S  5
+
+/******************************************************************************/
+
+static void
+record_fill (uint8_t  *record,
+             size_t    record_size,
+             uint32_t  seq)
+{
+    size_t i;
+
+    for (i = 0; i < record_size; i += sizeof (uint32_t))
+        memcpy (&record[i], &seq, sizeof (uint32_t));
+}
+
+/* Returns the sequence number in the record, or -1 if it is torn */
+static int64_t
+record_check (const uint8_t *record,
+              size_t         record_size)
+{
+    uint32_t seq;
+    uint32_t value;
+    size_t   i;
+
+    memcpy (&seq, record, sizeof (uint32_t));
+    for (i = sizeof (uint32_t); i < record_size; i += sizeof (uint32_t)) {
+        memcpy (&value, &record[i], sizeof (uint32_t));
+        if (value != seq)
+            return -1;
+    }
+    return seq;
+}
+
+static bool
+publish (mccr_shm_ring_t *producer,
+         uint32_t         seq)
+{
+    uint8_t record[RECORD_SIZE];
+
+    record_fill (record, sizeof (record), seq);
+    return (mccr_shm_ring_publish (producer, record, sizeof (record), seq) == MCCR_STATUS_OK);
+}
+
+static bool
+expect_read (const char      *description,
+             mccr_shm_ring_t *consumer,
+             uint32_t         expected_seq,
+             unsigned int     expected_n_dropped)
+{
+    uint8_t       record[RECORD_SIZE];
+    uint64_t      timestamp_us = 0;
+    unsigned int  n_dropped = 0;
+    mccr_status_t st;
+
+    if ((st = mccr_shm_ring_read (consumer, 0, record, &timestamp_us, &n_dropped)) != MCCR_STATUS_OK) {
+        printf ("FAIL: %s: read failed: %s\n", description, mccr_status_to_string (st));
+        return false;
+    }
+    if (record_check (record, sizeof (record)) != expected_seq || timestamp_us != expected_seq) {
+        printf ("FAIL: %s: record %u expected\n", description, expected_seq);
+        return false;
+    }
+    if (n_dropped != expected_n_dropped) {
+        printf ("FAIL: %s: %u dropped expected, got %u\n", description, expected_n_dropped, n_dropped);
+        return false;
+    }
+    return true;
+}
+
+static bool
+expect_empty (const char      *description,
+              mccr_shm_ring_t *consumer,
+              int              timeout_ms)
+{
+    uint8_t       record[RECORD_SIZE];
+    unsigned int  n_dropped = 0;
+    mccr_status_t st;
+
+    if ((st = mccr_shm_ring_read (consumer, timeout_ms, record, NULL, &n_dropped)) != MCCR_STATUS_TIMED_OUT) {
+        printf ("FAIL: %s: timeout expected, got %s\n", description, mccr_status_to_string (st));
+        return false;
+    }
+    if (n_dropped) {
+        printf ("FAIL: %s: none dropped expected, got %u\n", description, n_dropped);
+        return false;
+    }
+    return true;
+}
+
+static bool
+setup (size_t            record_size,
+       mccr_shm_ring_t **out_producer,
+       mccr_shm_ring_t **out_consumer)
+{
+    static const uint8_t blob[] = { 0x01, 0x02, 0x03 };
+    const uint8_t       *consumer_blob;
+    size_t               consumer_blob_size;
+
+    *out_producer = NULL;
+    *out_consumer = NULL;
+
+    if (mccr_shm_ring_new (N_SLOTS, record_size, blob, sizeof (blob), out_producer) != MCCR_STATUS_OK ||
+        mccr_shm_ring_new_from_fd (mccr_shm_ring_get_fd (*out_producer), out_consumer) != MCCR_STATUS_OK) {
+        printf ("FAIL: couldn't setup ring\n");
+        return false;
+    }
+
+    mccr_shm_ring_get_blob (*out_consumer, &consumer_blob, &consumer_blob_size);
+    if (consumer_blob_size != sizeof (blob) || memcmp (consumer_blob, blob, sizeof (blob)) != 0 ||
+        mccr_shm_ring_get_record_size (*out_consumer) != record_size) {
+        printf ("FAIL: consumer ring doesn't match producer ring\n");
+        return false;
+    }
+    return true;
+}
+
+static void
+teardown (mccr_shm_ring_t *producer,
+          mccr_shm_ring_t *consumer)
+{
+    mccr_shm_ring_free (consumer);
+    mccr_shm_ring_free (producer);
+}
+
+/******************************************************************************/
+/* Tests */
+
+/* Slot indices wrap several times with the consumer keeping up */
+static bool
+test_wraparound (void)
+{
+    mccr_shm_ring_t *producer;
+    mccr_shm_ring_t *consumer;
+    bool             ok = true;
+    uint32_t         seq;
+
+    if (!setup (RECORD_SIZE, &producer, &consumer)) {
+        teardown (producer, consumer);
+        return false;
+    }
+
+    ok &= expect_empty ("wraparound: empty", consumer, 0);
+    for (seq = 0; ok && seq < 5 * N_SLOTS; seq++) {
+        ok &= publish (producer, seq);
+        /* Two records at a time, so the ring is never overrun */
+        if (seq % 2)
+            ok &= (expect_read ("wraparound", consumer, seq - 1, 0) &&
+                   expect_read ("wraparound", consumer, seq, 0));
+    }
+    ok &= expect_empty ("wraparound: all read", consumer, 0);
+
+    teardown (producer, consumer);
+    if (ok)
+        printf ("PASS: wraparound\n");
+    return ok;
+}
+
+/* A consumer not reading for a while loses the oldest records, and is told
+ * how many in the next read only */
+static bool
+test_overrun (void)
+{
+    mccr_shm_ring_t *producer;
+    mccr_shm_ring_t *consumer;
+    bool             ok = true;
+    uint32_t         seq;
+
+    if (!setup (RECORD_SIZE, &producer, &consumer)) {
+        teardown (producer, consumer);
+        return false;
+    }
+
+    for (seq = 0; seq < N_SLOTS; seq++)
+        ok &= publish (producer, seq);
+    ok &= expect_read ("overrun: ring full", consumer, 0, 0);
+
+    /* Records 1 to 3 pending; publishing 4 to 9 leaves only the last ones
+     * in the ring, so records 1 to 5 are lost */
+    for (; seq < 10; seq++)
+        ok &= publish (producer, seq);
+    ok &= expect_read ("overrun: oldest kept", consumer, 6, 5);
+    ok &= expect_read ("overrun: next", consumer, 7, 0);
+    ok &= expect_read ("overrun: next", consumer, 8, 0);
+    ok &= expect_read ("overrun: last", consumer, 9, 0);
+    ok &= expect_empty ("overrun: all read", consumer, 0);
+
+    /* A consumer created afterwards only gets new records */
+    mccr_shm_ring_free (consumer);
+    consumer = NULL;
+    if (mccr_shm_ring_new_from_fd (mccr_shm_ring_get_fd (producer), &consumer) != MCCR_STATUS_OK) {
+        printf ("FAIL: overrun: couldn't create late consumer\n");
+        ok = false;
+    } else {
+        ok &= expect_empty ("overrun: late consumer", consumer, 0);
+        ok &= publish (producer, seq);
+        ok &= expect_read ("overrun: late consumer", consumer, seq, 0);
+    }
+
+    teardown (producer, consumer);
+    if (ok)
+        printf ("PASS: overrun\n");
+    return ok;
+}
+
+typedef struct {
+    mccr_shm_ring_t *producer;
+    bool             ok;
+} race_context_t;
+
+static void *
+race_producer_thread (void *user_data)
+{
+    race_context_t *ctx = user_data;
+    uint8_t        *record;
+    uint32_t        seq;
+
+    record = malloc (RACE_RECORD_SIZE);
+    for (seq = 0; record && seq < N_RACE_RECORDS; seq++) {
+        record_fill (record, RACE_RECORD_SIZE, seq);
+        if (mccr_shm_ring_publish (ctx->producer, record, RACE_RECORD_SIZE, seq) != MCCR_STATUS_OK)
+            break;
+    }
+    ctx->ok = (seq == N_RACE_RECORDS);
+    free (record);
+    return NULL;
+}
+
+/* Records are published as fast as possible while being read: slots are
+ * overwritten during the copy, and those reads must be dropped and retried
+ * with the next record instead of returning a torn one. Every record must
+ * also be either read or reported as dropped. */
+static bool
+test_torn_read (void)
+{
+    mccr_shm_ring_t *producer;
+    mccr_shm_ring_t *consumer;
+    race_context_t   ctx;
+    pthread_t        thread;
+    uint8_t         *record;
+    int64_t          expected_seq = 0;
+    unsigned long    n_read = 0;
+    bool             ok = true;
+
+    record = malloc (RACE_RECORD_SIZE);
+    if (!record || !setup (RACE_RECORD_SIZE, &producer, &consumer)) {
+        teardown (producer, consumer);
+        free (record);
+        return false;
+    }
+
+    ctx.producer = producer;
+    ctx.ok       = false;
+    if (pthread_create (&thread, NULL, race_producer_thread, &ctx) != 0) {
+        printf ("FAIL: torn read: couldn't create producer thread\n");
+        teardown (producer, consumer);
+        free (record);
+        return false;
+    }
+
+    while (expected_seq < N_RACE_RECORDS) {
+        unsigned int  n_dropped;
+        uint64_t      timestamp_us;
+        int64_t       seq;
+
+        if (mccr_shm_ring_read (consumer, WAKEUP_TIMEOUT_S * 1000, record, &timestamp_us, &n_dropped) != MCCR_STATUS_OK) {
+            printf ("FAIL: torn read: record %ld never read\n", (long) expected_seq);
+            ok = false;
+            break;
+        }
+        if ((seq = record_check (record, RACE_RECORD_SIZE)) < 0 || (uint64_t) seq != timestamp_us) {
+            printf ("FAIL: torn read: torn record returned after record %ld\n", (long) expected_seq - 1);
+            ok = false;
+            break;
+        }
+        if (seq != expected_seq + n_dropped) {
+            printf ("FAIL: torn read: record %ld returned after %u dropped, record %ld expected\n",
+                    (long) seq, n_dropped, (long) (expected_seq + n_dropped));
+            ok = false;
+            break;
+        }
+        expected_seq = seq + 1;
+        n_read++;
+    }
+
+    pthread_join (thread, NULL);
+    ok &= ctx.ok;
+
+    teardown (producer, consumer);
+    free (record);
+    if (ok)
+        printf ("PASS: torn read (%lu/%u records read)\n", n_read, N_RACE_RECORDS);
+    return ok;
+}
+
+/* The consumer in a child process sleeps in the futex of its own mapping, and
+ * must be woken up when the parent publishes through the producer mapping */
+static bool
+test_wakeup (void)
+{
+    mccr_shm_ring_t *producer = NULL;
+    int              sync_pipe[2];
+    pid_t            pid;
+    int              status = 0;
+    char             c;
+    bool             ok = true;
+
+    if (mccr_shm_ring_new (N_SLOTS, RECORD_SIZE, NULL, 0, &producer) != MCCR_STATUS_OK || pipe (sync_pipe) < 0) {
+        printf ("FAIL: wakeup: couldn't setup ring\n");
+        mccr_shm_ring_free (producer);
+        return false;
+    }
+
+    if ((pid = fork ()) < 0) {
+        printf ("FAIL: wakeup: couldn't fork\n");
+        mccr_shm_ring_free (producer);
+        return false;
+    }
+
+    if (pid == 0) {
+        mccr_shm_ring_t *consumer;
+        uint8_t          record[RECORD_SIZE];
+
+        /* Killed if never woken up */
+        alarm (WAKEUP_TIMEOUT_S);
+        close (sync_pipe[0]);
+        if (mccr_shm_ring_new_from_fd (mccr_shm_ring_get_fd (producer), &consumer) != MCCR_STATUS_OK)
+            _exit (EXIT_FAILURE);
+        if (write (sync_pipe[1], "", 1) != 1)
+            _exit (EXIT_FAILURE);
+        if (mccr_shm_ring_read (consumer, -1, record, NULL, NULL) != MCCR_STATUS_OK ||
+            record_check (record, sizeof (record)) != 42)
+            _exit (EXIT_FAILURE);
+        _exit (EXIT_SUCCESS);
+    }
+
+    close (sync_pipe[1]);
+    if (read (sync_pipe[0], &c, 1) != 1) {
+        printf ("FAIL: wakeup: consumer not created\n");
+        ok = false;
+    } else {
+        /* Give the child time to go to sleep before publishing */
+        usleep (100000);
+        ok &= publish (producer, 42);
+    }
+    close (sync_pipe[0]);
+
+    if (waitpid (pid, &status, 0) != pid || !WIFEXITED (status) || WEXITSTATUS (status) != EXIT_SUCCESS) {
+        printf ("FAIL: wakeup: consumer %s\n",
+                (WIFSIGNALED (status) && WTERMSIG (status) == SIGALRM) ? "never woken up" : "failed");
+        ok = false;
+    }
+
+    mccr_shm_ring_free (producer);
+    if (ok)
+        printf ("PASS: wakeup\n");
+    return ok;
+}
+
+/******************************************************************************/
+
+int main (int argc, char **argv)
+{
+    bool ok = true;
+
+    ok &= test_wraparound ();
+    ok &= test_overrun ();
+    ok &= test_torn_read ();
+    ok &= test_wakeup ();
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,306 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr duplicate swipe detection tests
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+/*
+ * Duplicate swipe detection tests: swipe reports with given hashed track 2
+ * data and device serial numbers are received from the fake reader, and
+ * whether they are flagged as duplicates is compared with the expected
+ * results.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+#include <mccr.h>
+#include "mccr-hid.h"
+
+#include "fake-hidapi.h"
+
+#define N_RANDOM_SWIPES  10000
+#define N_RANDOM_CARDS   24
+#define MAX_SWIPES       8
+
+static mccr_device_t *device;
+static uint8_t       *swipe_data;
+static size_t         swipe_data_size;
+static uint32_t       hashed_track_2_offset;
+static uint32_t       serial_number_offset;
+
+/******************************************************************************/
+
+/* Receives a swipe of the given card in the given reader, and returns whether
+ * it was flagged as duplicate */
+static bool
+swipe (uint8_t card,
+       uint8_t reader,
+       bool   *out_duplicate)
+{
+    mccr_swipe_report_t *report;
+
+    memset (&swipe_data[hashed_track_2_offset], 0, MCCR_HASHED_TRACK_2_DATA_SIZE);
+    memset (&swipe_data[serial_number_offset], 0, MCCR_DEVICE_SERIAL_NUMBER_SIZE);
+    /* Card 0 means no track 2 data */
+    if (card)
+        memset (&swipe_data[hashed_track_2_offset], card, MCCR_HASHED_TRACK_2_DATA_SIZE);
+    swipe_data[serial_number_offset] = reader;
+    fake_hidapi_set_input_report (swipe_data, swipe_data_size);
+
+    if (mccr_device_wait_swipe_report (device, 0, &report) != MCCR_STATUS_OK)
+        return false;
+    mccr_swipe_report_get_duplicate (report, out_duplicate);
+    mccr_swipe_report_free (report);
+    return true;
+}
+
+static bool
+expect_swipe (const char *description,
+              uint8_t     card,
+              uint8_t     reader,
+              bool        expected)
+{
+    bool duplicate;
+
+    if (!swipe (card, reader, &duplicate)) {
+        printf ("FAIL: %s: couldn't get swipe report\n", description);
+        return false;
+    }
+    if (duplicate != expected) {
+        printf ("FAIL: %s: %s expected\n", description, expected ? "duplicate" : "no duplicate");
+        return false;
+    }
+    printf ("PASS: %s\n", description);
+    return true;
+}
+
+static bool
+set_dedup (unsigned int window_ms,
+           unsigned int max_swipes)
+{
+    mccr_swipe_dedup_t *dedup;
+
+    if (!(dedup = mccr_swipe_dedup_new (window_ms, max_swipes)))
+        return false;
+    mccr_device_set_swipe_dedup (device, dedup);
+    mccr_swipe_dedup_unref (dedup);
+    return true;
+}
+
+/******************************************************************************/
+/* Tests */
+
+static bool
+test_basic (void)
+{
+    bool ok = true;
+
+    if (!set_dedup (60000, MAX_SWIPES))
+        return false;
+
+    ok &= expect_swipe ("first swipe",                 1, 1, false);
+    ok &= expect_swipe ("same card, same reader",      1, 1, true);
+    ok &= expect_swipe ("same card, other reader",     1, 2, false);
+    ok &= expect_swipe ("other card, same reader",     2, 1, false);
+    ok &= expect_swipe ("same card swiped third time", 1, 1, true);
+    ok &= expect_swipe ("no track 2 data",             0, 1, false);
+    ok &= expect_swipe ("no track 2 data again",       0, 1, false);
+    return ok;
+}
+
+static bool
+test_window (void)
+{
+    bool ok = true;
+
+    if (!set_dedup (50, MAX_SWIPES))
+        return false;
+
+    ok &= expect_swipe ("first swipe in window",       3, 1, false);
+    ok &= expect_swipe ("same card within window",     3, 1, true);
+    usleep (100000);
+    ok &= expect_swipe ("same card after window",      3, 1, false);
+    return ok;
+}
+
+/* Reports created from data have no timestamp, so the check time is used */
+static bool
+test_window_no_timestamp (void)
+{
+    mccr_swipe_dedup_t  *dedup;
+    mccr_swipe_report_t *report = NULL;
+    bool                 duplicate[3] = { false, false, false };
+    bool                 ok = true;
+    unsigned int         i;
+
+    if (!(dedup = mccr_swipe_dedup_new (50, MAX_SWIPES)))
+        return false;
+
+    memset (&swipe_data[hashed_track_2_offset], 5, MCCR_HASHED_TRACK_2_DATA_SIZE);
+    memset (&swipe_data[serial_number_offset], 0, MCCR_DEVICE_SERIAL_NUMBER_SIZE);
+    swipe_data[serial_number_offset] = 1;
+
+    for (i = 0; ok && i < 3; i++) {
+        /* The last one is checked once the window is over */
+        if (i == 2)
+            usleep (100000);
+        ok = (mccr_swipe_report_new_from_data (fake_hidapi_report_descriptor,
+                                               fake_hidapi_report_descriptor_size,
+                                               swipe_data,
+                                               swipe_data_size,
+                                               &report) == MCCR_STATUS_OK &&
+              mccr_swipe_dedup_check (dedup, report, &duplicate[i]) == MCCR_STATUS_OK);
+        if (report)
+            mccr_swipe_report_free (report);
+        report = NULL;
+    }
+    mccr_swipe_dedup_unref (dedup);
+
+    if (!ok) {
+        printf ("FAIL: no timestamp: couldn't check swipe report\n");
+        return false;
+    }
+    if (duplicate[0] || !duplicate[1] || duplicate[2]) {
+        printf ("FAIL: no timestamp: unexpected duplicate flags\n");
+        return false;
+    }
+    printf ("PASS: no timestamp\n");
+    return true;
+}
+
+static bool
+test_no_dedup (void)
+{
+    bool ok = true;
+
+    mccr_device_set_swipe_dedup (device, NULL);
+    ok &= expect_swipe ("no detector",                 4, 1, false);
+    ok &= expect_swipe ("no detector, same card",      4, 1, false);
+    return ok;
+}
+
+/* Random swipes compared with a simple model: with a window long enough,
+ * a swipe is a duplicate if the card is one of the last accepted ones */
+static bool
+test_random (void)
+{
+    uint8_t      accepted[MAX_SWIPES];
+    unsigned int n_accepted = 0;
+    unsigned int i, j;
+
+    if (!set_dedup (3600000, MAX_SWIPES))
+        return false;
+
+    srand (1);
+    for (i = 0; i < N_RANDOM_SWIPES; i++) {
+        uint8_t card;
+        bool    duplicate;
+        bool    expected = false;
+
+        card = 1 + (rand () % N_RANDOM_CARDS);
+        for (j = 0; j < n_accepted && !expected; j++)
+            expected = (accepted[j] == card);
+
+        if (!swipe (card, 1, &duplicate) || duplicate != expected) {
+            printf ("FAIL: random swipes: unexpected result in swipe %u\n", i);
+            return false;
+        }
+
+        if (!expected) {
+            if (n_accepted == MAX_SWIPES)
+                memmove (&accepted[0], &accepted[1], --n_accepted);
+            accepted[n_accepted++] = card;
+        }
+    }
+
+    printf ("PASS: random swipes\n");
+    return true;
+}
+
+/******************************************************************************/
+
+static bool
+setup (void)
+{
+    mccr_report_descriptor_context_t *desc;
+    bool                              found;
+
+    if (mccr_parse_report_descriptor (fake_hidapi_report_descriptor,
+                                      fake_hidapi_report_descriptor_size,
+                                      &desc) != MCCR_STATUS_OK)
+        return false;
+
+    swipe_data_size = mccr_report_descriptor_get_input_report_size (desc);
+    found = (mccr_report_descriptor_get_input_report_usage (desc, MCCR_INPUT_USAGE_ID_HASHED_TRACK_2_DATA, &hashed_track_2_offset, NULL) &&
+             mccr_report_descriptor_get_input_report_usage (desc, MCCR_INPUT_USAGE_ID_DEVICE_SERIAL_NUMBER, &serial_number_offset, NULL));
+    mccr_report_descriptor_context_unref (desc);
+    if (!found)
+        return false;
+
+    hashed_track_2_offset /= 8;
+    serial_number_offset  /= 8;
+    if (!(swipe_data = calloc (swipe_data_size, 1)))
+        return false;
+
+    if (mccr_init () != MCCR_STATUS_OK)
+        return false;
+    if (!(device = mccr_device_new (FAKE_HIDAPI_DEVICE_PATH)))
+        return false;
+    if (mccr_device_open (device) != MCCR_STATUS_OK)
+        return false;
+
+    return true;
+}
+
+static void
+teardown (void)
+{
+    if (device) {
+        mccr_device_close (device);
+        mccr_device_unref (device);
+    }
+    mccr_exit ();
+    free (swipe_data);
+}
+
+int main (int argc, char **argv)
+{
+    int ret = EXIT_SUCCESS;
+
+    if (!setup ()) {
+        printf ("FAIL: couldn't setup fake device\n");
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+
+    if (!test_basic () || !test_window () || !test_window_no_timestamp () || !test_no_dedup () || !test_random ())
+        ret = EXIT_FAILURE;
+
+out:
+    teardown ();
+    return ret;
+}
@@ -0,0 +1,220 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr swipe report tests
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+/*
+ * Swipe reports created from recorded raw data: a report is built with known
+ * track 2 data and DUKPT KSN, loaded back with the fake reader descriptor, and
+ * the contents read are compared with the original ones. Reports with no
+ * descriptor, or not matching its input report size, must be refused. The
+ * same is done for reports created from a descriptor parsed once.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <mccr.h>
+#include "mccr-hid.h"
+
+#include "fake-hidapi.h"
+
+static const uint8_t track_2[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+static const uint8_t ksn[MCCR_DUKPT_KSN_AND_COUNTER_SIZE] = {
+    0xff, 0xff, 0x98, 0x76, 0x54, 0x32, 0x10, 0xe0, 0x00, 0x2a
+};
+
+/******************************************************************************/
+
+static bool
+set_usage (mccr_report_descriptor_context_t *desc,
+           uint8_t                           usage_id,
+           uint8_t                          *data,
+           const uint8_t                    *value,
+           size_t                            value_size)
+{
+    uint32_t offset_bits, size_bits;
+
+    if (!mccr_report_descriptor_get_input_report_usage (desc, usage_id, &offset_bits, &size_bits) ||
+        value_size > size_bits / 8)
+        return false;
+    memcpy (&data[offset_bits / 8], value, value_size);
+    return true;
+}
+
+static uint8_t *
+build_report (size_t *out_data_size)
+{
+    mccr_report_descriptor_context_t *desc;
+    uint8_t                          *data;
+    uint8_t                           length = sizeof (track_2);
+    bool                              built;
+
+    if (mccr_parse_report_descriptor (fake_hidapi_report_descriptor,
+                                      fake_hidapi_report_descriptor_size,
+                                      &desc) != MCCR_STATUS_OK)
+        return NULL;
+
+    *out_data_size = mccr_report_descriptor_get_input_report_size (desc);
+    data = calloc (*out_data_size, 1);
+    built = (data &&
+             set_usage (desc, MCCR_INPUT_USAGE_ID_TRACK_2_ENCRYPTED_DATA_LENGTH, data, &length, 1) &&
+             set_usage (desc, MCCR_INPUT_USAGE_ID_TRACK_2_ENCRYPTED_DATA, data, track_2, sizeof (track_2)) &&
+             set_usage (desc, MCCR_INPUT_USAGE_ID_DUKPT_SERIAL_NUMBER_COUNTER, data, ksn, sizeof (ksn)));
+    mccr_report_descriptor_context_unref (desc);
+    if (!built) {
+        free (data);
+        return NULL;
+    }
+    return data;
+}
+
+static bool
+report_matches (mccr_swipe_report_t *report)
+{
+    uint8_t        length;
+    const uint8_t *value;
+
+    return (mccr_swipe_report_get_track_2_encrypted_data_length (report, &length) == MCCR_STATUS_OK &&
+            length == sizeof (track_2) &&
+            mccr_swipe_report_get_track_2_encrypted_data (report, &value) == MCCR_STATUS_OK &&
+            memcmp (value, track_2, sizeof (track_2)) == 0 &&
+            mccr_swipe_report_get_dukpt_ksn_and_counter (report, &value) == MCCR_STATUS_OK &&
+            memcmp (value, ksn, sizeof (ksn)) == 0);
+}
+
+static bool
+check_report (const char    *name,
+              const uint8_t *report_descriptor,
+              size_t         report_descriptor_size,
+              const uint8_t *data,
+              size_t         data_size)
+{
+    mccr_swipe_report_t *report;
+    mccr_status_t        st;
+    bool                 success;
+
+    if ((st = mccr_swipe_report_new_from_data (report_descriptor, report_descriptor_size, data, data_size, &report)) != MCCR_STATUS_OK) {
+        printf ("FAIL: %s: couldn't create swipe report: %s\n", name, mccr_status_to_string (st));
+        return false;
+    }
+
+    success = report_matches (report);
+    mccr_swipe_report_free (report);
+
+    printf ("%s: %s\n", success ? "PASS" : "FAIL", name);
+    return success;
+}
+
+static bool
+check_invalid (const char    *name,
+               const uint8_t *report_descriptor,
+               size_t         report_descriptor_size,
+               const uint8_t *data,
+               size_t         data_size)
+{
+    mccr_swipe_report_t *report;
+    mccr_status_t        st;
+
+    st = mccr_swipe_report_new_from_data (report_descriptor, report_descriptor_size, data, data_size, &report);
+    if (st == MCCR_STATUS_OK)
+        mccr_swipe_report_free (report);
+    if (st != MCCR_STATUS_INVALID_INPUT) {
+        printf ("FAIL: %s: %s\n", name, mccr_status_to_string (st));
+        return false;
+    }
+
+    printf ("PASS: %s\n", name);
+    return true;
+}
+
+/* Several reports are created with the same layout, and stay valid once the
+ * layout is freed */
+static bool
+check_layout (const char    *name,
+              const uint8_t *data,
+              size_t         data_size)
+{
+    mccr_report_layout_t *layout;
+    mccr_swipe_report_t  *reports[2] = { NULL, NULL };
+    mccr_swipe_report_t  *invalid;
+    mccr_status_t         st;
+    unsigned int          i;
+    bool                  success = true;
+
+    if ((st = mccr_report_layout_new (fake_hidapi_report_descriptor, fake_hidapi_report_descriptor_size, &layout)) != MCCR_STATUS_OK) {
+        printf ("FAIL: %s: couldn't create report layout: %s\n", name, mccr_status_to_string (st));
+        return false;
+    }
+
+    for (i = 0; i < 2; i++) {
+        if ((st = mccr_swipe_report_new_from_layout (layout, data, data_size, &reports[i])) != MCCR_STATUS_OK) {
+            printf ("FAIL: %s: couldn't create swipe report: %s\n", name, mccr_status_to_string (st));
+            success = false;
+        }
+    }
+
+    st = mccr_swipe_report_new_from_layout (layout, data, data_size - 1, &invalid);
+    if (st == MCCR_STATUS_OK)
+        mccr_swipe_report_free (invalid);
+    if (st != MCCR_STATUS_INVALID_INPUT) {
+        printf ("FAIL: %s: invalid size: %s\n", name, mccr_status_to_string (st));
+        success = false;
+    }
+
+    mccr_report_layout_free (layout);
+
+    for (i = 0; i < 2; i++) {
+        if (!reports[i])
+            continue;
+        success &= report_matches (reports[i]);
+        mccr_swipe_report_free (reports[i]);
+    }
+
+    printf ("%s: %s\n", success ? "PASS" : "FAIL", name);
+    return success;
+}
+
+int main (int argc, char **argv)
+{
+    uint8_t *data;
+    size_t   data_size;
+    int      ret = EXIT_SUCCESS;
+
+    if (!(data = build_report (&data_size))) {
+        printf ("FAIL: couldn't build swipe report\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!check_report ("report descriptor", fake_hidapi_report_descriptor, fake_hidapi_report_descriptor_size, data, data_size) ||
+        !check_invalid ("no descriptor", NULL, 0, data, data_size) ||
+        !check_invalid ("invalid size", fake_hidapi_report_descriptor, fake_hidapi_report_descriptor_size, data, data_size - 1) ||
+        !check_layout ("report layout", data, data_size))
+        ret = EXIT_FAILURE;
+
+    free (data);
+    mccr_exit ();
+    return ret;
+}
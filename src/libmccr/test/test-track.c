@@ -0,0 +1,338 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmccr track parsing tests
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+/*
+ * Track parsing tests: known tracks of each format are parsed, and the status
+ * and fields found are compared with the expected ones. The character scan
+ * works in blocks, so validation is also checked with the offending character
+ * at every position of a track.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <mccr.h>
+
+/******************************************************************************/
+
+typedef struct {
+    mccr_track_field_t  field;
+    const char         *value;
+} expected_field_t;
+
+typedef struct {
+    const char               *name;
+    mccr_card_encode_type_t   encode_type;
+    unsigned int              track_number;
+    mccr_track_parse_flags_t  flags;
+    const char               *data;
+    /* Append a valid (or an invalid) LRC character */
+    int                       lrc;
+    mccr_status_t             status;
+    expected_field_t          fields[8];
+} test_case_t;
+
+#define LRC_NONE    0
+#define LRC_VALID   1
+#define LRC_INVALID 2
+
+static const test_case_t test_cases[] = {
+    {
+        "iso track 1", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 1, MCCR_TRACK_PARSE_FLAGS_NONE,
+        "%B4111111111111111^DOE/JOHN^2512101123456789?", LRC_VALID, MCCR_STATUS_OK,
+        {
+            { MCCR_TRACK_FIELD_FORMAT_CODE,        "B"                },
+            { MCCR_TRACK_FIELD_PAN,                "4111111111111111" },
+            { MCCR_TRACK_FIELD_NAME,               "DOE/JOHN"         },
+            { MCCR_TRACK_FIELD_EXPIRATION_DATE,    "2512"             },
+            { MCCR_TRACK_FIELD_SERVICE_CODE,       "101"              },
+            { MCCR_TRACK_FIELD_DISCRETIONARY_DATA, "123456789"        },
+            { MCCR_TRACK_FIELD_LAST }
+        }
+    },
+    {
+        "iso track 1 masked", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 1, MCCR_TRACK_PARSE_FLAGS_MASKED,
+        "%B4111********1111^DOE/JOHN^2512101*********?", LRC_INVALID, MCCR_STATUS_OK,
+        {
+            { MCCR_TRACK_FIELD_PAN,                "4111********1111" },
+            { MCCR_TRACK_FIELD_DISCRETIONARY_DATA, "*********"        },
+            { MCCR_TRACK_FIELD_LAST }
+        }
+    },
+    {
+        "iso track 1 without expiration", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 1, MCCR_TRACK_PARSE_FLAGS_NONE,
+        "%B4111111111111111^DOE/JOHN^^101?", LRC_NONE, MCCR_STATUS_OK,
+        {
+            { MCCR_TRACK_FIELD_EXPIRATION_DATE,    ""    },
+            { MCCR_TRACK_FIELD_SERVICE_CODE,       "101" },
+            { MCCR_TRACK_FIELD_DISCRETIONARY_DATA, ""    },
+            { MCCR_TRACK_FIELD_LAST }
+        }
+    },
+    {
+        "iso track 1 bad lrc", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 1, MCCR_TRACK_PARSE_FLAGS_NONE,
+        "%B4111111111111111^DOE/JOHN^2512101123456789?", LRC_INVALID, MCCR_STATUS_UNEXPECTED_FORMAT,
+    },
+    {
+        "iso track 1 lowercase", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 1, MCCR_TRACK_PARSE_FLAGS_NONE,
+        "%B4111111111111111^doe/john^2512101123456789?", LRC_NONE, MCCR_STATUS_UNEXPECTED_FORMAT,
+    },
+    {
+        "iso track 1 no name", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 1, MCCR_TRACK_PARSE_FLAGS_NONE,
+        "%B4111111111111111^2512101123456789?", LRC_NONE, MCCR_STATUS_UNEXPECTED_FORMAT,
+    },
+    {
+        "iso track 2", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 2, MCCR_TRACK_PARSE_FLAGS_NONE,
+        ";4111111111111111=25121011234567890?", LRC_VALID, MCCR_STATUS_OK,
+        {
+            { MCCR_TRACK_FIELD_PAN,                "4111111111111111" },
+            { MCCR_TRACK_FIELD_EXPIRATION_DATE,    "2512"             },
+            { MCCR_TRACK_FIELD_SERVICE_CODE,       "101"              },
+            { MCCR_TRACK_FIELD_DISCRETIONARY_DATA, "1234567890"       },
+            { MCCR_TRACK_FIELD_NAME,               ""                 },
+            { MCCR_TRACK_FIELD_LAST }
+        }
+    },
+    {
+        "iso track 2 masked", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 2, MCCR_TRACK_PARSE_FLAGS_MASKED,
+        ";4111********1111=2512**********?", LRC_NONE, MCCR_STATUS_OK,
+        {
+            { MCCR_TRACK_FIELD_PAN,                "4111********1111" },
+            { MCCR_TRACK_FIELD_EXPIRATION_DATE,    "2512"             },
+            { MCCR_TRACK_FIELD_SERVICE_CODE,       "***"              },
+            { MCCR_TRACK_FIELD_LAST }
+        }
+    },
+    {
+        "iso track 2 mask not allowed", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 2, MCCR_TRACK_PARSE_FLAGS_NONE,
+        ";4111********1111=2512**********?", LRC_NONE, MCCR_STATUS_UNEXPECTED_FORMAT,
+    },
+    {
+        "iso track 2 no end sentinel", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 2, MCCR_TRACK_PARSE_FLAGS_NONE,
+        ";4111111111111111=25121011234567890", LRC_NONE, MCCR_STATUS_UNEXPECTED_FORMAT,
+    },
+    {
+        "iso track 2 wrong start sentinel", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 2, MCCR_TRACK_PARSE_FLAGS_NONE,
+        "%4111111111111111=25121011234567890?", LRC_NONE, MCCR_STATUS_UNEXPECTED_FORMAT,
+    },
+    {
+        "iso track 2 pan too long", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 2, MCCR_TRACK_PARSE_FLAGS_NONE,
+        ";41111111111111111111=2512101?", LRC_NONE, MCCR_STATUS_UNEXPECTED_FORMAT,
+    },
+    {
+        "iso track 3", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 3, MCCR_TRACK_PARSE_FLAGS_NONE,
+        ";014111111111111111=724724100000000000030300?", LRC_VALID, MCCR_STATUS_OK,
+        {
+            { MCCR_TRACK_FIELD_FORMAT_CODE,        "01"                       },
+            { MCCR_TRACK_FIELD_PAN,                "4111111111111111"         },
+            { MCCR_TRACK_FIELD_DISCRETIONARY_DATA, "724724100000000000030300" },
+            { MCCR_TRACK_FIELD_LAST }
+        }
+    },
+    {
+        "aamva track 1", MCCR_CARD_ENCODE_TYPE_AAMVA, 1, MCCR_TRACK_PARSE_FLAGS_NONE,
+        "%CASACRAMENTO^DOE$JOHN$^123 MAIN ST^?", LRC_VALID, MCCR_STATUS_OK,
+        {
+            { MCCR_TRACK_FIELD_STATE,   "CA"          },
+            { MCCR_TRACK_FIELD_CITY,    "SACRAMENTO"  },
+            { MCCR_TRACK_FIELD_NAME,    "DOE$JOHN$"   },
+            { MCCR_TRACK_FIELD_ADDRESS, "123 MAIN ST" },
+            { MCCR_TRACK_FIELD_LAST }
+        }
+    },
+    {
+        "aamva track 1 long city", MCCR_CARD_ENCODE_TYPE_AAMVA, 1, MCCR_TRACK_PARSE_FLAGS_NONE,
+        "%TXSOUTH PADRE ISDOE$JANE^1 BEACH RD^?", LRC_NONE, MCCR_STATUS_OK,
+        {
+            { MCCR_TRACK_FIELD_STATE,   "TX"            },
+            { MCCR_TRACK_FIELD_CITY,    "SOUTH PADRE I" },
+            { MCCR_TRACK_FIELD_NAME,    "SDOE$JANE"     },
+            { MCCR_TRACK_FIELD_ADDRESS, "1 BEACH RD"    },
+            { MCCR_TRACK_FIELD_LAST }
+        }
+    },
+    {
+        "aamva track 2", MCCR_CARD_ENCODE_TYPE_AAMVA, 2, MCCR_TRACK_PARSE_FLAGS_NONE,
+        ";6360141234567=2604198001011234?", LRC_VALID, MCCR_STATUS_OK,
+        {
+            { MCCR_TRACK_FIELD_IIN,                "636014"   },
+            { MCCR_TRACK_FIELD_ID_NUMBER,          "1234567"  },
+            { MCCR_TRACK_FIELD_EXPIRATION_DATE,    "2604"     },
+            { MCCR_TRACK_FIELD_BIRTH_DATE,         "19800101" },
+            { MCCR_TRACK_FIELD_ID_NUMBER_OVERFLOW, "1234"     },
+            { MCCR_TRACK_FIELD_LAST }
+        }
+    },
+    {
+        "aamva track 2 short iin", MCCR_CARD_ENCODE_TYPE_AAMVA, 2, MCCR_TRACK_PARSE_FLAGS_NONE,
+        ";63601=2604198001011234?", LRC_NONE, MCCR_STATUS_UNEXPECTED_FORMAT,
+    },
+    {
+        "aamva track 3", MCCR_CARD_ENCODE_TYPE_AAMVA, 3, MCCR_TRACK_PARSE_FLAGS_NONE,
+        "%!!95814      C               1505200BRNBRN                          ?", LRC_VALID, MCCR_STATUS_OK,
+        {
+            { MCCR_TRACK_FIELD_DISCRETIONARY_DATA, "!!95814      C               1505200BRNBRN                          " },
+            { MCCR_TRACK_FIELD_LAST }
+        }
+    },
+    {
+        "other encode type", MCCR_CARD_ENCODE_TYPE_OTHER, 2, MCCR_TRACK_PARSE_FLAGS_NONE,
+        ";4111111111111111=25121011234567890?", LRC_NONE, MCCR_STATUS_INVALID_INPUT,
+    },
+    {
+        "track 4", MCCR_CARD_ENCODE_TYPE_ISO_ABA, 4, MCCR_TRACK_PARSE_FLAGS_NONE,
+        ";4111111111111111=25121011234567890?", LRC_NONE, MCCR_STATUS_INVALID_INPUT,
+    },
+};
+
+/******************************************************************************/
+
+static uint8_t
+compute_lrc (const char *data,
+             uint8_t     offset)
+{
+    uint8_t lrc = 0;
+
+    for (; *data; data++)
+        lrc ^= (uint8_t) (*data - offset);
+    return lrc + offset;
+}
+
+static bool
+check_fields (const test_case_t  *test,
+              const uint8_t      *data,
+              const mccr_track_t *track)
+{
+    unsigned int i;
+
+    for (i = 0; test->fields[i].field != MCCR_TRACK_FIELD_LAST; i++) {
+        const mccr_track_span_t *span;
+
+        span = &track->fields[test->fields[i].field];
+        if (span->length != strlen (test->fields[i].value) ||
+            memcmp (&data[span->offset], test->fields[i].value, span->length) != 0) {
+            printf ("FAIL: %s: %s is '%.*s', expected '%s'\n",
+                    test->name, mccr_track_field_to_string (test->fields[i].field),
+                    span->length, &data[span->offset], test->fields[i].value);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool
+test_known_tracks (void)
+{
+    unsigned int i;
+    bool         ok = true;
+
+    for (i = 0; i < sizeof (test_cases) / sizeof (test_cases[0]); i++) {
+        const test_case_t *test = &test_cases[i];
+        uint8_t            data[128];
+        size_t             data_size;
+        mccr_track_t       track;
+        mccr_status_t      st;
+
+        data_size = strlen (test->data);
+        memcpy (data, test->data, data_size);
+        if (test->lrc != LRC_NONE) {
+            uint8_t offset;
+
+            offset = (test->data[0] == ';') ? 0x30 : 0x20;
+            data[data_size] = compute_lrc (test->data, offset);
+            if (test->lrc == LRC_INVALID)
+                data[data_size] = offset + ((data[data_size] - offset + 1) & ((offset == 0x30) ? 0x0f : 0x3f));
+            data_size++;
+        }
+        /* Zero padding as in decrypted tracks */
+        memset (&data[data_size], 0, 8);
+        data_size += 8;
+
+        st = mccr_track_parse (test->encode_type, test->track_number, test->flags, data, data_size, &track);
+        if (st != test->status) {
+            printf ("FAIL: %s: %s, expected %s\n", test->name, mccr_status_to_string (st), mccr_status_to_string (test->status));
+            ok = false;
+            continue;
+        }
+        if (st == MCCR_STATUS_OK) {
+            if (track.length != strlen (test->data) || track.has_lrc != (test->lrc != LRC_NONE)) {
+                printf ("FAIL: %s: length %u (lrc %s)\n", test->name, track.length, track.has_lrc ? "yes" : "no");
+                ok = false;
+                continue;
+            }
+            if (!check_fields (test, data, &track)) {
+                ok = false;
+                continue;
+            }
+        }
+        printf ("PASS: %s\n", test->name);
+    }
+    return ok;
+}
+
+/* Every position of a long track, before and after the end sentinel */
+static bool
+test_invalid_characters (void)
+{
+    static const char *track = "%B4111111111111111^DOE/JOHN^2512101123456789012345678901234567890?";
+    uint8_t            data[80];
+    size_t             data_size;
+    size_t             i;
+    mccr_track_t       parsed;
+    mccr_status_t      st;
+
+    data_size = strlen (track);
+    memcpy (data, track, data_size);
+    memset (&data[data_size], 'x', sizeof (data) - data_size);
+
+    for (i = 1; i < sizeof (data); i++) {
+        uint8_t original;
+
+        original = data[i];
+        data[i] = 0x7f;
+        st = mccr_track_parse (MCCR_CARD_ENCODE_TYPE_ISO_ABA, 1, MCCR_TRACK_PARSE_FLAGS_MASKED, data, sizeof (data), &parsed);
+        data[i] = original;
+        if ((i < data_size - 1 && st != MCCR_STATUS_UNEXPECTED_FORMAT) ||
+            (i >= data_size - 1 && i != data_size - 1 && st != MCCR_STATUS_OK)) {
+            printf ("FAIL: invalid character at offset %u: %s\n", (unsigned int) i, mccr_status_to_string (st));
+            return false;
+        }
+    }
+
+    printf ("PASS: invalid characters\n");
+    return true;
+}
+
+int main (int argc, char **argv)
+{
+    int ret = EXIT_SUCCESS;
+
+    if (!test_known_tracks () || !test_invalid_characters ())
+        ret = EXIT_FAILURE;
+
+    return ret;
+}
@@ -27,11 +27,15 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
+#include <ctype.h>
+#include <signal.h>
+#include <time.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <assert.h>
 
 #include <common.h>
+#include <json.h>
 
 #include <mccr.h>
 
@@ -375,21 +379,949 @@ run_wait_swipe (mccr_device_t *device,
     return EXIT_SUCCESS;
 }
 
+/******************************************************************************/
+/* Action: stream
+ *
+ * Swipes are handled back to back with the device kept open, each one
+ * written as a single JSON Lines record. Records are built in a buffer
+ * reused across swipes and written to a fully buffered stdout, flushed at
+ * each record boundary.
+ */
+
+#define STREAM_WAIT_TIMEOUT_MS 500
+
+static volatile sig_atomic_t stream_stop;
+
+static void
+stream_signal_handler (int signo)
+{
+    stream_stop = 1;
+}
+
+#define STREAM_TRACK(N)                                                                                                 \
+    static void                                                                                                         \
+    stream_track_##N (json_buffer_t       *record,                                                                      \
+                      mccr_swipe_report_t *report,                                                                      \
+                      bool                 ascii)                                                                       \
+    {                                                                                                                   \
+        uint8_t        status;                                                                                          \
+        const uint8_t *data;                                                                                            \
+        uint8_t        length;                                                                                          \
+                                                                                                                        \
+        json_buffer_append (record, "{\"track\":" #N ",");                                                              \
+                                                                                                                        \
+        if (mccr_swipe_report_get_track_##N##_decode_status (report, &status) == MCCR_STATUS_OK) {                      \
+            if (status == MCCR_SWIPE_TRACK_DECODE_STATUS_SUCCESS)                                                       \
+                json_buffer_append (record, "\"decoding\":\"success\",");                                               \
+            else if (status & MCCR_SWIPE_TRACK_DECODE_STATUS_ERROR)                                                     \
+                json_buffer_append (record, "\"decoding\":\"error\",");                                                 \
+            else                                                                                                        \
+                json_buffer_append (record, "\"decoding\":\"unknown\",");                                               \
+        }                                                                                                               \
+                                                                                                                        \
+        if (mccr_swipe_report_get_track_##N##_encrypted_data_length (report, &length) == MCCR_STATUS_OK &&              \
+            mccr_swipe_report_get_track_##N##_encrypted_data (report, &data) == MCCR_STATUS_OK) {                       \
+            json_buffer_append_uint (record, "data_length", length);                                                    \
+            json_buffer_append_hex (record, "data", data, length);                                                      \
+            if (ascii)                                                                                                  \
+                json_buffer_append_string (record, "ascii", data, length);                                              \
+        }                                                                                                               \
+                                                                                                                        \
+        if (mccr_swipe_report_get_track_##N##_absolute_data_length (report, &length) == MCCR_STATUS_OK)                 \
+            json_buffer_append_uint (record, "absolute_data_length", length);                                           \
+                                                                                                                        \
+        if (mccr_swipe_report_get_track_##N##_masked_data_length (report, &length) == MCCR_STATUS_OK &&                 \
+            mccr_swipe_report_get_track_##N##_masked_data (report, &data) == MCCR_STATUS_OK) {                          \
+            json_buffer_append_uint (record, "masked_data_length", length);                                             \
+            json_buffer_append_string (record, "masked_data", data, length);                                            \
+        }                                                                                                               \
+                                                                                                                        \
+        json_buffer_close (record, "},");                                                                               \
+    }
+
+STREAM_TRACK(1)
+STREAM_TRACK(2)
+STREAM_TRACK(3)
+
+/* Common record header: sequence number (if any), time and device path */
+static void
+record_open (json_buffer_t *record,
+             mccr_device_t *device,
+             long           seq)
+{
+    json_buffer_reset (record);
+    json_buffer_append (record, "{");
+    if (seq >= 0)
+        json_buffer_append_uint (record, "seq", (unsigned int) seq);
+    json_buffer_append_time (record, "time");
+    json_buffer_append_string (record, "path", (const uint8_t *) mccr_device_get_path (device), strlen (mccr_device_get_path (device)));
+}
+
+/* Returns false if the record couldn't be built completely */
+static bool
+stream_record (json_buffer_t       *record,
+               mccr_device_t       *device,
+               mccr_swipe_report_t *report,
+               unsigned long        seq,
+               bool                 ascii)
+{
+    mccr_card_encode_type_t card_encode_type;
+
+    record_open (record, device, (long) seq);
+
+    if (mccr_swipe_report_get_card_encode_type (report, &card_encode_type) == MCCR_STATUS_OK) {
+        json_buffer_append (record, "\"card_encode_type\":\"");
+        json_buffer_append (record, mccr_card_encode_type_to_string (card_encode_type));
+        json_buffer_append (record, "\",");
+    }
+
+    json_buffer_append (record, "\"tracks\":[");
+    stream_track_1 (record, report, ascii);
+    stream_track_2 (record, report, ascii);
+    stream_track_3 (record, report, ascii);
+    json_buffer_close (record, "]");
+    json_buffer_close (record, "}\n");
+    return !record->failed;
+}
+
+/* Records from multiple devices may be written at the same time, so each one
+ * is written and flushed with stdout locked */
+static bool
+stream_write (json_buffer_t *record)
+{
+    bool written;
+
+    flockfile (stdout);
+    written = (fwrite (record->str, 1, record->len, stdout) == record->len && fflush (stdout) == 0);
+    funlockfile (stdout);
+    return written;
+}
+
+static void
+stream_setup (void)
+{
+    static char      stdout_buffer[64 * 1024];
+    struct sigaction action;
+
+    setvbuf (stdout, stdout_buffer, _IOFBF, sizeof (stdout_buffer));
+
+    /* Stop cleanly on SIGINT/SIGTERM, closing the devices */
+    memset (&action, 0, sizeof (action));
+    action.sa_handler = stream_signal_handler;
+    sigaction (SIGINT,  &action, NULL);
+    sigaction (SIGTERM, &action, NULL);
+    /* The reader of stdout going away (e.g. piped to head) is detected when
+     * writing, so that the devices are closed as well */
+    action.sa_handler = SIG_IGN;
+    sigaction (SIGPIPE, &action, NULL);
+}
+
+static int
+stream_device (mccr_device_t *device,
+               bool           ascii)
+{
+    json_buffer_t record = { 0 };
+    unsigned long seq = 0;
+    int           ret = EXIT_SUCCESS;
+
+    while (!stream_stop) {
+        mccr_status_t        st;
+        mccr_swipe_report_t *report;
+
+        st = mccr_device_wait_swipe_report (device, STREAM_WAIT_TIMEOUT_MS, &report);
+        /* Single devices are open with reconnection enabled, so keep on
+         * waiting if unplugged */
+        if (st == MCCR_STATUS_TIMED_OUT || st == MCCR_STATUS_DISCONNECTED)
+            continue;
+        if (st != MCCR_STATUS_OK) {
+            fprintf (stderr, "error: cannot get swipe report from device at path '%s': %s\n",
+                     mccr_device_get_path (device), mccr_status_to_string (st));
+            ret = EXIT_FAILURE;
+            break;
+        }
+
+        if (!stream_record (&record, device, report, seq++, ascii)) {
+            mccr_swipe_report_free (report);
+            fprintf (stderr, "error: couldn't build swipe record: out of memory\n");
+            stream_stop = 1;
+            ret = EXIT_FAILURE;
+            break;
+        }
+        mccr_swipe_report_free (report);
+
+        if (!stream_write (&record)) {
+            /* e.g. the reader of the pipe went away */
+            stream_stop = 1;
+            ret = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    json_buffer_clear (&record);
+    return ret;
+}
+
+static int
+run_stream (mccr_device_t *device,
+            bool           ascii)
+{
+    stream_setup ();
+    return stream_device (device, ascii);
+}
+
+/******************************************************************************/
+/* Action: stream (all devices)
+ *
+ * One thread per open device, all of them writing records to stdout. Devices
+ * are enumerated again periodically, so that new ones are opened and the ones
+ * gone (i.e. failing to report swipes) are dropped, reporting both as
+ * "added" and "removed" event records. The run fails if any stream did.
+ */
+
+#define STREAM_RESCAN_INTERVAL_MS 1000
+
+typedef struct stream_worker_s {
+    mccr_device_t          *device;
+    bool                    ascii;
+    pthread_t               thread;
+    /* Set by the worker thread once done, only accessed atomically */
+    int                     finished;
+    /* Exit status of the stream, read once the thread is joined */
+    int                     ret;
+    struct stream_worker_s *next;
+} stream_worker_t;
+
+/* Returns false if the record couldn't be written, stopping all streams */
+static bool
+stream_event (mccr_device_t *device,
+              const char    *event)
+{
+    json_buffer_t record = { 0 };
+    bool          written = false;
+
+    record_open (&record, device, -1);
+    json_buffer_append (&record, "\"event\":\"");
+    json_buffer_append (&record, event);
+    json_buffer_append (&record, "\"");
+    json_buffer_close (&record, "}\n");
+    if (record.failed)
+        fprintf (stderr, "error: couldn't build event record: out of memory\n");
+    else
+        written = stream_write (&record);
+    if (!written)
+        stream_stop = 1;
+    json_buffer_clear (&record);
+    return written;
+}
+
+static void
+stream_worker_set_finished (stream_worker_t *worker)
+{
+    __sync_fetch_and_add (&worker->finished, 1);
+}
+
+static bool
+stream_worker_is_finished (stream_worker_t *worker)
+{
+    return !!__sync_fetch_and_add (&worker->finished, 0);
+}
+
+static void *
+stream_worker_thread (void *user_data)
+{
+    stream_worker_t *worker = user_data;
+
+    worker->ret = stream_device (worker->device, worker->ascii);
+    stream_worker_set_finished (worker);
+    return NULL;
+}
+
+static stream_worker_t *
+stream_worker_new (mccr_device_t *device,
+                   bool           ascii)
+{
+    stream_worker_t *worker;
+    mccr_status_t    st;
+
+    if ((st = mccr_device_open (device)) != MCCR_STATUS_OK) {
+        fprintf (stderr, "error: mccr device open failed at path '%s': %s\n",
+                 mccr_device_get_path (device), mccr_status_to_string (st));
+        return NULL;
+    }
+
+    worker = calloc (1, sizeof (stream_worker_t));
+    if (!worker) {
+        mccr_device_close (device);
+        return NULL;
+    }
+    worker->device = mccr_device_ref (device);
+    worker->ascii  = ascii;
+    worker->ret    = EXIT_SUCCESS;
+
+    /* Report the device before any swipe it may report */
+    if (!stream_event (device, "added"))
+        worker->ret = EXIT_FAILURE;
+
+    if (pthread_create (&worker->thread, NULL, stream_worker_thread, worker) != 0) {
+        fprintf (stderr, "error: couldn't launch stream thread for device at path '%s'\n",
+                 mccr_device_get_path (device));
+        worker->ret = EXIT_FAILURE;
+        stream_worker_set_finished (worker);
+        worker->thread = pthread_self ();
+    }
+
+    return worker;
+}
+
+/* Returns the exit status of the stream */
+static int
+stream_worker_free (stream_worker_t *worker)
+{
+    int ret;
+
+    if (!pthread_equal (worker->thread, pthread_self ()))
+        pthread_join (worker->thread, NULL);
+    ret = worker->ret;
+    if (!stream_event (worker->device, "removed"))
+        ret = EXIT_FAILURE;
+    mccr_device_close (worker->device);
+    mccr_device_unref (worker->device);
+    free (worker);
+    return ret;
+}
+
+static int
+run_stream_all (bool ascii)
+{
+    stream_worker_t *workers = NULL;
+    int              ret = EXIT_SUCCESS;
+
+    stream_setup ();
+
+    while (!stream_stop) {
+        mccr_device_t   **devices;
+        stream_worker_t **iter;
+        unsigned int      i;
+
+        /* Drop devices no longer reporting swipes */
+        for (iter = &workers; *iter;) {
+            stream_worker_t *worker = *iter;
+
+            if (stream_worker_is_finished (worker)) {
+                *iter = worker->next;
+                if (stream_worker_free (worker) != EXIT_SUCCESS)
+                    ret = EXIT_FAILURE;
+            } else
+                iter = &worker->next;
+        }
+
+        /* Open new devices */
+        devices = mccr_enumerate_devices ();
+        for (i = 0; devices && devices[i]; i++) {
+            stream_worker_t *worker;
+
+            for (worker = workers; worker; worker = worker->next) {
+                if (strcmp (mccr_device_get_path (worker->device), mccr_device_get_path (devices[i])) == 0)
+                    break;
+            }
+
+            if (!worker && (worker = stream_worker_new (devices[i], ascii))) {
+                worker->next = workers;
+                workers = worker;
+            }
+            mccr_device_unref (devices[i]);
+        }
+        free (devices);
+
+        for (i = 0; !stream_stop && i < STREAM_RESCAN_INTERVAL_MS / 100; i++) {
+            struct timespec interval = { 0, 100 * 1000000 };
+
+            nanosleep (&interval, NULL);
+        }
+    }
+
+    /* Workers stop as soon as their current wait times out */
+    while (workers) {
+        stream_worker_t *worker = workers;
+
+        workers = worker->next;
+        if (stream_worker_free (worker) != EXIT_SUCCESS)
+            ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
+
+/******************************************************************************/
+/* Action: bench */
+
+#define BENCH_DEFAULT_ITERATIONS       1000
+#define BENCH_SWIPE_DEFAULT_ITERATIONS 10
+
+/* Parses a generic command given as 'CC:LL:DD:DD:...', i.e. command id, data
+ * length and data, as the MagTek documentation lists them */
+static bool
+parse_generic_command (const char *str,
+                       uint8_t    *command_id,
+                       uint8_t    *data,
+                       size_t     *data_size)
+{
+    uint8_t buffer[2 + 255];
+    ssize_t bin_size;
+
+    if ((bin_size = strbin (str, buffer, sizeof (buffer))) < 2) {
+        fprintf (stderr, "error: invalid generic command: %s\n", str);
+        return false;
+    }
+
+    if (buffer[1] != bin_size - 2) {
+        fprintf (stderr, "error: invalid generic command data size: %u != %u\n",
+                 (unsigned int) buffer[1], (unsigned int) (bin_size - 2));
+        return false;
+    }
+
+    *command_id = buffer[0];
+    *data_size  = buffer[1];
+    memcpy (data, &buffer[2], *data_size);
+    return true;
+}
+
+static uint64_t
+now_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static int
+compare_uint64 (const void *a,
+                const void *b)
+{
+    uint64_t va = *(const uint64_t *) a;
+    uint64_t vb = *(const uint64_t *) b;
+
+    return (va > vb) - (va < vb);
+}
+
+/* Sorts the samples in place */
+static void
+print_stats (const char   *name,
+             uint64_t     *samples,
+             unsigned int  n_samples)
+{
+    qsort (samples, n_samples, sizeof (uint64_t), compare_uint64);
+    printf ("\t%-12s min %llu us, median %llu us, p99 %llu us, max %llu us\n",
+            name,
+            (unsigned long long) samples[0],
+            (unsigned long long) samples[n_samples / 2],
+            (unsigned long long) samples[(n_samples * 99 + 99) / 100 - 1],
+            (unsigned long long) samples[n_samples - 1]);
+}
+
+static int
+run_bench_swipe (mccr_device_t *device,
+                 unsigned int   n_iterations)
+{
+    uint64_t     *totals;
+    uint64_t     *max_gaps;
+    unsigned int  i;
+    int           ret = EXIT_SUCCESS;
+
+    totals   = calloc (n_iterations, sizeof (uint64_t));
+    max_gaps = calloc (n_iterations, sizeof (uint64_t));
+    if (!totals || !max_gaps) {
+        fprintf (stderr, "error: couldn't allocate samples\n");
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+
+    printf ("benchmarking swipe report reception (%u swipes)...\n", n_iterations);
+
+    for (i = 0; i < n_iterations; i++) {
+        mccr_status_t        st;
+        mccr_swipe_report_t *report;
+        unsigned int         n_fragments, total_us, max_gap_us;
+
+        if ((st = mccr_device_wait_swipe_report (device, -1, &report)) != MCCR_STATUS_OK) {
+            fprintf (stderr, "error: cannot get swipe report: %s\n", mccr_status_to_string (st));
+            ret = EXIT_FAILURE;
+            goto out;
+        }
+
+        mccr_swipe_report_get_fragment_timing (report, &n_fragments, &total_us, &max_gap_us);
+        mccr_swipe_report_free (report);
+
+        printf ("\tswipe %u: %u fragments in %u us (max gap %u us)\n", i + 1, n_fragments, total_us, max_gap_us);
+        totals[i]   = total_us;
+        max_gaps[i] = max_gap_us;
+    }
+
+    print_stats ("total:", totals, n_iterations);
+    print_stats ("max gap:", max_gaps, n_iterations);
+
+out:
+    free (totals);
+    free (max_gaps);
+    return ret;
+}
+
+static int
+run_bench (mccr_device_t *device,
+           const char    *target,
+           unsigned int   n_iterations)
+{
+    uint8_t       command_id = 0;
+    uint8_t       data[255];
+    size_t        data_size = 0;
+    uint64_t     *latencies;
+    uint64_t      start, total;
+    unsigned int  i, n_samples = 0, n_errors = 0;
+
+    if (strcmp (target, "swipe") == 0)
+        return run_bench_swipe (device, n_iterations ? n_iterations : BENCH_SWIPE_DEFAULT_ITERATIONS);
+
+    if (strcmp (target, "software-id") != 0 &&
+        strcmp (target, "reader-state") != 0 &&
+        !parse_generic_command (target, &command_id, data, &data_size))
+        return EXIT_FAILURE;
+
+    if (!n_iterations)
+        n_iterations = BENCH_DEFAULT_ITERATIONS;
+
+    latencies = calloc (n_iterations, sizeof (uint64_t));
+    if (!latencies) {
+        fprintf (stderr, "error: couldn't allocate samples\n");
+        return EXIT_FAILURE;
+    }
+
+    printf ("benchmarking '%s' round trips (%u iterations)...\n", target, n_iterations);
+
+    total = now_us ();
+    for (i = 0; i < n_iterations; i++) {
+        mccr_status_t st;
+
+        start = now_us ();
+        if (strcmp (target, "software-id") == 0) {
+            char *str = NULL;
+
+            st = mccr_device_read_software_id (device, &str);
+            free (str);
+        } else if (strcmp (target, "reader-state") == 0)
+            st = mccr_device_get_reader_state (device, NULL, NULL);
+        else
+            st = mccr_device_run_generic (device, command_id, data_size ? data : NULL, data_size, NULL, NULL);
+
+        if (st != MCCR_STATUS_OK) {
+            if (!n_errors++)
+                fprintf (stderr, "error: round trip failed: %s\n", mccr_status_to_string (st));
+            continue;
+        }
+        latencies[n_samples++] = now_us () - start;
+    }
+    total = now_us () - total;
+
+    printf ("\titerations:  %u (%u errors)\n", n_iterations, n_errors);
+    if (n_samples) {
+        print_stats ("latency:", latencies, n_samples);
+        printf ("\tthroughput:  %.1f ops/s\n", (double) n_samples * 1000000.0 / (double) (total ? total : 1));
+    }
+
+    free (latencies);
+    return n_errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/******************************************************************************/
+/* Action: batch
+ *
+ * Runs a list of generic commands over the open device, one per line, in the
+ * same format as --bench; optionally followed by '=' and the response
+ * expected, e.g.:
+ *
+ *   # read software id
+ *   00:01:00 = 32:31:30:34:32:38:30:39:41
+ *
+ * Empty lines and lines starting with '#' are ignored. The whole input is
+ * parsed and validated before running any command, so that a typo never
+ * leaves a device half-provisioned; then commands are run in order, stopping
+ * on the first failure.
+ */
+
+typedef struct {
+    unsigned int line;
+    uint8_t      command_id;
+    uint8_t      data[255];
+    size_t       data_size;
+    bool         check_response;
+    uint8_t      expected[255];
+    size_t       expected_size;
+} batch_command_t;
+
+static bool
+parse_batch_line (char            *line,
+                  unsigned int     line_number,
+                  batch_command_t *command)
+{
+    char    *expected;
+    ssize_t  expected_size;
+
+    memset (command, 0, sizeof (batch_command_t));
+    command->line = line_number;
+
+    if ((expected = strchr (line, '=')) != NULL) {
+        *(expected++) = '\0';
+        if ((expected_size = strbin (expected, command->expected, sizeof (command->expected))) < 0) {
+            fprintf (stderr, "error: line %u: invalid expected response: %s\n", line_number, expected);
+            return false;
+        }
+        command->check_response = true;
+        command->expected_size  = (size_t) expected_size;
+    }
+
+    if (!parse_generic_command (line, &command->command_id, command->data, &command->data_size)) {
+        fprintf (stderr, "error: line %u: invalid command\n", line_number);
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+parse_batch (FILE             *input,
+             batch_command_t **out_commands,
+             unsigned int     *out_n_commands)
+{
+    batch_command_t *commands = NULL;
+    unsigned int     n_commands = 0;
+    char            *line = NULL;
+    size_t           line_size = 0;
+    ssize_t          line_length;
+    unsigned int     line_number = 0, n_allocated = 0;
+
+    while ((line_length = getline (&line, &line_size, input)) >= 0) {
+        char *start;
+
+        line_number++;
+
+        /* Trim line, skip empty ones and comments */
+        while (line_length > 0 && isspace ((unsigned char) line[line_length - 1]))
+            line[--line_length] = '\0';
+        for (start = line; isspace ((unsigned char) *start); start++);
+        if (!*start || *start == '#')
+            continue;
+
+        if (n_commands == n_allocated) {
+            batch_command_t *aux;
+
+            n_allocated = n_allocated ? (2 * n_allocated) : 16;
+            aux = realloc (commands, n_allocated * sizeof (batch_command_t));
+            if (!aux) {
+                fprintf (stderr, "error: couldn't allocate batch commands\n");
+                goto failed;
+            }
+            commands = aux;
+        }
+
+        if (!parse_batch_line (start, line_number, &commands[n_commands]))
+            goto failed;
+        n_commands++;
+    }
+
+    free (line);
+    *out_commands   = commands;
+    *out_n_commands = n_commands;
+    return true;
+
+failed:
+    free (line);
+    free (commands);
+    return false;
+}
+
+static bool
+load_batch (const char       *path,
+            batch_command_t **out_commands,
+            unsigned int     *out_n_commands)
+{
+    FILE *input;
+    bool  loaded;
+
+    if (strcmp (path, "-") == 0)
+        input = stdin;
+    else if (!(input = fopen (path, "r"))) {
+        fprintf (stderr, "error: couldn't open batch file '%s'\n", path);
+        return false;
+    }
+
+    loaded = parse_batch (input, out_commands, out_n_commands);
+    if (input != stdin)
+        fclose (input);
+    return loaded;
+}
+
+/* Runs commands in order until the first failure, which is described in
+ * @error. Returns the number of commands run successfully. */
+static unsigned int
+batch_run_commands (mccr_device_t         *device,
+                    const batch_command_t *commands,
+                    unsigned int           n_commands,
+                    bool                   verbose,
+                    char                  *error,
+                    size_t                 error_size)
+{
+    unsigned int i;
+
+    for (i = 0; i < n_commands; i++) {
+        const batch_command_t *command = &commands[i];
+        mccr_status_t          st;
+        uint8_t               *response = NULL;
+        size_t                 response_size = 0;
+        bool                   unexpected;
+        char                  *hex;
+
+        st = mccr_device_run_generic (device,
+                                      command->command_id,
+                                      command->data_size ? command->data : NULL,
+                                      command->data_size,
+                                      &response,
+                                      &response_size);
+        if (st != MCCR_STATUS_OK) {
+            snprintf (error, error_size, "line %u: command 0x%02x failed: %s",
+                      command->line, command->command_id, mccr_status_to_string (st));
+            break;
+        }
+
+        unexpected = (command->check_response &&
+                      (response_size != command->expected_size ||
+                       (response_size && memcmp (response, command->expected, response_size) != 0)));
+        hex = response_size ? strhex (response, response_size, ":") : NULL;
+        free (response);
+
+        if (unexpected) {
+            snprintf (error, error_size, "line %u: command 0x%02x unexpected response: %s",
+                      command->line, command->command_id, hex ? hex : "none");
+            free (hex);
+            break;
+        }
+
+        if (verbose) {
+            if (hex)
+                printf ("[%u] command 0x%02x: success: %s\n", command->line, command->command_id, hex);
+            else
+                printf ("[%u] command 0x%02x: success\n", command->line, command->command_id);
+        }
+        free (hex);
+    }
+
+    return i;
+}
+
+static int
+run_batch (mccr_device_t *device,
+           const char    *path)
+{
+    batch_command_t *commands;
+    unsigned int     n_commands, n_run;
+    char             error[256];
+
+    if (!load_batch (path, &commands, &n_commands))
+        return EXIT_FAILURE;
+
+    n_run = batch_run_commands (device, commands, n_commands, true, error, sizeof (error));
+    if (n_run != n_commands)
+        fprintf (stderr, "error: %s\n", error);
+
+    printf ("%u/%u commands run successfully\n", n_run, n_commands);
+    free (commands);
+    return (n_run == n_commands) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/******************************************************************************/
+/* Action: batch (multiple devices)
+ *
+ * The same command list is run in every device, either all the ones found or
+ * the ones listed, by a bounded pool of worker threads; so that provisioning
+ * time depends on the slowest device, not on the number of devices. Results
+ * are collected and printed as a summary once all devices are processed.
+ */
+
+#define FLEET_DEFAULT_JOBS 4
+
+typedef struct {
+    char          *path;
+    mccr_device_t *device;
+    bool           success;
+    unsigned int   n_run;
+    uint64_t       elapsed_us;
+    char           error[256];
+} fleet_result_t;
+
+typedef struct {
+    const batch_command_t *commands;
+    unsigned int           n_commands;
+    fleet_result_t        *results;
+    unsigned int           n_results;
+    volatile unsigned int  next;
+} fleet_t;
+
+static void
+fleet_provision (fleet_t        *fleet,
+                 fleet_result_t *result)
+{
+    mccr_status_t st;
+    uint64_t      start;
+
+    start = now_us ();
+
+    if (!result->device)
+        snprintf (result->error, sizeof (result->error), "device not found");
+    else if ((st = mccr_device_open (result->device)) != MCCR_STATUS_OK)
+        snprintf (result->error, sizeof (result->error), "device open failed: %s", mccr_status_to_string (st));
+    else {
+        result->n_run = batch_run_commands (result->device, fleet->commands, fleet->n_commands,
+                                            false, result->error, sizeof (result->error));
+        result->success = (result->n_run == fleet->n_commands);
+        mccr_device_close (result->device);
+    }
+
+    result->elapsed_us = now_us () - start;
+}
+
+static void *
+fleet_worker_thread (void *user_data)
+{
+    fleet_t      *fleet = user_data;
+    unsigned int  i;
+
+    while ((i = __sync_fetch_and_add (&fleet->next, 1)) < fleet->n_results)
+        fleet_provision (fleet, &fleet->results[i]);
+    return NULL;
+}
+
+static int
+run_batch_fleet (const char    *path,
+                 char         **device_paths,
+                 unsigned int   n_device_paths,
+                 unsigned int   n_jobs)
+{
+    batch_command_t  *commands;
+    unsigned int      n_commands, i, n_success = 0;
+    fleet_t           fleet = { 0 };
+    pthread_t        *workers = NULL;
+    unsigned int      n_workers = 0;
+    uint64_t          start, elapsed_us, sum_us = 0;
+    int               ret = EXIT_FAILURE;
+
+    if (!load_batch (path, &commands, &n_commands))
+        return EXIT_FAILURE;
+
+    fleet.commands   = commands;
+    fleet.n_commands = n_commands;
+
+    /* Either all devices found, or the ones listed */
+    if (!device_paths) {
+        mccr_device_t **devices;
+
+        devices = mccr_enumerate_devices ();
+        for (i = 0; devices && devices[i]; i++);
+        fleet.n_results = i;
+        fleet.results   = calloc (fleet.n_results ? fleet.n_results : 1, sizeof (fleet_result_t));
+        for (i = 0; fleet.results && i < fleet.n_results; i++) {
+            fleet.results[i].device = devices[i];
+            fleet.results[i].path   = strdup (mccr_device_get_path (devices[i]));
+        }
+        free (devices);
+    } else {
+        fleet.n_results = n_device_paths;
+        fleet.results   = calloc (fleet.n_results, sizeof (fleet_result_t));
+        for (i = 0; fleet.results && i < fleet.n_results; i++) {
+            fleet.results[i].device = mccr_device_new (device_paths[i]);
+            fleet.results[i].path   = strdup (device_paths[i]);
+        }
+    }
+
+    if (!fleet.results) {
+        fprintf (stderr, "error: couldn't allocate device results\n");
+        goto out;
+    }
+    if (!fleet.n_results) {
+        fprintf (stderr, "error: no devices found\n");
+        goto out;
+    }
+
+    /* No more workers than devices */
+    if (!n_jobs)
+        n_jobs = FLEET_DEFAULT_JOBS;
+    if (n_jobs > fleet.n_results)
+        n_jobs = fleet.n_results;
+
+    printf ("running %u commands in %u devices (%u jobs)...\n", n_commands, fleet.n_results, n_jobs);
+
+    start = now_us ();
+    workers = calloc (n_jobs, sizeof (pthread_t));
+    for (n_workers = 0; workers && n_workers < n_jobs; n_workers++) {
+        if (pthread_create (&workers[n_workers], NULL, fleet_worker_thread, &fleet) != 0)
+            break;
+    }
+    /* If no worker could be launched, process devices here */
+    if (!n_workers)
+        fleet_worker_thread (&fleet);
+    for (i = 0; i < n_workers; i++)
+        pthread_join (workers[i], NULL);
+    elapsed_us = now_us () - start;
+
+    for (i = 0; i < fleet.n_results; i++) {
+        fleet_result_t *result = &fleet.results[i];
+
+        sum_us += result->elapsed_us;
+        if (result->success) {
+            n_success++;
+            printf ("[ok]     %s: %u/%u commands in %llu ms\n",
+                    result->path ? result->path : "unknown", result->n_run, n_commands,
+                    (unsigned long long) (result->elapsed_us / 1000));
+        } else
+            printf ("[failed] %s: %u/%u commands in %llu ms: %s\n",
+                    result->path ? result->path : "unknown", result->n_run, n_commands,
+                    (unsigned long long) (result->elapsed_us / 1000), result->error);
+    }
+
+    printf ("%u/%u devices provisioned successfully in %llu ms (%llu ms if run serially)\n",
+            n_success, fleet.n_results,
+            (unsigned long long) (elapsed_us / 1000),
+            (unsigned long long) (sum_us / 1000));
+
+    if (n_success == fleet.n_results)
+        ret = EXIT_SUCCESS;
+
+out:
+    for (i = 0; fleet.results && i < fleet.n_results; i++) {
+        if (fleet.results[i].device)
+            mccr_device_unref (fleet.results[i].device);
+        free (fleet.results[i].path);
+    }
+    free (fleet.results);
+    free (workers);
+    free (commands);
+    return ret;
+}
+
 /******************************************************************************/
 /* Logging */
 
-static pthread_t main_tid;
+static pthread_t  main_tid;
+static FILE      *log_stream;
 
 static void
 log_handler (pthread_t   thread_id,
              const char *message)
 {
-    flockfile (stdout);
+    flockfile (log_stream);
     if (thread_id == main_tid)
-        fprintf (stdout, "[mccr] %s\n", message);
+        fprintf (log_stream, "[mccr] %s\n", message);
     else
-        fprintf (stdout, "[mccr,%u] %s\n", (unsigned int) thread_id, message);
-    funlockfile (stdout);
+        fprintf (log_stream, "[mccr,%u] %s\n", (unsigned int) thread_id, message);
+    funlockfile (log_stream);
 }
 
 /******************************************************************************/
@@ -406,13 +1338,28 @@ print_help (void)
             "Device selection:\n"
             "  -f, --first                 Select the first device found.\n"
             "  -p, --path                  Select device at given path.\n"
+            "  -A, --all                   Select all devices, including the ones found\n"
+            "                              later on (only with --stream or --batch).\n"
             "\n"
             "Device options:\n"
             "  -s, --show                  Show information of a given device.\n"
             "  -r, --reset                 Reset (power cycle) device.\n"
             "  -I, --set-session-id=[H64]  Set session id.\n"
             "  -w, --wait-swipe            Wait for a credit card swipe.\n"
+            "  -S, --stream                Wait for credit card swipes continuously, printing\n"
+            "                              one JSON record per line for each one.\n"
             "  -a, --ascii                 Try to decode ASCII in data from swipe reports.\n"
+            "  -B, --bench=[TARGET]        Measure round trip latency and throughput of the\n"
+            "                              given target: 'software-id', 'reader-state', a\n"
+            "                              generic command [CMD], or 'swipe' to measure\n"
+            "                              swipe report fragment timing.\n"
+            "  -n, --iterations=[N]        Number of iterations in --bench.\n"
+            "  -b, --batch=[FILE]          Run generic commands [CMD] listed in a file, one per\n"
+            "                              line, optionally followed by '=' and the expected\n"
+            "                              response; '-' to read them from stdin. May be run\n"
+            "                              in multiple devices at once, given with --all or\n"
+            "                              with --path multiple times.\n"
+            "  -j, --jobs=[N]              Number of devices processed in parallel in --batch.\n"
             "\n"
             "Common options:\n"
             "  -d, --debug                 Enable verbose logging.\n"
@@ -421,11 +1368,17 @@ print_help (void)
             "\n"
             "Notes:\n"
             "  * [H64] is a 64bit unsigned number, in hexadecimal format (with or without 0x prefix).\n"
+            "  * [CMD] is a command id, data length and data, in hexadecimal format (e.g. 00:01:00).\n"
             "\n"
             "Examples:\n"
             "   $ " PROGRAM_NAME " --first --show\n"
             "   $ " PROGRAM_NAME " --first --set-session-id=01234abc\n"
             "   $ " PROGRAM_NAME " --first --wait-swipe\n"
+            "   $ " PROGRAM_NAME " --first --stream\n"
+            "   $ " PROGRAM_NAME " --all --stream\n"
+            "   $ " PROGRAM_NAME " --first --bench=reader-state --iterations=5000\n"
+            "   $ " PROGRAM_NAME " --first --batch=provisioning.txt\n"
+            "   $ " PROGRAM_NAME " --all --batch=provisioning.txt --jobs=8\n"
             "\n");
 }
 
@@ -449,10 +1402,18 @@ int main (int argc, char **argv)
     bool                action_reset = false;
     char               *action_set_session_id = NULL;
     bool                action_wait_swipe = false;
+    bool                action_stream = false;
+    char               *action_bench = NULL;
+    unsigned int        iterations = 0;
+    char               *action_batch = NULL;
     bool                ascii = false;
     bool                debug = false;
     bool                first = false;
+    bool                all = false;
     char               *path = NULL;
+    char              **paths = NULL;
+    unsigned int        n_paths = 0;
+    unsigned int        jobs = 0;
     mccr_device_t *device = NULL;
     mccr_status_t  st;
     unsigned int        ret;
@@ -461,11 +1422,17 @@ int main (int argc, char **argv)
         { "list",                 no_argument,       0, 'l' },
         { "first",                no_argument,       0, 'f' },
         { "path",                 required_argument, 0, 'p' },
+        { "all",                  no_argument,       0, 'A' },
         { "show",                 no_argument,       0, 's' },
         { "reset",                no_argument,       0, 'r' },
         { "set-session-id",       required_argument, 0, 'I' },
         { "wait-swipe",           no_argument,       0, 'w' },
+        { "stream",               no_argument,       0, 'S' },
         { "ascii",                no_argument,       0, 'a' },
+        { "bench",                required_argument, 0, 'B' },
+        { "iterations",           required_argument, 0, 'n' },
+        { "batch",                required_argument, 0, 'b' },
+        { "jobs",                 required_argument, 0, 'j' },
         { "debug",                no_argument,       0, 'd' },
         { "version",              no_argument,       0, 'v' },
         { "help",                 no_argument,       0, 'h' },
@@ -475,7 +1442,7 @@ int main (int argc, char **argv)
     /* turn off getopt error message */
     opterr = 1;
     while (iarg != -1) {
-        iarg = getopt_long (argc, argv, "lfp:srI:wadvh", longopts, &idx);
+        iarg = getopt_long (argc, argv, "lfp:AsrI:wSaB:n:b:j:dvh", longopts, &idx);
         switch (iarg) {
         case 'l':
             action_list = true;
@@ -483,11 +1450,22 @@ int main (int argc, char **argv)
         case 'f':
             first = true;
             break;
-        case 'p':
-            if (path)
-                fprintf (stderr, "warning: --path given multiple times\n");
-            else
-                path = strdup (optarg);
+        case 'p': {
+            char **aux;
+
+            /* Multiple paths only supported in --batch */
+            aux = realloc (paths, (n_paths + 1) * sizeof (char *));
+            if (!aux) {
+                fprintf (stderr, "error: couldn't allocate device paths\n");
+                return EXIT_FAILURE;
+            }
+            paths = aux;
+            paths[n_paths++] = strdup (optarg);
+            path = paths[0];
+            break;
+        }
+        case 'A':
+            all = true;
             break;
         case 's':
             action_show = true;
@@ -504,9 +1482,38 @@ int main (int argc, char **argv)
         case 'w':
             action_wait_swipe = true;
             break;
+        case 'S':
+            action_stream = true;
+            break;
         case 'a':
             ascii = true;
             break;
+        case 'B':
+            if (action_bench)
+                fprintf (stderr, "warning: --bench given multiple times\n");
+            else
+                action_bench = strdup (optarg);
+            break;
+        case 'b':
+            if (action_batch)
+                fprintf (stderr, "warning: --batch given multiple times\n");
+            else
+                action_batch = strdup (optarg);
+            break;
+        case 'j':
+            jobs = (unsigned int) strtoul (optarg, NULL, 10);
+            if (!jobs) {
+                fprintf (stderr, "error: invalid number of jobs: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            iterations = (unsigned int) strtoul (optarg, NULL, 10);
+            if (!iterations) {
+                fprintf (stderr, "error: invalid number of iterations: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'd':
             debug = true;
             break;
@@ -524,7 +1531,10 @@ int main (int argc, char **argv)
     n_device_actions = (action_show +
                         action_reset +
                         !!action_set_session_id +
-                        action_wait_swipe);
+                        action_wait_swipe +
+                        action_stream +
+                        !!action_bench +
+                        !!action_batch);
     n_actions = (n_global_actions + n_device_actions);
     if (n_actions > 1) {
         fprintf (stderr, "error: too many actions requested\n");
@@ -536,18 +1546,32 @@ int main (int argc, char **argv)
     }
 
     /* Warn if options not built properly */
-    if (ascii && !action_wait_swipe)
-        fprintf (stderr, "warning: --ascii only applies when --wait-swipe action is requested");
+    if (ascii && !action_wait_swipe && !action_stream)
+        fprintf (stderr, "warning: --ascii only applies when --wait-swipe or --stream actions are requested");
 
     /* Allow only one device selection at a time */
-    if (path && first) {
+    if ((!!path + first + all) > 1) {
         fprintf (stderr, "error: multiple device selection operations requested\n");
         return EXIT_FAILURE;
     }
+    if (iterations && !action_bench)
+        fprintf (stderr, "warning: --iterations only applies when --bench action is requested\n");
+    if (all && !action_stream && !action_batch) {
+        fprintf (stderr, "error: --all only applies when --stream or --batch actions are requested\n");
+        return EXIT_FAILURE;
+    }
+    if (n_paths > 1 && !action_batch) {
+        fprintf (stderr, "error: --path given multiple times only applies when --batch action is requested\n");
+        return EXIT_FAILURE;
+    }
+    if (jobs && !(action_batch && (all || n_paths > 1)))
+        fprintf (stderr, "warning: --jobs only applies when --batch action is requested in multiple devices\n");
 
     /* Setup library logging */
     if (debug) {
         main_tid = pthread_self ();
+        /* Keep stdout for records only when streaming */
+        log_stream = action_stream ? stderr : stdout;
         mccr_log_set_handler (log_handler);
     }
 
@@ -559,7 +1583,7 @@ int main (int argc, char **argv)
     }
 
     /* Some actions require a device to be specified */
-    if (n_device_actions) {
+    if (n_device_actions && !all && n_paths <= 1) {
         if (!path && !first) {
             fprintf (stderr, "error: operation requires a device to be specified\n");
             return EXIT_FAILURE;
@@ -574,8 +1598,9 @@ int main (int argc, char **argv)
             return EXIT_FAILURE;
         }
 
-        /* For all actions except for --show, open the device */
-        st = mccr_device_open (device);
+        /* For all actions except for --show, open the device; when streaming,
+         * survive the reader being unplugged and plugged back */
+        st = mccr_device_open_full (device, action_stream ? MCCR_DEVICE_OPEN_FLAGS_RECONNECT : MCCR_DEVICE_OPEN_FLAGS_NONE);
         if (st != MCCR_STATUS_OK) {
             fprintf (stderr, "error: mccr device open failed: %s\n", mccr_status_to_string (st));
             return EXIT_FAILURE;
@@ -593,6 +1618,16 @@ int main (int argc, char **argv)
         ret = run_set_session_id (device, action_set_session_id);
     else if (action_wait_swipe)
         ret = run_wait_swipe (device, ascii);
+    else if (action_stream && all)
+        ret = run_stream_all (ascii);
+    else if (action_stream)
+        ret = run_stream (device, ascii);
+    else if (action_bench)
+        ret = run_bench (device, action_bench, iterations);
+    else if (action_batch && (all || n_paths > 1))
+        ret = run_batch_fleet (action_batch, all ? NULL : paths, n_paths, jobs);
+    else if (action_batch)
+        ret = run_batch (device, action_batch);
     else
         assert (0);
 
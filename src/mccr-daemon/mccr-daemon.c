@@ -0,0 +1,1494 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * mccr-daemon - Daemon sharing MagTek Credit Card Readers with local clients
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+/*
+ * The daemon owns all readers and shares them with local clients connected
+ * to a Unix domain socket:
+ *
+ *  - Every swipe (decoded fields and raw report) and every reader added or
+ *    removed is published to all clients, as one JSON record per line.
+ *
+ *  - Clients may run generic commands in a reader by sending a line with a
+ *    request tag, the reader path and the command (as in mccr-cli --batch),
+ *    e.g. "1 /dev/hidraw0 00:01:00". Commands are run in order through one
+ *    queue per reader, and the response is sent to the requester only.
+ *
+ * Published messages are built once and kept in a broadcast ring, from which
+ * every client sends at its own pace; i.e. message contents are never copied
+ * per client. A client falling behind the whole ring doesn't block the
+ * readers or other clients: it skips the messages lost, and gets told how
+ * many they were.
+ */
+
+#include <config.h>
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <common.h>
+#include <json.h>
+
+#include <mccr.h>
+
+#define PROGRAM_NAME    "mccr-daemon"
+#define PROGRAM_VERSION PACKAGE_VERSION
+
+#define DEFAULT_SOCKET_PATH "/run/mccr-daemon.sock"
+
+#define SWIPE_WAIT_TIMEOUT_MS    500
+#define RESCAN_INTERVAL_MS       1000
+#define BROADCAST_RING_SIZE      256
+#define MAX_CLIENTS              64
+#define MAX_CLIENT_REQUESTS      16
+#define MAX_REQUEST_LENGTH       1024
+
+static volatile sig_atomic_t daemon_stop;
+static int                   wakeup_fds[2] = { -1, -1 };
+
+/* Wakes up the main loop, e.g. when there are new messages to send. Safe to
+ * use from signal handlers. */
+static void
+wakeup (void)
+{
+    char c = 0;
+
+    if (write (wakeup_fds[1], &c, 1) < 0) {
+        /* Pipe full, the main loop is going to wake up anyway */
+    }
+}
+
+static void
+deadline_ms (struct timespec *deadline,
+             unsigned int     timeout_ms)
+{
+    clock_gettime (CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec  += timeout_ms / 1000;
+    deadline->tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+/******************************************************************************/
+/* Messages */
+
+typedef struct {
+    volatile int refcount;
+    size_t       len;
+    char         data[];
+} message_t;
+
+static message_t *
+message_new (const json_buffer_t *buffer)
+{
+    message_t *message;
+
+    /* Never send incomplete records */
+    if (buffer->failed)
+        return NULL;
+
+    message = malloc (sizeof (message_t) + buffer->len);
+    if (!message)
+        return NULL;
+    message->refcount = 1;
+    message->len      = buffer->len;
+    memcpy (message->data, buffer->str, buffer->len);
+    return message;
+}
+
+static message_t *
+message_ref (message_t *message)
+{
+    __sync_fetch_and_add (&message->refcount, 1);
+    return message;
+}
+
+static void
+message_unref (message_t *message)
+{
+    if (__sync_fetch_and_sub (&message->refcount, 1) == 1)
+        free (message);
+}
+
+/******************************************************************************/
+/* Broadcast ring */
+
+static pthread_mutex_t  ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static message_t       *ring[BROADCAST_RING_SIZE];
+/* Sequence number of the next message published */
+static uint64_t         ring_head;
+
+static void
+broadcast (const json_buffer_t *buffer)
+{
+    message_t *message;
+    message_t *old;
+
+    if (!(message = message_new (buffer)))
+        return;
+
+    pthread_mutex_lock (&ring_lock);
+    old = ring[ring_head % BROADCAST_RING_SIZE];
+    ring[ring_head % BROADCAST_RING_SIZE] = message;
+    ring_head++;
+    pthread_mutex_unlock (&ring_lock);
+
+    if (old)
+        message_unref (old);
+    wakeup ();
+}
+
+static uint64_t
+broadcast_get_head (void)
+{
+    uint64_t head;
+
+    pthread_mutex_lock (&ring_lock);
+    head = ring_head;
+    pthread_mutex_unlock (&ring_lock);
+    return head;
+}
+
+/* Gets the message at the given sequence number, or the oldest one available
+ * if already gone */
+static message_t *
+broadcast_get (uint64_t *seq,
+               uint64_t *n_dropped)
+{
+    message_t *message = NULL;
+
+    *n_dropped = 0;
+
+    pthread_mutex_lock (&ring_lock);
+    if (ring_head - *seq > BROADCAST_RING_SIZE) {
+        *n_dropped = ring_head - BROADCAST_RING_SIZE - *seq;
+        *seq = ring_head - BROADCAST_RING_SIZE;
+    }
+    if (*seq < ring_head)
+        message = message_ref (ring[(*seq)++ % BROADCAST_RING_SIZE]);
+    pthread_mutex_unlock (&ring_lock);
+
+    return message;
+}
+
+static void
+broadcast_clear (void)
+{
+    unsigned int i;
+
+    for (i = 0; i < BROADCAST_RING_SIZE; i++) {
+        if (ring[i]) {
+            message_unref (ring[i]);
+            ring[i] = NULL;
+        }
+    }
+}
+
+/******************************************************************************/
+/* Responses, from the device command queues to the main loop */
+
+typedef struct response_s {
+    unsigned int       client_id;
+    message_t         *message;
+    /* Whether it answers a request, and so counts in the client limit */
+    bool               request;
+    struct response_s *next;
+} response_t;
+
+static pthread_mutex_t  responses_lock = PTHREAD_MUTEX_INITIALIZER;
+static response_t      *responses;
+static response_t      *responses_last;
+
+static void
+respond (unsigned int         client_id,
+         const json_buffer_t *buffer)
+{
+    response_t *response;
+
+    if (!(response = calloc (1, sizeof (response_t))))
+        return;
+    if (!(response->message = message_new (buffer))) {
+        free (response);
+        return;
+    }
+    response->client_id = client_id;
+    response->request   = true;
+
+    pthread_mutex_lock (&responses_lock);
+    if (responses_last)
+        responses_last->next = response;
+    else
+        responses = response;
+    responses_last = response;
+    pthread_mutex_unlock (&responses_lock);
+
+    wakeup ();
+}
+
+static response_t *
+responses_steal (void)
+{
+    response_t *list;
+
+    pthread_mutex_lock (&responses_lock);
+    list = responses;
+    responses = responses_last = NULL;
+    pthread_mutex_unlock (&responses_lock);
+    return list;
+}
+
+/******************************************************************************/
+/* Records */
+
+static void
+record_open (json_buffer_t *record,
+             const char    *event,
+             const char    *path)
+{
+    json_buffer_reset (record);
+    json_buffer_append (record, "{\"event\":\"");
+    json_buffer_append (record, event);
+    json_buffer_append (record, "\",");
+    json_buffer_append_time (record, "time");
+    json_buffer_append_string (record, "path", (const uint8_t *) path, strlen (path));
+}
+
+typedef mccr_status_t (* swipe_get_uint8_func) (mccr_swipe_report_t  *report,
+                                                uint8_t              *out);
+typedef mccr_status_t (* swipe_get_data_func)  (mccr_swipe_report_t  *report,
+                                                const uint8_t       **out);
+
+static const struct {
+    swipe_get_uint8_func decode_status;
+    swipe_get_uint8_func data_length;
+    swipe_get_data_func  data;
+    swipe_get_uint8_func absolute_data_length;
+    swipe_get_uint8_func masked_data_length;
+    swipe_get_data_func  masked_data;
+} track_getters[] = {
+    {
+        mccr_swipe_report_get_track_1_decode_status,
+        mccr_swipe_report_get_track_1_encrypted_data_length,
+        mccr_swipe_report_get_track_1_encrypted_data,
+        mccr_swipe_report_get_track_1_absolute_data_length,
+        mccr_swipe_report_get_track_1_masked_data_length,
+        mccr_swipe_report_get_track_1_masked_data,
+    },
+    {
+        mccr_swipe_report_get_track_2_decode_status,
+        mccr_swipe_report_get_track_2_encrypted_data_length,
+        mccr_swipe_report_get_track_2_encrypted_data,
+        mccr_swipe_report_get_track_2_absolute_data_length,
+        mccr_swipe_report_get_track_2_masked_data_length,
+        mccr_swipe_report_get_track_2_masked_data,
+    },
+    {
+        mccr_swipe_report_get_track_3_decode_status,
+        mccr_swipe_report_get_track_3_encrypted_data_length,
+        mccr_swipe_report_get_track_3_encrypted_data,
+        mccr_swipe_report_get_track_3_absolute_data_length,
+        mccr_swipe_report_get_track_3_masked_data_length,
+        mccr_swipe_report_get_track_3_masked_data,
+    },
+};
+
+static void
+record_swipe (json_buffer_t       *record,
+              const char          *path,
+              mccr_swipe_report_t *report,
+              unsigned long        seq)
+{
+    mccr_card_encode_type_t  card_encode_type;
+    const uint8_t           *data;
+    size_t                   data_size;
+    uint8_t                  value;
+    unsigned int             i;
+
+    record_open (record, "swipe", path);
+    json_buffer_append_uint (record, "seq", (unsigned int) seq);
+
+    if (mccr_swipe_report_get_card_encode_type (report, &card_encode_type) == MCCR_STATUS_OK) {
+        json_buffer_append (record, "\"card_encode_type\":\"");
+        json_buffer_append (record, mccr_card_encode_type_to_string (card_encode_type));
+        json_buffer_append (record, "\",");
+    }
+
+    json_buffer_append (record, "\"tracks\":[");
+    for (i = 0; i < sizeof (track_getters) / sizeof (track_getters[0]); i++) {
+        json_buffer_append (record, "{");
+        json_buffer_append_uint (record, "track", i + 1);
+        if (track_getters[i].decode_status (report, &value) == MCCR_STATUS_OK) {
+            if (value == MCCR_SWIPE_TRACK_DECODE_STATUS_SUCCESS)
+                json_buffer_append (record, "\"decoding\":\"success\",");
+            else if (value & MCCR_SWIPE_TRACK_DECODE_STATUS_ERROR)
+                json_buffer_append (record, "\"decoding\":\"error\",");
+            else
+                json_buffer_append (record, "\"decoding\":\"unknown\",");
+        }
+        if (track_getters[i].data_length (report, &value) == MCCR_STATUS_OK &&
+            track_getters[i].data (report, &data) == MCCR_STATUS_OK) {
+            json_buffer_append_uint (record, "data_length", value);
+            json_buffer_append_hex (record, "data", data, value);
+        }
+        if (track_getters[i].absolute_data_length (report, &value) == MCCR_STATUS_OK)
+            json_buffer_append_uint (record, "absolute_data_length", value);
+        if (track_getters[i].masked_data_length (report, &value) == MCCR_STATUS_OK &&
+            track_getters[i].masked_data (report, &data) == MCCR_STATUS_OK) {
+            json_buffer_append_uint (record, "masked_data_length", value);
+            json_buffer_append_string (record, "masked_data", data, value);
+        }
+        json_buffer_close (record, "},");
+    }
+    json_buffer_close (record, "],");
+
+    if (mccr_swipe_report_get_data (report, &data, &data_size) == MCCR_STATUS_OK)
+        json_buffer_append_hex (record, "raw", data, data_size);
+
+    json_buffer_close (record, "}\n");
+}
+
+/******************************************************************************/
+/* Devices */
+
+typedef struct request_s {
+    unsigned int      client_id;
+    char             *tag;
+    uint8_t           command_id;
+    uint8_t           data[255];
+    size_t            data_size;
+    struct request_s *next;
+} request_t;
+
+typedef struct device_s {
+    mccr_device_t   *device;
+    char            *path;
+    /* Whether it was published to the clients, and its threads launched */
+    bool             started;
+    bool             reader_running;
+    bool             commander_running;
+    pthread_t        reader;
+    pthread_t        commander;
+    /* Set by the reader thread when the device is no longer usable; only
+     * accessed atomically */
+    int              finished;
+    /* Command queue */
+    pthread_mutex_t  lock;
+    pthread_cond_t   cond;
+    request_t       *requests;
+    request_t       *requests_last;
+    /* Set when the device is being freed; only accessed atomically */
+    int              stopping;
+    /* Either in the main loop device list or in a rescan queue */
+    struct device_s *next;
+    /* In the list of devices opened by the rescan thread */
+    struct device_s *rescan_next;
+} device_t;
+
+static bool
+device_is_finished (device_t *device)
+{
+    return !!__sync_fetch_and_add (&device->finished, 0);
+}
+
+static bool
+device_is_stopping (device_t *device)
+{
+    return !!__sync_fetch_and_add (&device->stopping, 0);
+}
+
+static void
+device_stop (device_t *device)
+{
+    pthread_mutex_lock (&device->lock);
+    __sync_fetch_and_or (&device->stopping, 1);
+    pthread_cond_signal (&device->cond);
+    pthread_mutex_unlock (&device->lock);
+}
+
+static void
+request_free (request_t *request)
+{
+    free (request->tag);
+    free (request);
+}
+
+static void
+request_respond (device_t      *device,
+                 request_t     *request,
+                 mccr_status_t  st,
+                 const uint8_t *response,
+                 size_t         response_size)
+{
+    json_buffer_t record = { 0 };
+
+    record_open (&record, "response", device->path);
+    json_buffer_append_string (&record, "id", (const uint8_t *) request->tag, strlen (request->tag));
+    if (st == MCCR_STATUS_OK) {
+        json_buffer_append (&record, "\"status\":\"success\",");
+        if (response_size)
+            json_buffer_append_hex (&record, "response", response, response_size);
+    } else {
+        json_buffer_append (&record, "\"status\":\"error\",\"error\":\"");
+        json_buffer_append (&record, mccr_status_to_string (st));
+        json_buffer_append (&record, "\"");
+    }
+    json_buffer_close (&record, "}\n");
+
+    respond (request->client_id, &record);
+    json_buffer_clear (&record);
+}
+
+static void *
+device_reader_thread (void *user_data)
+{
+    device_t      *device = user_data;
+    json_buffer_t  record = { 0 };
+    unsigned long  seq = 0;
+
+    while (!daemon_stop && !device_is_stopping (device)) {
+        mccr_status_t        st;
+        mccr_swipe_report_t *report;
+
+        st = mccr_device_wait_swipe_report (device->device, SWIPE_WAIT_TIMEOUT_MS, &report);
+        if (st == MCCR_STATUS_TIMED_OUT)
+            continue;
+        if (st != MCCR_STATUS_OK) {
+            fprintf (stderr, "error: cannot get swipe report from device at path '%s': %s\n",
+                     device->path, mccr_status_to_string (st));
+            break;
+        }
+
+        record_swipe (&record, device->path, report, seq++);
+        mccr_swipe_report_free (report);
+        broadcast (&record);
+    }
+
+    json_buffer_clear (&record);
+    __sync_fetch_and_or (&device->finished, 1);
+    wakeup ();
+    return NULL;
+}
+
+/* Runs the queued commands one by one, as the device handles only one
+ * feature report request at a time */
+static void *
+device_commander_thread (void *user_data)
+{
+    device_t *device = user_data;
+
+    for (;;) {
+        request_t     *request;
+        mccr_status_t  st;
+        uint8_t       *response = NULL;
+        size_t         response_size = 0;
+
+        pthread_mutex_lock (&device->lock);
+        while (!device->requests && !device_is_stopping (device))
+            pthread_cond_wait (&device->cond, &device->lock);
+        request = device->requests;
+        if (request) {
+            device->requests = request->next;
+            if (!device->requests)
+                device->requests_last = NULL;
+        }
+        pthread_mutex_unlock (&device->lock);
+
+        if (!request)
+            break;
+
+        /* Pending requests are not run once the device is gone */
+        if (device_is_stopping (device))
+            st = MCCR_STATUS_NOT_OPEN;
+        else
+            st = mccr_device_run_generic (device->device,
+                                          request->command_id,
+                                          request->data_size ? request->data : NULL,
+                                          request->data_size,
+                                          &response,
+                                          &response_size);
+        request_respond (device, request, st, response, response_size);
+        free (response);
+        request_free (request);
+    }
+
+    return NULL;
+}
+
+static void
+device_queue_request (device_t  *device,
+                      request_t *request)
+{
+    pthread_mutex_lock (&device->lock);
+    if (device->requests_last)
+        device->requests_last->next = request;
+    else
+        device->requests = request;
+    device->requests_last = request;
+    pthread_cond_signal (&device->cond);
+    pthread_mutex_unlock (&device->lock);
+}
+
+static void
+device_event (device_t   *device,
+              const char *event)
+{
+    json_buffer_t record = { 0 };
+
+    record_open (&record, event, device->path);
+    json_buffer_close (&record, "}\n");
+    broadcast (&record);
+    json_buffer_clear (&record);
+}
+
+/* Opens the device, without publishing it yet; may take a while, so run in
+ * the rescan thread */
+static device_t *
+device_open (mccr_device_t *mccr_device)
+{
+    device_t      *device;
+    mccr_status_t  st;
+
+    if ((st = mccr_device_open (mccr_device)) != MCCR_STATUS_OK) {
+        fprintf (stderr, "error: mccr device open failed at path '%s': %s\n",
+                 mccr_device_get_path (mccr_device), mccr_status_to_string (st));
+        return NULL;
+    }
+
+    device = calloc (1, sizeof (device_t));
+    if (!device || !(device->path = strdup (mccr_device_get_path (mccr_device)))) {
+        free (device);
+        mccr_device_close (mccr_device);
+        return NULL;
+    }
+    device->device = mccr_device_ref (mccr_device);
+    pthread_mutex_init (&device->lock, NULL);
+    pthread_cond_init (&device->cond, NULL);
+    return device;
+}
+
+/* Publishes the device and launches its threads; if this fails, the device
+ * is left stopping, and must still be freed */
+static bool
+device_start (device_t *device)
+{
+    /* Publish the device before any swipe it may report */
+    device->started = true;
+    device_event (device, "added");
+
+    if (pthread_create (&device->reader, NULL, device_reader_thread, device) != 0) {
+        fprintf (stderr, "error: couldn't launch reader thread for device at path '%s'\n", device->path);
+        device_stop (device);
+        return false;
+    }
+    device->reader_running = true;
+
+    if (pthread_create (&device->commander, NULL, device_commander_thread, device) != 0) {
+        fprintf (stderr, "error: couldn't launch command thread for device at path '%s'\n", device->path);
+        device_stop (device);
+        return false;
+    }
+    device->commander_running = true;
+
+    return true;
+}
+
+/* Waits for the device threads to finish, so run in the rescan thread */
+static void
+device_free (device_t *device)
+{
+    device_stop (device);
+
+    if (device->commander_running)
+        pthread_join (device->commander, NULL);
+    if (device->reader_running)
+        pthread_join (device->reader, NULL);
+
+    if (device->started)
+        device_event (device, "removed");
+
+    pthread_cond_destroy (&device->cond);
+    pthread_mutex_destroy (&device->lock);
+    mccr_device_close (device->device);
+    mccr_device_unref (device->device);
+    free (device->path);
+    free (device);
+}
+
+static device_t *devices;
+
+static device_t *
+devices_lookup (const char *path)
+{
+    device_t *device;
+
+    for (device = devices; device; device = device->next) {
+        if (strcmp (device->path, path) == 0)
+            return device;
+    }
+    return NULL;
+}
+
+/******************************************************************************/
+/* Rescan */
+
+/* Opening devices and freeing them (which waits for their threads) may take a
+ * while, so it's done in a separate thread and never blocks the main loop.
+ * Devices opened are handed to the main loop, which publishes and starts them;
+ * the main loop hands back the ones finished, to be freed. */
+
+static pthread_t        rescan_tid;
+static pthread_mutex_t  rescan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   rescan_cond;
+static bool             rescan_stop;
+/* Opened, waiting for the main loop */
+static device_t        *rescan_opened;
+/* Finished, waiting to be freed */
+static device_t        *rescan_finished;
+
+static void
+rescan_free (device_t **known,
+             device_t  *list)
+{
+    while (list) {
+        device_t  *device = list;
+        device_t **iter;
+
+        list = device->next;
+        for (iter = known; *iter; iter = &(*iter)->rescan_next) {
+            if (*iter == device) {
+                *iter = device->rescan_next;
+                break;
+            }
+        }
+        device_free (device);
+    }
+}
+
+/* Opens the devices not known yet, and queues them for the main loop */
+static void
+rescan_open (device_t **known)
+{
+    mccr_device_t **found;
+    device_t       *opened = NULL, *last = NULL;
+    unsigned int    i;
+
+    found = mccr_enumerate_devices ();
+    for (i = 0; found && found[i]; i++) {
+        const char *path = mccr_device_get_path (found[i]);
+        device_t   *device;
+
+        for (device = *known; device; device = device->rescan_next) {
+            if (strcmp (device->path, path) == 0)
+                break;
+        }
+        if (!device && (device = device_open (found[i]))) {
+            device->rescan_next = *known;
+            *known = device;
+            if (last)
+                last->next = device;
+            else
+                opened = device;
+            last = device;
+        }
+        mccr_device_unref (found[i]);
+    }
+    free (found);
+
+    if (!opened)
+        return;
+
+    pthread_mutex_lock (&rescan_lock);
+    last->next = rescan_opened;
+    rescan_opened = opened;
+    pthread_mutex_unlock (&rescan_lock);
+    wakeup ();
+}
+
+static void *
+rescan_thread (void *user_data)
+{
+    device_t *known = NULL;
+    device_t *finished;
+
+    pthread_mutex_lock (&rescan_lock);
+    while (!rescan_stop) {
+        struct timespec deadline;
+
+        finished = rescan_finished;
+        rescan_finished = NULL;
+        pthread_mutex_unlock (&rescan_lock);
+
+        rescan_free (&known, finished);
+        rescan_open (&known);
+
+        /* Rescan right away when devices finish, so that they can be
+         * opened again if they are still there */
+        deadline_ms (&deadline, RESCAN_INTERVAL_MS);
+        pthread_mutex_lock (&rescan_lock);
+        while (!rescan_stop && !rescan_finished &&
+               pthread_cond_timedwait (&rescan_cond, &rescan_lock, &deadline) != ETIMEDOUT);
+    }
+
+    /* Whatever the main loop didn't take */
+    finished = rescan_finished;
+    rescan_finished = NULL;
+    pthread_mutex_unlock (&rescan_lock);
+    rescan_free (&known, finished);
+
+    pthread_mutex_lock (&rescan_lock);
+    finished = rescan_opened;
+    rescan_opened = NULL;
+    pthread_mutex_unlock (&rescan_lock);
+    rescan_free (&known, finished);
+
+    return NULL;
+}
+
+/* Hands devices back to the rescan thread, to be freed */
+static void
+rescan_release (device_t *list)
+{
+    device_t *last;
+
+    if (!list)
+        return;
+
+    for (last = list; last->next; last = last->next);
+
+    pthread_mutex_lock (&rescan_lock);
+    last->next = rescan_finished;
+    rescan_finished = list;
+    pthread_cond_signal (&rescan_cond);
+    pthread_mutex_unlock (&rescan_lock);
+}
+
+static bool
+rescan_start (void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init (&attr);
+    pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+    pthread_cond_init (&rescan_cond, &attr);
+    pthread_condattr_destroy (&attr);
+
+    if (pthread_create (&rescan_tid, NULL, rescan_thread, NULL) != 0) {
+        fprintf (stderr, "error: couldn't launch rescan thread\n");
+        pthread_cond_destroy (&rescan_cond);
+        return false;
+    }
+    return true;
+}
+
+/* Frees all devices, the ones in the main loop given */
+static void
+rescan_finish (device_t *list)
+{
+    rescan_release (list);
+
+    pthread_mutex_lock (&rescan_lock);
+    rescan_stop = true;
+    pthread_cond_signal (&rescan_cond);
+    pthread_mutex_unlock (&rescan_lock);
+
+    pthread_join (rescan_tid, NULL);
+    pthread_cond_destroy (&rescan_cond);
+}
+
+/* Hands back the devices finished, and starts the ones opened */
+static void
+devices_update (void)
+{
+    device_t **iter;
+    device_t  *opened, *finished = NULL;
+
+    for (iter = &devices; *iter;) {
+        device_t *device = *iter;
+
+        if (device_is_finished (device)) {
+            *iter = device->next;
+            device->next = finished;
+            finished = device;
+        } else
+            iter = &device->next;
+    }
+
+    pthread_mutex_lock (&rescan_lock);
+    opened = rescan_opened;
+    rescan_opened = NULL;
+    pthread_mutex_unlock (&rescan_lock);
+
+    while (opened) {
+        device_t *device = opened;
+
+        opened = device->next;
+        if (device_start (device)) {
+            device->next = devices;
+            devices = device;
+        } else {
+            device->next = finished;
+            finished = device;
+        }
+    }
+
+    rescan_release (finished);
+}
+
+/******************************************************************************/
+/* Clients */
+
+typedef struct client_s {
+    int              fd;
+    unsigned int     id;
+    /* Next broadcast message to send */
+    uint64_t         cursor;
+    /* Message being sent */
+    message_t       *current;
+    size_t           current_offset;
+    /* Messages for this client only, sent before any broadcast one */
+    response_t      *pending;
+    response_t      *pending_last;
+    /* Requests either running or with the response not sent yet; no more
+     * requests are read from the client while at the limit */
+    unsigned int     n_requests;
+    char             request[MAX_REQUEST_LENGTH];
+    size_t           request_len;
+    struct client_s *next;
+} client_t;
+
+static client_t     *clients;
+static unsigned int  n_clients;
+
+static client_t *
+clients_lookup (unsigned int id)
+{
+    client_t *client;
+
+    for (client = clients; client; client = client->next) {
+        if (client->id == id)
+            return client;
+    }
+    return NULL;
+}
+
+static void
+client_queue_response (client_t   *client,
+                       response_t *response)
+{
+    if (response->request)
+        client->n_requests++;
+
+    if (client->pending_last)
+        client->pending_last->next = response;
+    else
+        client->pending = response;
+    client->pending_last = response;
+}
+
+static void
+client_queue (client_t  *client,
+              message_t *message,
+              bool       request)
+{
+    response_t *response;
+
+    if (!(response = calloc (1, sizeof (response_t)))) {
+        message_unref (message);
+        return;
+    }
+    response->client_id = client->id;
+    response->message   = message;
+    response->request   = request;
+    client_queue_response (client, response);
+}
+
+static void
+client_queue_error (client_t   *client,
+                    const char *tag,
+                    const char *error)
+{
+    json_buffer_t  record = { 0 };
+    message_t     *message;
+
+    json_buffer_append (&record, "{\"event\":\"response\",");
+    json_buffer_append_time (&record, "time");
+    if (tag)
+        json_buffer_append_string (&record, "id", (const uint8_t *) tag, strlen (tag));
+    json_buffer_append (&record, "\"status\":\"error\",");
+    json_buffer_append_string (&record, "error", (const uint8_t *) error, strlen (error));
+    json_buffer_close (&record, "}\n");
+
+    if ((message = message_new (&record)))
+        client_queue (client, message, true);
+    json_buffer_clear (&record);
+}
+
+/* Parses a generic command given as 'CC:LL:DD:DD:...', i.e. command id, data
+ * length and data, as mccr-cli does */
+static bool
+parse_generic_command (const char *str,
+                       request_t  *request)
+{
+    uint8_t buffer[2 + 255];
+    ssize_t bin_size;
+
+    if ((bin_size = strbin (str, buffer, sizeof (buffer))) < 2 || buffer[1] != bin_size - 2)
+        return false;
+
+    request->command_id = buffer[0];
+    request->data_size  = buffer[1];
+    memcpy (request->data, &buffer[2], request->data_size);
+    return true;
+}
+
+/* Requests are given as '<tag> <path> <command>' */
+static void
+client_process_request (client_t *client,
+                        char     *line)
+{
+    char      *tag, *path, *command, *saveptr = NULL;
+    device_t  *device;
+    request_t *request;
+
+    tag     = strtok_r (line, " \t", &saveptr);
+    path    = strtok_r (NULL, " \t", &saveptr);
+    command = strtok_r (NULL, "", &saveptr);
+    if (!tag)
+        return;
+    if (!path || !command) {
+        client_queue_error (client, tag, "invalid request");
+        return;
+    }
+
+    if (!(device = devices_lookup (path)) || device_is_finished (device)) {
+        client_queue_error (client, tag, "device not found");
+        return;
+    }
+
+    if (!(request = calloc (1, sizeof (request_t))) || !(request->tag = strdup (tag))) {
+        free (request);
+        client_queue_error (client, tag, "out of memory");
+        return;
+    }
+    request->client_id = client->id;
+
+    if (!parse_generic_command (command, request)) {
+        request_free (request);
+        client_queue_error (client, tag, "invalid command");
+        return;
+    }
+
+    client->n_requests++;
+    device_queue_request (device, request);
+}
+
+static bool
+client_can_request (client_t *client)
+{
+    return client->n_requests < MAX_CLIENT_REQUESTS;
+}
+
+/* Processes the lines read, while the client is below its request limit;
+ * every line gets a response, either from the device or an error */
+static void
+client_process_requests (client_t *client)
+{
+    char *eol;
+
+    while (client_can_request (client) && (eol = strchr (client->request, '\n')) != NULL) {
+        *eol = '\0';
+        if (eol > client->request && eol[-1] == '\r')
+            eol[-1] = '\0';
+        client_process_request (client, client->request);
+        client->request_len -= (size_t) (eol + 1 - client->request);
+        memmove (client->request, eol + 1, client->request_len + 1);
+    }
+
+    /* Line too long, no way to process it */
+    if (client_can_request (client) && client->request_len == sizeof (client->request) - 1) {
+        client_queue_error (client, NULL, "request too long");
+        client->request_len = 0;
+    }
+}
+
+/* Returns false if the client is gone */
+static bool
+client_read (client_t *client)
+{
+    ssize_t n_read;
+
+    n_read = recv (client->fd, &client->request[client->request_len],
+                   sizeof (client->request) - client->request_len - 1, MSG_DONTWAIT);
+    if (n_read == 0)
+        return false;
+    if (n_read < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+
+    client->request_len += (size_t) n_read;
+    client->request[client->request_len] = '\0';
+
+    client_process_requests (client);
+    return true;
+}
+
+static message_t *
+client_next_message (client_t *client)
+{
+    message_t *message;
+    uint64_t   n_dropped;
+
+    /* Messages for this client first */
+    if (client->pending) {
+        response_t *response = client->pending;
+
+        client->pending = response->next;
+        if (!client->pending)
+            client->pending_last = NULL;
+        if (response->request)
+            client->n_requests--;
+        message = response->message;
+        free (response);
+        return message;
+    }
+
+    message = broadcast_get (&client->cursor, &n_dropped);
+    if (n_dropped) {
+        json_buffer_t  record = { 0 };
+        message_t     *overrun;
+        char           aux[48];
+
+        /* Tell the client about the messages lost before the next one */
+        json_buffer_append (&record, "{\"event\":\"overrun\",");
+        json_buffer_append_time (&record, "time");
+        snprintf (aux, sizeof (aux), "\"dropped\":%llu}\n", (unsigned long long) n_dropped);
+        json_buffer_append (&record, aux);
+        if ((overrun = message_new (&record))) {
+            if (message)
+                client_queue (client, message, false);
+            message = overrun;
+        }
+        json_buffer_clear (&record);
+    }
+
+    return message;
+}
+
+/* Sends as much as possible without blocking. Returns false if the client is
+ * gone. */
+static bool
+client_flush (client_t *client)
+{
+    for (;;) {
+        ssize_t sent;
+
+        if (!client->current) {
+            if (!(client->current = client_next_message (client)))
+                return true;
+            client->current_offset = 0;
+        }
+
+        sent = send (client->fd,
+                     &client->current->data[client->current_offset],
+                     client->current->len - client->current_offset,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+
+        client->current_offset += (size_t) sent;
+        if (client->current_offset == client->current->len) {
+            message_unref (client->current);
+            client->current = NULL;
+        }
+    }
+}
+
+static bool
+client_has_pending (client_t *client,
+                    uint64_t  head)
+{
+    return (client->current || client->pending || client->cursor < head);
+}
+
+static void
+client_new (int fd)
+{
+    static unsigned int  next_id = 1;
+    client_t            *client;
+    device_t            *device;
+
+    if (n_clients == MAX_CLIENTS || !(client = calloc (1, sizeof (client_t)))) {
+        fprintf (stderr, "error: cannot accept more clients\n");
+        close (fd);
+        return;
+    }
+
+    client->fd     = fd;
+    client->id     = next_id++;
+    client->cursor = broadcast_get_head ();
+
+    /* Let the client know about the devices available */
+    for (device = devices; device; device = device->next) {
+        json_buffer_t  record = { 0 };
+        message_t     *message;
+
+        record_open (&record, "added", device->path);
+        json_buffer_close (&record, "}\n");
+        if ((message = message_new (&record)))
+            client_queue (client, message, false);
+        json_buffer_clear (&record);
+    }
+
+    client->next = clients;
+    clients = client;
+    n_clients++;
+}
+
+static void
+client_free (client_t *client)
+{
+    close (client->fd);
+    if (client->current)
+        message_unref (client->current);
+    while (client->pending) {
+        response_t *response = client->pending;
+
+        client->pending = response->next;
+        message_unref (response->message);
+        free (response);
+    }
+    free (client);
+    n_clients--;
+}
+
+/* Responses are routed to their clients, if still around */
+static void
+dispatch_responses (void)
+{
+    response_t *list;
+
+    list = responses_steal ();
+    while (list) {
+        response_t *response = list;
+        client_t   *client;
+
+        list = response->next;
+        response->next = NULL;
+
+        if ((client = clients_lookup (response->client_id)) != NULL) {
+            /* Already counted when the request was queued in the device */
+            client->n_requests--;
+            client_queue_response (client, response);
+        } else {
+            message_unref (response->message);
+            free (response);
+        }
+    }
+}
+
+/******************************************************************************/
+/* Main loop */
+
+static int
+create_socket (const char *socket_path)
+{
+    struct sockaddr_un addr;
+    int                fd;
+
+    if (strlen (socket_path) >= sizeof (addr.sun_path)) {
+        fprintf (stderr, "error: socket path too long: %s\n", socket_path);
+        return -1;
+    }
+
+    if ((fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0) {
+        fprintf (stderr, "error: couldn't create socket: %s\n", strerror (errno));
+        return -1;
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, socket_path);
+
+    /* Remove stale socket from a previous run, if any */
+    unlink (socket_path);
+    if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 || listen (fd, 16) < 0) {
+        fprintf (stderr, "error: couldn't listen in socket '%s': %s\n", socket_path, strerror (errno));
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void
+signal_handler (int signo)
+{
+    daemon_stop = 1;
+    wakeup ();
+}
+
+static int
+run (const char *socket_path)
+{
+    int            listen_fd;
+    struct pollfd *fds = NULL;
+    client_t     **iter;
+
+    if ((listen_fd = create_socket (socket_path)) < 0)
+        return EXIT_FAILURE;
+
+    fds = calloc (2 + MAX_CLIENTS, sizeof (struct pollfd));
+    if (!fds || !rescan_start ()) {
+        free (fds);
+        close (listen_fd);
+        unlink (socket_path);
+        return EXIT_FAILURE;
+    }
+
+    while (!daemon_stop) {
+        client_t     *client;
+        unsigned int  n_fds, i;
+        uint64_t      head;
+
+        devices_update ();
+        dispatch_responses ();
+
+        /* Send as much as possible right away; only wait for the clients
+         * that can't take more */
+        head = broadcast_get_head ();
+        fds[0].fd     = listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd     = wakeup_fds[0];
+        fds[1].events = POLLIN;
+        for (iter = &clients, n_fds = 2; *iter;) {
+            client = *iter;
+            if (!client_flush (client)) {
+                *iter = client->next;
+                client_free (client);
+                continue;
+            }
+            /* Responses sent may allow requests already read to run */
+            client_process_requests (client);
+            fds[n_fds].fd      = client->fd;
+            fds[n_fds].events  = ((client_can_request (client) ? POLLIN : 0) |
+                                  (client_has_pending (client, head) ? POLLOUT : 0));
+            fds[n_fds].revents = 0;
+            n_fds++;
+            iter = &client->next;
+        }
+
+        if (poll (fds, n_fds, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf (stderr, "error: poll failed: %s\n", strerror (errno));
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char buffer[64];
+
+            while (read (wakeup_fds[0], buffer, sizeof (buffer)) > 0);
+        }
+
+        /* Clients are in the same order as their fds */
+        for (iter = &clients, i = 2; *iter && i < n_fds; i++) {
+            client = *iter;
+            if ((fds[i].revents & (POLLERR | POLLHUP)) ||
+                ((fds[i].revents & POLLIN) && !client_read (client))) {
+                *iter = client->next;
+                client_free (client);
+                continue;
+            }
+            iter = &client->next;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd;
+
+            while ((fd = accept4 (listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0)
+                client_new (fd);
+        }
+    }
+
+    while (clients) {
+        client_t *client = clients;
+
+        clients = client->next;
+        client_free (client);
+    }
+
+    rescan_finish (devices);
+    devices = NULL;
+
+    /* Responses to requests flushed when devices were removed */
+    dispatch_responses ();
+    broadcast_clear ();
+
+    free (fds);
+    close (listen_fd);
+    unlink (socket_path);
+    return EXIT_SUCCESS;
+}
+
+/******************************************************************************/
+/* Logging */
+
+static pthread_t main_tid;
+
+static void
+log_handler (pthread_t   thread_id,
+             const char *message)
+{
+    flockfile (stderr);
+    if (thread_id == main_tid)
+        fprintf (stderr, "[mccr] %s\n", message);
+    else
+        fprintf (stderr, "[mccr,%u] %s\n", (unsigned int) thread_id, message);
+    funlockfile (stderr);
+}
+
+/******************************************************************************/
+
+static void
+print_help (void)
+{
+    printf ("\n"
+            "Usage: " PROGRAM_NAME " <option>\n"
+            "\n"
+            "Options:\n"
+            "  -s, --socket=[PATH]         Unix domain socket to listen in\n"
+            "                              (default: " DEFAULT_SOCKET_PATH ").\n"
+            "  -d, --debug                 Enable verbose logging.\n"
+            "  -h, --help                  Show help.\n"
+            "  -v, --version               Show version.\n"
+            "\n"
+            "Clients get one JSON record per line for each swipe in any reader, and\n"
+            "for each reader added or removed. Clients may also run generic commands\n"
+            "in a reader sending lines with a request tag, the reader path and the\n"
+            "command (command id, data length and data, in hexadecimal format):\n"
+            "   1 /dev/hidraw0 00:01:00\n"
+            "\n"
+            "Examples:\n"
+            "   $ " PROGRAM_NAME " --socket=/tmp/mccr.sock\n"
+            "   $ socat - UNIX-CONNECT:/tmp/mccr.sock\n"
+            "\n");
+}
+
+static void
+print_version (void)
+{
+    printf ("\n"
+            PROGRAM_NAME " " PROGRAM_VERSION "\n");
+    printf ("  Built against libmccr %u.%u.%u\n", MCCR_MAJOR_VERSION, MCCR_MINOR_VERSION, MCCR_MICRO_VERSION);
+    printf ("  Running with libmmcr %u.%u.%u\n", mccr_get_major_version (), mccr_get_minor_version (), mccr_get_micro_version ());
+    printf ("Copyright (2016-2017) Zodiac Inflight Innovations\n"
+            "\n");
+}
+
+int main (int argc, char **argv)
+{
+    int               idx, iarg = 0;
+    char             *socket_path = NULL;
+    bool              debug = false;
+    struct sigaction  action;
+    mccr_status_t     st;
+    int               ret;
+
+    const struct option longopts[] = {
+        { "socket",  required_argument, 0, 's' },
+        { "debug",   no_argument,       0, 'd' },
+        { "version", no_argument,       0, 'v' },
+        { "help",    no_argument,       0, 'h' },
+        { 0,         0,                 0, 0   },
+    };
+
+    /* turn off getopt error message */
+    opterr = 1;
+    while (iarg != -1) {
+        iarg = getopt_long (argc, argv, "s:dvh", longopts, &idx);
+        switch (iarg) {
+        case 's':
+            if (socket_path)
+                fprintf (stderr, "warning: --socket given multiple times\n");
+            else
+                socket_path = strdup (optarg);
+            break;
+        case 'd':
+            debug = true;
+            break;
+        case 'h':
+            print_help ();
+            return 0;
+        case 'v':
+            print_version ();
+            return 0;
+        }
+    }
+
+    /* Setup library logging */
+    if (debug) {
+        main_tid = pthread_self ();
+        mccr_log_set_handler (log_handler);
+    }
+
+    if (pipe2 (wakeup_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        fprintf (stderr, "error: couldn't create wakeup pipe: %s\n", strerror (errno));
+        return EXIT_FAILURE;
+    }
+
+    memset (&action, 0, sizeof (action));
+    action.sa_handler = signal_handler;
+    sigaction (SIGINT,  &action, NULL);
+    sigaction (SIGTERM, &action, NULL);
+    /* Clients going away are detected on send() */
+    action.sa_handler = SIG_IGN;
+    sigaction (SIGPIPE, &action, NULL);
+
+    /* Initialize */
+    st = mccr_init ();
+    if (st != MCCR_STATUS_OK) {
+        fprintf (stderr, "error: mccr library initialization failed: %s\n", mccr_status_to_string (st));
+        return EXIT_FAILURE;
+    }
+
+    ret = run (socket_path ? socket_path : DEFAULT_SOCKET_PATH);
+
+    mccr_exit ();
+    free (socket_path);
+    close (wakeup_fds[0]);
+    close (wakeup_fds[1]);
+    return ret;
+}
@@ -0,0 +1,740 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * mccr-decrypt - Offline decryption of MagTek Credit Card Reader swipes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+/*
+ * Swipe reports recorded earlier are decrypted with a given BDK, using the
+ * DUKPT KSN reported by the reader along with each swipe. Input lines are
+ * either mccr-daemon JSON records (only 'swipe' ones are processed, using
+ * their 'raw' report) or raw input reports in hexadecimal format, one per
+ * line.
+ *
+ * Lines are read in chunks, decrypted by a pool of worker threads and written
+ * back in the same order they were read, either as JSON Lines or as tab
+ * separated columns.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+#include <dukpt.h>
+
+#include <common.h>
+#include <json.h>
+#include <key-cache.h>
+
+#include <mccr.h>
+
+#define PROGRAM_NAME    "mccr-decrypt"
+#define PROGRAM_VERSION PACKAGE_VERSION
+
+/* Lines processed at once; bounds memory use regardless of the input size */
+#define CHUNK_SIZE 1024
+
+/* One IPEK per reader */
+#define KEY_CACHE_MAX_IPEKS 256
+
+/******************************************************************************/
+/* Options */
+
+typedef enum {
+    OUTPUT_FORMAT_JSONL,
+    OUTPUT_FORMAT_TSV,
+} output_format_t;
+
+static const struct {
+    const char       *name;
+    dukpt_key_type_t  key_type;
+} key_types[] = {
+    { "pin",           DUKPT_KEY_TYPE_PIN_ENCRYPTION },
+    { "mac-request",   DUKPT_KEY_TYPE_MAC_REQUEST    },
+    { "mac-response",  DUKPT_KEY_TYPE_MAC_RESPONSE   },
+    { "data-request",  DUKPT_KEY_TYPE_DATA_REQUEST   },
+    { "data-response", DUKPT_KEY_TYPE_DATA_RESPONSE  },
+};
+
+static bool
+parse_key_type (const char       *str,
+                dukpt_key_type_t *out_key_type)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof (key_types) / sizeof (key_types[0]); i++) {
+        if (strcmp (str, key_types[i].name) == 0) {
+            *out_key_type = key_types[i].key_type;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+load_report_descriptor (const char  *path,
+                        uint8_t    **out_desc,
+                        size_t      *out_desc_size)
+{
+    FILE    *input;
+    uint8_t *desc;
+    size_t   desc_size;
+
+    if (!(input = fopen (path, "rb"))) {
+        fprintf (stderr, "error: couldn't open report descriptor file '%s'\n", path);
+        return false;
+    }
+
+    /* HID report descriptors are at most 4096 bytes long */
+    desc = malloc (4096);
+    desc_size = desc ? fread (desc, 1, 4096, input) : 0;
+    fclose (input);
+
+    if (!desc_size) {
+        fprintf (stderr, "error: couldn't read report descriptor file '%s'\n", path);
+        free (desc);
+        return false;
+    }
+
+    *out_desc      = desc;
+    *out_desc_size = desc_size;
+    return true;
+}
+
+/******************************************************************************/
+/* Record parsing */
+
+/* Finds the (still escaped) value of the given string member in a JSON
+ * record written by mccr-daemon */
+static bool
+record_get_string (const char  *line,
+                   const char  *key,
+                   const char **out_value,
+                   size_t      *out_value_size)
+{
+    char        pattern[32];
+    const char *start, *end;
+
+    snprintf (pattern, sizeof (pattern), "\"%s\":\"", key);
+    if (!(start = strstr (line, pattern)))
+        return false;
+    start += strlen (pattern);
+
+    for (end = start; *end && *end != '"'; end++) {
+        if (*end == '\\' && end[1])
+            end++;
+    }
+    if (*end != '"')
+        return false;
+
+    *out_value      = start;
+    *out_value_size = (size_t) (end - start);
+    return true;
+}
+
+/******************************************************************************/
+/* Decryption */
+
+typedef struct {
+    mccr_status_t (* data_length)          (mccr_swipe_report_t *, uint8_t *);
+    mccr_status_t (* data)                 (mccr_swipe_report_t *, const uint8_t **);
+    mccr_status_t (* absolute_data_length) (mccr_swipe_report_t *, uint8_t *);
+} track_getters_t;
+
+static const track_getters_t track_getters[] = {
+    {
+        mccr_swipe_report_get_track_1_encrypted_data_length,
+        mccr_swipe_report_get_track_1_encrypted_data,
+        mccr_swipe_report_get_track_1_absolute_data_length,
+    },
+    {
+        mccr_swipe_report_get_track_2_encrypted_data_length,
+        mccr_swipe_report_get_track_2_encrypted_data,
+        mccr_swipe_report_get_track_2_absolute_data_length,
+    },
+    {
+        mccr_swipe_report_get_track_3_encrypted_data_length,
+        mccr_swipe_report_get_track_3_encrypted_data,
+        mccr_swipe_report_get_track_3_absolute_data_length,
+    },
+};
+
+#define N_TRACKS (sizeof (track_getters) / sizeof (track_getters[0]))
+
+typedef struct {
+    uint8_t length;
+    /* Length of the track contents, without padding */
+    uint8_t absolute_length;
+    uint8_t data[256];
+} decrypted_track_t;
+
+typedef struct {
+    unsigned int       line_number;
+    char              *line;
+    size_t             line_size;
+    /* Results */
+    bool               skipped;
+    const char        *error;
+    uint8_t            ksn[MCCR_DUKPT_KSN_AND_COUNTER_SIZE];
+    decrypted_track_t  tracks[N_TRACKS];
+    json_buffer_t      output;
+} record_t;
+
+typedef struct {
+    dukpt_key_t           bdk;
+    dukpt_key_type_t      key_type;
+    mccr_report_layout_t *layout;
+    output_format_t       output_format;
+    key_cache_t          *key_cache;
+    /* Current chunk */
+    record_t             *records;
+    unsigned int          n_records;
+    volatile unsigned int next;
+} decrypt_t;
+
+static void
+decrypt_report (decrypt_t           *ctx,
+                record_t            *record,
+                mccr_swipe_report_t *report)
+{
+    const uint8_t *ksn;
+    const uint8_t *data;
+    dukpt_key_t    key;
+    unsigned int   i;
+
+    if (mccr_swipe_report_get_dukpt_ksn_and_counter (report, &ksn) != MCCR_STATUS_OK) {
+        record->error = "no DUKPT KSN in report";
+        return;
+    }
+    memcpy (record->ksn, ksn, sizeof (record->ksn));
+
+    key_cache_get_key (ctx->key_cache, (const dukpt_key_t *) &ctx->bdk, (const dukpt_ksn_t *) ksn, ctx->key_type, &key);
+
+    for (i = 0; i < N_TRACKS; i++) {
+        decrypted_track_t *track = &record->tracks[i];
+
+        if (track_getters[i].data_length (report, &track->length) != MCCR_STATUS_OK ||
+            track_getters[i].data (report, &data) != MCCR_STATUS_OK) {
+            track->length = 0;
+            continue;
+        }
+        if (!track->length)
+            continue;
+
+        if (track_getters[i].absolute_data_length (report, &track->absolute_length) != MCCR_STATUS_OK ||
+            track->absolute_length > track->length)
+            track->absolute_length = track->length;
+
+        dukpt_decrypt ((const dukpt_key_t *) &key, data, track->length, track->data, track->length);
+    }
+
+    memwipe (&key, sizeof (key));
+}
+
+static void
+decrypt_record (decrypt_t *ctx,
+                record_t  *record)
+{
+    mccr_swipe_report_t *report;
+    const char          *hex;
+    size_t               hex_size;
+    uint8_t             *data;
+    ssize_t              data_size;
+
+    record->skipped = false;
+    record->error   = NULL;
+    memset (record->tracks, 0, sizeof (record->tracks));
+
+    /* Journal records other than swipes are skipped */
+    if (record->line[0] == '{') {
+        if (!strstr (record->line, "\"event\":\"swipe\"")) {
+            record->skipped = true;
+            return;
+        }
+        if (!record_get_string (record->line, "raw", &hex, &hex_size)) {
+            record->error = "no raw report in record";
+            return;
+        }
+    } else {
+        hex      = record->line;
+        hex_size = strlen (record->line);
+    }
+
+    if (!(data = malloc ((hex_size / 2) + 1))) {
+        record->error = "couldn't allocate report";
+        return;
+    }
+
+    if ((data_size = hex_decode (hex, hex_size, data, (hex_size / 2) + 1)) < 0)
+        record->error = "invalid raw report";
+    else if (mccr_swipe_report_new_from_layout (ctx->layout, data, (size_t) data_size, &report) != MCCR_STATUS_OK)
+        record->error = "raw report doesn't match report descriptor";
+    else {
+        decrypt_report (ctx, record, report);
+        mccr_swipe_report_free (report);
+    }
+
+    free (data);
+}
+
+/******************************************************************************/
+/* Output */
+
+static void
+append_escaped_member (json_buffer_t *buffer,
+                       const char    *line,
+                       const char    *key)
+{
+    const char *value;
+    size_t      value_size;
+
+    if (!record_get_string (line, key, &value, &value_size))
+        return;
+
+    json_buffer_append (buffer, "\"");
+    json_buffer_append (buffer, key);
+    json_buffer_append (buffer, "\":\"");
+    if (json_buffer_reserve (buffer, value_size)) {
+        memcpy (&buffer->str[buffer->len], value, value_size);
+        buffer->len += value_size;
+    }
+    json_buffer_append (buffer, "\",");
+}
+
+static void
+format_jsonl (record_t *record)
+{
+    json_buffer_t *output = &record->output;
+    unsigned int   i;
+
+    json_buffer_append (output, "{");
+    json_buffer_append_uint (output, "line", record->line_number);
+    if (record->line[0] == '{') {
+        append_escaped_member (output, record->line, "time");
+        append_escaped_member (output, record->line, "path");
+    }
+
+    if (record->error) {
+        json_buffer_append (output, "\"error\":\"");
+        json_buffer_append (output, record->error);
+        json_buffer_close (output, "\"}\n");
+        return;
+    }
+
+    json_buffer_append_hex (output, "ksn", record->ksn, sizeof (record->ksn));
+    json_buffer_append (output, "\"tracks\":[");
+    for (i = 0; i < N_TRACKS; i++) {
+        const decrypted_track_t *track = &record->tracks[i];
+
+        if (!track->length)
+            continue;
+        json_buffer_append (output, "{");
+        json_buffer_append_uint (output, "track", i + 1);
+        json_buffer_append_uint (output, "data_length", track->length);
+        json_buffer_append_hex (output, "data", track->data, track->length);
+        json_buffer_append_string (output, "ascii", track->data, track->absolute_length);
+        json_buffer_close (output, "},");
+    }
+    json_buffer_close (output, "]");
+    json_buffer_close (output, "}\n");
+}
+
+/* Values never include the separators */
+static void
+append_column (json_buffer_t *buffer,
+               const char    *value,
+               size_t         value_size,
+               bool           last)
+{
+    size_t i;
+
+    if (json_buffer_reserve (buffer, value_size + 1)) {
+        for (i = 0; i < value_size; i++)
+            buffer->str[buffer->len++] = isprint ((unsigned char) value[i]) ? value[i] : '#';
+        buffer->str[buffer->len++] = last ? '\n' : '\t';
+    }
+}
+
+#define TSV_HEADER "line\ttime\tpath\tksn\ttrack_1\ttrack_2\ttrack_3\terror\n"
+
+static void
+format_tsv (record_t *record)
+{
+    json_buffer_t *output = &record->output;
+    char           aux[2 * MCCR_DUKPT_KSN_AND_COUNTER_SIZE + 1];
+    const char    *value;
+    size_t         value_size;
+    unsigned int   i;
+
+    snprintf (aux, sizeof (aux), "%u", record->line_number);
+    append_column (output, aux, strlen (aux), false);
+
+    if (record->line[0] == '{' && record_get_string (record->line, "time", &value, &value_size))
+        append_column (output, value, value_size, false);
+    else
+        append_column (output, NULL, 0, false);
+
+    if (record->line[0] == '{' && record_get_string (record->line, "path", &value, &value_size))
+        append_column (output, value, value_size, false);
+    else
+        append_column (output, NULL, 0, false);
+
+    if (record->error) {
+        for (i = 0; i < 1 + N_TRACKS; i++)
+            append_column (output, NULL, 0, false);
+        append_column (output, record->error, strlen (record->error), true);
+        return;
+    }
+
+    append_column (output, aux, hex_encode (record->ksn, sizeof (record->ksn), NULL, aux, sizeof (aux)), false);
+    for (i = 0; i < N_TRACKS; i++)
+        append_column (output, (const char *) record->tracks[i].data, record->tracks[i].absolute_length, false);
+    append_column (output, NULL, 0, true);
+}
+
+/******************************************************************************/
+/* Worker pool */
+
+static void *
+decrypt_worker_thread (void *user_data)
+{
+    decrypt_t    *ctx = user_data;
+    unsigned int  i;
+
+    while ((i = __sync_fetch_and_add (&ctx->next, 1)) < ctx->n_records) {
+        record_t *record = &ctx->records[i];
+
+        decrypt_record (ctx, record);
+        json_buffer_reset (&record->output);
+        if (record->skipped)
+            continue;
+        if (ctx->output_format == OUTPUT_FORMAT_TSV)
+            format_tsv (record);
+        else
+            format_jsonl (record);
+    }
+    return NULL;
+}
+
+static void
+decrypt_chunk (decrypt_t    *ctx,
+               pthread_t    *workers,
+               unsigned int  n_jobs)
+{
+    unsigned int n_workers, i;
+
+    ctx->next = 0;
+    for (n_workers = 0; n_workers < n_jobs && n_workers < ctx->n_records; n_workers++) {
+        if (pthread_create (&workers[n_workers], NULL, decrypt_worker_thread, ctx) != 0)
+            break;
+    }
+    /* If no worker could be launched, decrypt here */
+    if (!n_workers)
+        decrypt_worker_thread (ctx);
+    for (i = 0; i < n_workers; i++)
+        pthread_join (workers[i], NULL);
+}
+
+/* Reads the next chunk of lines, trimmed, skipping empty ones and comments */
+static unsigned int
+read_chunk (decrypt_t    *ctx,
+            FILE         *input,
+            unsigned int *line_number)
+{
+    ctx->n_records = 0;
+    while (ctx->n_records < CHUNK_SIZE) {
+        record_t *record = &ctx->records[ctx->n_records];
+        ssize_t   line_length;
+        char     *start;
+
+        if ((line_length = getline (&record->line, &record->line_size, input)) < 0)
+            break;
+        (*line_number)++;
+
+        while (line_length > 0 && isspace ((unsigned char) record->line[line_length - 1]))
+            record->line[--line_length] = '\0';
+        for (start = record->line; isspace ((unsigned char) *start); start++);
+        if (!*start || *start == '#')
+            continue;
+        if (start != record->line)
+            memmove (record->line, start, strlen (start) + 1);
+
+        record->line_number = *line_number;
+        ctx->n_records++;
+    }
+    return ctx->n_records;
+}
+
+static int
+run_decrypt (decrypt_t    *ctx,
+             const char   *path,
+             unsigned int  n_jobs)
+{
+    FILE         *input;
+    pthread_t    *workers;
+    unsigned int  line_number = 0;
+    unsigned int  n_decrypted = 0, n_failed = 0, i;
+    int           ret = EXIT_FAILURE;
+
+    if (!path || strcmp (path, "-") == 0)
+        input = stdin;
+    else if (!(input = fopen (path, "r"))) {
+        fprintf (stderr, "error: couldn't open input file '%s'\n", path);
+        return EXIT_FAILURE;
+    }
+
+    ctx->records = calloc (CHUNK_SIZE, sizeof (record_t));
+    workers      = calloc (n_jobs, sizeof (pthread_t));
+    if (!ctx->records || !workers) {
+        fprintf (stderr, "error: couldn't allocate records\n");
+        goto out;
+    }
+
+    if (ctx->output_format == OUTPUT_FORMAT_TSV)
+        fputs (TSV_HEADER, stdout);
+
+    while (read_chunk (ctx, input, &line_number) > 0) {
+        decrypt_chunk (ctx, workers, n_jobs);
+
+        for (i = 0; i < ctx->n_records; i++) {
+            record_t *record = &ctx->records[i];
+
+            if (record->skipped)
+                continue;
+            if (record->error)
+                n_failed++;
+            else
+                n_decrypted++;
+            if (fwrite (record->output.str, 1, record->output.len, stdout) != record->output.len) {
+                fprintf (stderr, "error: couldn't write output\n");
+                goto out;
+            }
+        }
+    }
+
+    if (fflush (stdout) != 0) {
+        fprintf (stderr, "error: couldn't write output\n");
+        goto out;
+    }
+
+    fprintf (stderr, "%u swipes decrypted, %u failed\n", n_decrypted, n_failed);
+    if (!n_failed)
+        ret = EXIT_SUCCESS;
+
+out:
+    /* Both the tracks and the output hold the cleartext */
+    for (i = 0; ctx->records && i < CHUNK_SIZE; i++) {
+        record_t *record = &ctx->records[i];
+
+        free (record->line);
+        memwipe (record->tracks, sizeof (record->tracks));
+        if (record->output.str)
+            memwipe (record->output.str, record->output.allocated);
+        json_buffer_clear (&record->output);
+    }
+    free (ctx->records);
+    free (workers);
+    if (input != stdin)
+        fclose (input);
+    return ret;
+}
+
+/******************************************************************************/
+
+static void
+print_help (void)
+{
+    printf ("\n"
+            "Usage: " PROGRAM_NAME " <option> [FILE]\n"
+            "\n"
+            "Decrypts the swipe reports listed in FILE (or in stdin if none given or '-'),\n"
+            "either mccr-daemon JSON records or raw input reports in hexadecimal format,\n"
+            "one per line.\n"
+            "\n"
+            "Options:\n"
+            "  -b, --bdk=[KEY]             Base Derivation Key, in hexadecimal format.\n"
+            "  -k, --key-type=[TYPE]       Key type: 'pin' (default), 'mac-request',\n"
+            "                              'mac-response', 'data-request' or 'data-response'.\n"
+            "  -D, --descriptor=[FILE]     HID report descriptor of the readers that sent the\n"
+            "                              reports (e.g. dumped from\n"
+            "                              /sys/class/hidraw/hidraw0/device/report_descriptor).\n"
+            "  -o, --output=[FORMAT]       Output format: 'jsonl' (default) or 'tsv'.\n"
+            "  -j, --jobs=[N]              Number of reports decrypted in parallel; defaults\n"
+            "                              to the number of CPUs online.\n"
+            "\n"
+            "Common options:\n"
+            "  -h, --help                  Show help.\n"
+            "  -v, --version               Show version.\n"
+            "\n"
+            "Examples:\n"
+            "   $ " PROGRAM_NAME " --bdk=0123456789ABCDEFFEDCBA9876543210 --descriptor=desc.bin swipes.jsonl\n"
+            "   $ " PROGRAM_NAME " --bdk=0123456789ABCDEFFEDCBA9876543210 --descriptor=desc.bin --key-type=data-request --output=tsv < swipes.jsonl\n"
+            "\n");
+}
+
+static void
+print_version (void)
+{
+    printf ("\n"
+            PROGRAM_NAME " " PROGRAM_VERSION "\n");
+    printf ("  Built against libmccr %u.%u.%u\n", MCCR_MAJOR_VERSION, MCCR_MINOR_VERSION, MCCR_MICRO_VERSION);
+    printf ("  Running with libmmcr %u.%u.%u\n", mccr_get_major_version (), mccr_get_minor_version (), mccr_get_micro_version ());
+    printf ("Copyright (2016-2017) Zodiac Inflight Innovations\n"
+            "\n");
+}
+
+int main (int argc, char **argv)
+{
+    int           idx, iarg = 0;
+    decrypt_t     ctx = { { 0 } };
+    char         *bdk = NULL;
+    char         *descriptor = NULL;
+    uint8_t      *desc = NULL;
+    size_t        desc_size = 0;
+    unsigned int  jobs = 0;
+    long          n_cpus;
+    mccr_status_t st;
+    int           ret = EXIT_FAILURE;
+
+    const struct option longopts[] = {
+        { "bdk",        required_argument, 0, 'b' },
+        { "key-type",   required_argument, 0, 'k' },
+        { "descriptor", required_argument, 0, 'D' },
+        { "output",     required_argument, 0, 'o' },
+        { "jobs",       required_argument, 0, 'j' },
+        { "version",    no_argument,       0, 'v' },
+        { "help",       no_argument,       0, 'h' },
+        { 0,            0,                 0, 0   },
+    };
+
+    ctx.key_type      = DUKPT_KEY_TYPE_PIN_ENCRYPTION;
+    ctx.output_format = OUTPUT_FORMAT_JSONL;
+
+    /* turn off getopt error message */
+    opterr = 1;
+    while (iarg != -1) {
+        iarg = getopt_long (argc, argv, "b:k:D:o:j:vh", longopts, &idx);
+        switch (iarg) {
+        case 'b':
+            /* Decoded last, so that it's only in memory while needed */
+            bdk = optarg;
+            break;
+        case 'k':
+            if (!parse_key_type (optarg, &ctx.key_type)) {
+                fprintf (stderr, "error: invalid key type: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'D':
+            if (descriptor)
+                fprintf (stderr, "warning: --descriptor given multiple times\n");
+            else
+                descriptor = optarg;
+            break;
+        case 'o':
+            if (strcmp (optarg, "jsonl") == 0)
+                ctx.output_format = OUTPUT_FORMAT_JSONL;
+            else if (strcmp (optarg, "tsv") == 0)
+                ctx.output_format = OUTPUT_FORMAT_TSV;
+            else {
+                fprintf (stderr, "error: invalid output format: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'j':
+            jobs = (unsigned int) strtoul (optarg, NULL, 10);
+            if (!jobs) {
+                fprintf (stderr, "error: invalid number of jobs: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h':
+            print_help ();
+            return 0;
+        case 'v':
+            print_version ();
+            return 0;
+        }
+    }
+
+    if (!bdk) {
+        fprintf (stderr, "error: no BDK given\n");
+        return EXIT_FAILURE;
+    }
+    /* Records only have the raw reports, whose layout depends on the reader */
+    if (!descriptor) {
+        fprintf (stderr, "error: no report descriptor given\n");
+        return EXIT_FAILURE;
+    }
+    if (optind + 1 < argc) {
+        fprintf (stderr, "error: too many input files given\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!jobs) {
+        n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+        jobs = n_cpus > 0 ? (unsigned int) n_cpus : 1;
+    }
+
+    /* Initialize */
+    st = mccr_init ();
+    if (st != MCCR_STATUS_OK) {
+        fprintf (stderr, "error: mccr library initialization failed: %s\n", mccr_status_to_string (st));
+        return EXIT_FAILURE;
+    }
+
+    /* The descriptor is parsed once, and the layout shared by all workers */
+    if (!load_report_descriptor (descriptor, &desc, &desc_size))
+        goto out;
+    st = mccr_report_layout_new (desc, desc_size, &ctx.layout);
+    free (desc);
+    if (st != MCCR_STATUS_OK) {
+        fprintf (stderr, "error: couldn't parse report descriptor file '%s': %s\n", descriptor, mccr_status_to_string (st));
+        goto out;
+    }
+
+    if (!(ctx.key_cache = key_cache_new (KEY_CACHE_MAX_IPEKS))) {
+        fprintf (stderr, "error: couldn't allocate key cache\n");
+        goto out;
+    }
+
+    if (strbin (bdk, (uint8_t *) &ctx.bdk, sizeof (ctx.bdk)) != sizeof (ctx.bdk)) {
+        fprintf (stderr, "error: invalid BDK\n");
+        goto out;
+    }
+
+    ret = run_decrypt (&ctx, optind < argc ? argv[optind] : NULL, jobs);
+
+out:
+    memwipe (&ctx.bdk, sizeof (ctx.bdk));
+    key_cache_free (ctx.key_cache);
+    if (ctx.layout)
+        mccr_report_layout_free (ctx.layout);
+    mccr_exit ();
+
+    return ret;
+}
@@ -42,6 +42,7 @@
 /* Context */
 
 static gboolean  version_flag;
+static gboolean  dashboard_flag;
 static gchar    *log_level_str;
 
 static const GOptionEntry entries[] = {
@@ -50,6 +51,11 @@ static const GOptionEntry entries[] = {
         "Log level: one of [error, warning, info, debug]",
         "[LEVEL]"
     },
+    {
+        "dashboard", 'd', 0, G_OPTION_ARG_NONE, &dashboard_flag,
+        "Show all devices at once in a dashboard",
+        NULL
+    },
     {
         "version", 'v', 0, G_OPTION_ARG_NONE, &version_flag,
         "Print version",
@@ -196,7 +202,7 @@ int main (int argc, char **argv)
     }
     g_debug ("mccr initialized");
 
-    app = mui_app_new ();
+    app = mui_app_new (dashboard_flag);
     g_application_set_default (G_APPLICATION (app));
     run_status = g_application_run (G_APPLICATION (app), argc, argv);
     g_object_unref (app);
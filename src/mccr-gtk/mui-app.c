@@ -25,9 +25,23 @@
 
 #include "mui-app.h"
 #include "mui-window.h"
+#include "mui-dashboard.h"
 
 G_DEFINE_TYPE (MuiApp, mui_app, GTK_TYPE_APPLICATION)
 
+enum {
+    PROP_0,
+    PROP_DASHBOARD,
+    N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES] = { NULL };
+
+struct _MuiAppPrivate {
+    /* Properties */
+    gboolean dashboard;
+};
+
 /******************************************************************************/
 /* Application menu management */
 
@@ -113,13 +127,13 @@ static GActionEntry app_entries[] = {
 /******************************************************************************/
 /* Activate */
 
-static MuiWindow *
+static GtkWindow *
 app_window_new (MuiApp *self)
 {
     GtkWidget *window;
 
     /* Register window in app */
-    window = mui_window_new ();
+    window = self->priv->dashboard ? mui_dashboard_new () : mui_window_new ();
     gtk_application_add_window (GTK_APPLICATION (self), GTK_WINDOW (window));
     gtk_application_window_set_show_menubar (GTK_APPLICATION_WINDOW (window), FALSE);
 
@@ -127,16 +141,16 @@ app_window_new (MuiApp *self)
     gtk_window_set_position (GTK_WINDOW (window), GTK_WIN_POS_CENTER);
 
     /* transfer none */
-    return MUI_WINDOW (window);
+    return GTK_WINDOW (window);
 }
 
 static void
 activate (GApplication *application)
 {
-    MuiWindow *window;
+    GtkWindow *window;
 
     window = app_window_new (MUI_APP (application));
-    gtk_window_present (GTK_WINDOW (window));
+    gtk_window_present (window);
 }
 
 /******************************************************************************/
@@ -161,25 +175,78 @@ startup (GApplication *application)
 /******************************************************************************/
 
 MuiApp *
-mui_app_new (void)
+mui_app_new (gboolean dashboard)
 {
     return g_object_new (MUI_TYPE_APP,
                          "application-id", "es.aleksander.MCCR",
+                         "dashboard",      dashboard,
                          NULL);
 }
 
 static void
 mui_app_init (MuiApp *self)
 {
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MUI_TYPE_APP, MuiAppPrivate);
     g_set_application_name ("MCCR GTK+");
     gtk_window_set_default_icon_name ("mccr-gtk");
 }
 
+static void
+set_property (GObject      *object,
+              guint         prop_id,
+              const GValue *value,
+              GParamSpec   *pspec)
+{
+    MuiApp *self = MUI_APP (object);
+
+    switch (prop_id) {
+    case PROP_DASHBOARD:
+        self->priv->dashboard = g_value_get_boolean (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+        break;
+    }
+}
+
+static void
+get_property (GObject    *object,
+              guint       prop_id,
+              GValue     *value,
+              GParamSpec *pspec)
+{
+    MuiApp *self = MUI_APP (object);
+
+    switch (prop_id) {
+    case PROP_DASHBOARD:
+        g_value_set_boolean (value, self->priv->dashboard);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+        break;
+    }
+}
+
 static void
 mui_app_class_init (MuiAppClass *klass)
 {
+    GObjectClass      *object_class      = G_OBJECT_CLASS (klass);
     GApplicationClass *application_class = G_APPLICATION_CLASS (klass);
 
+    g_type_class_add_private (klass, sizeof (MuiAppPrivate));
+
+    object_class->set_property = set_property;
+    object_class->get_property = get_property;
+
     application_class->startup  = startup;
     application_class->activate = activate;
+
+    properties[PROP_DASHBOARD] =
+        g_param_spec_boolean ("dashboard",
+                              "Dashboard",
+                              "Whether all devices are shown at once in a dashboard",
+                              FALSE,
+                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    g_object_class_install_properties (object_class, N_PROPERTIES, properties);
 }
@@ -35,11 +35,13 @@ G_BEGIN_DECLS
 #define MUI_IS_APP_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), MUI_TYPE_APP))
 #define MUI_APP_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), MUI_TYPE_APP, MuiAppClass))
 
-typedef struct _MuiApp      MuiApp;
-typedef struct _MuiAppClass MuiAppClass;
+typedef struct _MuiApp        MuiApp;
+typedef struct _MuiAppClass   MuiAppClass;
+typedef struct _MuiAppPrivate MuiAppPrivate;
 
 struct _MuiApp {
-    GtkApplication parent_instance;
+    GtkApplication  parent_instance;
+    MuiAppPrivate  *priv;
 };
 
 struct _MuiAppClass {
@@ -48,7 +50,7 @@ struct _MuiAppClass {
 
 GType mui_app_get_type (void) G_GNUC_CONST;
 
-MuiApp   *mui_app_new  (void);
+MuiApp   *mui_app_new  (gboolean  dashboard);
 void      mui_app_quit (MuiApp *self);
 
 G_END_DECLS
@@ -0,0 +1,293 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * mccr-gtk - GTK+ tool to manage MagTek Credit Card Readers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <config.h>
+#include <string.h>
+#include <stdlib.h>
+#include <gtk/gtk.h>
+#include <gudev/gudev.h>
+
+#include <mccr.h>
+
+#include "mui-dashboard.h"
+#include "mui-processor.h"
+#include "mui-tile.h"
+
+#define MAGTEK_VID 0x0801
+
+G_DEFINE_TYPE (MuiDashboard, mui_dashboard, GTK_TYPE_APPLICATION_WINDOW)
+
+struct _MuiDashboardPrivate {
+    GtkWidget *headerbar;
+    GtkWidget *box_no_devices;
+    GtkWidget *scrolled_window;
+    GtkWidget *tiles;
+
+    /* Devices shown, by path */
+    GHashTable *devices;
+
+    /* Device monitoring */
+    GUdevClient *udev;
+};
+
+/******************************************************************************/
+/* Devices */
+
+typedef struct {
+    MuiProcessor *processor;
+    GCancellable *swipe_stream_cancellable;
+    GtkWidget    *tile;
+} DashboardDevice;
+
+static void
+swipe_stream_ready (MuiProcessor *processor,
+                    GAsyncResult *res)
+{
+    GError *error = NULL;
+
+    /* The stream only finishes when cancelled or when the processor is
+     * stopped, so there's nothing to reschedule */
+    if (!mui_processor_swipe_stream_finish (processor, res, &error)) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning ("swipe stream failed in %s: %s", mui_processor_get_path (processor), error->message);
+        g_error_free (error);
+    }
+}
+
+static void
+dashboard_device_free (DashboardDevice *device)
+{
+    /* The stream holds a reference to the processor until cancelled */
+    g_cancellable_cancel (device->swipe_stream_cancellable);
+    g_object_unref (device->swipe_stream_cancellable);
+
+    /* The tile gets destroyed along with its flow box child, if any */
+#if GTK_CHECK_VERSION (3,12,0)
+    gtk_widget_destroy (gtk_widget_get_parent (device->tile));
+#else
+    gtk_widget_destroy (device->tile);
+#endif
+
+    g_object_unref (device->processor);
+    g_slice_free (DashboardDevice, device);
+}
+
+static DashboardDevice *
+dashboard_device_new (MuiDashboard *self,
+                      const gchar  *path)
+{
+    DashboardDevice *device;
+
+    device = g_slice_new0 (DashboardDevice);
+
+    /* All processors share the same thread, so there is no per-device cost
+     * other than the device itself; an idle reader just adds its input
+     * descriptor to the ones polled in that thread */
+    device->processor = mui_processor_new (path);
+
+    device->tile = mui_tile_new (path);
+    g_object_set (device->tile, "processor", device->processor, NULL);
+    gtk_widget_show (device->tile);
+    gtk_container_add (GTK_CONTAINER (self->priv->tiles), device->tile);
+
+    mui_processor_start (device->processor);
+    mui_processor_load_properties (device->processor);
+
+    device->swipe_stream_cancellable = g_cancellable_new ();
+    mui_processor_swipe_stream (device->processor,
+                                device->swipe_stream_cancellable,
+                                (GAsyncReadyCallback) swipe_stream_ready,
+                                NULL);
+
+    return device;
+}
+
+static void
+reload_devices (MuiDashboard *self)
+{
+    mccr_device_t  **devices;
+    GHashTable      *found;
+    GHashTableIter   iter;
+    gpointer         path;
+    guint            n_devices;
+    guint            i;
+    gchar           *subtitle;
+
+    /* Only devices not shown yet are added, and only the ones gone are
+     * removed, so the others keep on streaming swipes undisturbed */
+    found = g_hash_table_new (g_str_hash, g_str_equal);
+    devices = mccr_enumerate_devices ();
+    for (i = 0; devices && devices[i]; i++) {
+        path = (gpointer) mccr_device_get_path (devices[i]);
+        g_hash_table_add (found, path);
+        if (!g_hash_table_contains (self->priv->devices, path))
+            g_hash_table_insert (self->priv->devices, g_strdup (path), dashboard_device_new (self, path));
+    }
+
+    g_hash_table_iter_init (&iter, self->priv->devices);
+    while (g_hash_table_iter_next (&iter, &path, NULL)) {
+        if (!g_hash_table_contains (found, path))
+            g_hash_table_iter_remove (&iter);
+    }
+
+    g_hash_table_unref (found);
+    for (i = 0; devices && devices[i]; i++)
+        mccr_device_unref (devices[i]);
+    free (devices);
+
+    n_devices = g_hash_table_size (self->priv->devices);
+    if (!n_devices) {
+        gtk_widget_hide (self->priv->scrolled_window);
+        gtk_widget_show (self->priv->box_no_devices);
+        gtk_header_bar_set_subtitle (GTK_HEADER_BAR (self->priv->headerbar), "no device found");
+        return;
+    }
+
+    gtk_widget_hide (self->priv->box_no_devices);
+    gtk_widget_show (self->priv->scrolled_window);
+    subtitle = g_strdup_printf ("%u device%s", n_devices, n_devices > 1 ? "s" : "");
+    gtk_header_bar_set_subtitle (GTK_HEADER_BAR (self->priv->headerbar), subtitle);
+    g_free (subtitle);
+}
+
+/******************************************************************************/
+/* Device monitoring */
+
+static void
+handle_uevent (GUdevClient  *client,
+               const char   *action,
+               GUdevDevice  *device,
+               MuiDashboard *self)
+{
+    const gchar *aux;
+    guint16      vid;
+
+    aux = g_udev_device_get_property (device, "ID_VENDOR_ID");
+    vid = (guint16) (aux ? g_ascii_strtoull (aux, NULL, 16) : 0);
+    if (vid != MAGTEK_VID)
+        return;
+
+    g_debug ("action: %s, sysfs: %s", action, g_udev_device_get_sysfs_path (device));
+    reload_devices (self);
+}
+
+static void
+start_monitoring (MuiDashboard *self)
+{
+    static const gchar *subsystems[] = { "usb/usb_device", NULL };
+
+    self->priv->udev = g_udev_client_new ((const gchar * const *) subsystems);
+    g_signal_connect (self->priv->udev, "uevent", G_CALLBACK (handle_uevent), self);
+
+    reload_devices (self);
+}
+
+/******************************************************************************/
+
+GtkWidget *
+mui_dashboard_new (void)
+{
+    MuiDashboard *self;
+    GtkWidget    *box;
+    GtkWidget    *image;
+    GtkWidget    *label;
+
+    self = g_object_new (MUI_TYPE_DASHBOARD, NULL);
+
+    box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+    gtk_widget_show (box);
+    gtk_container_add (GTK_CONTAINER (self), box);
+
+    /* No devices view */
+    self->priv->box_no_devices = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
+    image = gtk_image_new_from_icon_name ("face-confused-symbolic", GTK_ICON_SIZE_DIALOG);
+    gtk_widget_set_valign (image, GTK_ALIGN_END);
+    gtk_widget_show (image);
+    gtk_box_pack_start (GTK_BOX (self->priv->box_no_devices), image, TRUE, TRUE, 0);
+    label = gtk_label_new ("No MagneSafe devices found");
+    gtk_widget_set_valign (label, GTK_ALIGN_START);
+    gtk_widget_show (label);
+    gtk_box_pack_start (GTK_BOX (self->priv->box_no_devices), label, TRUE, TRUE, 0);
+    gtk_box_pack_start (GTK_BOX (box), self->priv->box_no_devices, TRUE, TRUE, 0);
+
+    /* Tiles view */
+    self->priv->scrolled_window = gtk_scrolled_window_new (NULL, NULL);
+    gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (self->priv->scrolled_window), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+#if GTK_CHECK_VERSION (3,12,0)
+    self->priv->tiles = gtk_flow_box_new ();
+    gtk_flow_box_set_selection_mode (GTK_FLOW_BOX (self->priv->tiles), GTK_SELECTION_NONE);
+    gtk_flow_box_set_homogeneous (GTK_FLOW_BOX (self->priv->tiles), TRUE);
+    gtk_flow_box_set_row_spacing (GTK_FLOW_BOX (self->priv->tiles), 10);
+    gtk_flow_box_set_column_spacing (GTK_FLOW_BOX (self->priv->tiles), 10);
+#else
+    self->priv->tiles = gtk_box_new (GTK_ORIENTATION_VERTICAL, 10);
+#endif
+    gtk_widget_set_valign (self->priv->tiles, GTK_ALIGN_START);
+    gtk_container_set_border_width (GTK_CONTAINER (self->priv->tiles), 10);
+    gtk_widget_show (self->priv->tiles);
+    gtk_container_add (GTK_CONTAINER (self->priv->scrolled_window), self->priv->tiles);
+    gtk_box_pack_start (GTK_BOX (box), self->priv->scrolled_window, TRUE, TRUE, 0);
+
+    /* Headerbar */
+    self->priv->headerbar = gtk_header_bar_new ();
+    gtk_header_bar_set_title (GTK_HEADER_BAR (self->priv->headerbar), "MCCR GTK+ dashboard");
+    gtk_header_bar_set_show_close_button (GTK_HEADER_BAR (self->priv->headerbar), TRUE);
+    gtk_widget_show (self->priv->headerbar);
+    gtk_window_set_titlebar (GTK_WINDOW (self), self->priv->headerbar);
+
+    gtk_window_set_default_size (GTK_WINDOW (self), 900, 600);
+
+    start_monitoring (self);
+
+    return GTK_WIDGET (self);
+}
+
+static void
+mui_dashboard_init (MuiDashboard *self)
+{
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MUI_TYPE_DASHBOARD, MuiDashboardPrivate);
+    self->priv->devices = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) dashboard_device_free);
+}
+
+static void
+dispose (GObject *object)
+{
+    MuiDashboard *self = MUI_DASHBOARD (object);
+
+    /* Devices are removed before the tiles get destroyed along with the
+     * window */
+    g_clear_object (&self->priv->udev);
+    g_clear_pointer (&self->priv->devices, g_hash_table_unref);
+
+    G_OBJECT_CLASS (mui_dashboard_parent_class)->dispose (object);
+}
+
+static void
+mui_dashboard_class_init (MuiDashboardClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    g_type_class_add_private (klass, sizeof (MuiDashboardPrivate));
+
+    object_class->dispose = dispose;
+}
@@ -32,12 +32,25 @@
 
 #include "mui-page-advanced.h"
 #include "mui-processor.h"
+#include "mui-swipe.h"
 
 G_DEFINE_TYPE (MuiPageAdvanced, mui_page_advanced, MUI_TYPE_PAGE)
 
+typedef struct {
+    GtkWidget *decode_status;
+    GtkWidget *encrypted_data_length;
+    GtkWidget *encrypted_data;
+    GtkWidget *masked_data_length;
+    GtkWidget *masked_data;
+} TrackLabels;
+
 struct _MuiPageAdvancedPrivate {
     /* Common labels */
     GtkWidget *common_item_labels[MUI_PROCESSOR_ITEM_LAST];
+
+    /* Swipe labels */
+    GtkWidget   *card_encode_type_label;
+    TrackLabels  track_labels[MUI_SWIPE_N_TRACKS];
 };
 
 /******************************************************************************/
@@ -71,6 +84,86 @@ report_item (MuiPage          *_self,
     }
 }
 
+/******************************************************************************/
+/* Swipe reporting */
+
+static void
+set_label_data (GtkWidget    *label,
+                const guint8 *data,
+                guint8        data_length)
+{
+    gchar *str;
+
+    if (!data) {
+        gtk_label_set_text (GTK_LABEL (label), "n/a");
+        return;
+    }
+
+    str = strhex (data, data_length, " ");
+    gtk_label_set_text (GTK_LABEL (label), str);
+    g_free (str);
+}
+
+static void
+set_label_data_length (GtkWidget *label,
+                       guint8     data_length)
+{
+    gchar *str;
+
+    str = g_strdup_printf ("%u bytes", data_length);
+    gtk_label_set_text (GTK_LABEL (label), str);
+    g_free (str);
+}
+
+static void
+set_label_decode_status (GtkWidget           *label,
+                         const MuiSwipeTrack *track)
+{
+    gchar *str;
+
+    if (!track->decode_status_set)
+        gtk_label_set_text (GTK_LABEL (label), "n/a");
+    else if (track->decode_status == MCCR_SWIPE_TRACK_DECODE_STATUS_SUCCESS)
+        gtk_label_set_text (GTK_LABEL (label), "success");
+    else if (track->decode_status & MCCR_SWIPE_TRACK_DECODE_STATUS_ERROR)
+        gtk_label_set_text (GTK_LABEL (label), "error");
+    else {
+        str = g_strdup_printf ("unknown status (0x%02x)", track->decode_status);
+        gtk_label_set_text (GTK_LABEL (label), str);
+        g_free (str);
+    }
+}
+
+static void
+report_swipe (MuiPage  *_self,
+              MuiSwipe *swipe)
+{
+    MuiPageAdvanced         *self;
+    mccr_card_encode_type_t  card_encode_type;
+    guint                    i;
+
+    self = MUI_PAGE_ADVANCED (_self);
+
+    if (mui_swipe_get_card_encode_type (swipe, &card_encode_type))
+        gtk_label_set_text (GTK_LABEL (self->priv->card_encode_type_label), mccr_card_encode_type_to_string (card_encode_type));
+    else
+        gtk_label_set_text (GTK_LABEL (self->priv->card_encode_type_label), "n/a");
+
+    for (i = 0; i < MUI_SWIPE_N_TRACKS; i++) {
+        const MuiSwipeTrack *track;
+        TrackLabels         *labels;
+
+        track  = mui_swipe_peek_track (swipe, i + 1);
+        labels = &self->priv->track_labels[i];
+
+        set_label_decode_status (labels->decode_status,         track);
+        set_label_data_length   (labels->encrypted_data_length, track->encrypted_data_length);
+        set_label_data          (labels->encrypted_data,        track->encrypted_data, track->encrypted_data_length);
+        set_label_data_length   (labels->masked_data_length,    track->masked_data_length);
+        set_label_data          (labels->masked_data,           track->masked_data, track->masked_data_length);
+    }
+}
+
 /******************************************************************************/
 /* Reset */
 
@@ -87,6 +180,14 @@ reset (MuiPage *_self)
         if (GTK_IS_LABEL (self->priv->common_item_labels[i]))
             gtk_label_set_text (GTK_LABEL (self->priv->common_item_labels[i]), "n/a");
     }
+    gtk_label_set_text (GTK_LABEL (self->priv->card_encode_type_label), "n/a");
+    for (i = 0; i < MUI_SWIPE_N_TRACKS; i++) {
+        gtk_label_set_text (GTK_LABEL (self->priv->track_labels[i].decode_status),         "n/a");
+        gtk_label_set_text (GTK_LABEL (self->priv->track_labels[i].encrypted_data_length), "n/a");
+        gtk_label_set_text (GTK_LABEL (self->priv->track_labels[i].encrypted_data),        "n/a");
+        gtk_label_set_text (GTK_LABEL (self->priv->track_labels[i].masked_data_length),    "n/a");
+        gtk_label_set_text (GTK_LABEL (self->priv->track_labels[i].masked_data),           "n/a");
+    }
 
     gtk_label_set_text (GTK_LABEL (self->priv->common_item_labels[MUI_PROCESSOR_ITEM_STATUS_ERROR]), "n/a");
     gtk_widget_hide (self->priv->common_item_labels[MUI_PROCESSOR_ITEM_STATUS_ERROR]);
@@ -144,22 +245,22 @@ mui_page_advanced_new (void)
     self->priv->common_item_labels[MUI_PROCESSOR_ITEM_MAGTEK_UPDATE_TOKEN]   = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-mut"));
 
     /* Swipe info */
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_CARD_ENCODE_TYPE]              = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-card-encode-type"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_1_DECODE_STATUS]         = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-decoding-1"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_1_ENCRYPTED_DATA_LENGTH] = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-data-length-1"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_1_ENCRYPTED_DATA]        = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-data-1"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_1_MASKED_DATA_LENGTH]    = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-masked-data-length-1"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_1_MASKED_DATA]           = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-masked-data-1"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_2_DECODE_STATUS]         = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-decoding-2"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_2_ENCRYPTED_DATA_LENGTH] = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-data-length-2"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_2_ENCRYPTED_DATA]        = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-data-2"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_2_MASKED_DATA_LENGTH]    = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-masked-data-length-2"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_2_MASKED_DATA]           = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-masked-data-2"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_3_DECODE_STATUS]         = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-decoding-3"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_3_ENCRYPTED_DATA_LENGTH] = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-data-length-3"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_3_ENCRYPTED_DATA]        = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-data-3"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_3_MASKED_DATA_LENGTH]    = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-masked-data-length-3"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_3_MASKED_DATA]           = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-masked-data-3"));
+    self->priv->card_encode_type_label = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-card-encode-type"));
+    self->priv->track_labels[0].decode_status         = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-decoding-1"));
+    self->priv->track_labels[0].encrypted_data_length = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-data-length-1"));
+    self->priv->track_labels[0].encrypted_data        = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-data-1"));
+    self->priv->track_labels[0].masked_data_length    = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-masked-data-length-1"));
+    self->priv->track_labels[0].masked_data           = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-masked-data-1"));
+    self->priv->track_labels[1].decode_status         = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-decoding-2"));
+    self->priv->track_labels[1].encrypted_data_length = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-data-length-2"));
+    self->priv->track_labels[1].encrypted_data        = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-data-2"));
+    self->priv->track_labels[1].masked_data_length    = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-masked-data-length-2"));
+    self->priv->track_labels[1].masked_data           = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-masked-data-2"));
+    self->priv->track_labels[2].decode_status         = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-decoding-3"));
+    self->priv->track_labels[2].encrypted_data_length = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-data-length-3"));
+    self->priv->track_labels[2].encrypted_data        = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-data-3"));
+    self->priv->track_labels[2].masked_data_length    = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-masked-data-length-3"));
+    self->priv->track_labels[2].masked_data           = GTK_WIDGET (gtk_builder_get_object (builder, "advanced-label-masked-data-3"));
 
     g_object_unref (builder);
 
@@ -181,6 +282,7 @@ mui_page_advanced_class_init (MuiPageAdvancedClass *klass)
 
     g_type_class_add_private (klass, sizeof (MuiPageAdvancedPrivate));
 
-    page_class->report_item = report_item;
-    page_class->reset       = reset;
+    page_class->report_item  = report_item;
+    page_class->report_swipe = report_swipe;
+    page_class->reset        = reset;
 }
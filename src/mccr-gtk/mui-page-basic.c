@@ -29,12 +29,17 @@
 #include <dukpt.h>
 
 #include <common.h>
+#include <key-cache.h>
 
 #include "mui-page-basic.h"
 #include "mui-processor.h"
+#include "mui-swipe.h"
 
 G_DEFINE_TYPE (MuiPageBasic, mui_page_basic, MUI_TYPE_PAGE)
 
+/* One IPEK per reader and BDK */
+#define KEY_CACHE_MAX_IPEKS 16
+
 typedef enum {
     INFO_PAGE_BASIC_ITEM_TRACK_1_DEC_HEX,
     INFO_PAGE_BASIC_ITEM_TRACK_1_ASCII,
@@ -55,6 +60,10 @@ struct _MuiPageBasicPrivate {
     GtkWidget *key_variant_combobox;
     GtkWidget *common_item_labels[MUI_PROCESSOR_ITEM_LAST];
     GtkWidget *basic_item_labels[INFO_PAGE_BASIC_ITEM_LAST];
+    GtkWidget *encrypted_data_labels[MUI_SWIPE_N_TRACKS];
+
+    /* Last swipe, decrypted again whenever the keys change */
+    MuiSwipe *swipe;
 
     /* Decryption support */
     gint             security_level;
@@ -62,13 +71,14 @@ struct _MuiPageBasicPrivate {
     gboolean         bdk_set;
     dukpt_ksn_t      ksn;
     gboolean         ksn_set;
-    dukpt_key_t      ipek;
-    gboolean         ipek_set;
     dukpt_key_type_t key_type;
-    dukpt_key_t      decryption_key;
-    gboolean         decryption_key_set;
     dukpt_ksn_t      next_ksn;
     gboolean         next_ksn_set;
+
+    /* Decryption running in a worker thread */
+    GCancellable    *decryption_cancellable;
+    /* IPEKs and keys derived, shared with the worker threads */
+    key_cache_t     *key_cache;
 };
 
 /******************************************************************************/
@@ -91,138 +101,232 @@ security_level_updated (MuiPageBasic *self,
 }
 
 static void
-reload_decryption_key (MuiPageBasic *self)
+reset_all_track_decryption (MuiPageBasic *self)
 {
-    gchar *str;
+    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_1_DEC_HEX]), "n/a");
+    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_1_ASCII]),   "n/a");
+    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_2_DEC_HEX]), "n/a");
+    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_2_ASCII]),   "n/a");
+    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_3_DEC_HEX]), "n/a");
+    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_3_ASCII]),   "n/a");
+}
 
-    if (self->priv->decryption_key_set)
-        return;
+/* Everything the worker thread needs is copied in the job, so that it never
+ * touches the page; the IPEKs computed are kept in the key cache */
+typedef struct {
+    MuiSwipe         *swipe;
+    gboolean          decrypt;
+    dukpt_key_t       bdk;
+    gboolean          bdk_set;
+    dukpt_ksn_t       ksn;
+    gboolean          ksn_set;
+    dukpt_key_type_t  key_type;
+    key_cache_t      *key_cache;
+    dukpt_key_t       decryption_key;
+    gboolean          decryption_key_set;
+    /* Results, NULL if track left untouched */
+    gchar            *dec_hex[MUI_SWIPE_N_TRACKS];
+    gchar            *ascii[MUI_SWIPE_N_TRACKS];
+} DecryptionJob;
+
+static void
+str_wipe_free (gchar *str)
+{
+    if (str) {
+        memwipe (str, strlen (str));
+        g_free (str);
+    }
+}
+
+/* Keys and cleartext tracks are wiped, not just freed */
+static void
+decryption_job_free (DecryptionJob *job)
+{
+    guint i;
+
+    for (i = 0; i < MUI_SWIPE_N_TRACKS; i++) {
+        str_wipe_free (job->dec_hex[i]);
+        str_wipe_free (job->ascii[i]);
+    }
+    mui_swipe_unref (job->swipe);
+    memwipe (&job->bdk,            sizeof (job->bdk));
+    memwipe (&job->ksn,            sizeof (job->ksn));
+    memwipe (&job->decryption_key, sizeof (job->decryption_key));
+    g_slice_free (DecryptionJob, job);
+}
+
+static void
+decryption_job_load_key (DecryptionJob *job)
+{
+    gchar *str;
 
     g_debug ("reloading decryption key...");
 
-    if (!self->priv->ksn_set) {
+    if (!job->ksn_set) {
         g_debug ("Cannot initialize IPEK or DUKPT encryption key: no valid KSN set");
         return;
     }
 
-    if (!self->priv->bdk_set) {
+    if (!job->bdk_set) {
         g_debug ("Cannot initialize IPEK or DUKPT encryption key: no valid BDK set");
         return;
     }
 
-    /* IPEK */
-    if (!self->priv->ipek_set) {
-        self->priv->ipek_set = TRUE;
-        dukpt_compute_ipek ((const dukpt_key_t *) &self->priv->bdk, (const dukpt_ksn_t *) &self->priv->ksn, &self->priv->ipek);
-        str = strhex ((uint8_t *) &self->priv->ipek, sizeof (self->priv->ipek), ":");
-        g_debug ("IPEK initialized: %s", str);
-        g_free (str);
-    }
-
-    /* Compute the key we'll use to decrypt */
-    dukpt_compute_key ((const dukpt_key_t *) &self->priv->ipek, (const dukpt_ksn_t *) &self->priv->ksn, self->priv->key_type, &self->priv->decryption_key);
-    str = strhex ((guint8 *) &self->priv->decryption_key, sizeof (self->priv->decryption_key), ":");
+    /* Compute the key we'll use to decrypt, reusing the IPEK computed for a
+     * previous swipe of the same reader */
+    key_cache_get_key (job->key_cache,
+                       (const dukpt_key_t *) &job->bdk,
+                       (const dukpt_ksn_t *) &job->ksn,
+                       job->key_type,
+                       &job->decryption_key);
+    str = strhex ((guint8 *) &job->decryption_key, sizeof (job->decryption_key), ":");
     g_debug ("DUKPT decryption key computed: %s", str);
-    g_free (str);
-    self->priv->decryption_key_set = TRUE;
+    str_wipe_free (str);
+    job->decryption_key_set = TRUE;
 }
 
 static void
-reset_all_track_decryption (MuiPageBasic *self)
-{
-    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_1_DEC_HEX]), "n/a");
-    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_1_ASCII]),   "n/a");
-    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_2_DEC_HEX]), "n/a");
-    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_2_ASCII]),   "n/a");
-    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_3_DEC_HEX]), "n/a");
-    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_3_ASCII]),   "n/a");
-}
-
-static void
-reload_track_decryption (MuiPageBasic      *self,
-                         const gchar       *track,
-                         MuiProcessorItem   common_item_orig_hex,
-                         InfoPageBasicItem  basic_item_dec_hex,
-                         InfoPageBasicItem  basic_item_ascii)
+decryption_job_run_track (DecryptionJob *job,
+                          guint          track_number)
 {
-    const gchar *original;
-    guint8      *input = NULL;
-    guint8      *output = NULL;
-    gsize        buffer_size;
-    gssize       data_size;
-    gchar       *str = NULL;
-
-    /* 1: factory-only, should never happen
-     * 2: unencrypted
-     * 3: encrypted
-     * 4: encrypted + auth
-     */
-    if (self->priv->security_level < 2) {
-        g_debug ("[%s] no decryption possible: invalid security level: %u", track, self->priv->security_level);
-        goto out;
-    }
-
-    /* Get original hex from label */
-    original = gtk_label_get_text (GTK_LABEL (self->priv->common_item_labels[common_item_orig_hex]));
-    if (g_strcmp0 (original, "n/a") == 0)
-        goto out;
+    const MuiSwipeTrack *track;
+    guint8              *output;
 
-    buffer_size = 1 + (strlen (original) / 2);
-
-    /* Build original bin */
-    input = (guint8 *) g_malloc0 (buffer_size);
-    if ((data_size = strbin (original, input, buffer_size)) < 0) {
-        g_warning ("[%s] couldn't convert hex string '%s' to binary", track, original);
-        goto out;
-    }
+    track = mui_swipe_peek_track (job->swipe, track_number);
+    if (!track->encrypted_data)
+        return;
 
     /* Check whether decryption is necessary */
-    if (self->priv->security_level == 2 || !gtk_switch_get_active (GTK_SWITCH (self->priv->decryption_switch))) {
-        str = strascii (input, data_size);
-        g_debug ("[%s] decryption not applicable, original ASCII: %s", track, str);
-        gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[basic_item_dec_hex]), "n/a");
-        gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[basic_item_ascii]), str);
-        g_free (str);
-        goto out;
+    if (!job->decrypt) {
+        job->ascii[track_number - 1] = strascii (track->encrypted_data, track->encrypted_data_length);
+        g_debug ("[track %u] decryption not applicable, original ASCII: %s", track_number, job->ascii[track_number - 1]);
+        return;
     }
 
     /* Decryption not possible? */
-    if (!self->priv->decryption_key_set) {
-        g_warning ("[%s] couldn't decrypt: decryption key not set", track);
-        goto out;
+    if (!job->decryption_key_set) {
+        g_warning ("[track %u] couldn't decrypt: decryption key not set", track_number);
+        return;
     }
 
     /* Decrypt */
-    output = (guint8 *) g_malloc0 (buffer_size);
-    dukpt_decrypt ((const dukpt_key_t *) &self->priv->decryption_key, input, data_size, output, data_size);
+    output = (guint8 *) g_malloc0 (track->encrypted_data_length);
+    dukpt_decrypt ((const dukpt_key_t *) &job->decryption_key,
+                   track->encrypted_data, track->encrypted_data_length,
+                   output, track->encrypted_data_length);
 
-    str = strhex (output, data_size, " ");
-    g_debug ("[%s] decrypted: %s", track, str);
-    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[basic_item_dec_hex]), str);
-    g_free (str);
+    job->dec_hex[track_number - 1] = strhex (output, track->encrypted_data_length, " ");
+    g_debug ("[track %u] decrypted: %s", track_number, job->dec_hex[track_number - 1]);
 
-    str = strascii (output, data_size);
-    g_debug ("[%s] decrypted ASCII: %s", track, str);
-    gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[basic_item_ascii]), str);
-    g_free (str);
+    job->ascii[track_number - 1] = strascii (output, track->encrypted_data_length);
+    g_debug ("[track %u] decrypted ASCII: %s", track_number, job->ascii[track_number - 1]);
 
-out:
-    g_free (input);
+    memwipe (output, track->encrypted_data_length);
     g_free (output);
 }
 
+static void
+decryption_thread (GTask         *task,
+                   MuiPageBasic  *self,
+                   DecryptionJob *job,
+                   GCancellable  *cancellable)
+{
+    guint i;
+
+    if (job->decrypt)
+        decryption_job_load_key (job);
+
+    for (i = 1; i <= MUI_SWIPE_N_TRACKS; i++) {
+        if (g_task_return_error_if_cancelled (task))
+            return;
+        decryption_job_run_track (job, i);
+    }
+
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+decryption_ready (MuiPageBasic *self,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+    static const InfoPageBasicItem dec_hex_items[MUI_SWIPE_N_TRACKS] = {
+        INFO_PAGE_BASIC_ITEM_TRACK_1_DEC_HEX,
+        INFO_PAGE_BASIC_ITEM_TRACK_2_DEC_HEX,
+        INFO_PAGE_BASIC_ITEM_TRACK_3_DEC_HEX,
+    };
+    static const InfoPageBasicItem ascii_items[MUI_SWIPE_N_TRACKS] = {
+        INFO_PAGE_BASIC_ITEM_TRACK_1_ASCII,
+        INFO_PAGE_BASIC_ITEM_TRACK_2_ASCII,
+        INFO_PAGE_BASIC_ITEM_TRACK_3_ASCII,
+    };
+    DecryptionJob *job;
+    guint          i;
+
+    /* Cancelled jobs were replaced by newer ones, so just ignore them */
+    if (!g_task_propagate_boolean (G_TASK (res), NULL))
+        return;
+
+    g_clear_object (&self->priv->decryption_cancellable);
+
+    job = g_task_get_task_data (G_TASK (res));
+
+    for (i = 0; i < MUI_SWIPE_N_TRACKS; i++) {
+        if (!job->ascii[i])
+            continue;
+        gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[dec_hex_items[i]]), job->dec_hex[i] ? job->dec_hex[i] : "n/a");
+        gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[ascii_items[i]]),   job->ascii[i]);
+    }
+}
+
+static void
+cancel_decryption (MuiPageBasic *self)
+{
+    if (self->priv->decryption_cancellable) {
+        g_cancellable_cancel (self->priv->decryption_cancellable);
+        g_clear_object (&self->priv->decryption_cancellable);
+    }
+}
+
 static void
 reload_decryption (MuiPageBasic *self)
 {
+    DecryptionJob *job;
+    GTask         *task;
+
     /* Support relaunching decryption when the keys change but not the
      * encrypted data to decrypt (e.g. when changing the BDK or the key type
-     * in the basic page) */
+     * in the basic page). Any decryption still running is outdated. */
+    cancel_decryption (self);
+
+    if (!self->priv->swipe)
+        return;
 
-    reload_decryption_key (self);
+    /* 1: factory-only, should never happen
+     * 2: unencrypted
+     * 3: encrypted
+     * 4: encrypted + auth
+     */
+    if (self->priv->security_level < 2) {
+        g_debug ("no decryption possible: invalid security level: %u", self->priv->security_level);
+        return;
+    }
 
-    reload_track_decryption (self, "track 1", MUI_PROCESSOR_ITEM_TRACK_1_ENCRYPTED_DATA, INFO_PAGE_BASIC_ITEM_TRACK_1_DEC_HEX, INFO_PAGE_BASIC_ITEM_TRACK_1_ASCII);
-    reload_track_decryption (self, "track 2", MUI_PROCESSOR_ITEM_TRACK_2_ENCRYPTED_DATA, INFO_PAGE_BASIC_ITEM_TRACK_2_DEC_HEX, INFO_PAGE_BASIC_ITEM_TRACK_2_ASCII);
-    reload_track_decryption (self, "track 3", MUI_PROCESSOR_ITEM_TRACK_3_ENCRYPTED_DATA, INFO_PAGE_BASIC_ITEM_TRACK_3_DEC_HEX, INFO_PAGE_BASIC_ITEM_TRACK_3_ASCII);
+    job = g_slice_new0 (DecryptionJob);
+    job->swipe     = mui_swipe_ref (self->priv->swipe);
+    job->decrypt   = (self->priv->security_level > 2 && gtk_switch_get_active (GTK_SWITCH (self->priv->decryption_switch)));
+    job->bdk_set   = self->priv->bdk_set;
+    job->ksn_set   = self->priv->ksn_set;
+    job->key_type  = self->priv->key_type;
+    job->key_cache = self->priv->key_cache;
+    memcpy (&job->bdk, &self->priv->bdk, sizeof (job->bdk));
+    memcpy (&job->ksn, &self->priv->ksn, sizeof (job->ksn));
+
+    self->priv->decryption_cancellable = g_cancellable_new ();
+    task = g_task_new (self, self->priv->decryption_cancellable, (GAsyncReadyCallback) decryption_ready, NULL);
+    g_task_set_task_data (task, job, (GDestroyNotify) decryption_job_free);
+    g_task_run_in_thread (task, (GTaskThreadFunc) decryption_thread);
+    g_object_unref (task);
 }
 
 /******************************************************************************/
@@ -235,10 +339,8 @@ bdk_entry_activated (MuiPageBasic *self)
     gssize         data_size;
     PangoAttrList *attrs;
 
-    /* BDK changed, we need to reload BDK, IPEK, decryption key and decrypted text */
-    self->priv->bdk_set            = FALSE;
-    self->priv->ipek_set           = FALSE;
-    self->priv->decryption_key_set = FALSE;
+    /* BDK changed, we need to reload BDK and decrypted text */
+    self->priv->bdk_set = FALSE;
     reset_all_track_decryption (self);
 
     attrs = pango_attr_list_new ();
@@ -274,10 +376,7 @@ key_type_updated (MuiPageBasic *self)
 {
     const gchar *key_variant_str;
 
-    /* Key type changed, we need to reload decryption key and decrypted text */
-    self->priv->decryption_key_set = FALSE;
-
-    /* Decryption key */
+    /* Key type changed, we need to reload decrypted text */
     key_variant_str = gtk_combo_box_get_active_id (GTK_COMBO_BOX (self->priv->key_variant_combobox));
     if (g_strcmp0 (key_variant_str, "pin") == 0)
         self->priv->key_type = DUKPT_KEY_TYPE_PIN_ENCRYPTION;
@@ -335,47 +434,53 @@ dukpt_ksn_and_counter_assigned_to_swipe (MuiPageBasic *self)
         self->priv->ksn_set      = TRUE;
         self->priv->next_ksn_set = FALSE;
 
-        /* KSN changed, so we need to reload IPEK, decryption key and decrypted text */
-        self->priv->ipek_set = FALSE;
-        self->priv->decryption_key_set = FALSE;
+        /* KSN changed, so we need to reload decrypted text */
         reset_all_track_decryption (self);
-        reload_decryption_key (self);
     }
 }
 
 /******************************************************************************/
-/* Masked data */
+/* Swipe reporting */
 
 static void
-masked_data_updated (MuiPageBasic      *self,
-                     const gchar       *track,
-                     MuiProcessorItem   item,
-                     InfoPageBasicItem  basic_item,
-                     const gchar       *value)
+report_swipe (MuiPage  *_self,
+              MuiSwipe *swipe)
 {
-    GtkWidget *label;
-    gsize      buffer_size;
-    gssize     bin_size;
-    guint8    *bin = NULL;
-    gchar     *ascii = NULL;
-
-    label = self->priv->basic_item_labels[basic_item];
-    g_assert (GTK_IS_LABEL (label));
-
-    /* Build original bin */
-    buffer_size = 1 + (strlen (value) / 2);
-    bin = (guint8 *) g_malloc0 (buffer_size);
-    if ((bin_size = strbin (value, bin, buffer_size)) < 0) {
-        g_warning ("[%s] couldn't convert hex string '%s' to binary", track, value);
-        goto out;
-    }
+    static const InfoPageBasicItem masked_items[MUI_SWIPE_N_TRACKS] = {
+        INFO_PAGE_BASIC_ITEM_TRACK_1_MASKED,
+        INFO_PAGE_BASIC_ITEM_TRACK_2_MASKED,
+        INFO_PAGE_BASIC_ITEM_TRACK_3_MASKED,
+    };
+    MuiPageBasic *self;
+    guint         i;
 
-    ascii = strascii (bin, bin_size);
-    gtk_label_set_text (GTK_LABEL (label), ascii);
+    self = MUI_PAGE_BASIC (_self);
+
+    reset_all_track_decryption (self);
+
+    if (self->priv->swipe)
+        mui_swipe_unref (self->priv->swipe);
+    self->priv->swipe = mui_swipe_ref (swipe);
+
+    /* Only the original encrypted data and the masked data are shown as they
+     * come, everything else is the decrypted contents */
+    for (i = 0; i < MUI_SWIPE_N_TRACKS; i++) {
+        const MuiSwipeTrack *track;
+        gchar               *str;
+
+        track = mui_swipe_peek_track (swipe, i + 1);
+
+        str = track->encrypted_data ? strhex (track->encrypted_data, track->encrypted_data_length, " ") : NULL;
+        gtk_label_set_text (GTK_LABEL (self->priv->encrypted_data_labels[i]), str ? str : "n/a");
+        g_free (str);
 
-out:
-    g_free (bin);
-    g_free (ascii);
+        str = track->masked_data ? strascii (track->masked_data, track->masked_data_length) : NULL;
+        gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[masked_items[i]]), str ? str : "n/a");
+        g_free (str);
+    }
+
+    dukpt_ksn_and_counter_assigned_to_swipe (self);
+    reload_decryption (self);
 }
 
 /******************************************************************************/
@@ -410,22 +515,6 @@ report_item (MuiPage          *_self,
         case MUI_PROCESSOR_ITEM_DUKPT_KSN_AND_COUNTER:
             dukpt_ksn_and_counter_updated (self, value);
             break;
-        case MUI_PROCESSOR_ITEM_SWIPE_STARTED:
-            reset_all_track_decryption (self);
-            break;
-        case MUI_PROCESSOR_ITEM_TRACK_1_MASKED_DATA:
-            masked_data_updated (self, "track 1", MUI_PROCESSOR_ITEM_TRACK_1_MASKED_DATA, INFO_PAGE_BASIC_ITEM_TRACK_1_MASKED, value);
-            break;
-        case MUI_PROCESSOR_ITEM_TRACK_2_MASKED_DATA:
-            masked_data_updated (self, "track 2", MUI_PROCESSOR_ITEM_TRACK_2_MASKED_DATA, INFO_PAGE_BASIC_ITEM_TRACK_2_MASKED, value);
-            break;
-        case MUI_PROCESSOR_ITEM_TRACK_3_MASKED_DATA:
-            masked_data_updated (self, "track 3", MUI_PROCESSOR_ITEM_TRACK_3_MASKED_DATA, INFO_PAGE_BASIC_ITEM_TRACK_3_MASKED, value);
-            break;
-        case MUI_PROCESSOR_ITEM_SWIPE_FINISHED:
-            dukpt_ksn_and_counter_assigned_to_swipe (self);
-            reload_decryption (self);
-            break;
         default:
             break;
     }
@@ -442,6 +531,9 @@ reset (MuiPage *_self)
 
     self = MUI_PAGE_BASIC (_self);
 
+    cancel_decryption (self);
+    g_clear_pointer (&self->priv->swipe, mui_swipe_unref);
+
     /* Reset all labels to n/a */
     for (i = MUI_PROCESSOR_ITEM_MANUFACTURER; i < MUI_PROCESSOR_ITEM_LAST; i++) {
         if (GTK_IS_LABEL (self->priv->common_item_labels[i]))
@@ -451,6 +543,8 @@ reset (MuiPage *_self)
         if (GTK_IS_LABEL (self->priv->basic_item_labels[i]))
             gtk_label_set_text (GTK_LABEL (self->priv->basic_item_labels[i]), "n/a");
     }
+    for (i = 0; i < MUI_SWIPE_N_TRACKS; i++)
+        gtk_label_set_text (GTK_LABEL (self->priv->encrypted_data_labels[i]), "n/a");
 
     gtk_label_set_text (GTK_LABEL (self->priv->common_item_labels[MUI_PROCESSOR_ITEM_STATUS_ERROR]), "n/a");
     gtk_widget_hide (self->priv->common_item_labels[MUI_PROCESSOR_ITEM_STATUS_ERROR]);
@@ -482,11 +576,13 @@ mui_page_basic_new (void)
     gtk_box_pack_start (GTK_BOX (self), box, TRUE, TRUE, 0);
 
     /* Common labels */
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_STATUS]                 = GTK_WIDGET (gtk_builder_get_object (builder, "basic-label-status"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_STATUS_ERROR]           = GTK_WIDGET (gtk_builder_get_object (builder, "basic-label-status-error"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_1_ENCRYPTED_DATA] = GTK_WIDGET (gtk_builder_get_object (builder, "basic-label-orig-hex-track-1"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_2_ENCRYPTED_DATA] = GTK_WIDGET (gtk_builder_get_object (builder, "basic-label-orig-hex-track-2"));
-    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_TRACK_3_ENCRYPTED_DATA] = GTK_WIDGET (gtk_builder_get_object (builder, "basic-label-orig-hex-track-3"));
+    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_STATUS]       = GTK_WIDGET (gtk_builder_get_object (builder, "basic-label-status"));
+    self->priv->common_item_labels[MUI_PROCESSOR_ITEM_STATUS_ERROR] = GTK_WIDGET (gtk_builder_get_object (builder, "basic-label-status-error"));
+
+    /* Original encrypted data labels */
+    self->priv->encrypted_data_labels[0] = GTK_WIDGET (gtk_builder_get_object (builder, "basic-label-orig-hex-track-1"));
+    self->priv->encrypted_data_labels[1] = GTK_WIDGET (gtk_builder_get_object (builder, "basic-label-orig-hex-track-2"));
+    self->priv->encrypted_data_labels[2] = GTK_WIDGET (gtk_builder_get_object (builder, "basic-label-orig-hex-track-3"));
 
     /* Swipe info labels */
     self->priv->basic_item_labels[INFO_PAGE_BASIC_ITEM_TRACK_1_DEC_HEX]  = GTK_WIDGET (gtk_builder_get_object (builder, "basic-label-dec-hex-track-1"));
@@ -545,15 +641,43 @@ static void
 mui_page_basic_init (MuiPageBasic *self)
 {
     self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MUI_TYPE_PAGE_BASIC, MuiPageBasicPrivate);
+    self->priv->key_cache = key_cache_new (KEY_CACHE_MAX_IPEKS);
+    g_assert (self->priv->key_cache);
+}
+
+static void
+dispose (GObject *object)
+{
+    MuiPageBasic *self = MUI_PAGE_BASIC (object);
+
+    cancel_decryption (self);
+    g_clear_pointer (&self->priv->swipe, mui_swipe_unref);
+
+    G_OBJECT_CLASS (mui_page_basic_parent_class)->dispose (object);
+}
+
+static void
+finalize (GObject *object)
+{
+    MuiPageBasic *self = MUI_PAGE_BASIC (object);
+
+    key_cache_free (self->priv->key_cache);
+
+    G_OBJECT_CLASS (mui_page_basic_parent_class)->finalize (object);
 }
 
 static void
 mui_page_basic_class_init (MuiPageBasicClass *klass)
 {
-    MuiPageClass *page_class = MUI_PAGE_CLASS (klass);
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    MuiPageClass *page_class   = MUI_PAGE_CLASS (klass);
 
     g_type_class_add_private (klass, sizeof (MuiPageBasicPrivate));
 
-    page_class->report_item = report_item;
-    page_class->reset       = reset;
+    object_class->dispose  = dispose;
+    object_class->finalize = finalize;
+
+    page_class->report_item  = report_item;
+    page_class->report_swipe = report_swipe;
+    page_class->reset        = reset;
 }
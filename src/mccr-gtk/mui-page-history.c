@@ -0,0 +1,225 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * mccr-gtk - GTK+ tool to manage MagTek Credit Card Readers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <config.h>
+#include <string.h>
+#include <stdlib.h>
+#include <gtk/gtk.h>
+
+#include <common.h>
+
+#include "mui-page-history.h"
+#include "mui-swipe-history.h"
+#include "mui-processor.h"
+#include "mui-swipe.h"
+
+/* Swipes kept in the history, oldest ones dropped first */
+#define SWIPE_HISTORY_CAPACITY 4096
+
+G_DEFINE_TYPE (MuiPageHistory, mui_page_history, MUI_TYPE_PAGE)
+
+struct _MuiPageHistoryPrivate {
+    MuiSwipeHistory *history;
+    GtkWidget       *tree_view;
+};
+
+/******************************************************************************/
+/* Cell formatting
+ *
+ * Cells are only formatted when the row is shown, so the cost doesn't depend
+ * on the number of swipes in the history.
+ */
+
+static void
+number_cell_data (GtkTreeViewColumn *column,
+                  GtkCellRenderer   *cell,
+                  GtkTreeModel      *model,
+                  GtkTreeIter       *iter,
+                  gpointer           user_data)
+{
+    gchar str[16];
+
+    g_snprintf (str, sizeof (str), "%u", mui_swipe_history_get_number (MUI_SWIPE_HISTORY (model), iter));
+    g_object_set (cell, "text", str, NULL);
+}
+
+static void
+time_cell_data (GtkTreeViewColumn *column,
+                GtkCellRenderer   *cell,
+                GtkTreeModel      *model,
+                GtkTreeIter       *iter,
+                gpointer           user_data)
+{
+    GDateTime *time;
+    gchar     *str;
+
+    time = g_date_time_new_from_unix_local (mui_swipe_history_get_time (MUI_SWIPE_HISTORY (model), iter) / G_USEC_PER_SEC);
+    str = g_date_time_format (time, "%Y-%m-%d %H:%M:%S");
+    g_object_set (cell, "text", str, NULL);
+    g_free (str);
+    g_date_time_unref (time);
+}
+
+static void
+card_encode_type_cell_data (GtkTreeViewColumn *column,
+                            GtkCellRenderer   *cell,
+                            GtkTreeModel      *model,
+                            GtkTreeIter       *iter,
+                            gpointer           user_data)
+{
+    mccr_card_encode_type_t card_encode_type;
+
+    if (mui_swipe_get_card_encode_type (mui_swipe_history_peek_swipe (MUI_SWIPE_HISTORY (model), iter), &card_encode_type))
+        g_object_set (cell, "text", mccr_card_encode_type_to_string (card_encode_type), NULL);
+    else
+        g_object_set (cell, "text", "n/a", NULL);
+}
+
+static void
+masked_track_cell_data (GtkTreeViewColumn *column,
+                        GtkCellRenderer   *cell,
+                        GtkTreeModel      *model,
+                        GtkTreeIter       *iter,
+                        gpointer           user_data)
+{
+    const MuiSwipeTrack *track;
+    gchar               *str;
+
+    track = mui_swipe_peek_track (mui_swipe_history_peek_swipe (MUI_SWIPE_HISTORY (model), iter), GPOINTER_TO_UINT (user_data));
+    str = track->masked_data ? strascii (track->masked_data, track->masked_data_length) : NULL;
+    g_object_set (cell, "text", str ? str : "n/a", NULL);
+    g_free (str);
+}
+
+static void
+append_column (MuiPageHistory        *self,
+               const gchar           *title,
+               gint                   width,
+               GtkTreeCellDataFunc    func,
+               gpointer               user_data)
+{
+    GtkTreeViewColumn *column;
+    GtkCellRenderer   *renderer;
+
+    renderer = gtk_cell_renderer_text_new ();
+    g_object_set (renderer, "ellipsize", PANGO_ELLIPSIZE_END, NULL);
+
+    /* Fixed sizing is required by the fixed height mode of the view, so that
+     * rows not shown aren't measured */
+    column = gtk_tree_view_column_new ();
+    gtk_tree_view_column_set_title (column, title);
+    gtk_tree_view_column_set_sizing (column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width (column, width);
+    gtk_tree_view_column_set_resizable (column, TRUE);
+    gtk_tree_view_column_pack_start (column, renderer, TRUE);
+    gtk_tree_view_column_set_cell_data_func (column, renderer, func, user_data, NULL);
+    gtk_tree_view_append_column (GTK_TREE_VIEW (self->priv->tree_view), column);
+}
+
+/******************************************************************************/
+/* Swipe reporting */
+
+static void
+report_swipe (MuiPage  *_self,
+              MuiSwipe *swipe)
+{
+    MuiPageHistory *self;
+
+    self = MUI_PAGE_HISTORY (_self);
+
+    mui_swipe_history_append (self->priv->history, swipe);
+}
+
+/******************************************************************************/
+/* Reset */
+
+static void
+reset (MuiPage *_self)
+{
+    MuiPageHistory *self;
+
+    self = MUI_PAGE_HISTORY (_self);
+
+    mui_swipe_history_clear (self->priv->history);
+}
+
+/******************************************************************************/
+
+GtkWidget *
+mui_page_history_new (void)
+{
+    MuiPageHistory *self;
+    GtkWidget      *scrolled_window;
+
+    self = MUI_PAGE_HISTORY (gtk_widget_new (MUI_TYPE_PAGE_HISTORY, NULL));
+
+    self->priv->tree_view = gtk_tree_view_new_with_model (GTK_TREE_MODEL (self->priv->history));
+    gtk_tree_view_set_fixed_height_mode (GTK_TREE_VIEW (self->priv->tree_view), TRUE);
+    append_column (self, "#",          60,  number_cell_data,           NULL);
+    append_column (self, "Time",       160, time_cell_data,             NULL);
+    append_column (self, "Card",       120, card_encode_type_cell_data, NULL);
+    append_column (self, "Track 1",    250, masked_track_cell_data,     GUINT_TO_POINTER (1));
+    append_column (self, "Track 2",    250, masked_track_cell_data,     GUINT_TO_POINTER (2));
+    gtk_widget_show (self->priv->tree_view);
+
+    scrolled_window = gtk_scrolled_window_new (NULL, NULL);
+    gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrolled_window), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    gtk_container_add (GTK_CONTAINER (scrolled_window), self->priv->tree_view);
+    gtk_widget_show (scrolled_window);
+    gtk_box_pack_start (GTK_BOX (self), scrolled_window, TRUE, TRUE, 0);
+
+    return GTK_WIDGET (self);
+}
+
+/******************************************************************************/
+
+static void
+mui_page_history_init (MuiPageHistory *self)
+{
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MUI_TYPE_PAGE_HISTORY, MuiPageHistoryPrivate);
+    self->priv->history = mui_swipe_history_new (SWIPE_HISTORY_CAPACITY);
+}
+
+static void
+finalize (GObject *object)
+{
+    MuiPageHistory *self = MUI_PAGE_HISTORY (object);
+
+    g_object_unref (self->priv->history);
+
+    G_OBJECT_CLASS (mui_page_history_parent_class)->finalize (object);
+}
+
+static void
+mui_page_history_class_init (MuiPageHistoryClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    MuiPageClass *page_class   = MUI_PAGE_CLASS (klass);
+
+    g_type_class_add_private (klass, sizeof (MuiPageHistoryPrivate));
+
+    object_class->finalize = finalize;
+
+    page_class->report_swipe = report_swipe;
+    page_class->reset        = reset;
+}
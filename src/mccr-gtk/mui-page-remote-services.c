@@ -89,6 +89,14 @@ struct _MuiPageRemoteServicesPrivate {
     GtkWidget    *remote_service_footer;
     GtkWidget    *remote_service_footer_label;
 
+    /* Results, in the order shown, and the key ones indexed by KSI */
+    GPtrArray  *results;
+    GHashTable *results_ksi_index;
+    guint32     results_ksi_lengths;
+    /* Check images shown, and the single row left sensitive, if any */
+    GSList     *results_checked;
+    GtkWidget  *results_single_row;
+
     /* Settings */
     gchar     *settings_path;
     GKeyFile  *settings;
@@ -207,23 +215,27 @@ typedef enum {
     RESULT_TYPE_COMMAND,
 } ResultType;
 
-typedef struct {
+typedef struct _RowContext RowContext;
+
+struct _RowContext {
     /* Common */
     ResultType  type;
     gchar      *id;
     gchar      *name;
     gchar      *description;
+    GtkWidget  *row;          /* soft */
     GtkWidget  *check_image;  /* soft */
     GtkWidget  *spinner;      /* soft */
     GtkWidget  *status_label; /* soft */
 
     /* Key list specific */
-    gchar *ksi;
+    gchar      *ksi;
+    RowContext *ksi_next; /* next result with the same KSI */
 
     /* Command list specific */
     gchar *execution_type;
     gchar *command;
-} RowContext;
+};
 
 static void
 row_context_free (RowContext *ctx)
@@ -240,64 +252,124 @@ row_context_free (RowContext *ctx)
 static void
 common_results_listbox_clear (MuiPageRemoteServices *self)
 {
-    GList *children, *l;
+    guint i;
 
     g_clear_object (&self->priv->remote_service_results_size_group_edges);
     g_clear_object (&self->priv->remote_service_results_size_group_center);
 
-    children = gtk_container_get_children (GTK_CONTAINER (self->priv->remote_service_results_listbox));
-    for (l = children; l; l = g_list_next (l))
-        gtk_container_remove (GTK_CONTAINER (self->priv->remote_service_results_listbox), GTK_WIDGET (l->data));
-    g_list_free (children);
+    /* Rows are destroyed before the contexts they refer to */
+    for (i = 0; i < self->priv->results->len; i++) {
+        RowContext *ctx;
+
+        ctx = g_ptr_array_index (self->priv->results, i);
+        if (ctx->row)
+            gtk_widget_destroy (ctx->row);
+    }
+    g_ptr_array_set_size (self->priv->results, 0);
+
+    g_hash_table_remove_all (self->priv->results_ksi_index);
+    self->priv->results_ksi_lengths = 0;
+    g_clear_pointer (&self->priv->results_checked, g_slist_free);
+    self->priv->results_single_row = NULL;
 }
 
 static void
-common_results_listbox_init (MuiPageRemoteServices *self)
+common_results_store_append (MuiPageRemoteServices *self,
+                             ResultType             type,
+                             const gchar           *id,
+                             const gchar           *name,
+                             const gchar           *description,
+                             const gchar           *ksi,
+                             const gchar           *execution_type,
+                             const gchar           *command)
 {
-    g_assert (!self->priv->remote_service_results_size_group_center);
-    self->priv->remote_service_results_size_group_center = gtk_size_group_new (GTK_SIZE_GROUP_HORIZONTAL);
-    g_assert (!self->priv->remote_service_results_size_group_edges);
-    self->priv->remote_service_results_size_group_edges = gtk_size_group_new (GTK_SIZE_GROUP_HORIZONTAL);
+    RowContext *ctx;
+    gsize       ksi_length;
+    gchar      *key;
+
+    ctx = g_slice_new0 (RowContext);
+    ctx->type            = type;
+    ctx->id              = g_strdup (id);
+    ctx->name            = g_strdup (name);
+    ctx->description     = g_strdup (description);
+    ctx->ksi             = g_strdup (ksi);
+    ctx->execution_type  = g_strdup (execution_type);
+    ctx->command         = g_strdup (command);
+    g_ptr_array_add (self->priv->results, ctx);
+
+    if (!ksi)
+        return;
+
+    /* A KSI longer than the KSN in hex can never be a prefix of it */
+    ksi_length = strlen (ksi);
+    if (ksi_length > 2 * sizeof (dukpt_ksn_t))
+        return;
+
+    /* Index by KSI; if already there, the new result is chained to the
+     * ones with the same KSI and the new key string is freed */
+    key = g_ascii_strup (ksi, -1);
+    ctx->ksi_next = g_hash_table_lookup (self->priv->results_ksi_index, key);
+    g_hash_table_insert (self->priv->results_ksi_index, key, ctx);
+    self->priv->results_ksi_lengths |= (1 << ksi_length);
 }
 
 static void
 common_results_listbox_set_sensitivity (MuiPageRemoteServices *self,
                                         GtkWidget             *single_row)
 {
-    GList *children, *l;
+    guint i;
 
-    children = gtk_container_get_children (GTK_CONTAINER (self->priv->remote_service_results_listbox));
-    for (l = children; l; l = g_list_next (l)) {
-        GtkWidget  *row;
+    if (single_row == self->priv->results_single_row)
+        return;
+    self->priv->results_single_row = single_row;
 
-        row = (GtkWidget *)(l->data);
-        gtk_widget_set_sensitive (row, (!single_row || (single_row == row)));
+    for (i = 0; i < self->priv->results->len; i++) {
+        RowContext *ctx;
+
+        ctx = g_ptr_array_index (self->priv->results, i);
+        gtk_widget_set_sensitive (ctx->row, (!single_row || (single_row == ctx->row)));
     }
-    g_list_free (children);
+}
+
+static void
+common_results_listbox_show_check (MuiPageRemoteServices *self,
+                                   GtkWidget             *check_image)
+{
+    gtk_widget_show (check_image);
+    self->priv->results_checked = g_slist_prepend (self->priv->results_checked, check_image);
 }
 
 static void
 common_results_listbox_select_current (MuiPageRemoteServices *self,
                                        const dukpt_ksn_t     *ksn)
 {
-    GList *children, *l;
+    gchar hexksn[2 * sizeof (dukpt_ksn_t) + 1];
+    gsize hexksn_length;
+    gsize i;
 
-    children = gtk_container_get_children (GTK_CONTAINER (self->priv->remote_service_results_listbox));
-    for (l = children; l; l = g_list_next (l)) {
-        GtkWidget  *row;
-        RowContext *ctx;
+    /* Only the checks shown earlier need to be hidden */
+    g_slist_foreach (self->priv->results_checked, (GFunc) gtk_widget_hide, NULL);
+    g_clear_pointer (&self->priv->results_checked, g_slist_free);
 
-        row = (GtkWidget *)(l->data);
+    if (!ksn || !*ksn || !self->priv->results_ksi_lengths)
+        return;
+
+    /* The KSI must be a prefix of the KSN in hex, so look up in the index
+     * each KSN prefix with the length of any of the KSIs found */
+    hexksn_length = hex_encode ((const uint8_t *) *ksn, sizeof (dukpt_ksn_t), NULL, hexksn, sizeof (hexksn));
+    for (i = 0; i <= hexksn_length; i++) {
+        RowContext *ctx;
+        gchar       c;
 
-        ctx = g_object_get_data (G_OBJECT (row), "RowContext");
-        g_assert (ctx);
+        if (!(self->priv->results_ksi_lengths & (1 << i)))
+            continue;
 
-        if (ksi_matches_ksn (ksn, ctx->ksi))
-            gtk_widget_show (ctx->check_image);
-        else
-            gtk_widget_hide (ctx->check_image);
+        c = hexksn[i];
+        hexksn[i] = '\0';
+        for (ctx = g_hash_table_lookup (self->priv->results_ksi_index, hexksn); ctx; ctx = ctx->ksi_next)
+            common_results_listbox_show_check (self, ctx->check_image);
+        hexksn[i] = c;
     }
-    g_list_free (children);
 }
 
 static GtkWindow *
@@ -416,39 +488,19 @@ common_result_row_activated (MuiPageRemoteServices *self,
     }
 }
 
-static void
-common_results_listbox_append_row (MuiPageRemoteServices *self,
-                                   ResultType             type,
-                                   const gchar           *id,
-                                   const gchar           *name,
-                                   const gchar           *description,
-                                   const gchar           *ksi,
-                                   const gchar           *execution_type,
-                                   const gchar           *command)
+static GtkWidget *
+common_results_listbox_create_row (MuiPageRemoteServices *self,
+                                   RowContext            *ctx)
 {
-    GtkWidget  *row;
-    GtkWidget  *box;
-    GtkWidget  *inner_box;
-    GtkWidget  *label;
-    RowContext *ctx;
-    GIcon      *icon;
+    GtkWidget *row;
+    GtkWidget *box;
+    GtkWidget *inner_box;
+    GtkWidget *label;
+    GIcon     *icon;
 
     row = gtk_list_box_row_new ();
     gtk_widget_show (row);
-
-    ctx = g_slice_new0 (RowContext);
-    ctx->type            = type;
-    ctx->id              = g_strdup (id);
-    ctx->name            = g_strdup (name);
-    ctx->description     = g_strdup (description);
-    ctx->ksi             = g_strdup (ksi);
-    ctx->execution_type  = g_strdup (execution_type);
-    ctx->command         = g_strdup (command);
-
-    g_object_set_data_full (G_OBJECT (row),
-                            "RowContext",
-                            ctx,
-                            (GDestroyNotify) row_context_free);
+    g_object_set_data (G_OBJECT (row), "RowContext", ctx);
 
     box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 18);
     gtk_widget_show (box);
@@ -473,7 +525,7 @@ common_results_listbox_append_row (MuiPageRemoteServices *self,
     gtk_widget_set_valign (ctx->spinner, GTK_ALIGN_CENTER);
     gtk_box_pack_start (GTK_BOX (inner_box), ctx->spinner, TRUE, TRUE, 0);
 
-    switch (type) {
+    switch (ctx->type) {
         case RESULT_TYPE_KEY: {
             gchar *str;
 
@@ -481,9 +533,9 @@ common_results_listbox_append_row (MuiPageRemoteServices *self,
             str = g_markup_printf_escaped ("<span weight=\"bold\">%s</span>\n"
                                            "\t<span style=\"italic\">%s</span>\n"
                                            "\tksi: %s",
-                                           name,
-                                           description,
-                                           ksi);
+                                           ctx->name,
+                                           ctx->description,
+                                           ctx->ksi);
             gtk_label_set_markup (GTK_LABEL (label), str);
             g_free (str);
 
@@ -498,7 +550,7 @@ common_results_listbox_append_row (MuiPageRemoteServices *self,
             break;
         }
         case RESULT_TYPE_COMMAND:
-            label = gtk_label_new (description);
+            label = gtk_label_new (ctx->description);
 
             /* Center all items returned */
 #if GTK_CHECK_VERSION (3,16,0)
@@ -530,7 +582,30 @@ common_results_listbox_append_row (MuiPageRemoteServices *self,
     gtk_widget_hide (ctx->status_label);
     gtk_box_pack_start (GTK_BOX (inner_box), ctx->status_label, FALSE, TRUE, 0);
 
-    gtk_list_box_insert (GTK_LIST_BOX (self->priv->remote_service_results_listbox), row, -1);
+    return row;
+}
+
+static void
+common_results_listbox_populate (MuiPageRemoteServices *self)
+{
+    guint i;
+
+    g_assert (!self->priv->remote_service_results_size_group_center);
+    self->priv->remote_service_results_size_group_center = gtk_size_group_new (GTK_SIZE_GROUP_HORIZONTAL);
+    g_assert (!self->priv->remote_service_results_size_group_edges);
+    self->priv->remote_service_results_size_group_edges = gtk_size_group_new (GTK_SIZE_GROUP_HORIZONTAL);
+
+    /* Rows are all created from the stored results while the list is
+     * hidden, so that it is laid out just once when shown */
+    for (i = 0; i < self->priv->results->len; i++) {
+        RowContext *ctx;
+
+        ctx = g_ptr_array_index (self->priv->results, i);
+        ctx->row = common_results_listbox_create_row (self, ctx);
+        gtk_list_box_insert (GTK_LIST_BOX (self->priv->remote_service_results_listbox), ctx->row, -1);
+    }
+
+    gtk_widget_show (self->priv->remote_service_results_scrolled_window);
 }
 
 /******************************************************************************/
@@ -571,7 +646,7 @@ key_update_finished (KeyUpdateContext *ctx,
     gtk_widget_hide (ctx->spinner);
     gtk_widget_hide (ctx->status_label);
     if (success)
-        gtk_widget_show (ctx->check_image);
+        common_results_listbox_show_check (ctx->self, ctx->check_image);
 
     g_clear_object (&ctx->self->priv->remote_service_cancellable);
     g_object_notify_by_pspec (G_OBJECT (ctx->self), properties[PROP_OPERATION_ONGOING]);
@@ -780,10 +855,6 @@ get_key_list_ready (MuiRemoteService      *remote_service,
     if (!keys)
         goto out;
 
-    /* Show key results */
-    gtk_widget_show (self->priv->remote_service_results_scrolled_window);
-    common_results_listbox_init (self);
-
     for (i = 0; i < keys->len; i++) {
         MuiKeyInfo *key_info;
 
@@ -795,17 +866,20 @@ get_key_list_ready (MuiRemoteService      *remote_service,
             continue;
         }
 
-        common_results_listbox_append_row (self,
-                                           RESULT_TYPE_KEY,
-                                           (const gchar *) key_info->id,
-                                           (const gchar *) key_info->key_name,
-                                           (const gchar *) key_info->description,
-                                           (const gchar *) key_info->ksi,
-                                           NULL,  /* execution type */
-                                           NULL); /* command */
+        common_results_store_append (self,
+                                     RESULT_TYPE_KEY,
+                                     (const gchar *) key_info->id,
+                                     (const gchar *) key_info->key_name,
+                                     (const gchar *) key_info->description,
+                                     (const gchar *) key_info->ksi,
+                                     NULL,  /* execution type */
+                                     NULL); /* command */
     }
     g_array_unref (keys);
 
+    /* Show key results */
+    common_results_listbox_populate (self);
+
     /* Select current key */
     common_results_listbox_select_current (self, self->priv->ksn_set ? (const dukpt_ksn_t *) &self->priv->ksn : NULL);
 
@@ -860,7 +934,7 @@ generic_command_finished (GenericCommandContext *ctx,
     gtk_widget_hide (ctx->spinner);
     gtk_widget_hide (ctx->status_label);
     if (success) {
-        gtk_widget_show (ctx->check_image);
+        common_results_listbox_show_check (ctx->self, ctx->check_image);
 
         ctx->self->priv->n_commands_executed++;
         common_update_footer (ctx->self);
@@ -1272,25 +1346,24 @@ get_command_list_ready (MuiRemoteService      *remote_service,
     if (!commands)
         goto out;
 
-    /* Show command results */
-    gtk_widget_show (self->priv->remote_service_results_scrolled_window);
-    common_results_listbox_init (self);
-
     for (i = 0; i < commands->len; i++) {
         MuiCommandInfo *command_info;
 
         command_info = &g_array_index (commands, MuiCommandInfo, i);
-        common_results_listbox_append_row (self,
-                                           RESULT_TYPE_COMMAND,
-                                           (const gchar *) command_info->id,
-                                           (const gchar *) command_info->name,
-                                           (const gchar *) command_info->description,
-                                           NULL, /* ksi */
-                                           (const gchar *) command_info->execution_type,
-                                           (const gchar *) command_info->value);
+        common_results_store_append (self,
+                                     RESULT_TYPE_COMMAND,
+                                     (const gchar *) command_info->id,
+                                     (const gchar *) command_info->name,
+                                     (const gchar *) command_info->description,
+                                     NULL, /* ksi */
+                                     (const gchar *) command_info->execution_type,
+                                     (const gchar *) command_info->value);
     }
     g_array_unref (commands);
 
+    /* Show command results */
+    common_results_listbox_populate (self);
+
     common_results_listbox_select_current (self, NULL);
 
 out:
@@ -1631,6 +1704,8 @@ mui_page_remote_services_init (MuiPageRemoteServices *self)
 {
     self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MUI_TYPE_PAGE_REMOTE_SERVICES, MuiPageRemoteServicesPrivate);
     self->priv->remote_service = mui_remote_service_new ();
+    self->priv->results = g_ptr_array_new_with_free_func ((GDestroyNotify) row_context_free);
+    self->priv->results_ksi_index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 }
 
 static void
@@ -1673,6 +1748,19 @@ dispose (GObject *object)
     G_OBJECT_CLASS (mui_page_remote_services_parent_class)->dispose (object);
 }
 
+static void
+finalize (GObject *object)
+{
+    MuiPageRemoteServices *self = MUI_PAGE_REMOTE_SERVICES (object);
+
+    /* Rows are gone by now, along with any reference to their context */
+    g_slist_free (self->priv->results_checked);
+    g_hash_table_unref (self->priv->results_ksi_index);
+    g_ptr_array_unref (self->priv->results);
+
+    G_OBJECT_CLASS (mui_page_remote_services_parent_class)->finalize (object);
+}
+
 static void
 mui_page_remote_services_class_init (MuiPageRemoteServicesClass *klass)
 {
@@ -1683,6 +1771,7 @@ mui_page_remote_services_class_init (MuiPageRemoteServicesClass *klass)
 
     object_class->get_property = get_property;
     object_class->dispose      = dispose;
+    object_class->finalize     = finalize;
     page_class->report_item    = report_item;
     page_class->reset          = reset;
 
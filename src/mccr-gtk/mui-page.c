@@ -53,6 +53,7 @@ static guint signals[LAST_SIGNAL] = { 0 };
 struct _MuiPagePrivate {
     MuiProcessor *processor;
     gulong        report_item_id;
+    gulong        report_swipe_id;
 };
 
 /******************************************************************************/
@@ -148,6 +149,41 @@ inthread_report_item (MuiPage          *self,
     g_idle_add ((GSourceFunc) report_item_cb, ctx);
 }
 
+typedef struct {
+    MuiPage  *self;
+    MuiSwipe *swipe;
+} ReportSwipeContext;
+
+static void
+report_swipe_context_free (ReportSwipeContext *ctx)
+{
+    mui_swipe_unref (ctx->swipe);
+    g_object_unref (ctx->self);
+    g_slice_free (ReportSwipeContext, ctx);
+}
+
+static gboolean
+report_swipe_cb (ReportSwipeContext *ctx)
+{
+    MUI_PAGE_GET_CLASS (ctx->self)->report_swipe (ctx->self, ctx->swipe);
+    report_swipe_context_free (ctx);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+inthread_report_swipe (MuiPage  *self,
+                       MuiSwipe *swipe)
+{
+    ReportSwipeContext *ctx;
+
+    /* The swipe is immutable, so it's just shared with the main thread */
+    ctx = g_slice_new0 (ReportSwipeContext);
+    ctx->self  = g_object_ref (self);
+    ctx->swipe = mui_swipe_ref (swipe);
+
+    g_idle_add ((GSourceFunc) report_swipe_cb, ctx);
+}
+
 static void
 setup_processor (MuiPage *self)
 {
@@ -155,12 +191,19 @@ setup_processor (MuiPage *self)
         return;
 
     g_assert (!self->priv->report_item_id);
+    g_assert (!self->priv->report_swipe_id);
 
     if (MUI_PAGE_GET_CLASS (self)->report_item)
         self->priv->report_item_id = g_signal_connect_swapped (self->priv->processor,
                                                                "report-item",
                                                                G_CALLBACK (inthread_report_item),
                                                                self);
+
+    if (MUI_PAGE_GET_CLASS (self)->report_swipe)
+        self->priv->report_swipe_id = g_signal_connect_swapped (self->priv->processor,
+                                                                "report-swipe",
+                                                                G_CALLBACK (inthread_report_swipe),
+                                                                self);
 }
 
 static void
@@ -171,6 +214,11 @@ cleanup_processor (MuiPage *self)
         g_signal_handler_disconnect (self->priv->processor, self->priv->report_item_id);
         self->priv->report_item_id = 0;
     }
+    if (self->priv->report_swipe_id) {
+        g_assert (self->priv->processor);
+        g_signal_handler_disconnect (self->priv->processor, self->priv->report_swipe_id);
+        self->priv->report_swipe_id = 0;
+    }
     g_clear_object (&self->priv->processor);
 }
 
@@ -49,10 +49,12 @@ struct _MuiPage {
 struct _MuiPageClass {
     GtkBoxClass parent_class;
 
-    void (* report_item) (MuiPage          *self,
-                          MuiProcessorItem  item,
-                          const gchar      *value);
-    void (* reset)       (MuiPage          *self);
+    void (* report_item)  (MuiPage          *self,
+                           MuiProcessorItem  item,
+                           const gchar      *value);
+    void (* report_swipe) (MuiPage          *self,
+                           MuiSwipe         *swipe);
+    void (* reset)        (MuiPage          *self);
 
     /* signals */
     void (* user_error)       (MuiPage     *self,
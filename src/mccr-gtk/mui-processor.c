@@ -34,6 +34,15 @@
 
 #define DEFAULT_WAIT_SWIPE_TIMEOUT_MS 1000
 
+/* Swipe waits never block the shared thread; the device is checked for an
+ * already available swipe report, and checked again once its input descriptor
+ * is readable or the wait times out. Devices without an input descriptor to
+ * poll (e.g. with the libusb backend) are checked again after this time. */
+#define WAIT_SWIPE_POLL_MS 50
+
+/* Time to wait before reading swipes again after a swipe stream error */
+#define SWIPE_STREAM_RETRY_TIMEOUT_SECS 1
+
 G_DEFINE_TYPE (MuiProcessor, mui_processor, G_TYPE_OBJECT)
 
 enum {
@@ -46,6 +55,7 @@ static GParamSpec *properties[N_PROPERTIES] = { NULL };
 
 enum {
     REPORT_ITEM,
+    REPORT_SWIPE,
     LAST_SIGNAL
 };
 
@@ -55,12 +65,32 @@ struct _MuiProcessorPrivate {
     /* Properties */
     gchar      *path;
 
-    /* Internal thread */
-    GThread      *thread;
+    /* Operations run in the shared thread */
     GMainContext *thread_context;
-    GMainLoop    *thread_loop;
-    GIOChannel   *thread_channel;
+    GSource      *operation_source;
     GAsyncQueue  *thread_queue;
+    volatile gint thread_queue_seq;
+
+    /* Set once the stop operation has been run in the shared thread */
+    GMutex        stop_mutex;
+    GCond         stop_cond;
+    gboolean      stopped;
+
+    /* Whether a property reload is queued and not yet started */
+    volatile gint load_properties_pending;
+
+    /* Swipe waits with no swipe report available yet, checked again once
+     * the queue is empty */
+    GQueue        pending_wait_swipes;
+
+    /* Device input descriptor, polled in the operation source while there
+     * are pending swipe waits */
+    gint          input_fd;
+    gpointer      input_fd_tag;
+
+    /* Swipe stream waiting to be retried after an error */
+    GTask        *swipe_stream_retry_task;
+    GSource      *swipe_stream_retry_source;
 
     /* The device */
     mccr_device_t *device;
@@ -91,24 +121,6 @@ static const gchar *processor_item_str[] = {
     [MUI_PROCESSOR_ITEM_SECURITY_LEVEL]                = "security-level",
     [MUI_PROCESSOR_ITEM_ENCRYPTION_COUNTER]            = "encryption-counter",
     [MUI_PROCESSOR_ITEM_MAGTEK_UPDATE_TOKEN]           = "magtek-update-token",
-    [MUI_PROCESSOR_ITEM_SWIPE_STARTED]                 = "swipe-started",
-    [MUI_PROCESSOR_ITEM_CARD_ENCODE_TYPE]              = "card-encode-type",
-    [MUI_PROCESSOR_ITEM_TRACK_1_DECODE_STATUS]         = "track-1-decode-status",
-    [MUI_PROCESSOR_ITEM_TRACK_1_ENCRYPTED_DATA_LENGTH] = "track-1-encrypted-data-length",
-    [MUI_PROCESSOR_ITEM_TRACK_1_ENCRYPTED_DATA]        = "track-1-encrypted-data",
-    [MUI_PROCESSOR_ITEM_TRACK_1_MASKED_DATA_LENGTH]    = "track-1-masked-data-length",
-    [MUI_PROCESSOR_ITEM_TRACK_1_MASKED_DATA]           = "track-1-masked-data",
-    [MUI_PROCESSOR_ITEM_TRACK_2_DECODE_STATUS]         = "track-2-decode-status",
-    [MUI_PROCESSOR_ITEM_TRACK_2_ENCRYPTED_DATA_LENGTH] = "track-2-encrypted-data-length",
-    [MUI_PROCESSOR_ITEM_TRACK_2_ENCRYPTED_DATA]        = "track-2-encrypted-data",
-    [MUI_PROCESSOR_ITEM_TRACK_2_MASKED_DATA_LENGTH]    = "track-2-masked-data-length",
-    [MUI_PROCESSOR_ITEM_TRACK_2_MASKED_DATA]           = "track-2-masked-data",
-    [MUI_PROCESSOR_ITEM_TRACK_3_DECODE_STATUS]         = "track-3-decode-status",
-    [MUI_PROCESSOR_ITEM_TRACK_3_ENCRYPTED_DATA_LENGTH] = "track-3-encrypted-data-length",
-    [MUI_PROCESSOR_ITEM_TRACK_3_ENCRYPTED_DATA]        = "track-3-encrypted-data",
-    [MUI_PROCESSOR_ITEM_TRACK_3_MASKED_DATA_LENGTH]    = "track-3-masked-data-length",
-    [MUI_PROCESSOR_ITEM_TRACK_3_MASKED_DATA]           = "track-3-masked-data",
-    [MUI_PROCESSOR_ITEM_SWIPE_FINISHED]                = "swipe-finished",
 };
 
 G_STATIC_ASSERT (G_N_ELEMENTS (processor_item_str) == MUI_PROCESSOR_ITEM_LAST);
@@ -133,6 +145,14 @@ report_item (MuiProcessor     *self,
     g_signal_emit (self, signals[REPORT_ITEM], 0, (guint) item, value);
 }
 
+static void
+report_swipe (MuiProcessor *self,
+              MuiSwipe     *swipe)
+{
+    g_debug ("[processor] report swipe");
+    g_signal_emit (self, signals[REPORT_SWIPE], 0, swipe);
+}
+
 /*****************************************************************************/
 
 const gchar *
@@ -375,13 +395,37 @@ typedef enum {
     OPERATION_TYPE_RESET,
     OPERATION_TYPE_LOAD_PROPERTIES,
     OPERATION_TYPE_WAIT_SWIPE,
+    OPERATION_TYPE_SWIPE_STREAM,
     OPERATION_TYPE_RUN_COMMAND,
     OPERATION_TYPE_STOP,
 } OperationType;
 
+/* Operations are run by priority, and in the order they were scheduled within
+ * the same priority. User requests go first, then property reloads, and swipe
+ * waits last; the start operation always goes before any other one as it
+ * creates the device. Swipe waits don't hold the thread while there is no
+ * input, so operations scheduled meanwhile are run right away. */
+static const gint operation_priority[] = {
+    [OPERATION_TYPE_START]           = 3,
+    [OPERATION_TYPE_RESET]           = 2,
+    [OPERATION_TYPE_RUN_COMMAND]     = 2,
+    [OPERATION_TYPE_LOAD_PROPERTIES] = 1,
+    [OPERATION_TYPE_WAIT_SWIPE]      = 0,
+    [OPERATION_TYPE_SWIPE_STREAM]    = 0,
+    [OPERATION_TYPE_STOP]            = 0,
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (operation_priority) == OPERATION_TYPE_STOP + 1);
+
 typedef struct {
     OperationType  type;
+    /* Order in which the operation was scheduled */
+    guint          seq;
     CommandInfo   *command_info;
+    /* Monotonic time at which the swipe wait times out, set when first run */
+    gint64         wait_swipe_deadline;
+    /* Whether the swipe stream status has already been reported */
+    gboolean       swipe_stream_started;
 } OperationContext;
 
 static void
@@ -410,6 +454,46 @@ operation_task_new (MuiProcessor        *self,
     return operation_task;
 }
 
+static gint
+operation_task_compare (GTask    *a,
+                        GTask    *b,
+                        gpointer  user_data)
+{
+    OperationContext *context_a;
+    OperationContext *context_b;
+
+    context_a = g_task_get_task_data (a);
+    context_b = g_task_get_task_data (b);
+
+    /* Negative if a goes first */
+    if (operation_priority[context_a->type] != operation_priority[context_b->type])
+        return operation_priority[context_b->type] - operation_priority[context_a->type];
+    return (gint) (context_a->seq - context_b->seq);
+}
+
+/* Operations put back in the queue (e.g. pending swipe waits) keep their
+ * original order */
+static void
+requeue_operation (MuiProcessor *self,
+                   GTask        *operation_task)
+{
+    g_async_queue_push_sorted (self->priv->thread_queue,
+                               operation_task,
+                               (GCompareDataFunc) operation_task_compare,
+                               NULL);
+}
+
+static void
+push_operation (MuiProcessor *self,
+                GTask        *operation_task)
+{
+    OperationContext *operation_context;
+
+    operation_context = g_task_get_task_data (operation_task);
+    operation_context->seq = (guint) g_atomic_int_add (&self->priv->thread_queue_seq, 1);
+    requeue_operation (self, operation_task);
+}
+
 static void notify_operation_available (MuiProcessor *self);
 
 /* Start */
@@ -417,8 +501,8 @@ static void notify_operation_available (MuiProcessor *self);
 static void
 schedule_operation_start (MuiProcessor *self)
 {
-    g_async_queue_push (self->priv->thread_queue,
-                        operation_task_new (self, OPERATION_TYPE_START, NULL, NULL, NULL, NULL));
+    push_operation (self,
+                    operation_task_new (self, OPERATION_TYPE_START, NULL, NULL, NULL, NULL));
     notify_operation_available (self);
 }
 
@@ -427,8 +511,13 @@ schedule_operation_start (MuiProcessor *self)
 static void
 schedule_operation_load_properties (MuiProcessor *self)
 {
-    g_async_queue_push (self->priv->thread_queue,
-                        operation_task_new (self, OPERATION_TYPE_LOAD_PROPERTIES, NULL, NULL, NULL, NULL));
+    /* A reload already queued will load all properties anyway */
+    if (!g_atomic_int_compare_and_exchange (&self->priv->load_properties_pending, FALSE, TRUE)) {
+        g_debug ("[processor] property reload already pending");
+        return;
+    }
+
+    push_operation (self, operation_task_new (self, OPERATION_TYPE_LOAD_PROPERTIES, NULL, NULL, NULL, NULL));
     notify_operation_available (self);
 }
 
@@ -437,8 +526,8 @@ schedule_operation_load_properties (MuiProcessor *self)
 static void
 schedule_operation_reset (MuiProcessor *self)
 {
-    g_async_queue_push (self->priv->thread_queue,
-                        operation_task_new (self, OPERATION_TYPE_RESET, NULL, NULL, NULL, NULL));
+    push_operation (self,
+                    operation_task_new (self, OPERATION_TYPE_RESET, NULL, NULL, NULL, NULL));
     notify_operation_available (self);
 }
 
@@ -458,13 +547,39 @@ schedule_operation_wait_swipe (MuiProcessor        *self,
                                GAsyncReadyCallback  callback,
                                gpointer             user_data)
 {
-    g_async_queue_push (self->priv->thread_queue,
-                        operation_task_new (self,
-                                            OPERATION_TYPE_WAIT_SWIPE,
-                                            NULL,
-                                            cancellable,
-                                            callback,
-                                            user_data));
+    push_operation (self,
+                    operation_task_new (self,
+                                        OPERATION_TYPE_WAIT_SWIPE,
+                                        NULL,
+                                        cancellable,
+                                        callback,
+                                        user_data));
+    notify_operation_available (self);
+}
+
+/* Swipe stream */
+
+static gboolean
+schedule_operation_swipe_stream_finish (MuiProcessor  *self,
+                                        GAsyncResult  *res,
+                                        GError       **error)
+{
+    return g_task_propagate_boolean (G_TASK (res), error);
+}
+
+static void
+schedule_operation_swipe_stream (MuiProcessor        *self,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+    push_operation (self,
+                    operation_task_new (self,
+                                        OPERATION_TYPE_SWIPE_STREAM,
+                                        NULL,
+                                        cancellable,
+                                        callback,
+                                        user_data));
     notify_operation_available (self);
 }
 
@@ -485,13 +600,13 @@ schedule_operation_run_command (MuiProcessor            *self,
                                 GAsyncReadyCallback      callback,
                                 gpointer                 user_data)
 {
-    g_async_queue_push (self->priv->thread_queue,
-                        operation_task_new (self,
-                                            OPERATION_TYPE_RUN_COMMAND,
-                                            command_info,
-                                            cancellable,
-                                            callback,
-                                            user_data));
+    push_operation (self,
+                    operation_task_new (self,
+                                        OPERATION_TYPE_RUN_COMMAND,
+                                        command_info,
+                                        cancellable,
+                                        callback,
+                                        user_data));
     notify_operation_available (self);
 }
 
@@ -500,175 +615,43 @@ schedule_operation_run_command (MuiProcessor            *self,
 static void
 schedule_operation_stop (MuiProcessor *self)
 {
-    g_async_queue_push (self->priv->thread_queue,
-                        operation_task_new (NULL, OPERATION_TYPE_STOP, NULL, NULL, NULL, NULL));
+    push_operation (self,
+                    operation_task_new (NULL, OPERATION_TYPE_STOP, NULL, NULL, NULL, NULL));
     notify_operation_available (self);
 }
 
 /*****************************************************************************/
 
-static void
-process_track (MuiProcessor          *self,
-               mccr_swipe_report_t   *report,
-               mccr_status_t       (* get_decode_status)         (mccr_swipe_report_t *report, uint8_t        *status),
-               mccr_status_t       (* get_encrypted_data_length) (mccr_swipe_report_t *report, uint8_t        *status),
-               mccr_status_t       (* get_encrypted_data)        (mccr_swipe_report_t *report, const uint8_t **out_data),
-               mccr_status_t       (* get_masked_data_length)    (mccr_swipe_report_t *report, uint8_t        *status),
-               mccr_status_t       (* get_masked_data)           (mccr_swipe_report_t *report, const uint8_t **out_data),
-               MuiProcessorItem       decode_status_item,
-               MuiProcessorItem       encrypted_data_length_item,
-               MuiProcessorItem       encrypted_data_item,
-               MuiProcessorItem       masked_data_length_item,
-               MuiProcessorItem       masked_data_item)
-{
-    mccr_status_t st;
-    uint8_t            status;
-
-    /* Track decode status */
-    {
-        char *decode_status = NULL;
-
-        if ((st = get_decode_status (report, &status)) != MCCR_STATUS_OK)
-            g_warning ("Cannot get track decode status: %s", mccr_status_to_string (st));
-        else if (status == MCCR_SWIPE_TRACK_DECODE_STATUS_SUCCESS)
-            decode_status = g_strdup ("success");
-        else if (status & MCCR_SWIPE_TRACK_DECODE_STATUS_ERROR)
-            decode_status = g_strdup ("error");
-        else
-            decode_status = g_strdup_printf ("unknown status (0x%02x)", status);
-
-        report_item (self, decode_status_item, decode_status ? decode_status : "n/a");
-        g_free (decode_status);
-    }
-
-    /* Encrypted data */
-    {
-        const uint8_t *data;
-        uint8_t        length;
-        char          *encrypted_data_length = NULL;
-        char          *encrypted_data        = NULL;
-
-        if ((st = get_encrypted_data_length (report, &length)) != MCCR_STATUS_OK)
-            g_warning ("Cannot get track encrypted data length: %s", mccr_status_to_string (st));
-        else
-            encrypted_data_length = g_strdup_printf ("%u bytes", length);
-
-        if (length > 0) {
-            if ((st = get_encrypted_data (report, &data)) != MCCR_STATUS_OK)
-                g_warning ("Cannot get track encrypted data: %s", mccr_status_to_string (st));
-            else
-                encrypted_data = strhex (data, length, " ");
-        }
-
-        report_item (self, encrypted_data_length_item, encrypted_data_length ? encrypted_data_length : "n/a");
-        report_item (self, encrypted_data_item,        encrypted_data        ? encrypted_data        : "n/a");
-
-        g_free (encrypted_data_length);
-        g_free (encrypted_data);
-     }
-
-    /* Masked data */
-    {
-        const uint8_t *data;
-        uint8_t        length;
-        char          *masked_data_length = NULL;
-        char          *masked_data        = NULL;
-
-        if ((st = get_masked_data_length (report, &length)) != MCCR_STATUS_OK)
-            g_warning ("Cannot get track masked data length: %s", mccr_status_to_string (st));
-        else
-            masked_data_length = g_strdup_printf ("%u bytes", length);
-
-        if (length > 0) {
-            if ((st = get_masked_data (report, &data)) != MCCR_STATUS_OK)
-                g_warning ("Cannot get track masked data: %s", mccr_status_to_string (st));
-            else
-                masked_data = strhex (data, length, " ");
-        }
-
-        report_item (self, masked_data_length_item, masked_data_length ? masked_data_length : "n/a");
-        report_item (self, masked_data_item,        masked_data        ? masked_data        : "n/a");
-
-        g_free (masked_data_length);
-        g_free (masked_data);
-    }
-}
-
+/* The device is only checked for a swipe report already available, failing
+ * with G_IO_ERROR_WOULD_BLOCK otherwise. A swipe already being received is
+ * read whole, as the rest of its fragments are read within the same call. */
 static gboolean
 run_wait_swipe (MuiProcessor  *self,
+                GCancellable  *cancellable,
                 GError       **error)
 {
-    mccr_status_t            st;
-    mccr_swipe_report_t     *report;
-    mccr_card_encode_type_t  card_encode_type;
-    gchar                   *str;
+    mccr_status_t        st;
+    mccr_swipe_report_t *report;
+    MuiSwipe            *swipe;
 
-    report_item (self, MUI_PROCESSOR_ITEM_STATUS, "Waiting for swipe...");
+    if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
 
-    st = mccr_device_wait_swipe_report (self->priv->device, DEFAULT_WAIT_SWIPE_TIMEOUT_MS, &report);
+    st = mccr_device_wait_swipe_report (self->priv->device, 0, &report);
     if (st != MCCR_STATUS_OK) {
         if (st == MCCR_STATUS_TIMED_OUT)
-            g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "Timeout");
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK, "No swipe available");
         else
             g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                          "Cannot get swipe report: %s", mccr_status_to_string (st));
         return FALSE;
     }
 
-    /* We're going to report a new swipe */
-    report_item (self, MUI_PROCESSOR_ITEM_SWIPE_STARTED, NULL);
-
-    str = NULL;
-    if ((st = mccr_swipe_report_get_card_encode_type (report, &card_encode_type)) != MCCR_STATUS_OK)
-        g_warning ("Cannot get card encode type: %s", mccr_status_to_string (st));
-    else
-        str = g_strdup (mccr_card_encode_type_to_string (card_encode_type));
-    report_item (self, MUI_PROCESSOR_ITEM_CARD_ENCODE_TYPE, str);
-    g_free (str);
-
-    process_track (self,
-                   report,
-                   mccr_swipe_report_get_track_1_decode_status,
-                   mccr_swipe_report_get_track_1_encrypted_data_length,
-                   mccr_swipe_report_get_track_1_encrypted_data,
-                   mccr_swipe_report_get_track_1_masked_data_length,
-                   mccr_swipe_report_get_track_1_masked_data,
-                   MUI_PROCESSOR_ITEM_TRACK_1_DECODE_STATUS,
-                   MUI_PROCESSOR_ITEM_TRACK_1_ENCRYPTED_DATA_LENGTH,
-                   MUI_PROCESSOR_ITEM_TRACK_1_ENCRYPTED_DATA,
-                   MUI_PROCESSOR_ITEM_TRACK_1_MASKED_DATA_LENGTH,
-                   MUI_PROCESSOR_ITEM_TRACK_1_MASKED_DATA);
-
-    process_track (self,
-                   report,
-                   mccr_swipe_report_get_track_2_decode_status,
-                   mccr_swipe_report_get_track_2_encrypted_data_length,
-                   mccr_swipe_report_get_track_2_encrypted_data,
-                   mccr_swipe_report_get_track_2_masked_data_length,
-                   mccr_swipe_report_get_track_2_masked_data,
-                   MUI_PROCESSOR_ITEM_TRACK_2_DECODE_STATUS,
-                   MUI_PROCESSOR_ITEM_TRACK_2_ENCRYPTED_DATA_LENGTH,
-                   MUI_PROCESSOR_ITEM_TRACK_2_ENCRYPTED_DATA,
-                   MUI_PROCESSOR_ITEM_TRACK_2_MASKED_DATA_LENGTH,
-                   MUI_PROCESSOR_ITEM_TRACK_2_MASKED_DATA);
-
-    process_track (self,
-                   report,
-                   mccr_swipe_report_get_track_3_decode_status,
-                   mccr_swipe_report_get_track_3_encrypted_data_length,
-                   mccr_swipe_report_get_track_3_encrypted_data,
-                   mccr_swipe_report_get_track_3_masked_data_length,
-                   mccr_swipe_report_get_track_3_masked_data,
-                   MUI_PROCESSOR_ITEM_TRACK_3_DECODE_STATUS,
-                   MUI_PROCESSOR_ITEM_TRACK_3_ENCRYPTED_DATA_LENGTH,
-                   MUI_PROCESSOR_ITEM_TRACK_3_ENCRYPTED_DATA,
-                   MUI_PROCESSOR_ITEM_TRACK_3_MASKED_DATA_LENGTH,
-                   MUI_PROCESSOR_ITEM_TRACK_3_MASKED_DATA);
-
-    /* We finished reporting a swipe */
-    report_item (self, MUI_PROCESSOR_ITEM_SWIPE_FINISHED, NULL);
-
-    mccr_swipe_report_free (report);
+    /* The whole swipe is reported at once, and the swipe takes ownership of
+     * the report */
+    swipe = mui_swipe_new (report);
+    report_swipe (self, swipe);
+    mui_swipe_unref (swipe);
     return TRUE;
 }
 
@@ -781,14 +764,89 @@ out:
 }
 
 static gboolean
-operation_available_cb (MuiProcessor *self)
+swipe_stream_retry_cb (MuiProcessor *self)
+{
+    g_debug ("[processor] retrying swipe stream");
+    requeue_operation (self, self->priv->swipe_stream_retry_task);
+    self->priv->swipe_stream_retry_task = NULL;
+    g_clear_pointer (&self->priv->swipe_stream_retry_source, g_source_unref);
+    /* The device may have changed meanwhile; the reload has a higher
+     * priority, so it runs before the stream goes on */
+    schedule_operation_load_properties (self);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_swipe_stream_retry (MuiProcessor *self,
+                             GTask        *operation_task)
+{
+    g_assert (!self->priv->swipe_stream_retry_task);
+    g_assert (!self->priv->swipe_stream_retry_source);
+
+    self->priv->swipe_stream_retry_task = operation_task;
+    self->priv->swipe_stream_retry_source = g_timeout_source_new_seconds (SWIPE_STREAM_RETRY_TIMEOUT_SECS);
+    g_source_set_callback (self->priv->swipe_stream_retry_source, (GSourceFunc) swipe_stream_retry_cb, self, NULL);
+    g_source_attach (self->priv->swipe_stream_retry_source, self->priv->thread_context);
+}
+
+/* The device input descriptor is only polled while there are pending swipe
+ * waits, as it stays readable until they are checked again; it may also change
+ * if the device is open again. */
+static void
+update_input_fd (MuiProcessor *self)
+{
+    gint fd = -1;
+
+    if (self->priv->device && !g_queue_is_empty (&self->priv->pending_wait_swipes))
+        fd = mccr_device_get_input_fd (self->priv->device);
+
+    if (self->priv->input_fd_tag && fd != self->priv->input_fd) {
+        g_source_remove_unix_fd (self->priv->operation_source, self->priv->input_fd_tag);
+        self->priv->input_fd_tag = NULL;
+    }
+    if (!self->priv->input_fd_tag && fd >= 0)
+        self->priv->input_fd_tag = g_source_add_unix_fd (self->priv->operation_source, fd, G_IO_IN);
+    self->priv->input_fd = fd;
+}
+
+/* Whether the pending swipe waits are checked periodically instead of only
+ * when the device sends input */
+static gboolean
+pending_wait_swipes_polled (MuiProcessor *self)
+{
+    return (!g_queue_is_empty (&self->priv->pending_wait_swipes) && !self->priv->input_fd_tag);
+}
+
+/* Monotonic time at which the first pending swipe wait times out, or -1 if
+ * none does (e.g. only swipe streams pending) */
+static gint64
+pending_wait_swipes_deadline (MuiProcessor *self)
+{
+    GList  *l;
+    gint64  deadline = -1;
+
+    for (l = self->priv->pending_wait_swipes.head; l; l = g_list_next (l)) {
+        OperationContext *pending_context;
+
+        pending_context = g_task_get_task_data (G_TASK (l->data));
+        if (pending_context->type == OPERATION_TYPE_WAIT_SWIPE &&
+            (deadline < 0 || pending_context->wait_swipe_deadline < deadline))
+            deadline = pending_context->wait_swipe_deadline;
+    }
+    return deadline;
+}
+
+/* Runs the next operation in the queue, if any. Returns FALSE once the
+ * processor is stopped. */
+static gboolean
+run_next_operation (MuiProcessor *self)
 {
     GTask            *operation_task;
     OperationContext *operation_context;
 
     operation_task = g_async_queue_try_pop (self->priv->thread_queue);
     if (!operation_task)
-        return G_SOURCE_REMOVE;
+        return TRUE;
 
     operation_context = g_task_get_task_data (operation_task);
     g_assert (operation_context);
@@ -796,7 +854,7 @@ operation_available_cb (MuiProcessor *self)
     /* Early cancellation? */
     if (g_task_return_error_if_cancelled (operation_task)) {
         g_object_unref (operation_task);
-        return G_SOURCE_REMOVE;
+        return TRUE;
     }
 
     /* Start */
@@ -806,16 +864,19 @@ operation_available_cb (MuiProcessor *self)
         self->priv->device = mccr_device_new (self->priv->path);
         g_task_return_boolean (operation_task, TRUE);
         g_object_unref (operation_task);
-        return G_SOURCE_REMOVE;
+        return TRUE;
     }
 
     /* Load properties */
     if (operation_context->type == OPERATION_TYPE_LOAD_PROPERTIES) {
         g_debug ("[processor] operation task: load properties");
+        /* Reloads requested from now on must be run, as they may be
+         * requested after a change in the device */
+        g_atomic_int_set (&self->priv->load_properties_pending, FALSE);
         load_device_properties (self);
         g_task_return_boolean (operation_task, TRUE);
         g_object_unref (operation_task);
-        return G_SOURCE_REMOVE;
+        return TRUE;
     }
 
     /* Reset */
@@ -824,20 +885,75 @@ operation_available_cb (MuiProcessor *self)
         mccr_device_reset (self->priv->device);
         g_task_return_boolean (operation_task, TRUE);
         g_object_unref (operation_task);
-        return G_SOURCE_REMOVE;
+        return TRUE;
     }
 
     /* Wait for swipe */
     if (operation_context->type == OPERATION_TYPE_WAIT_SWIPE) {
         GError *error = NULL;
 
-        g_debug ("[processor] operation task: wait swipe");
-        if (!run_wait_swipe (self, &error))
+        if (!operation_context->wait_swipe_deadline) {
+            g_debug ("[processor] operation task: wait swipe");
+            report_item (self, MUI_PROCESSOR_ITEM_STATUS, "Waiting for swipe...");
+            operation_context->wait_swipe_deadline = g_get_monotonic_time () + (DEFAULT_WAIT_SWIPE_TIMEOUT_MS * 1000);
+        }
+
+        if (!run_wait_swipe (self, g_task_get_cancellable (operation_task), &error)) {
+            if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+                g_error_free (error);
+                if (g_get_monotonic_time () < operation_context->wait_swipe_deadline) {
+                    g_queue_push_tail (&self->priv->pending_wait_swipes, operation_task);
+                    return TRUE;
+                }
+                error = g_error_new (G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "Timeout");
+            }
             g_task_return_error (operation_task, error);
-        else
+        } else
             g_task_return_boolean (operation_task, TRUE);
         g_object_unref (operation_task);
-        return G_SOURCE_REMOVE;
+        return TRUE;
+    }
+
+    /* Swipe stream */
+    if (operation_context->type == OPERATION_TYPE_SWIPE_STREAM) {
+        GError *error = NULL;
+
+        if (!operation_context->swipe_stream_started) {
+            g_debug ("[processor] operation task: swipe stream");
+            report_item (self, MUI_PROCESSOR_ITEM_STATUS, "Waiting for swipe...");
+            operation_context->swipe_stream_started = TRUE;
+        }
+
+        /* There is no timeout, the stream only stops if cancelled or on
+         * error. Device properties (e.g. the DUKPT KSN) may change with
+         * every swipe, so a reload is scheduled, coalesced with any other
+         * one pending; the stream goes on right after it. */
+        if (run_wait_swipe (self, g_task_get_cancellable (operation_task), &error)) {
+            schedule_operation_load_properties (self);
+            operation_context->swipe_stream_started = FALSE;
+            requeue_operation (self, operation_task);
+            return TRUE;
+        }
+
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+            g_error_free (error);
+            g_queue_push_tail (&self->priv->pending_wait_swipes, operation_task);
+            return TRUE;
+        }
+
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_task_return_error (operation_task, error);
+            g_object_unref (operation_task);
+            return TRUE;
+        }
+
+        /* Errors don't stop the stream, it's retried after a while */
+        g_debug ("[processor] swipe stream error: %s", error->message);
+        report_item (self, MUI_PROCESSOR_ITEM_STATUS_ERROR, error->message);
+        g_error_free (error);
+        operation_context->swipe_stream_started = FALSE;
+        schedule_swipe_stream_retry (self, operation_task);
+        return TRUE;
     }
 
     /* Run command */
@@ -850,17 +966,44 @@ operation_available_cb (MuiProcessor *self)
         else
             g_task_return_boolean (operation_task, TRUE);
         g_object_unref (operation_task);
-        return G_SOURCE_REMOVE;
+        return TRUE;
     }
 
     /* Process stop */
     if (operation_context->type == OPERATION_TYPE_STOP) {
+        GTask *pending_task;
+
         g_debug ("[processor] operation task: stop");
+        if (self->priv->swipe_stream_retry_source) {
+            g_source_destroy (self->priv->swipe_stream_retry_source);
+            g_clear_pointer (&self->priv->swipe_stream_retry_source, g_source_unref);
+        }
+        if (self->priv->swipe_stream_retry_task) {
+            g_task_return_boolean (self->priv->swipe_stream_retry_task, TRUE);
+            g_clear_object (&self->priv->swipe_stream_retry_task);
+        }
+        /* Finish pending waits as if they had timed out, and pending streams
+         * as if explicitly stopped */
+        while ((pending_task = g_queue_pop_head (&self->priv->pending_wait_swipes)) != NULL) {
+            OperationContext *pending_context;
+
+            pending_context = g_task_get_task_data (pending_task);
+            if (pending_context->type == OPERATION_TYPE_SWIPE_STREAM)
+                g_task_return_boolean (pending_task, TRUE);
+            else
+                g_task_return_new_error (pending_task, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "Timeout");
+            g_object_unref (pending_task);
+        }
+        update_input_fd (self);
         g_clear_pointer (&self->priv->device, mccr_device_unref);
-        g_main_loop_quit (self->priv->thread_loop);
         g_task_return_boolean (operation_task, TRUE);
         g_object_unref (operation_task);
-        return G_SOURCE_REMOVE;
+
+        g_mutex_lock (&self->priv->stop_mutex);
+        self->priv->stopped = TRUE;
+        g_cond_signal (&self->priv->stop_cond);
+        g_mutex_unlock (&self->priv->stop_mutex);
+        return FALSE;
     }
 
     /* Unknown task type? */
@@ -868,116 +1011,208 @@ operation_available_cb (MuiProcessor *self)
     return FALSE;
 }
 
-static void
-notify_operation_available (MuiProcessor *self)
+/* A single operation is run each time the source is dispatched, so that the
+ * operations of all the processors sharing the thread are interleaved. Swipe
+ * waits with no swipe available are only checked again once the device sent
+ * input or they timed out, and no other operation is pending, so that they
+ * never delay the ones scheduled meanwhile, and an idle swipe stream never
+ * wakes up the thread. */
+static gboolean
+operation_source_cb (MuiProcessor *self)
 {
-    g_main_context_invoke (self->priv->thread_context, (GSourceFunc) operation_available_cb, self);
-}
+    GSource *source;
+    GTask   *operation_task;
+    gint64   deadline;
+
+    source = self->priv->operation_source;
+
+    /* Cleared before popping, so that operations pushed from now on are
+     * notified again */
+    g_source_set_ready_time (source, -1);
+
+    deadline = pending_wait_swipes_deadline (self);
+    if (g_async_queue_length (self->priv->thread_queue) == 0 &&
+        (pending_wait_swipes_polled (self) ||
+         (deadline >= 0 && deadline <= g_source_get_time (source)) ||
+         (self->priv->input_fd_tag && g_source_query_unix_fd (source, self->priv->input_fd_tag)))) {
+        while ((operation_task = g_queue_pop_head (&self->priv->pending_wait_swipes)) != NULL)
+            requeue_operation (self, operation_task);
+    }
 
-/*****************************************************************************/
-/* Thread timing control */
+    if (!run_next_operation (self))
+        return G_SOURCE_REMOVE;
 
-#define THREAD_TIMER_TIMEOUT_SECS 30
+    update_input_fd (self);
+    if (pending_wait_swipes_polled (self))
+        g_source_set_ready_time (source, g_source_get_time (source) + (WAIT_SWIPE_POLL_MS * 1000));
+    else if ((deadline = pending_wait_swipes_deadline (self)) >= 0)
+        g_source_set_ready_time (source, deadline);
+    if (g_async_queue_length (self->priv->thread_queue) > 0)
+        g_source_set_ready_time (source, 0);
 
-typedef struct {
-    MuiProcessor *self;
-    GTimer       *timer;
-} ThreadTimerContext;
+    return G_SOURCE_CONTINUE;
+}
 
-static void
-thread_timer_context_free (ThreadTimerContext *ctx)
+static gboolean
+operation_source_dispatch (GSource     *source,
+                           GSourceFunc  callback,
+                           gpointer     user_data)
 {
-    g_timer_destroy (ctx->timer);
-    g_slice_free (ThreadTimerContext, ctx);
+    return callback (user_data);
 }
 
-static ThreadTimerContext *
-thread_timer_context_new (MuiProcessor *self)
-{
-    ThreadTimerContext *ctx;
+static GSourceFuncs operation_source_funcs = {
+    .dispatch = operation_source_dispatch,
+};
 
-    ctx = g_slice_new0 (ThreadTimerContext);
-    ctx->self  = self;
-    ctx->timer = g_timer_new ();
-    return ctx;
+static void
+notify_operation_available (MuiProcessor *self)
+{
+    /* Safe from any thread, wakes up the shared thread if needed */
+    g_source_set_ready_time (self->priv->operation_source, 0);
 }
 
+/*****************************************************************************/
+/* Thread timing control */
+
+#define THREAD_TIMER_TIMEOUT_SECS 30
+
 static gboolean
-thread_timer_context_step (ThreadTimerContext *ctx)
+thread_timer_step (GTimer *timer)
 {
-    g_debug ("[processor] support running for %.0lf seconds", g_timer_elapsed (ctx->timer, NULL));
+    g_debug ("[processor] support running for %.0lf seconds", g_timer_elapsed (timer, NULL));
     return G_SOURCE_CONTINUE;
 }
 
 static void
-thread_timer_setup (MuiProcessor *self)
+thread_timer_setup (GMainContext *context)
 {
     GSource *source;
 
     source = g_timeout_source_new_seconds (THREAD_TIMER_TIMEOUT_SECS);
     g_source_set_callback (source,
-                           (GSourceFunc) thread_timer_context_step,
-                           thread_timer_context_new (self),
-                           (GDestroyNotify) thread_timer_context_free);
-    g_source_attach (source, self->priv->thread_context);
+                           (GSourceFunc) thread_timer_step,
+                           g_timer_new (),
+                           (GDestroyNotify) g_timer_destroy);
+    g_source_attach (source, context);
     g_source_unref (source);
 }
 
 /*****************************************************************************/
-/* Setup/teardown inner thread */
-
-static void
-inner_thread_teardown (MuiProcessor *self)
-{
-    if (!self->priv->thread)
-        return;
+/* Shared thread
+ *
+ * All processors run their operations in the same thread, each one through
+ * its own operation source attached to the thread context. While swipe waits
+ * are pending, each source also polls the input descriptor of its device, so
+ * the thread sleeps in a single poll() over all the devices, and only wakes up
+ * when an operation is scheduled, a device sends input, or a swipe wait times
+ * out. The thread is created along with the first processor started, and
+ * stopped along with the last one.
+ */
 
-    schedule_operation_stop (self);
+typedef struct {
+    guint         ref_count;
+    GThread      *thread;
+    GMainContext *context;
+    GMainLoop    *loop;
+} SharedThread;
 
-    g_clear_pointer (&self->priv->thread,         g_thread_join);
-    g_clear_pointer (&self->priv->thread_context, g_main_context_unref);
-    g_clear_pointer (&self->priv->thread_queue,   g_async_queue_unref);
-}
+G_LOCK_DEFINE_STATIC (shared_thread);
+static SharedThread *shared_thread;
 
 static gpointer
-inner_thread_func (MuiProcessor *self)
+shared_thread_func (SharedThread *thread)
 {
-    g_assert (self->priv->thread_context);
-    g_assert (!self->priv->thread_loop);
-
     g_debug ("[processor] started");
 
-    g_main_context_push_thread_default (self->priv->thread_context);
+    g_main_context_push_thread_default (thread->context);
+    thread_timer_setup (thread->context);
+    g_main_loop_run (thread->loop);
+    g_main_context_pop_thread_default (thread->context);
 
-    /* Create loop */
-    g_assert (!self->priv->thread_loop);
-    self->priv->thread_loop = g_main_loop_new (self->priv->thread_context, FALSE);
+    g_debug ("[processor] finished");
 
-    /* Setup thread timer control */
-    thread_timer_setup (self);
+    return NULL;
+}
 
-    /* Launch loop */
-    g_main_loop_run (self->priv->thread_loop);
-    g_main_loop_unref (self->priv->thread_loop);
-    self->priv->thread_loop = NULL;
+static gboolean
+shared_thread_quit_cb (SharedThread *thread)
+{
+    g_main_loop_quit (thread->loop);
+    return G_SOURCE_REMOVE;
+}
 
-    g_main_context_pop_thread_default (self->priv->thread_context);
+static GMainContext *
+shared_thread_ref (void)
+{
+    GMainContext *context;
+
+    G_LOCK (shared_thread);
+    if (!shared_thread) {
+        shared_thread = g_slice_new0 (SharedThread);
+        shared_thread->context = g_main_context_new ();
+        shared_thread->loop    = g_main_loop_new (shared_thread->context, FALSE);
+        shared_thread->thread  = g_thread_new ("mui-processor", (GThreadFunc) shared_thread_func, shared_thread);
+    }
+    shared_thread->ref_count++;
+    context = g_main_context_ref (shared_thread->context);
+    G_UNLOCK (shared_thread);
 
-    g_debug ("[processor] finished");
+    return context;
+}
 
-    return NULL;
+static void
+shared_thread_unref (void)
+{
+    G_LOCK (shared_thread);
+    g_assert (shared_thread);
+    if (!--shared_thread->ref_count) {
+        /* The loop may not be running yet, so quit it from within */
+        g_main_context_invoke (shared_thread->context, (GSourceFunc) shared_thread_quit_cb, shared_thread);
+        g_thread_join (shared_thread->thread);
+        g_main_loop_unref (shared_thread->loop);
+        g_main_context_unref (shared_thread->context);
+        g_slice_free (SharedThread, shared_thread);
+        shared_thread = NULL;
+    }
+    G_UNLOCK (shared_thread);
+}
+
+/*****************************************************************************/
+/* Setup/teardown operation processing */
+
+static void
+inner_thread_teardown (MuiProcessor *self)
+{
+    if (!self->priv->operation_source)
+        return;
+
+    /* The operation source is removed once the stop operation has been run,
+     * and nothing refers to the processor in the shared thread afterwards */
+    schedule_operation_stop (self);
+    g_mutex_lock (&self->priv->stop_mutex);
+    while (!self->priv->stopped)
+        g_cond_wait (&self->priv->stop_cond, &self->priv->stop_mutex);
+    g_mutex_unlock (&self->priv->stop_mutex);
+
+    g_clear_pointer (&self->priv->operation_source, g_source_unref);
+    g_clear_pointer (&self->priv->thread_queue,     g_async_queue_unref);
+    g_clear_pointer (&self->priv->thread_context,   g_main_context_unref);
+    shared_thread_unref ();
 }
 
 static void
 inner_thread_setup (MuiProcessor *self)
 {
-    g_assert (!self->priv->thread);
     g_assert (!self->priv->thread_context);
+    g_assert (!self->priv->operation_source);
     g_assert (!self->priv->thread_queue);
 
-    self->priv->thread_context = g_main_context_new ();
-    self->priv->thread_queue   = g_async_queue_new_full ((GDestroyNotify) g_object_unref);
-    self->priv->thread         = g_thread_new (NULL, (GThreadFunc) inner_thread_func, self);
+    self->priv->thread_context   = shared_thread_ref ();
+    self->priv->thread_queue     = g_async_queue_new_full ((GDestroyNotify) g_object_unref);
+    self->priv->operation_source = g_source_new (&operation_source_funcs, sizeof (GSource));
+    g_source_set_callback (self->priv->operation_source, (GSourceFunc) operation_source_cb, self, NULL);
+    g_source_attach (self->priv->operation_source, self->priv->thread_context);
 }
 
 /*****************************************************************************/
@@ -1045,6 +1280,43 @@ mui_processor_wait_swipe (MuiProcessor        *self,
     schedule_operation_wait_swipe (self, cancellable, (GAsyncReadyCallback) wait_swipe_ready, task);
 }
 
+/*****************************************************************************/
+/* Swipe stream */
+
+gboolean
+mui_processor_swipe_stream_finish (MuiProcessor  *self,
+                                   GAsyncResult  *res,
+                                   GError       **error)
+{
+    return g_task_propagate_boolean (G_TASK (res), error);
+}
+
+static void
+swipe_stream_ready (MuiProcessor *self,
+                    GAsyncResult *res,
+                    GTask        *task)
+{
+    GError *error = NULL;
+
+    if (!schedule_operation_swipe_stream_finish (self, res, &error))
+        g_task_return_error (task, error);
+    else
+        g_task_return_boolean (task, TRUE);
+    g_object_unref (task);
+}
+
+void
+mui_processor_swipe_stream (MuiProcessor        *self,
+                            GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+    GTask *task;
+
+    task = g_task_new (self, cancellable, callback, user_data);
+    schedule_operation_swipe_stream (self, cancellable, (GAsyncReadyCallback) swipe_stream_ready, task);
+}
+
 /*****************************************************************************/
 /* Run command */
 
@@ -1125,6 +1397,10 @@ static void
 mui_processor_init (MuiProcessor *self)
 {
     self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MUI_TYPE_PROCESSOR, MuiProcessorPrivate);
+    g_queue_init (&self->priv->pending_wait_swipes);
+    self->priv->input_fd = -1;
+    g_mutex_init (&self->priv->stop_mutex);
+    g_cond_init (&self->priv->stop_cond);
 }
 
 static void
@@ -1171,6 +1447,8 @@ finalize (GObject *object)
 
     inner_thread_teardown (self);
 
+    g_cond_clear (&self->priv->stop_cond);
+    g_mutex_clear (&self->priv->stop_mutex);
     g_free (self->priv->path);
 
     G_OBJECT_CLASS (mui_processor_parent_class)->finalize (object);
@@ -1203,4 +1481,12 @@ mui_processor_class_init (MuiProcessorClass *klass)
                       G_STRUCT_OFFSET (MuiProcessorClass, report_item),
                       NULL, NULL, NULL,
                       G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_STRING);
+
+    signals[REPORT_SWIPE] =
+        g_signal_new ("report-swipe",
+                      G_OBJECT_CLASS_TYPE (object_class),
+                      G_SIGNAL_RUN_FIRST,
+                      G_STRUCT_OFFSET (MuiProcessorClass, report_swipe),
+                      NULL, NULL, NULL,
+                      G_TYPE_NONE, 1, MUI_TYPE_SWIPE);
 }
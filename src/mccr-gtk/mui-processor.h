@@ -27,6 +27,8 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 
+#include "mui-swipe.h"
+
 #define MUI_TYPE_PROCESSOR            (mui_processor_get_type ())
 #define MUI_PROCESSOR(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), MUI_TYPE_PROCESSOR, MuiProcessor))
 #define MUI_PROCESSOR_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), MUI_TYPE_PROCESSOR, MuiProcessorClass))
@@ -63,25 +65,6 @@ typedef enum {
     MUI_PROCESSOR_ITEM_SECURITY_LEVEL,
     MUI_PROCESSOR_ITEM_ENCRYPTION_COUNTER,
     MUI_PROCESSOR_ITEM_MAGTEK_UPDATE_TOKEN,
-    /* Swipe information */
-    MUI_PROCESSOR_ITEM_SWIPE_STARTED,
-    MUI_PROCESSOR_ITEM_CARD_ENCODE_TYPE,
-    MUI_PROCESSOR_ITEM_TRACK_1_DECODE_STATUS,
-    MUI_PROCESSOR_ITEM_TRACK_1_ENCRYPTED_DATA_LENGTH,
-    MUI_PROCESSOR_ITEM_TRACK_1_ENCRYPTED_DATA,
-    MUI_PROCESSOR_ITEM_TRACK_1_MASKED_DATA_LENGTH,
-    MUI_PROCESSOR_ITEM_TRACK_1_MASKED_DATA,
-    MUI_PROCESSOR_ITEM_TRACK_2_DECODE_STATUS,
-    MUI_PROCESSOR_ITEM_TRACK_2_ENCRYPTED_DATA_LENGTH,
-    MUI_PROCESSOR_ITEM_TRACK_2_ENCRYPTED_DATA,
-    MUI_PROCESSOR_ITEM_TRACK_2_MASKED_DATA_LENGTH,
-    MUI_PROCESSOR_ITEM_TRACK_2_MASKED_DATA,
-    MUI_PROCESSOR_ITEM_TRACK_3_DECODE_STATUS,
-    MUI_PROCESSOR_ITEM_TRACK_3_ENCRYPTED_DATA_LENGTH,
-    MUI_PROCESSOR_ITEM_TRACK_3_ENCRYPTED_DATA,
-    MUI_PROCESSOR_ITEM_TRACK_3_MASKED_DATA_LENGTH,
-    MUI_PROCESSOR_ITEM_TRACK_3_MASKED_DATA,
-    MUI_PROCESSOR_ITEM_SWIPE_FINISHED,
     MUI_PROCESSOR_ITEM_LAST
 } MuiProcessorItem;
 
@@ -95,9 +78,11 @@ struct _MuiProcessor {
 struct _MuiProcessorClass {
     GObjectClass parent;
 
-    void (* report_item) (MuiProcessor     *self,
-                          MuiProcessorItem  item,
-                          const gchar      *value);
+    void (* report_item)  (MuiProcessor     *self,
+                           MuiProcessorItem  item,
+                           const gchar      *value);
+    void (* report_swipe) (MuiProcessor     *self,
+                           MuiSwipe         *swipe);
 };
 
 GType         mui_processor_get_type           (void);
@@ -114,6 +99,16 @@ gboolean      mui_processor_wait_swipe_finish  (MuiProcessor         *self,
                                                 GAsyncResult         *res,
                                                 GError              **error);
 
+/* The swipe stream keeps on reporting swipes until cancelled or until the
+ * processor is stopped; errors are reported as items and don't stop it */
+void          mui_processor_swipe_stream        (MuiProcessor         *self,
+                                                 GCancellable         *cancellable,
+                                                 GAsyncReadyCallback   callback,
+                                                 gpointer              user_data);
+gboolean      mui_processor_swipe_stream_finish (MuiProcessor         *self,
+                                                 GAsyncResult         *res,
+                                                 GError              **error);
+
 typedef enum {
     MUI_PROCESSOR_COMMAND_FLAG_NONE,
     MUI_PROCESSOR_COMMAND_FLAG_RESPONSE_EXPECTED,
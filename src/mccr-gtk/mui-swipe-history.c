@@ -0,0 +1,413 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * mccr-gtk - GTK+ tool to manage MagTek Credit Card Readers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <gtk/gtk.h>
+
+#include "mui-swipe-history.h"
+
+static void tree_model_init (GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (MuiSwipeHistory, mui_swipe_history, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL, tree_model_init))
+
+typedef struct {
+    gint64    time;
+    MuiSwipe *swipe;
+} SwipeRecord;
+
+struct _MuiSwipeHistoryPrivate {
+    /* Ring of records, allocated once */
+    SwipeRecord *records;
+    guint        capacity;
+    /* Number of the oldest record kept, and number of records kept; the
+     * record with number N is stored in slot N % capacity */
+    guint        first;
+    guint        n_records;
+    gint         stamp;
+};
+
+/*****************************************************************************/
+/* Iters keep the record number, so they don't need to be updated when older
+ * records are dropped */
+
+static inline void
+iter_set (MuiSwipeHistory *self,
+          GtkTreeIter     *iter,
+          guint            number)
+{
+    iter->stamp      = self->priv->stamp;
+    iter->user_data  = GUINT_TO_POINTER (number);
+    iter->user_data2 = NULL;
+    iter->user_data3 = NULL;
+}
+
+static inline guint
+iter_get_number (GtkTreeIter *iter)
+{
+    return GPOINTER_TO_UINT (iter->user_data);
+}
+
+static gboolean
+iter_is_valid (MuiSwipeHistory *self,
+               GtkTreeIter     *iter)
+{
+    return (iter &&
+            iter->stamp == self->priv->stamp &&
+            (iter_get_number (iter) - self->priv->first) < self->priv->n_records);
+}
+
+static SwipeRecord *
+iter_peek_record (MuiSwipeHistory *self,
+                  GtkTreeIter     *iter)
+{
+    g_assert (iter_is_valid (self, iter));
+    return &self->priv->records[iter_get_number (iter) % self->priv->capacity];
+}
+
+/*****************************************************************************/
+
+guint
+mui_swipe_history_get_number (MuiSwipeHistory *self,
+                              GtkTreeIter     *iter)
+{
+    g_return_val_if_fail (MUI_IS_SWIPE_HISTORY (self), 0);
+    g_return_val_if_fail (iter_is_valid (self, iter), 0);
+
+    return iter_get_number (iter) + 1;
+}
+
+gint64
+mui_swipe_history_get_time (MuiSwipeHistory *self,
+                            GtkTreeIter     *iter)
+{
+    g_return_val_if_fail (MUI_IS_SWIPE_HISTORY (self), 0);
+    g_return_val_if_fail (iter_is_valid (self, iter), 0);
+
+    return iter_peek_record (self, iter)->time;
+}
+
+MuiSwipe *
+mui_swipe_history_peek_swipe (MuiSwipeHistory *self,
+                              GtkTreeIter     *iter)
+{
+    g_return_val_if_fail (MUI_IS_SWIPE_HISTORY (self), NULL);
+    g_return_val_if_fail (iter_is_valid (self, iter), NULL);
+
+    return iter_peek_record (self, iter)->swipe;
+}
+
+/*****************************************************************************/
+
+void
+mui_swipe_history_append (MuiSwipeHistory *self,
+                          MuiSwipe        *swipe)
+{
+    SwipeRecord *record;
+    GtkTreePath *path;
+    GtkTreeIter  iter;
+    guint        number;
+
+    g_return_if_fail (MUI_IS_SWIPE_HISTORY (self));
+    g_return_if_fail (swipe);
+
+    /* Drop the oldest record if full, reusing its slot */
+    if (self->priv->n_records == self->priv->capacity) {
+        record = &self->priv->records[self->priv->first % self->priv->capacity];
+        g_clear_pointer (&record->swipe, mui_swipe_unref);
+        self->priv->first++;
+        self->priv->n_records--;
+
+        path = gtk_tree_path_new_first ();
+        gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+        gtk_tree_path_free (path);
+    }
+
+    number = self->priv->first + self->priv->n_records;
+    record = &self->priv->records[number % self->priv->capacity];
+    record->time  = g_get_real_time ();
+    record->swipe = mui_swipe_ref (swipe);
+    self->priv->n_records++;
+
+    iter_set (self, &iter, number);
+    path = gtk_tree_path_new_from_indices (self->priv->n_records - 1, -1);
+    gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+    gtk_tree_path_free (path);
+}
+
+void
+mui_swipe_history_clear (MuiSwipeHistory *self)
+{
+    SwipeRecord *record;
+    GtkTreePath *path;
+    guint        end;
+
+    g_return_if_fail (MUI_IS_SWIPE_HISTORY (self));
+
+    /* Removed from the newest one, so that no row changes its index while
+     * clearing; numbers are never reused */
+    end = self->priv->first + self->priv->n_records;
+    while (self->priv->n_records > 0) {
+        self->priv->n_records--;
+        record = &self->priv->records[(self->priv->first + self->priv->n_records) % self->priv->capacity];
+        g_clear_pointer (&record->swipe, mui_swipe_unref);
+
+        path = gtk_tree_path_new_from_indices (self->priv->n_records, -1);
+        gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+        gtk_tree_path_free (path);
+    }
+    self->priv->first = end;
+}
+
+/*****************************************************************************/
+/* Tree model interface, flat list */
+
+static GtkTreeModelFlags
+get_flags (GtkTreeModel *model)
+{
+    return (GTK_TREE_MODEL_ITERS_PERSIST | GTK_TREE_MODEL_LIST_ONLY);
+}
+
+static gint
+get_n_columns (GtkTreeModel *model)
+{
+    return MUI_SWIPE_HISTORY_N_COLUMNS;
+}
+
+static GType
+get_column_type (GtkTreeModel *model,
+                 gint          index)
+{
+    switch (index) {
+    case MUI_SWIPE_HISTORY_COLUMN_NUMBER:
+        return G_TYPE_UINT;
+    case MUI_SWIPE_HISTORY_COLUMN_TIME:
+        return G_TYPE_INT64;
+    case MUI_SWIPE_HISTORY_COLUMN_SWIPE:
+        return MUI_TYPE_SWIPE;
+    default:
+        g_return_val_if_reached (G_TYPE_INVALID);
+    }
+}
+
+static gboolean
+get_iter (GtkTreeModel *model,
+          GtkTreeIter  *iter,
+          GtkTreePath  *path)
+{
+    MuiSwipeHistory *self = MUI_SWIPE_HISTORY (model);
+    gint             index;
+
+    if (gtk_tree_path_get_depth (path) != 1)
+        return FALSE;
+
+    index = gtk_tree_path_get_indices (path)[0];
+    if (index < 0 || (guint) index >= self->priv->n_records)
+        return FALSE;
+
+    iter_set (self, iter, self->priv->first + index);
+    return TRUE;
+}
+
+static GtkTreePath *
+get_path (GtkTreeModel *model,
+          GtkTreeIter  *iter)
+{
+    MuiSwipeHistory *self = MUI_SWIPE_HISTORY (model);
+
+    g_return_val_if_fail (iter_is_valid (self, iter), NULL);
+
+    return gtk_tree_path_new_from_indices (iter_get_number (iter) - self->priv->first, -1);
+}
+
+static void
+get_value (GtkTreeModel *model,
+           GtkTreeIter  *iter,
+           gint          column,
+           GValue       *value)
+{
+    MuiSwipeHistory *self = MUI_SWIPE_HISTORY (model);
+    SwipeRecord     *record;
+
+    g_return_if_fail (iter_is_valid (self, iter));
+
+    record = iter_peek_record (self, iter);
+    g_value_init (value, get_column_type (model, column));
+    switch (column) {
+    case MUI_SWIPE_HISTORY_COLUMN_NUMBER:
+        g_value_set_uint (value, iter_get_number (iter) + 1);
+        break;
+    case MUI_SWIPE_HISTORY_COLUMN_TIME:
+        g_value_set_int64 (value, record->time);
+        break;
+    case MUI_SWIPE_HISTORY_COLUMN_SWIPE:
+        g_value_set_boxed (value, record->swipe);
+        break;
+    default:
+        g_assert_not_reached ();
+    }
+}
+
+static gboolean
+iter_next (GtkTreeModel *model,
+           GtkTreeIter  *iter)
+{
+    MuiSwipeHistory *self = MUI_SWIPE_HISTORY (model);
+
+    g_return_val_if_fail (iter_is_valid (self, iter), FALSE);
+
+    iter_set (self, iter, iter_get_number (iter) + 1);
+    if (!iter_is_valid (self, iter)) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+iter_previous (GtkTreeModel *model,
+               GtkTreeIter  *iter)
+{
+    MuiSwipeHistory *self = MUI_SWIPE_HISTORY (model);
+
+    g_return_val_if_fail (iter_is_valid (self, iter), FALSE);
+
+    if (iter_get_number (iter) == self->priv->first) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+    iter_set (self, iter, iter_get_number (iter) - 1);
+    return TRUE;
+}
+
+static gboolean
+iter_nth_child (GtkTreeModel *model,
+                GtkTreeIter  *iter,
+                GtkTreeIter  *parent,
+                gint          n)
+{
+    MuiSwipeHistory *self = MUI_SWIPE_HISTORY (model);
+
+    if (parent || n < 0 || (guint) n >= self->priv->n_records) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    iter_set (self, iter, self->priv->first + n);
+    return TRUE;
+}
+
+static gboolean
+iter_children (GtkTreeModel *model,
+               GtkTreeIter  *iter,
+               GtkTreeIter  *parent)
+{
+    return iter_nth_child (model, iter, parent, 0);
+}
+
+static gboolean
+iter_has_child (GtkTreeModel *model,
+                GtkTreeIter  *iter)
+{
+    return FALSE;
+}
+
+static gint
+iter_n_children (GtkTreeModel *model,
+                 GtkTreeIter  *iter)
+{
+    MuiSwipeHistory *self = MUI_SWIPE_HISTORY (model);
+
+    return iter ? 0 : (gint) self->priv->n_records;
+}
+
+static gboolean
+iter_parent (GtkTreeModel *model,
+             GtkTreeIter  *iter,
+             GtkTreeIter  *child)
+{
+    iter->stamp = 0;
+    return FALSE;
+}
+
+static void
+tree_model_init (GtkTreeModelIface *iface)
+{
+    iface->get_flags       = get_flags;
+    iface->get_n_columns   = get_n_columns;
+    iface->get_column_type = get_column_type;
+    iface->get_iter        = get_iter;
+    iface->get_path        = get_path;
+    iface->get_value       = get_value;
+    iface->iter_next       = iter_next;
+    iface->iter_previous   = iter_previous;
+    iface->iter_children   = iter_children;
+    iface->iter_has_child  = iter_has_child;
+    iface->iter_n_children = iter_n_children;
+    iface->iter_nth_child  = iter_nth_child;
+    iface->iter_parent     = iter_parent;
+}
+
+/*****************************************************************************/
+
+MuiSwipeHistory *
+mui_swipe_history_new (guint capacity)
+{
+    MuiSwipeHistory *self;
+
+    g_return_val_if_fail (capacity > 0, NULL);
+
+    self = MUI_SWIPE_HISTORY (g_object_new (MUI_TYPE_SWIPE_HISTORY, NULL));
+    self->priv->capacity = capacity;
+    self->priv->records  = g_new0 (SwipeRecord, capacity);
+    return self;
+}
+
+static void
+mui_swipe_history_init (MuiSwipeHistory *self)
+{
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MUI_TYPE_SWIPE_HISTORY, MuiSwipeHistoryPrivate);
+    self->priv->stamp = g_random_int_range (1, G_MAXINT32);
+}
+
+static void
+finalize (GObject *object)
+{
+    MuiSwipeHistory *self = MUI_SWIPE_HISTORY (object);
+    guint            i;
+
+    for (i = 0; i < self->priv->capacity; i++)
+        g_clear_pointer (&self->priv->records[i].swipe, mui_swipe_unref);
+    g_free (self->priv->records);
+
+    G_OBJECT_CLASS (mui_swipe_history_parent_class)->finalize (object);
+}
+
+static void
+mui_swipe_history_class_init (MuiSwipeHistoryClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    g_type_class_add_private (object_class, sizeof (MuiSwipeHistoryPrivate));
+
+    object_class->finalize = finalize;
+}
@@ -0,0 +1,82 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * mccr-gtk - GTK+ tool to manage MagTek Credit Card Readers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#ifndef MUI_SWIPE_HISTORY_H
+#define MUI_SWIPE_HISTORY_H
+
+#include <gtk/gtk.h>
+
+#include "mui-swipe.h"
+
+G_BEGIN_DECLS
+
+/* The swipe history keeps the latest swipes in a ring of fixed capacity, the
+ * oldest one dropped when a new one arrives and the ring is full. It is
+ * exposed as a flat tree model, so that a tree view only formats the rows
+ * being shown; iters refer to the swipe number, and stay valid until the
+ * swipe is dropped. */
+
+#define MUI_TYPE_SWIPE_HISTORY         (mui_swipe_history_get_type ())
+#define MUI_SWIPE_HISTORY(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), MUI_TYPE_SWIPE_HISTORY, MuiSwipeHistory))
+#define MUI_SWIPE_HISTORY_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST ((k), MUI_TYPE_SWIPE_HISTORY, MuiSwipeHistoryClass))
+#define MUI_IS_SWIPE_HISTORY(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), MUI_TYPE_SWIPE_HISTORY))
+#define MUI_IS_SWIPE_HISTORY_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), MUI_TYPE_SWIPE_HISTORY))
+#define MUI_SWIPE_HISTORY_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), MUI_TYPE_SWIPE_HISTORY, MuiSwipeHistoryClass))
+
+typedef struct _MuiSwipeHistory        MuiSwipeHistory;
+typedef struct _MuiSwipeHistoryClass   MuiSwipeHistoryClass;
+typedef struct _MuiSwipeHistoryPrivate MuiSwipeHistoryPrivate;
+
+typedef enum {
+    MUI_SWIPE_HISTORY_COLUMN_NUMBER, /* G_TYPE_UINT, starting at 1 */
+    MUI_SWIPE_HISTORY_COLUMN_TIME,   /* G_TYPE_INT64, wall-clock time in us */
+    MUI_SWIPE_HISTORY_COLUMN_SWIPE,  /* MUI_TYPE_SWIPE */
+    MUI_SWIPE_HISTORY_N_COLUMNS
+} MuiSwipeHistoryColumn;
+
+struct _MuiSwipeHistory {
+    GObject                 parent;
+    MuiSwipeHistoryPrivate *priv;
+};
+
+struct _MuiSwipeHistoryClass {
+    GObjectClass parent;
+};
+
+GType            mui_swipe_history_get_type   (void) G_GNUC_CONST;
+MuiSwipeHistory *mui_swipe_history_new        (guint            capacity);
+void             mui_swipe_history_append     (MuiSwipeHistory *self,
+                                               MuiSwipe        *swipe);
+void             mui_swipe_history_clear      (MuiSwipeHistory *self);
+
+/* Direct accessors for valid iters, without going through GValues */
+guint            mui_swipe_history_get_number (MuiSwipeHistory *self,
+                                               GtkTreeIter     *iter);
+gint64           mui_swipe_history_get_time   (MuiSwipeHistory *self,
+                                               GtkTreeIter     *iter);
+MuiSwipe        *mui_swipe_history_peek_swipe (MuiSwipeHistory *self,
+                                               GtkTreeIter     *iter);
+
+G_END_DECLS
+
+#endif /* MUI_SWIPE_HISTORY_H */
@@ -0,0 +1,172 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * mccr-gtk - GTK+ tool to manage MagTek Credit Card Readers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <glib-object.h>
+
+#include <mccr.h>
+
+#include "mui-swipe.h"
+
+struct _MuiSwipe {
+    volatile gint            ref_count;
+    mccr_swipe_report_t     *report;
+    gboolean                 card_encode_type_set;
+    mccr_card_encode_type_t  card_encode_type;
+    MuiSwipeTrack            tracks[MUI_SWIPE_N_TRACKS];
+};
+
+G_DEFINE_BOXED_TYPE (MuiSwipe, mui_swipe, mui_swipe_ref, mui_swipe_unref)
+
+/*****************************************************************************/
+
+MuiSwipe *
+mui_swipe_ref (MuiSwipe *self)
+{
+    g_return_val_if_fail (self, NULL);
+
+    g_atomic_int_inc (&self->ref_count);
+    return self;
+}
+
+void
+mui_swipe_unref (MuiSwipe *self)
+{
+    g_return_if_fail (self);
+
+    if (g_atomic_int_dec_and_test (&self->ref_count)) {
+        mccr_swipe_report_free (self->report);
+        g_slice_free (MuiSwipe, self);
+    }
+}
+
+/*****************************************************************************/
+
+mccr_swipe_report_t *
+mui_swipe_peek_report (MuiSwipe *self)
+{
+    g_return_val_if_fail (self, NULL);
+
+    return self->report;
+}
+
+gboolean
+mui_swipe_get_card_encode_type (MuiSwipe                *self,
+                                mccr_card_encode_type_t *out_card_encode_type)
+{
+    g_return_val_if_fail (self, FALSE);
+
+    if (!self->card_encode_type_set)
+        return FALSE;
+    if (out_card_encode_type)
+        *out_card_encode_type = self->card_encode_type;
+    return TRUE;
+}
+
+const MuiSwipeTrack *
+mui_swipe_peek_track (MuiSwipe *self,
+                      guint     track_number)
+{
+    g_return_val_if_fail (self, NULL);
+    g_return_val_if_fail (track_number >= 1 && track_number <= MUI_SWIPE_N_TRACKS, NULL);
+
+    return &self->tracks[track_number - 1];
+}
+
+/*****************************************************************************/
+
+static void
+load_track (MuiSwipeTrack        *track,
+            mccr_swipe_report_t  *report,
+            mccr_status_t       (* get_decode_status)         (mccr_swipe_report_t *report, uint8_t        *status),
+            mccr_status_t       (* get_encrypted_data_length) (mccr_swipe_report_t *report, uint8_t        *length),
+            mccr_status_t       (* get_encrypted_data)        (mccr_swipe_report_t *report, const uint8_t **out_data),
+            mccr_status_t       (* get_masked_data_length)    (mccr_swipe_report_t *report, uint8_t        *length),
+            mccr_status_t       (* get_masked_data)           (mccr_swipe_report_t *report, const uint8_t **out_data))
+{
+    mccr_status_t st;
+
+    if ((st = get_decode_status (report, &track->decode_status)) != MCCR_STATUS_OK)
+        g_warning ("Cannot get track decode status: %s", mccr_status_to_string (st));
+    else
+        track->decode_status_set = TRUE;
+
+    if ((st = get_encrypted_data_length (report, &track->encrypted_data_length)) != MCCR_STATUS_OK) {
+        g_warning ("Cannot get track encrypted data length: %s", mccr_status_to_string (st));
+        track->encrypted_data_length = 0;
+    } else if (track->encrypted_data_length > 0 &&
+               (st = get_encrypted_data (report, &track->encrypted_data)) != MCCR_STATUS_OK) {
+        g_warning ("Cannot get track encrypted data: %s", mccr_status_to_string (st));
+        track->encrypted_data = NULL;
+    }
+
+    if ((st = get_masked_data_length (report, &track->masked_data_length)) != MCCR_STATUS_OK) {
+        g_warning ("Cannot get track masked data length: %s", mccr_status_to_string (st));
+        track->masked_data_length = 0;
+    } else if (track->masked_data_length > 0 &&
+               (st = get_masked_data (report, &track->masked_data)) != MCCR_STATUS_OK) {
+        g_warning ("Cannot get track masked data: %s", mccr_status_to_string (st));
+        track->masked_data = NULL;
+    }
+}
+
+MuiSwipe *
+mui_swipe_new (mccr_swipe_report_t *report)
+{
+    MuiSwipe      *self;
+    mccr_status_t  st;
+
+    g_return_val_if_fail (report, NULL);
+
+    self = g_slice_new0 (MuiSwipe);
+    self->ref_count = 1;
+    self->report    = report;
+
+    if ((st = mccr_swipe_report_get_card_encode_type (report, &self->card_encode_type)) != MCCR_STATUS_OK)
+        g_warning ("Cannot get card encode type: %s", mccr_status_to_string (st));
+    else
+        self->card_encode_type_set = TRUE;
+
+    load_track (&self->tracks[0],
+                report,
+                mccr_swipe_report_get_track_1_decode_status,
+                mccr_swipe_report_get_track_1_encrypted_data_length,
+                mccr_swipe_report_get_track_1_encrypted_data,
+                mccr_swipe_report_get_track_1_masked_data_length,
+                mccr_swipe_report_get_track_1_masked_data);
+    load_track (&self->tracks[1],
+                report,
+                mccr_swipe_report_get_track_2_decode_status,
+                mccr_swipe_report_get_track_2_encrypted_data_length,
+                mccr_swipe_report_get_track_2_encrypted_data,
+                mccr_swipe_report_get_track_2_masked_data_length,
+                mccr_swipe_report_get_track_2_masked_data);
+    load_track (&self->tracks[2],
+                report,
+                mccr_swipe_report_get_track_3_decode_status,
+                mccr_swipe_report_get_track_3_encrypted_data_length,
+                mccr_swipe_report_get_track_3_encrypted_data,
+                mccr_swipe_report_get_track_3_masked_data_length,
+                mccr_swipe_report_get_track_3_masked_data);
+
+    return self;
+}
@@ -0,0 +1,62 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * mccr-gtk - GTK+ tool to manage MagTek Credit Card Readers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#ifndef MUI_SWIPE_H
+#define MUI_SWIPE_H
+
+#include <glib-object.h>
+
+#include <mccr.h>
+
+/* A swipe is built in the processor thread once all its contents have been
+ * decoded, and is never modified afterwards, so that it can be shared with
+ * the pages without any copy. */
+
+#define MUI_TYPE_SWIPE (mui_swipe_get_type ())
+
+typedef struct _MuiSwipe MuiSwipe;
+
+typedef struct {
+    /* Decode status, only valid if set */
+    gboolean       decode_status_set;
+    guint8         decode_status;
+    /* Encrypted and masked data, NULL if not available */
+    const guint8  *encrypted_data;
+    guint8         encrypted_data_length;
+    const guint8  *masked_data;
+    guint8         masked_data_length;
+} MuiSwipeTrack;
+
+#define MUI_SWIPE_N_TRACKS 3
+
+GType                mui_swipe_get_type              (void) G_GNUC_CONST;
+MuiSwipe            *mui_swipe_new                   (mccr_swipe_report_t     *report);
+MuiSwipe            *mui_swipe_ref                   (MuiSwipe                *self);
+void                 mui_swipe_unref                 (MuiSwipe                *self);
+mccr_swipe_report_t *mui_swipe_peek_report           (MuiSwipe                *self);
+gboolean             mui_swipe_get_card_encode_type  (MuiSwipe                *self,
+                                                      mccr_card_encode_type_t *out_card_encode_type);
+const MuiSwipeTrack *mui_swipe_peek_track            (MuiSwipe                *self,
+                                                      guint                    track_number);
+
+#endif /* MUI_SWIPE_H */
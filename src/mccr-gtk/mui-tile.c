@@ -0,0 +1,228 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * mccr-gtk - GTK+ tool to manage MagTek Credit Card Readers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <config.h>
+#include <string.h>
+#include <stdlib.h>
+#include <gtk/gtk.h>
+
+#include <common.h>
+
+#include "mui-tile.h"
+#include "mui-processor.h"
+#include "mui-swipe.h"
+
+G_DEFINE_TYPE (MuiTile, mui_tile, MUI_TYPE_PAGE)
+
+typedef enum {
+    TILE_ITEM_PRODUCT,
+    TILE_ITEM_DEVICE_SN,
+    TILE_ITEM_STATUS,
+    TILE_ITEM_N_SWIPES,
+    TILE_ITEM_LAST_SWIPE,
+    TILE_ITEM_LAST
+} TileItem;
+
+static const gchar *tile_item_title[] = {
+    [TILE_ITEM_PRODUCT]    = "Product",
+    [TILE_ITEM_DEVICE_SN]  = "Device S/N",
+    [TILE_ITEM_STATUS]     = "Status",
+    [TILE_ITEM_N_SWIPES]   = "Swipes",
+    [TILE_ITEM_LAST_SWIPE] = "Last swipe",
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (tile_item_title) == TILE_ITEM_LAST);
+
+struct _MuiTilePrivate {
+    GtkWidget *frame;
+    GtkWidget *item_labels[TILE_ITEM_LAST];
+    guint      n_swipes;
+};
+
+/******************************************************************************/
+/* Swipe reporting */
+
+static void
+report_swipe (MuiPage  *_self,
+              MuiSwipe *swipe)
+{
+    MuiTile                 *self;
+    mccr_card_encode_type_t  card_encode_type;
+    const MuiSwipeTrack     *track;
+    gchar                   *masked;
+    gchar                   *str;
+    GDateTime               *now;
+    gchar                   *time_str;
+    guint                    i;
+
+    self = MUI_TILE (_self);
+
+    str = g_strdup_printf ("%u", ++self->priv->n_swipes);
+    gtk_label_set_text (GTK_LABEL (self->priv->item_labels[TILE_ITEM_N_SWIPES]), str);
+    g_free (str);
+
+    /* The first masked track available identifies the card well enough */
+    masked = NULL;
+    for (i = 0; !masked && i < MUI_SWIPE_N_TRACKS; i++) {
+        track = mui_swipe_peek_track (swipe, i + 1);
+        if (track->masked_data && track->masked_data_length)
+            masked = strascii (track->masked_data, track->masked_data_length);
+    }
+
+    now = g_date_time_new_now_local ();
+    time_str = g_date_time_format (now, "%H:%M:%S");
+    str = g_strdup_printf ("%s, %s%s%s",
+                           time_str,
+                           mui_swipe_get_card_encode_type (swipe, &card_encode_type) ? mccr_card_encode_type_to_string (card_encode_type) : "unknown",
+                           masked ? ": " : "",
+                           masked ? masked : "");
+    gtk_label_set_text (GTK_LABEL (self->priv->item_labels[TILE_ITEM_LAST_SWIPE]), str);
+    g_free (str);
+    g_free (time_str);
+    g_date_time_unref (now);
+    g_free (masked);
+}
+
+/******************************************************************************/
+/* Item reporting */
+
+static void
+report_item (MuiPage          *_self,
+             MuiProcessorItem  item,
+             const gchar      *value)
+{
+    MuiTile         *self;
+    GtkStyleContext *context;
+
+    self = MUI_TILE (_self);
+
+    switch (item) {
+        case MUI_PROCESSOR_ITEM_PRODUCT:
+            gtk_label_set_text (GTK_LABEL (self->priv->item_labels[TILE_ITEM_PRODUCT]), value);
+            break;
+        case MUI_PROCESSOR_ITEM_DEVICE_SN:
+            gtk_label_set_text (GTK_LABEL (self->priv->item_labels[TILE_ITEM_DEVICE_SN]), value);
+            break;
+        case MUI_PROCESSOR_ITEM_STATUS:
+        case MUI_PROCESSOR_ITEM_STATUS_ERROR:
+            gtk_label_set_text (GTK_LABEL (self->priv->item_labels[TILE_ITEM_STATUS]), value);
+            context = gtk_widget_get_style_context (self->priv->item_labels[TILE_ITEM_STATUS]);
+            if (item == MUI_PROCESSOR_ITEM_STATUS_ERROR)
+                gtk_style_context_add_class (context, GTK_STYLE_CLASS_ERROR);
+            else
+                gtk_style_context_remove_class (context, GTK_STYLE_CLASS_ERROR);
+            break;
+        default:
+            break;
+    }
+}
+
+/******************************************************************************/
+/* Reset */
+
+static void
+reset (MuiPage *_self)
+{
+    MuiTile *self;
+    guint    i;
+
+    self = MUI_TILE (_self);
+
+    self->priv->n_swipes = 0;
+    for (i = 0; i < TILE_ITEM_LAST; i++)
+        gtk_label_set_text (GTK_LABEL (self->priv->item_labels[i]), "n/a");
+    gtk_label_set_text (GTK_LABEL (self->priv->item_labels[TILE_ITEM_N_SWIPES]), "0");
+    gtk_label_set_text (GTK_LABEL (self->priv->item_labels[TILE_ITEM_STATUS]), "Initializing...");
+    gtk_style_context_remove_class (gtk_widget_get_style_context (self->priv->item_labels[TILE_ITEM_STATUS]), GTK_STYLE_CLASS_ERROR);
+}
+
+/******************************************************************************/
+
+GtkWidget *
+mui_tile_new (const gchar *path)
+{
+    MuiTile   *self;
+    GtkWidget *grid;
+    guint      i;
+
+    self = MUI_TILE (gtk_widget_new (MUI_TYPE_TILE, NULL));
+
+    self->priv->frame = gtk_frame_new (path);
+    gtk_widget_show (self->priv->frame);
+    gtk_box_pack_start (GTK_BOX (self), self->priv->frame, TRUE, TRUE, 0);
+
+    grid = gtk_grid_new ();
+    gtk_grid_set_row_spacing (GTK_GRID (grid), 5);
+    gtk_grid_set_column_spacing (GTK_GRID (grid), 10);
+    gtk_container_set_border_width (GTK_CONTAINER (grid), 10);
+    gtk_widget_show (grid);
+    gtk_container_add (GTK_CONTAINER (self->priv->frame), grid);
+
+    for (i = 0; i < TILE_ITEM_LAST; i++) {
+        GtkWidget *title_label;
+
+        title_label = gtk_label_new (tile_item_title[i]);
+        gtk_style_context_add_class (gtk_widget_get_style_context (title_label), GTK_STYLE_CLASS_DIM_LABEL);
+        self->priv->item_labels[i] = gtk_label_new (NULL);
+        gtk_label_set_ellipsize (GTK_LABEL (self->priv->item_labels[i]), PANGO_ELLIPSIZE_END);
+        gtk_label_set_width_chars (GTK_LABEL (self->priv->item_labels[i]), 30);
+        gtk_widget_set_hexpand (self->priv->item_labels[i], TRUE);
+
+#if GTK_CHECK_VERSION (3,16,0)
+        gtk_label_set_xalign (GTK_LABEL (title_label), 1.0);
+        gtk_label_set_xalign (GTK_LABEL (self->priv->item_labels[i]), 0.0);
+#else
+        gtk_misc_set_alignment (GTK_MISC (title_label), 1.0, 0.5);
+        gtk_misc_set_alignment (GTK_MISC (self->priv->item_labels[i]), 0.0, 0.5);
+#endif
+
+        gtk_widget_show (title_label);
+        gtk_widget_show (self->priv->item_labels[i]);
+        gtk_grid_attach (GTK_GRID (grid), title_label,                0, i, 1, 1);
+        gtk_grid_attach (GTK_GRID (grid), self->priv->item_labels[i], 1, i, 1, 1);
+    }
+
+    reset (MUI_PAGE (self));
+
+    return GTK_WIDGET (self);
+}
+
+/******************************************************************************/
+
+static void
+mui_tile_init (MuiTile *self)
+{
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MUI_TYPE_TILE, MuiTilePrivate);
+}
+
+static void
+mui_tile_class_init (MuiTileClass *klass)
+{
+    MuiPageClass *page_class = MUI_PAGE_CLASS (klass);
+
+    g_type_class_add_private (klass, sizeof (MuiTilePrivate));
+
+    page_class->report_item  = report_item;
+    page_class->report_swipe = report_swipe;
+    page_class->reset        = reset;
+}
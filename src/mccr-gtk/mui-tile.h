@@ -0,0 +1,62 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * mccr-gtk - GTK+ tool to manage MagTek Credit Card Readers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#ifndef MUI_TILE_H
+#define MUI_TILE_H
+
+#include <gtk/gtk.h>
+
+#include "mui-page.h"
+
+G_BEGIN_DECLS
+
+#define MUI_TYPE_TILE         (mui_tile_get_type ())
+#define MUI_TILE(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), MUI_TYPE_TILE, MuiTile))
+#define MUI_TILE_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST ((k), MUI_TYPE_TILE, MuiTileClass))
+#define MUI_IS_TILE(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), MUI_TYPE_TILE))
+#define MUI_IS_TILE_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), MUI_TYPE_TILE))
+#define MUI_TILE_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), MUI_TYPE_TILE, MuiTileClass))
+
+typedef struct _MuiTile        MuiTile;
+typedef struct _MuiTileClass   MuiTileClass;
+typedef struct _MuiTilePrivate MuiTilePrivate;
+
+/* A tile is a compact page summarizing the state of a single device, so that
+ * several of them can be shown at once in the dashboard */
+
+struct _MuiTile {
+    MuiPage         parent_instance;
+    MuiTilePrivate *priv;
+};
+
+struct _MuiTileClass {
+    MuiPageClass parent_class;
+};
+
+GType mui_tile_get_type (void) G_GNUC_CONST;
+
+GtkWidget *mui_tile_new (const gchar *path);
+
+G_END_DECLS
+
+#endif /* MUI_TILE_H */
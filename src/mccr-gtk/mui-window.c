@@ -35,6 +35,7 @@
 #include "mui-processor.h"
 #include "mui-page-basic.h"
 #include "mui-page-advanced.h"
+#include "mui-page-history.h"
 #include "mui-page-remote-services.h"
 
 #define MAGTEK_VID 0x0801
@@ -64,6 +65,7 @@ struct _MuiWindowPrivate {
     /* Pages */
     GtkWidget *page_basic;
     GtkWidget *page_advanced;
+    GtkWidget *page_history;
     GtkWidget *page_remote_services;
 
     /* Error message reporting */
@@ -77,7 +79,7 @@ struct _MuiWindowPrivate {
     GUdevClient *udev;
 
     /* Swipe support */
-    guint scheduled_id;
+    GCancellable *swipe_stream_cancellable;
 };
 
 /******************************************************************************/
@@ -132,59 +134,31 @@ report_user_error (MuiWindow   *self,
 /******************************************************************************/
 /* Swipe support */
 
-static void wait_for_swipe (MuiWindow *self,
-                            gboolean   reload_info);
-
-static gboolean
-wait_for_swipe_reschedule_cb (MuiWindow *self)
-{
-    self->priv->scheduled_id = 0;
-    wait_for_swipe (self, TRUE);
-    return G_SOURCE_REMOVE;
-}
-
 static void
-wait_for_swipe_ready (MuiProcessor *processor,
-                      GAsyncResult *res,
-                      MuiWindow    *self)
+swipe_stream_ready (MuiProcessor *processor,
+                    GAsyncResult *res,
+                    MuiWindow    *self)
 {
     GError *error = NULL;
 
-    if (!mui_processor_wait_swipe_finish (processor, res, &error)) {
-        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT)) {
-            /* Ignore error if device gone */
-            if (!self->priv->device_path)
-                report_user_error (self, error->message);
-            self->priv->scheduled_id = g_timeout_add_seconds (1, (GSourceFunc) wait_for_swipe_reschedule_cb, self);
-        } else
-            /* On timeout error, just reschedule silently without reloading any
-             * info */
-            wait_for_swipe (self, FALSE);
+    /* The stream only finishes when cancelled or when the processor is
+     * stopped, so there's nothing to reschedule */
+    if (!mui_processor_swipe_stream_finish (processor, res, &error)) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            report_user_error (self, error->message);
         g_error_free (error);
-        return;
     }
 
-    wait_for_swipe (self, TRUE);
-}
-
-static void
-wait_for_swipe (MuiWindow *self,
-                gboolean   reload_info)
-{
-    if (!self->priv->processor)
-        return;
-
-    if (reload_info)
-        mui_processor_load_properties (self->priv->processor);
-    mui_processor_wait_swipe (self->priv->processor, NULL, (GAsyncReadyCallback) wait_for_swipe_ready, g_object_ref (self));
+    g_object_unref (self);
 }
 
 static void
 cleanup_processor (MuiWindow *self)
 {
-    if (self->priv->scheduled_id) {
-        g_source_remove (self->priv->scheduled_id);
-        self->priv->scheduled_id = 0;
+    /* The stream holds a reference to the processor until cancelled */
+    if (self->priv->swipe_stream_cancellable) {
+        g_cancellable_cancel (self->priv->swipe_stream_cancellable);
+        g_clear_object (&self->priv->swipe_stream_cancellable);
     }
 
     if (self->priv->processor) {
@@ -202,8 +176,13 @@ setup_processor (MuiWindow *self)
     g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PROCESSOR]);
 
     mui_processor_start (self->priv->processor);
+    mui_processor_load_properties (self->priv->processor);
 
-    wait_for_swipe (self, TRUE);
+    self->priv->swipe_stream_cancellable = g_cancellable_new ();
+    mui_processor_swipe_stream (self->priv->processor,
+                                self->priv->swipe_stream_cancellable,
+                                (GAsyncReadyCallback) swipe_stream_ready,
+                                g_object_ref (self));
 }
 
 /******************************************************************************/
@@ -220,6 +199,7 @@ reset_window (MuiWindow *self)
 
     mui_page_reset (MUI_PAGE (self->priv->page_basic));
     mui_page_reset (MUI_PAGE (self->priv->page_advanced));
+    mui_page_reset (MUI_PAGE (self->priv->page_history));
     mui_page_reset (MUI_PAGE (self->priv->page_remote_services));
 
     devices = mccr_enumerate_devices ();
@@ -409,6 +389,14 @@ mui_window_new (void)
     gtk_widget_show (self->priv->page_advanced);
     gtk_stack_add_titled (GTK_STACK (self->priv->info_stack), self->priv->page_advanced, "advanced-box", "Advanced");
 
+    /* Add history page */
+    self->priv->page_history = mui_page_history_new ();
+    g_object_bind_property (self,                     "processor",
+                            self->priv->page_history, "processor",
+                            G_BINDING_SYNC_CREATE);
+    gtk_widget_show (self->priv->page_history);
+    gtk_stack_add_titled (GTK_STACK (self->priv->info_stack), self->priv->page_history, "history-box", "History");
+
     /* Add remote services page */
     self->priv->page_remote_services = mui_page_remote_services_new ();
     g_object_bind_property (self,                             "processor",